@@ -0,0 +1,293 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2026 James Tirta Halim <tirtajames45 at gmail dot com> */
+
+#ifndef ACTUATE_H
+#define ACTUATE_H 1
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+
+#include "event.h"
+#include "macros.h"
+#include "path.h"
+#include "util.h"
+
+/* Fan writes from a thread of their own.
+ *
+ * A write to the pwm of a Super I/O or SMBus chip, such as nct6775 or it87,
+ * can take milliseconds, so the tick only leaves the speed in the mailbox
+ * of the fan, and this thread writes it. Each mailbox holds the latest
+ * speed and file of its fan; one not written yet is replaced, rather than
+ * queued behind. The tick never waits: it swaps the mailbox and, if the
+ * thread had already emptied it, bumps an eventfd. A write that fails is
+ * left in c_act_err() for the loop, and the fan is not written again until
+ * c_act_forget(). Only the writes made are counted, see c_act_writes_take(),
+ * and the time each takes is kept per chip. */
+
+#define C_ACT_NONE UINT64_MAX
+/* Not a file, e.g. nvidia:N. */
+#define C_ACT_NO_CHIP UINT_MAX
+
+typedef struct {
+	/* fd << 32 | speed, or C_ACT_NONE. */
+	uint64_t want;
+	/* errno of the last write, if it failed. */
+	int err;
+	unsigned int chip;
+	/* Writes made, by the thread, and taken by c_act_writes_take(). */
+	unsigned long long writes;
+	unsigned long long writes_taken;
+} c_act_slot_ty;
+
+/* Written by the thread only. */
+typedef struct {
+	/* Name of the hwmon, or of its directory if it has none. */
+	char name[64];
+	char dev[NAME_MAX + 1];
+	unsigned long long writes;
+	unsigned long long ns;
+	unsigned long long ns_max;
+} c_act_chip_ty;
+
+static c_act_slot_ty *c_act_slots;
+static unsigned int c_act_len;
+static c_act_chip_ty *c_act_chips;
+static unsigned int c_act_chips_len;
+/* Room for the chips of fans found again elsewhere after hotplug. */
+static unsigned int c_act_chips_cap;
+static int c_act_efd = -1;
+static pthread_t c_act_thread;
+static int c_act_running;
+static int c_act_stopping;
+
+/* Return the chip of the fan at path, added if it is new, or
+ * C_ACT_NO_CHIP. */
+static unsigned int
+c_act_chip(const char *path)
+{
+	char dir[PATH_MAX], p[PATH_MAX + NAME_MAX + 2], dev[PATH_MAX];
+	c_act_chip_ty chip;
+	const char *slash = strrchr(path, '/');
+	if (slash == NULL || (size_t)(slash - path) >= sizeof(dir))
+		return C_ACT_NO_CHIP;
+	memcpy(dir, path, (size_t)(slash - path));
+	dir[slash - path] = '\0';
+	memset(&chip, 0, sizeof(chip));
+	snprintf(p, sizeof(p), "%s/name", dir);
+	if (path_line_read(p, chip.name, sizeof(chip.name)) == -1) {
+		const char *base = strrchr(dir, '/');
+		snprintf(chip.name, sizeof(chip.name), "%.63s", base ? base + 1 : dir);
+	}
+	snprintf(p, sizeof(p), "%s/device", dir);
+	if (realpath(p, dev) != NULL)
+		snprintf(chip.dev, sizeof(chip.dev), "%s", strrchr(dev, '/') + 1);
+	unsigned int i = 0;
+	while (i < c_act_chips_len && (strcmp(c_act_chips[i].name, chip.name) || strcmp(c_act_chips[i].dev, chip.dev)))
+		++i;
+	if (i == c_act_chips_len) {
+		if (unlikely(c_act_chips_len == c_act_chips_cap))
+			return C_ACT_NO_CHIP;
+		/* Seen by the thread once a slot is released with it. */
+		c_act_chips[c_act_chips_len++] = chip;
+	}
+	return i;
+}
+
+/* Set up the mailboxes of the len fans at paths. */
+static int
+c_act_init(const char **paths, unsigned int len)
+{
+	c_act_slots = (c_act_slot_ty *)calloc(len ? len : 1, sizeof(c_act_slot_ty));
+	c_act_chips = (c_act_chip_ty *)calloc(2 * len + 1, sizeof(c_act_chip_ty));
+	if (unlikely(c_act_slots == NULL || c_act_chips == NULL))
+		return -1;
+	c_act_len = len;
+	c_act_chips_len = 0;
+	c_act_chips_cap = 2 * len + 1;
+	for (unsigned int i = 0; i < len; ++i) {
+		c_act_slots[i].want = C_ACT_NONE;
+		c_act_slots[i].chip = c_act_chip(paths[i]);
+	}
+	errno = 0;
+	return 0;
+}
+
+/* Write the speed in the mailbox of fan i, if any. */
+static void
+c_act_apply(unsigned int i)
+{
+	c_act_slot_ty *s = c_act_slots + i;
+	char speeds[4];
+	if (__atomic_load_n(&s->err, __ATOMIC_ACQUIRE))
+		return;
+	const uint64_t want = __atomic_exchange_n(&s->want, C_ACT_NONE, __ATOMIC_ACQ_REL);
+	if (want == C_ACT_NONE)
+		return;
+	unsigned int speeds_len = (unsigned int)(c_utoa_le3_p((unsigned int)(want & 0xffffffff), speeds) - speeds);
+	speeds[speeds_len++] = '\n';
+	const unsigned long long start = c_now_ns();
+	if (unlikely(pwrite((int)(want >> 32), speeds, speeds_len, 0) != (ssize_t)speeds_len)) {
+		__atomic_store_n(&s->err, errno ? errno : EIO, __ATOMIC_RELEASE);
+		return;
+	}
+	__atomic_store_n(&s->writes, s->writes + 1, __ATOMIC_RELEASE);
+	const unsigned int chip = __atomic_load_n(&s->chip, __ATOMIC_ACQUIRE);
+	if (chip == C_ACT_NO_CHIP)
+		return;
+	const unsigned long long ns = c_now_ns() - start;
+	c_act_chip_ty *c = c_act_chips + chip;
+	__atomic_store_n(&c->writes, c->writes + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->ns, c->ns + ns, __ATOMIC_RELAXED);
+	if (ns > c->ns_max)
+		__atomic_store_n(&c->ns_max, ns, __ATOMIC_RELAXED);
+}
+
+/* Write the mailboxes each time they are filled, until c_act_stop(). */
+static void *
+c_act_loop(void *arg)
+{
+	uint64_t n;
+	(void)arg;
+	for (;;) {
+		if (read(c_act_efd, &n, sizeof(n)) == -1 && errno != EINTR)
+			break;
+		/* Speeds left before the stop are still written. */
+		const int stop = __atomic_load_n(&c_act_stopping, __ATOMIC_ACQUIRE);
+		for (unsigned int i = 0; i < c_act_len; ++i)
+			c_act_apply(i);
+		if (stop)
+			break;
+	}
+	return NULL;
+}
+
+/* Signals are left to the main loop. */
+static int
+c_act_start(void)
+{
+	sigset_t all, old;
+	c_act_efd = eventfd(0, EFD_CLOEXEC);
+	if (c_act_efd == -1)
+		return -1;
+	__atomic_store_n(&c_act_stopping, 0, __ATOMIC_RELAXED);
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	const int ret = pthread_create(&c_act_thread, NULL, c_act_loop, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (ret) {
+		close(c_act_efd);
+		c_act_efd = -1;
+		errno = ret;
+		return -1;
+	}
+	c_act_running = 1;
+	return 0;
+}
+
+static void
+c_act_kick(void)
+{
+	const uint64_t one = 1;
+	/* Only fails if the count overflows, which still wakes the thread. */
+	if (write(c_act_efd, &one, sizeof(one)) == -1)
+		errno = 0;
+}
+
+/* Leave speed (0-255) for fan i, open as fd. */
+static ATTR_INLINE void
+c_act_put(unsigned int i, int fd, unsigned int speed)
+{
+	const uint64_t want = ((uint64_t)(uint32_t)fd << 32) | speed;
+	if (__atomic_exchange_n(&c_act_slots[i].want, want, __ATOMIC_ACQ_REL) == C_ACT_NONE)
+		c_act_kick();
+}
+
+/* Return the errno of the failed write to fan i, or 0. */
+static ATTR_INLINE int
+c_act_err(unsigned int i)
+{
+	return __atomic_load_n(&c_act_slots[i].err, __ATOMIC_ACQUIRE);
+}
+
+/* Return the writes made to fan i since the last call. */
+static unsigned long long
+c_act_writes_take(unsigned int i)
+{
+	c_act_slot_ty *s = c_act_slots + i;
+	const unsigned long long writes = __atomic_load_n(&s->writes, __ATOMIC_ACQUIRE);
+	const unsigned long long n = writes - s->writes_taken;
+	s->writes_taken = writes;
+	return n;
+}
+
+/* Label fan i, open again at path, with the chip it is now on, before it
+ * is next written. */
+static void
+c_act_rechip(unsigned int i, const char *path)
+{
+	__atomic_store_n(&c_act_slots[i].chip, c_act_chip(path), __ATOMIC_RELEASE);
+}
+
+/* Drop what is left for fan i and let it be written again, once its file
+ * is closed or replaced. */
+static void
+c_act_forget(unsigned int i)
+{
+	__atomic_store_n(&c_act_slots[i].want, C_ACT_NONE, __ATOMIC_RELAXED);
+	__atomic_store_n(&c_act_slots[i].err, 0, __ATOMIC_RELEASE);
+}
+
+/* Write what is left and stop the thread. Safe to call more than once. */
+static void
+c_act_stop(void)
+{
+	if (!c_act_running)
+		return;
+	__atomic_store_n(&c_act_stopping, 1, __ATOMIC_RELEASE);
+	c_act_kick();
+	pthread_join(c_act_thread, NULL);
+	close(c_act_efd);
+	c_act_efd = -1;
+	c_act_running = 0;
+}
+
+/* Metrics of the writes to each chip, see metrics.h. */
+static void
+c_act_metrics_write(FILE *fp)
+{
+	fprintf(fp, "# HELP cfan_fan_write_seconds Time a write to a fan took, by chip.\n# TYPE cfan_fan_write_seconds summary\n");
+	for (unsigned int i = 0; i < c_act_chips_len; ++i) {
+		const c_act_chip_ty *c = c_act_chips + i;
+		fprintf(fp, "cfan_fan_write_seconds_sum{chip=\"%s\",device=\"%s\"} %.9f\n", c->name, c->dev, (double)__atomic_load_n(&c->ns, __ATOMIC_RELAXED) / 1e9);
+		fprintf(fp, "cfan_fan_write_seconds_count{chip=\"%s\",device=\"%s\"} %llu\n", c->name, c->dev, __atomic_load_n(&c->writes, __ATOMIC_RELAXED));
+	}
+	fprintf(fp, "# HELP cfan_fan_write_max_seconds Longest write to a fan since start, by chip.\n# TYPE cfan_fan_write_max_seconds gauge\n");
+	for (unsigned int i = 0; i < c_act_chips_len; ++i) {
+		const c_act_chip_ty *c = c_act_chips + i;
+		fprintf(fp, "cfan_fan_write_max_seconds{chip=\"%s\",device=\"%s\"} %.9f\n", c->name, c->dev, (double)__atomic_load_n(&c->ns_max, __ATOMIC_RELAXED) / 1e9);
+	}
+}
+
+static void
+c_act_cleanup(void)
+{
+	c_act_stop();
+	free(c_act_slots);
+	free(c_act_chips);
+	c_act_slots = NULL;
+	c_act_chips = NULL;
+	c_act_len = 0;
+	c_act_chips_len = 0;
+	c_act_chips_cap = 0;
+}
+
+#endif /* ACTUATE_H */
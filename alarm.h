@@ -0,0 +1,575 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2026 James Tirta Halim <tirtajames45 at gmail dot com> */
+
+#ifndef ALARM_H
+#define ALARM_H 1
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <linux/thermal.h>
+
+#include "macros.h"
+#include "conf.h"
+#include "event.h"
+#include "path.h"
+#include "temp.h"
+#include "util.h"
+
+/* Wakeups from the kernel, so that cfan can sleep while nothing changes.
+ *
+ * A hwmon sensor marked alarm (temp NAME PATH alarm) has its tempN_max moved
+ * to event_band above the temperature while cfan sleeps. The driver then
+ * sysfs_notify()s tempN_max_alarm, or tempN_alarm, which epoll reports as
+ * EPOLLPRI. The limit is written back when cfan wakes, on exit and on a
+ * crash, see c_alarm_crash_restore(). The originals are also saved, so
+ * that a start after cfan was killed puts them back. Few drivers notify
+ * alarms, so each one is tested at start.
+ *
+ * A thermal zone marked alarm wakes cfan when it crosses one of its trip
+ * points, through the event group of the thermal generic netlink family.
+ * Its trip points drive the kernel's own cooling and are left alone, and
+ * lie far above the bottom of a fan curve, so a zone is not left to sleep
+ * on them alone. */
+
+/* How long a driver has to report a tested alarm. (msecs) */
+#define C_ALARM_TEST_MS 3000
+
+typedef struct {
+	/* tempN_max and its alarm, or -1. */
+	int max_fd;
+	int alarm_fd;
+	/* Id of the thermal zone, or -1. */
+	int tz;
+	/* Limit written by cfan, or INT_MIN. */
+	int armed;
+	/* Limit before cfan moved it. */
+	unsigned int orig_len;
+	char orig[C_TEMP_BUF_LEN];
+} c_alarm_ty;
+
+/* One per temperature of the configuration. */
+static c_alarm_ty *c_alarms;
+static unsigned int c_alarms_len;
+static int c_alarm_nlfd = -1;
+static uint16_t c_alarm_nl_family;
+/* The originals of the limits, while cfan may move them, or NULL. */
+static const char *c_alarm_saved_path;
+
+static void
+c_alarm_close(c_alarm_ty *a)
+{
+	if (a->max_fd != -1)
+		close(a->max_fd);
+	if (a->alarm_fd != -1)
+		close(a->alarm_fd);
+	a->max_fd = a->alarm_fd = a->tz = -1;
+	a->armed = INT_MIN;
+}
+
+/* Open the limit and the alarm of the hwmon tempN_input at path, or find
+ * the id of the thermal zone of .../thermal_zoneN/temp. */
+static int
+c_alarm_open(c_alarm_ty *a, const char *path)
+{
+	char p[PATH_MAX];
+	const size_t len = strlen(path);
+	const char *base = strrchr(path, '/');
+	base = base ? base + 1 : path;
+	a->max_fd = a->alarm_fd = a->tz = -1;
+	a->armed = INT_MIN;
+	if (!strncmp(base, "temp", S_LEN("temp")) && len > S_LEN("_input") && !strcmp(path + len - S_LEN("_input"), "_input")) {
+		const int n = (int)(len - S_LEN("_input"));
+		if ((size_t)snprintf(p, sizeof(p), "%.*s_max_alarm", n, path) >= sizeof(p)) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		a->alarm_fd = open(p, O_RDONLY | O_CLOEXEC);
+		if (a->alarm_fd == -1) {
+			snprintf(p, sizeof(p), "%.*s_alarm", n, path);
+			a->alarm_fd = open(p, O_RDONLY | O_CLOEXEC);
+		}
+		snprintf(p, sizeof(p), "%.*s_max", n, path);
+		a->max_fd = open(p, O_RDWR | O_CLOEXEC);
+		const ssize_t r = (a->max_fd == -1) ? -1 : pread(a->max_fd, a->orig, sizeof(a->orig), 0);
+		if (a->alarm_fd == -1 || r <= 0) {
+			c_alarm_close(a);
+			return -1;
+		}
+		a->orig_len = (unsigned int)r;
+		return 0;
+	}
+	if (base > path && !strcmp(base, "temp")) {
+		const char *dir = base - 1;
+		while (dir > path && dir[-1] != '/')
+			--dir;
+		if (sscanf(dir, "thermal_zone%d/", &a->tz) == 1 && a->tz >= 0)
+			return 0;
+		a->tz = -1;
+	}
+	errno = ENOTSUP;
+	return -1;
+}
+
+/* Read the alarm, which clears it and lets it be notified again. */
+static ATTR_INLINE void
+c_alarm_read(const c_alarm_ty *a)
+{
+	char buf[8];
+	if (a->alarm_fd != -1)
+		(void)!pread(a->alarm_fd, buf, sizeof(buf), 0);
+}
+
+/* Move the limit of a to limit millidegrees. */
+static int
+c_alarm_arm(c_alarm_ty *a, int limit)
+{
+	char buf[C_TEMP_BUF_LEN];
+	if (a->max_fd == -1 || a->armed == limit)
+		return 0;
+	const unsigned int len = (unsigned int)(c_itoa_p(limit, buf) - buf);
+	if (unlikely(pwrite(a->max_fd, buf, len, 0) != (ssize_t)len))
+		return -1;
+	a->armed = limit;
+	c_alarm_read(a);
+	return 0;
+}
+
+/* Write back the limit a had. */
+static int
+c_alarm_disarm(c_alarm_ty *a)
+{
+	if (a->armed == INT_MIN)
+		return 0;
+	a->armed = INT_MIN;
+	return (pwrite(a->max_fd, a->orig, a->orig_len, 0) == (ssize_t)a->orig_len) ? 0 : -1;
+}
+
+/* Write back every limit moved, from a signal handler. */
+static void
+c_alarm_crash_restore(void)
+{
+	for (unsigned int i = 0; i < c_alarms_len; ++i)
+		if (c_alarms[i].armed != INT_MIN)
+			(void)!pwrite(c_alarms[i].max_fd, c_alarms[i].orig, c_alarms[i].orig_len, 0);
+}
+
+static void
+c_alarm_disarm_all(void)
+{
+	for (unsigned int i = 0; i < c_alarms_len; ++i)
+		if (unlikely(c_alarm_disarm(c_alarms + i) == -1))
+			fprintf(stderr, "cfan: can't restore the limit of temp %u.\n", i);
+}
+
+/* Move each limit band above its temperature in temps. */
+static int
+c_alarm_arm_all(const int *temps, int band)
+{
+	for (unsigned int i = 0; i < c_alarms_len; ++i) {
+		if (c_alarms[i].max_fd == -1)
+			continue;
+		if (unlikely(temps[i] == C_TEMP_INVALID || c_alarm_arm(c_alarms + i, temps[i] + band) == -1)) {
+			c_alarm_disarm_all();
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Consume the notifications of the alarms. */
+static void
+c_alarm_ack(void)
+{
+	for (unsigned int i = 0; i < c_alarms_len; ++i)
+		c_alarm_read(c_alarms + i);
+}
+
+/* Take the original of the limit of the sensor at path from text, the
+ * lines saved by c_alarm_saved_write(), if it has one. */
+static void
+c_alarm_saved_get(c_alarm_ty *a, const char *text, const char *path)
+{
+	const size_t len = strlen(path);
+	for (const char *line = text, *nl; (nl = strchr(line, '\n')); line = nl + 1) {
+		if (strncmp(line, path, len) || line[len] != '\t')
+			continue;
+		const char *val = line + len + 1;
+		/* With its newline. */
+		const size_t val_len = (size_t)(nl - val) + 1;
+		if (val_len > 1 && val_len <= sizeof(a->orig)) {
+			memcpy(a->orig, val, val_len);
+			a->orig_len = (unsigned int)val_len;
+		}
+		return;
+	}
+}
+
+/* Read the originals saved during boot into buf, and return them without
+ * the boot id, or NULL. Only a file of the current user that no one else
+ * can write is trusted, as with path_cache_load(). */
+static const char *
+c_alarm_saved_read(const char *path, const char *boot, char *buf, size_t sz)
+{
+	struct stat st;
+	const int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		close(fd);
+		return NULL;
+	}
+	const ssize_t n = read(fd, buf, sz - 1);
+	close(fd);
+	if (n <= 0)
+		return NULL;
+	buf[n] = '\0';
+	const size_t boot_len = strlen(boot);
+	/* A reboot reloaded the drivers, and their limits with them. */
+	if (strncmp(buf, boot, boot_len) || buf[boot_len] != '\n')
+		return NULL;
+	return buf + boot_len + 1;
+}
+
+/* Save the originals of the limits of the alarms at paths to path, through
+ * a temporary file renamed into place. */
+static int
+c_alarm_saved_write(const char *path, const char *boot, const char *const *paths)
+{
+	char tmp[PATH_MAX];
+	if (unlikely((size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp)))
+		return -1;
+	unlink(tmp);
+	const int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	if (fd == -1)
+		return -1;
+	FILE *fp = fdopen(fd, "w");
+	if (unlikely(fp == NULL)) {
+		close(fd);
+		unlink(tmp);
+		return -1;
+	}
+	fprintf(fp, "%s\n", boot);
+	for (unsigned int i = 0; i < c_alarms_len; ++i) {
+		const c_alarm_ty *a = c_alarms + i;
+		if (a->max_fd != -1)
+			fprintf(fp, "%s\t%.*s%s", paths[i], (int)a->orig_len, a->orig, (a->orig[a->orig_len - 1] == '\n') ? "" : "\n");
+	}
+	if ((ferror(fp) | fclose(fp)) != 0 || rename(tmp, path) == -1) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+/* Open the alarms of the temperatures of conf marked alarm, at paths.
+ * Keep the hwmon alarms that the driver reports when their limit is moved
+ * below the temperature, within C_ALARM_TEST_MS.
+ *
+ * The originals of the limits are saved at saved, unless it is NULL, before
+ * any is moved. Those saved there during this boot are written back first,
+ * in case cfan was killed with the limits moved. */
+static int
+c_alarm_init(const c_conf_ty *conf, const char *const *paths, const char *saved)
+{
+	struct epoll_event evs[16];
+	char boot[64];
+	static char text[16384];
+	c_alarms = (c_alarm_ty *)calloc(conf->temps_len + 1, sizeof(c_alarm_ty));
+	if (unlikely(c_alarms == NULL))
+		return -1;
+	c_alarms_len = conf->temps_len;
+	/* Without a boot id, originals from before a reboot could be taken. */
+	if (saved != NULL && path_line_read(PATH_BOOT_ID, boot, sizeof(boot)) == -1)
+		saved = NULL;
+	const char *saved_text = (saved != NULL) ? c_alarm_saved_read(saved, boot, text, sizeof(text)) : NULL;
+	unsigned int limits = 0;
+	for (unsigned int i = 0; i < c_alarms_len; ++i) {
+		c_alarm_ty *a = c_alarms + i;
+		a->max_fd = a->alarm_fd = a->tz = -1;
+		a->armed = INT_MIN;
+		if (conf->temps_flags == NULL || !(conf->temps_flags[i] & C_CONF_TEMP_ALARM))
+			continue;
+		if (c_alarm_open(a, paths[i]) == -1) {
+			fprintf(stderr, "cfan: temp %s has no alarm or trip points, it will be polled.\n", conf->temp_names[i]);
+			continue;
+		}
+		if (a->max_fd == -1)
+			continue;
+		if (saved_text != NULL) {
+			c_alarm_saved_get(a, saved_text, paths[i]);
+			if (unlikely(pwrite(a->max_fd, a->orig, a->orig_len, 0) != (ssize_t)a->orig_len))
+				fprintf(stderr, "cfan: can't restore the limit of temp %s.\n", conf->temp_names[i]);
+		}
+		++limits;
+	}
+	c_alarm_saved_path = NULL;
+	if (saved != NULL) {
+		if (limits && c_alarm_saved_write(saved, boot, paths) == 0) {
+			c_alarm_saved_path = saved;
+		} else {
+			(void)unlink(saved);
+			/* A limit is only moved once its original is saved. */
+			for (unsigned int i = 0; i < c_alarms_len; ++i)
+				if (c_alarms[i].max_fd != -1) {
+					fprintf(stderr, "cfan: can't save the limit of temp %s to %s, it will be polled.\n", conf->temp_names[i], saved);
+					c_alarm_close(c_alarms + i);
+				}
+		}
+	}
+	const int epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (unlikely(epfd == -1))
+		return -1;
+	unsigned int pending = 0;
+	for (unsigned int i = 0; i < c_alarms_len; ++i) {
+		c_alarm_ty *a = c_alarms + i;
+		if (a->max_fd == -1)
+			continue;
+		struct epoll_event ev;
+		ev.events = EPOLLPRI;
+		ev.data.u64 = 0;
+		ev.data.u32 = i;
+		const int fd = open(paths[i], O_RDONLY | O_CLOEXEC);
+		const int temp = (fd == -1) ? C_TEMP_INVALID : c_temp_fd_get(fd);
+		if (fd != -1)
+			close(fd);
+		c_alarm_read(a);
+		if (temp == C_TEMP_INVALID || epoll_ctl(epfd, EPOLL_CTL_ADD, a->alarm_fd, &ev) == -1 || c_alarm_arm(a, temp - 2000) == -1) {
+			fprintf(stderr, "cfan: can't test the alarm of temp %s, it will be polled.\n", conf->temp_names[i]);
+			c_alarm_disarm(a);
+			c_alarm_close(a);
+			continue;
+		}
+		++pending;
+	}
+	const unsigned long long end = c_now_ms() + C_ALARM_TEST_MS;
+	for (unsigned long long now = c_now_ms(); pending && now < end; now = c_now_ms()) {
+		const int n = epoll_wait(epfd, evs, LEN(evs), (int)(end - now));
+		for (int k = 0; k < n; ++k) {
+			c_alarm_ty *a = c_alarms + evs[k].data.u32;
+			/* Disarmed once reported. */
+			if (a->armed != INT_MIN) {
+				c_alarm_disarm(a);
+				--pending;
+			}
+		}
+	}
+	close(epfd);
+	for (unsigned int i = 0; i < c_alarms_len; ++i) {
+		if (c_alarms[i].armed == INT_MIN)
+			continue;
+		fprintf(stderr, "cfan: the driver of temp %s does not report its alarm, it will be polled.\n", conf->temp_names[i]);
+		c_alarm_disarm(c_alarms + i);
+		c_alarm_close(c_alarms + i);
+	}
+	for (unsigned int i = 0; i < c_alarms_len; ++i)
+		c_alarm_read(c_alarms + i);
+	errno = 0;
+	return 0;
+}
+
+/* Add the alarms to the main loop as id. */
+static int
+c_alarm_ev_add(unsigned int id)
+{
+	for (unsigned int i = 0; i < c_alarms_len; ++i)
+		if (c_alarms[i].alarm_fd != -1 && unlikely(c_ev_add(c_alarms[i].alarm_fd, EPOLLPRI, id) == -1))
+			return -1;
+	return 0;
+}
+
+/* Return 1 if every temperature of every zone of conf wakes cfan when it
+ * rises event_band, which only a limit moved by cfan does. */
+static int
+c_alarm_covers(const c_conf_ty *conf)
+{
+	for (unsigned int i = 0; i < conf->zones_len; ++i) {
+		const c_zone_ty *z = conf->zones + i;
+		if (z->fn_temps_len)
+			return 0;
+		for (unsigned int j = 0; j < C_ZONE_LEN(z->temps_len, conf->temps_len); ++j) {
+			const c_alarm_ty *a = c_alarms + C_ZONE_AT(z->temps, z->temps_len, j);
+			if (a->max_fd == -1)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+#ifdef THERMAL_GENL_FAMILY_NAME
+
+/* Find the attribute of type among the len bytes of attributes at p. */
+static const struct nlattr *
+c_alarm_nla_find(const void *p, size_t len, unsigned int type)
+{
+	const struct nlattr *na = (const struct nlattr *)p;
+	while (len >= NLA_HDRLEN && na->nla_len >= NLA_HDRLEN && na->nla_len <= len) {
+		if ((na->nla_type & NLA_TYPE_MASK) == type)
+			return na;
+		const size_t step = MIN((size_t)NLA_ALIGN(na->nla_len), len);
+		len -= step;
+		na = (const struct nlattr *)((const char *)na + step);
+	}
+	return NULL;
+}
+
+#	define C_ALARM_NLA_DATA(na) ((const void *)((const char *)(na) + NLA_HDRLEN))
+#	define C_ALARM_NLA_LEN(na)  ((size_t)(na)->nla_len - NLA_HDRLEN)
+
+/* Find the thermal family and join its event group. Return the socket. */
+static int
+c_alarm_nl_init(void)
+{
+	struct {
+		struct nlmsghdr n;
+		struct genlmsghdr g;
+		char attrs[64];
+	} req;
+	union {
+		struct nlmsghdr n;
+		char buf[8192];
+	} res;
+	struct sockaddr_nl sa;
+	const int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+	if (fd == -1)
+		return -1;
+	memset(&req, 0, sizeof(req));
+	struct nlattr *na = (struct nlattr *)req.attrs;
+	na->nla_type = CTRL_ATTR_FAMILY_NAME;
+	na->nla_len = NLA_HDRLEN + sizeof(THERMAL_GENL_FAMILY_NAME);
+	memcpy(req.attrs + NLA_HDRLEN, THERMAL_GENL_FAMILY_NAME, sizeof(THERMAL_GENL_FAMILY_NAME));
+	req.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN + NLA_ALIGN(na->nla_len));
+	req.n.nlmsg_type = GENL_ID_CTRL;
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.n.nlmsg_seq = 1;
+	req.g.cmd = CTRL_CMD_GETFAMILY;
+	req.g.version = 1;
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	const ssize_t r = (sendto(fd, &req, req.n.nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)) == -1) ? -1 : recv(fd, &res, sizeof(res), 0);
+	/* No thermal family, e.g. in a VM. */
+	if (r < (ssize_t)NLMSG_LENGTH(GENL_HDRLEN) || !NLMSG_OK(&res.n, (size_t)r) || res.n.nlmsg_type != GENL_ID_CTRL)
+		goto fail;
+	const char *attrs = (const char *)NLMSG_DATA(&res.n) + GENL_HDRLEN;
+	const size_t attrs_len = res.n.nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+	const struct nlattr *id = c_alarm_nla_find(attrs, attrs_len, CTRL_ATTR_FAMILY_ID);
+	const struct nlattr *groups = c_alarm_nla_find(attrs, attrs_len, CTRL_ATTR_MCAST_GROUPS);
+	if (id == NULL || C_ALARM_NLA_LEN(id) < sizeof(uint16_t) || groups == NULL)
+		goto fail;
+	memcpy(&c_alarm_nl_family, C_ALARM_NLA_DATA(id), sizeof(uint16_t));
+	/* A nest of groups, each a nest of a name and an id. */
+	const char *g = (const char *)C_ALARM_NLA_DATA(groups);
+	for (size_t len = C_ALARM_NLA_LEN(groups); len >= NLA_HDRLEN;) {
+		const struct nlattr *grp = (const struct nlattr *)g;
+		if (grp->nla_len < NLA_HDRLEN || grp->nla_len > len)
+			break;
+		const struct nlattr *name = c_alarm_nla_find(C_ALARM_NLA_DATA(grp), C_ALARM_NLA_LEN(grp), CTRL_ATTR_MCAST_GRP_NAME);
+		const struct nlattr *gid = c_alarm_nla_find(C_ALARM_NLA_DATA(grp), C_ALARM_NLA_LEN(grp), CTRL_ATTR_MCAST_GRP_ID);
+		if (name && gid && C_ALARM_NLA_LEN(gid) >= sizeof(uint32_t) && !strncmp((const char *)C_ALARM_NLA_DATA(name), THERMAL_GENL_EVENT_GROUP_NAME, C_ALARM_NLA_LEN(name))) {
+			uint32_t group;
+			memcpy(&group, C_ALARM_NLA_DATA(gid), sizeof(group));
+			if (setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) == -1 || fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
+				goto fail;
+			c_alarm_nlfd = fd;
+			return fd;
+		}
+		const size_t step = MIN((size_t)NLA_ALIGN(grp->nla_len), len);
+		len -= step;
+		g += step;
+	}
+fail:
+	close(fd);
+	errno = ENOENT;
+	return -1;
+}
+
+/* Drain the thermal events. Return 1 if a zone of the alarms crossed a
+ * trip point, or if events were lost. */
+static int
+c_alarm_nl_read(void)
+{
+	union {
+		struct nlmsghdr n;
+		char buf[8192];
+	} res;
+	int hit = 0;
+	for (;;) {
+		const ssize_t r = recv(c_alarm_nlfd, &res, sizeof(res), 0);
+		if (r == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			if (errno == ENOBUFS) {
+				hit = 1;
+				continue;
+			}
+			return -1;
+		}
+		size_t len = (size_t)r;
+		for (const struct nlmsghdr *n = &res.n; NLMSG_OK(n, len); n = NLMSG_NEXT(n, len)) {
+			if (n->nlmsg_type != c_alarm_nl_family || n->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+				continue;
+			const struct genlmsghdr *g = (const struct genlmsghdr *)NLMSG_DATA(n);
+			if (g->cmd != THERMAL_GENL_EVENT_TZ_TRIP_UP && g->cmd != THERMAL_GENL_EVENT_TZ_TRIP_DOWN)
+				continue;
+			const struct nlattr *id = c_alarm_nla_find((const char *)g + GENL_HDRLEN, n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN), THERMAL_GENL_ATTR_TZ_ID);
+			uint32_t tz;
+			if (id == NULL || C_ALARM_NLA_LEN(id) < sizeof(tz))
+				continue;
+			memcpy(&tz, C_ALARM_NLA_DATA(id), sizeof(tz));
+			for (unsigned int i = 0; i < c_alarms_len; ++i)
+				hit |= (c_alarms[i].tz == (int)tz);
+		}
+	}
+	errno = 0;
+	return hit;
+}
+
+#else
+
+static int
+c_alarm_nl_init(void)
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
+static int
+c_alarm_nl_read(void)
+{
+	return 0;
+}
+
+#endif /* THERMAL_GENL_FAMILY_NAME */
+
+static void
+c_alarm_cleanup(void)
+{
+	int restored = 1;
+	for (unsigned int i = 0; i < c_alarms_len; ++i) {
+		restored &= (c_alarm_disarm(c_alarms + i) == 0);
+		c_alarm_close(c_alarms + i);
+	}
+	/* Kept for the next start otherwise. */
+	if (c_alarm_saved_path != NULL && restored)
+		(void)unlink(c_alarm_saved_path);
+	c_alarm_saved_path = NULL;
+	free(c_alarms);
+	c_alarms = NULL;
+	c_alarms_len = 0;
+	if (c_alarm_nlfd != -1)
+		close(c_alarm_nlfd);
+	c_alarm_nlfd = -1;
+}
+
+#endif /* ALARM_H */
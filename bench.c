@@ -0,0 +1,262 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2026 James Tirta Halim <tirtajames45 at gmail dot com> */
+
+/* Microbenchmarks of the hot path, and the cost of a whole tick of cfan
+ * against a fake sysfs tree of 1, 16 and 256 sensors and fans. Run with
+ * `make bench`. */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+
+/* Syscalls made by cfan, counted where it calls them. Their headers are
+ * included above, so that only the calls are wrapped. clock_gettime()
+ * goes through the vDSO and is not counted. */
+static unsigned long long bench_syscalls;
+#define pread(...)           (++bench_syscalls, pread(__VA_ARGS__))
+#define pwrite(...)          (++bench_syscalls, pwrite(__VA_ARGS__))
+#define read(...)            (++bench_syscalls, read(__VA_ARGS__))
+#define write(...)           (++bench_syscalls, write(__VA_ARGS__))
+#define open(...)            (++bench_syscalls, open(__VA_ARGS__))
+#define close(...)           (++bench_syscalls, close(__VA_ARGS__))
+#define syscall(...)         (++bench_syscalls, syscall(__VA_ARGS__))
+#define timerfd_settime(...) (++bench_syscalls, timerfd_settime(__VA_ARGS__))
+
+#define main cfan_main
+#include "cfan.c"
+#undef main
+
+#define BENCH_ITERS       10000000
+#define BENCH_ITERS_SYS   200000
+#define BENCH_TICKS       2000
+#define BENCH_TICKS_SLOW  200
+
+static volatile unsigned int bench_sink;
+
+static unsigned long long
+bench_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000 + (unsigned long long)ts.tv_nsec;
+}
+
+static void
+bench_report(const char *name, unsigned long long ns, unsigned long long n)
+{
+	printf("%-28s %10.2f ns\n", name, (double)ns / (double)n);
+}
+
+static void
+bench_atou_le3(void)
+{
+	char bufs[256][4];
+	int lens[256];
+	for (unsigned int i = 0; i < 256; ++i)
+		lens[i] = snprintf(bufs[i], sizeof(bufs[i]), "%u", i);
+	unsigned int sum = 0;
+	const unsigned long long t = bench_ns();
+	for (unsigned int i = 0; i < BENCH_ITERS; ++i)
+		sum += c_atou_le3(bufs[i & 255], lens[i & 255]);
+	bench_report("c_atou_le3", bench_ns() - t, BENCH_ITERS);
+	bench_sink = sum;
+}
+
+static void
+bench_utoa_le3_p(void)
+{
+	char buf[4];
+	unsigned int sum = 0;
+	const unsigned long long t = bench_ns();
+	for (unsigned int i = 0; i < BENCH_ITERS; ++i)
+		sum += (unsigned int)(c_utoa_le3_p(i & 255, buf) - buf) + (unsigned char)buf[0];
+	bench_report("c_utoa_le3_p", bench_ns() - t, BENCH_ITERS);
+	bench_sink = sum;
+}
+
+static void
+bench_temp_fd_get(const char *dir)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/temp", dir);
+	const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd == -1 || write(fd, "45000\n", 6) != 6) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	unsigned int sum = 0;
+	const unsigned long long t = bench_ns();
+	for (unsigned int i = 0; i < BENCH_ITERS_SYS; ++i)
+		sum += (unsigned int)c_temp_fd_get(fd);
+	bench_report("c_temp_fd_get (tmpfs)", bench_ns() - t, BENCH_ITERS_SYS);
+	bench_sink = sum;
+	close(fd);
+	unlink(path);
+}
+
+static void
+bench_curve_get(void)
+{
+	unsigned int sum = 0;
+	const unsigned long long t = bench_ns();
+	for (unsigned int i = 0; i < BENCH_ITERS; ++i)
+		sum += c_curve_get(FAN_CURVE_DEFAULT, 30000 + (int)(i & 0xffff));
+	bench_report("c_curve_get", bench_ns() - t, BENCH_ITERS);
+	bench_sink = sum;
+}
+
+static void
+bench_step_get(void)
+{
+	const c_param_ty prm = C_PARAM_DEFAULT;
+	unsigned int sum = 0, rem = 0;
+	const unsigned long long t = bench_ns();
+	for (unsigned int i = 0; i < BENCH_ITERS; ++i) {
+		unsigned int curr = i & 255;
+		sum += c_step_get(&prm, &curr, (i >> 8) & 255, 60000, i & 4095, prm.interval_ms, &rem) + curr;
+	}
+	bench_report("c_step_get", bench_ns() - t, BENCH_ITERS);
+	bench_sink = sum;
+}
+
+static void
+bench_file_write(const char *path, const char *s)
+{
+	const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd == -1 || write(fd, s, strlen(s)) != (ssize_t)strlen(s)) {
+		perror(path);
+		_exit(EXIT_FAILURE);
+	}
+	close(fd);
+}
+
+/* Run ticks of cfan with n sensors and n fans in one zone, with the
+ * temperature swinging so that the fans are written. Run in a child,
+ * since cfan's state is global and set up once. */
+static void
+bench_tick(const char *dir, unsigned int n)
+{
+	char path[PATH_MAX];
+	char err[C_CONF_ERR_LEN];
+	c_conf_buf_ty text = { NULL, 0, 0 };
+	int *fds = (int *)malloc(n * sizeof(int));
+	if (fds == NULL || c_conf_buf_add(&text, S_LITERAL("# bench\n")) == -1)
+		_exit(EXIT_FAILURE);
+	for (unsigned int i = 0; i < n; ++i) {
+		char line[PATH_MAX + 32];
+		snprintf(path, sizeof(path), "%s/temp%u_input", dir, i);
+		bench_file_write(path, "40000\n");
+		fds[i] = open(path, O_WRONLY);
+		int len = snprintf(line, sizeof(line), "temp t%u %s\n", i, path);
+		if (fds[i] == -1 || c_conf_buf_add(&text, line, (size_t)len) == -1)
+			_exit(EXIT_FAILURE);
+		snprintf(path, sizeof(path), "%s/pwm%u", dir, i);
+		bench_file_write(path, "100\n");
+		len = snprintf(line, sizeof(line), "fan f%u %s\n", i, path);
+		if (c_conf_buf_add(&text, line, (size_t)len) == -1)
+			_exit(EXIT_FAILURE);
+	}
+	void *img;
+	size_t img_sz;
+	if (c_conf_compile("bench", text.p, text.len, NULL, c_table_fn_names, &img, &img_sz, err, sizeof(err)) == -1
+	    || c_conf_from_img(&c_conf, img, img_sz, c_table_fn_names, err, sizeof(err)) == -1) {
+		fprintf(stderr, "bench: %s\n", err);
+		_exit(EXIT_FAILURE);
+	}
+	free(text.p);
+	c_sig_setup();
+	c_init();
+	c_zones_start();
+	snprintf(path, sizeof(path), "%s/status", dir);
+	if (c_rec_init(&c_conf, REC_LEN) == -1 || c_status_init(path, &c_conf) == -1) {
+		perror("bench");
+		_exit(EXIT_FAILURE);
+	}
+	c_loop.interval_ms = c_conf.param.interval_ms;
+	for (int pass = 0; pass < 2; ++pass) {
+#ifdef USE_IO_URING
+		const char *how = (c_uring.fd != -1) ? "io_uring" : "pread";
+#else
+		const char *how = "pread";
+#endif
+		const unsigned int ticks = (n > 16) ? BENCH_TICKS_SLOW : BENCH_TICKS;
+		unsigned long long ns = 0, calls = 0, writes = c_writes;
+		for (unsigned int k = 0; k < ticks; ++k) {
+			/* 40 to 70 degrees and back, in steps of a degree. */
+			char temp[16];
+			const int len = snprintf(temp, sizeof(temp), "%u\n", 40000 + 1000 * ((k % 60 < 30) ? k % 60 : 60 - k % 60));
+			for (unsigned int i = 0; i < n; ++i)
+				if (pwrite(fds[i], temp, (size_t)len, 0) != len)
+					_exit(EXIT_FAILURE);
+			/* As if a whole interval had passed. */
+			c_loop.last_ms = c_now_ms() - c_loop.interval_ms;
+			const unsigned long long c = bench_syscalls;
+			const unsigned long long t = bench_ns();
+			c_tick(&c_loop);
+			ns += bench_ns() - t;
+			calls += bench_syscalls - c;
+		}
+		writes = c_writes - writes;
+		printf("tick %3u sensors/fans %-8s %10.2f us %8.2f syscalls %8.2f writes\n", n, how, (double)ns / ticks / 1000, (double)calls / ticks, (double)writes / ticks);
+		/* Budget: one read per sensor, or one io_uring_enter() for all,
+		 * one write per changed fan, and one timer update per tick. */
+		const unsigned long long reads = (how[0] == 'i') ? 1 : n;
+		if (calls > (reads + 1) * ticks + writes) {
+			fprintf(stderr, "bench: tick with %u sensors over its syscall budget.\n", n);
+			_exit(EXIT_FAILURE);
+		}
+#ifdef USE_IO_URING
+		if (c_uring.fd == -1)
+			break;
+		c_uring_exit(&c_uring);
+#else
+		break;
+#endif
+	}
+	fflush(stdout);
+	c_status_cleanup(path);
+	for (unsigned int i = 0; i < n; ++i) {
+		snprintf(path, sizeof(path), "%s/temp%u_input", dir, i);
+		unlink(path);
+		snprintf(path, sizeof(path), "%s/pwm%u", dir, i);
+		unlink(path);
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+int
+main(void)
+{
+	char dir[] = "/tmp/cfan-bench-XXXXXX";
+	const unsigned int sizes[] = { 1, 16, 256 };
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+	bench_atou_le3();
+	bench_utoa_le3_p();
+	bench_temp_fd_get(dir);
+	bench_curve_get();
+	bench_step_get();
+	int ret = EXIT_SUCCESS;
+	for (unsigned int i = 0; i < LEN(sizes); ++i) {
+		int status;
+		fflush(stdout);
+		const pid_t pid = fork();
+		if (pid == 0)
+			bench_tick(dir, sizes[i]);
+		if (pid == -1 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "bench: tick with %u sensors failed.\n", sizes[i]);
+			ret = EXIT_FAILURE;
+		}
+	}
+	rmdir(dir);
+	return ret;
+}
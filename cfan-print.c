@@ -4,15 +4,22 @@
 #include <unistd.h>
 #include <assert.h>
 #include <string.h>
+#include <stdlib.h>
+#include <time.h>
 
-#define table_len sizeof(c_table_temptospeed_med) 
-#define FAN_CURVE_MEDIUM c_table_temptospeed_med
-#define FAN_CURVE_HIGH c_table_temptospeed_high
+#include "cfan-status.h"
+#include "cfan-rec.h"
+
+/* Degrees to print. */
+#define table_len 120
+#define FAN_CURVE_MEDIUM (&c_table_temptospeed_med)
+#define FAN_CURVE_HIGH (&c_table_temptospeed_high)
 
 void
-print_table(const unsigned char *table)
+print_table(const c_curve_ty *table)
 {
 	for (unsigned int i = 0; i < table_len; ++i) {
+		const unsigned int speed = c_curve_get(table, (int)i * 1000);
 		const char *space;
 		if (i <= 9)
 			space = "  ";
@@ -23,7 +30,7 @@ print_table(const unsigned char *table)
 		printf("%s%dc ", space, i);
 		for (unsigned int j = 0; j <= 100; ++j) {
 			const char *c;
-			if (j == (unsigned int)(table[i] / 2.55)) {
+			if (j == (unsigned int)(speed / 2.55)) {
 				c = "x";
 				printf("%s ", c);
 				printf("%d%%", j);
@@ -62,30 +69,136 @@ print_table(const unsigned char *table)
 	putchar('\n');
 }
 
-const unsigned char *find_curve()
+const c_curve_ty *curve_by_name(const char *curve)
+{
+	const c_curve_ty *table = FAN_CURVE_DEFAULT;
+	if (!strcmp(curve, "medium"))
+		table = FAN_CURVE_MEDIUM;
+	else if (!strcmp(curve, "high"))
+		table = FAN_CURVE_HIGH;
+	return table;
+}
+
+const c_curve_ty *find_curve()
 {
 	int fd = open(CFAN_PATH "/" CFAN_FILE_CURVE, O_RDONLY);
 	assert(fd != -1);
 	char curve[4096];
-	int read_sz = read(fd, curve, sizeof(curve));
+	int read_sz = read(fd, curve, sizeof(curve) - 1);
 	assert(read_sz != -1);
 	assert(close(fd) != -1);
+	curve[read_sz] = '\0';
 	char *p = strchr(curve, '\n');
-	if (p) {
+	if (p)
 		*p = '\0';
-		--read_sz;
+	return curve_by_name(curve);
+}
+
+void
+print_status(const cfan_status_hdr_ty *h)
+{
+	printf("tick %llu, every %ums, curve %s\n", (unsigned long long)h->tick, h->interval_ms, h->curve);
+	printf("writes %llu, skipped %llu, held by hysteresis %llu\n", (unsigned long long)h->writes, (unsigned long long)h->writes_skipped, (unsigned long long)h->writes_held);
+	for (unsigned int i = 0; i < h->temps_len; ++i) {
+		const cfan_status_temp_ty *t = cfan_status_temps(h) + i;
+		if (t->temp == INT32_MIN)
+			printf("temp %s: -\n", t->name);
+		else
+			printf("temp %s: %.1fc\n", t->name, (double)t->temp / 1000);
 	}
-	const unsigned char *table = FAN_CURVE_DEFAULT;
-	if (!strcmp(curve, "medium"))
-		table = FAN_CURVE_MEDIUM;
-	else if (!strcmp(curve, "high"))
-		table = FAN_CURVE_HIGH;
-	return table;
+	for (unsigned int i = 0; i < h->zones_len; ++i) {
+		const cfan_status_zone_ty *z = cfan_status_zones(h) + i;
+		static const char *modes[] = { "curve", "pid", "rpm" };
+		if (z->temp == INT32_MIN)
+			printf("zone %s: -", z->name);
+		else
+			printf("zone %s: %.1fc", z->name, (double)z->temp / 1000);
+		printf(", speed %u, %s %s%s%s%s\n", z->speed, (z->mode < 3) ? modes[z->mode] : "?", z->curve, (z->flags & CFAN_STATUS_SWITCHING) ? ", switching" : "", (z->flags & CFAN_STATUS_FORCED) ? ", forced" : "", (z->flags & CFAN_STATUS_LOST) ? ", lost a device" : "");
+	}
+	for (unsigned int i = 0; i < h->fans_len; ++i) {
+		const cfan_status_fan_ty *f = cfan_status_fans(h) + i;
+		if (f->flags & CFAN_STATUS_GONE) {
+			printf("fan %s: gone\n", f->name);
+			continue;
+		}
+		printf("fan %s: speed %u", f->name, f->speed);
+		if (f->flags & CFAN_STATUS_TACH)
+			printf(", %u rpm%s", f->rpm, (f->flags & CFAN_STATUS_STALLED) ? ", stalled" : "");
+		putchar('\n');
+	}
+}
+
+/* Print a flight recorder dump, a tick per line. */
+int
+print_rec(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL) {
+		perror(path);
+		return 1;
+	}
+	size_t size = 0, cap = 0;
+	char *buf = NULL;
+	for (size_t n = 1; n > 0; size += n) {
+		if (size == cap) {
+			cap = cap ? cap * 2 : 65536;
+			char *p = realloc(buf, cap);
+			assert(p != NULL);
+			buf = p;
+		}
+		n = fread(buf + size, 1, cap - size, fp);
+	}
+	fclose(fp);
+	const cfan_rec_hdr_ty *h = (const cfan_rec_hdr_ty *)buf;
+	if (cfan_rec_check(h, size) != 0) {
+		fprintf(stderr, "cfan-print: %s: not a recording of this version.\n", path);
+		free(buf);
+		return 1;
+	}
+	printf("%u of %llu ticks\n", h->len, (unsigned long long)h->ticks);
+	for (uint32_t i = 0; i < h->len; ++i) {
+		const cfan_rec_slot_ty *s = cfan_rec_slot(h, i);
+		const long long real_ms = (long long)s->ms + h->real_ms;
+		const time_t t = (time_t)(real_ms / 1000);
+		struct tm tm;
+		char date[32];
+		strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm));
+		printf("%s.%03lld every %ums", date, real_ms % 1000, s->interval_ms);
+		for (uint32_t j = 0; j < h->temps_len; ++j) {
+			const int32_t temp = cfan_rec_temps(s)[j];
+			if (temp == INT32_MIN)
+				printf(" %s=-", cfan_rec_name(h, j));
+			else
+				printf(" %s=%.1f", cfan_rec_name(h, j), (double)temp / 1000);
+		}
+		for (uint32_t j = 0; j < h->zones_len; ++j) {
+			const cfan_rec_zone_ty *z = cfan_rec_zones(h, s) + j;
+			printf(" | %s %.1fc speed %u target %u %s", cfan_rec_name(h, h->temps_len + j), (double)z->temp / 1000, z->speed, z->target, cfan_rec_reason_name(z->reason));
+		}
+		putchar('\n');
+	}
+	free(buf);
+	return 0;
 }
 
 int
-main()
+main(int argc, char **argv)
 {
+	if (argc == 3 && !strcmp(argv[1], "--rec"))
+		return print_rec(argv[2]);
+	/* Prefer the status segment of a running cfan. */
+	static char buf[CFAN_STATUS_SIZE_MAX];
+	cfan_status_ty st;
+	if (cfan_status_open(&st) == 0) {
+		const int ret = cfan_status_read(&st, buf, sizeof(buf));
+		cfan_status_close(&st);
+		if (ret == 0) {
+			const cfan_status_hdr_ty *h = (const cfan_status_hdr_ty *)buf;
+			print_table(curve_by_name(h->curve));
+			print_status(h);
+			return 0;
+		}
+	}
 	print_table(find_curve());
 	return 0;
 }
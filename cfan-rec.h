@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2026 James Tirta Halim <tirtajames45 at gmail dot com> */
+
+#ifndef CFAN_REC_H
+#define CFAN_REC_H 1
+
+/* Flight recorder dump, written by cfan on `cfan-ctl record` and when it
+ * crashes, and a reader for it.
+ *
+ * The file is a cfan_rec_hdr_ty, the names of the temperatures and then
+ * of the zones, each terminated by a NUL, and len slots, oldest first.
+ * A slot is a cfan_rec_slot_ty, temps_len int32_t temperatures and
+ * zones_len cfan_rec_zone_ty:
+ *
+ *   const cfan_rec_hdr_ty *h = (const cfan_rec_hdr_ty *)buf;
+ *   if (cfan_rec_check(h, size) == 0)
+ *           for (uint32_t i = 0; i < h->len; ++i)
+ *                   ... cfan_rec_zones(h, cfan_rec_slot(h, i))[0].speed ... */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CFAN_REC_MAGIC   "cfanrec"
+#define CFAN_REC_VERSION 1
+
+/* Why a zone is at the speed it is. */
+enum {
+	/* Moved straight to the target. */
+	CFAN_REC_DIRECT,
+	/* Already at the target. */
+	CFAN_REC_UNCHANGED,
+	/* Rise held back by spike suppression. */
+	CFAN_REC_SPIKE,
+	/* Fall limited by stepdown_max. */
+	CFAN_REC_RAMP,
+	/* Kept by the hysteresis; the curve at the raw temperature differs. */
+	CFAN_REC_HELD,
+	/* Set by the PID controller. */
+	CFAN_REC_PID,
+	/* Held from the control socket. */
+	CFAN_REC_FORCED,
+	/* Raised to the curve ahead of a steady rise, see predict.h. */
+	CFAN_REC_PREDICT,
+	/* Raised above the curve by CPU pressure, see psi.h. */
+	CFAN_REC_LOAD,
+	/* At the top of the curve while a device of the zone is gone. */
+	CFAN_REC_LOST,
+	CFAN_REC_REASONS_NUM,
+};
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	/* Bytes per slot. */
+	uint32_t slot_size;
+	uint32_t temps_len;
+	uint32_t zones_len;
+	/* Slots in the file. */
+	uint32_t len;
+	/* Bytes of names after the header. */
+	uint32_t names_len;
+	/* Ticks recorded since cfan started, of which the last len are kept. */
+	uint64_t ticks;
+	/* CLOCK_REALTIME minus CLOCK_MONOTONIC when dumped, in msecs. */
+	int64_t real_ms;
+} cfan_rec_hdr_ty;
+
+typedef struct {
+	/* CLOCK_MONOTONIC in msecs. */
+	uint64_t ms;
+	/* Interval until the next tick. */
+	uint32_t interval_ms;
+	uint32_t reserved;
+} cfan_rec_slot_ty;
+
+typedef struct {
+	/* Millidegrees. */
+	int32_t temp;
+	/* Speed of the curve or the controller, and the speed applied:
+	 * 0-255, or RPM in mode rpm. */
+	uint32_t target;
+	uint32_t speed;
+	uint8_t reason;
+	uint8_t reserved[3];
+} cfan_rec_zone_ty;
+
+/* Return the size of a slot. */
+static inline size_t
+cfan_rec_slot_size(uint32_t temps_len, uint32_t zones_len)
+{
+	return sizeof(cfan_rec_slot_ty) + temps_len * sizeof(int32_t) + zones_len * sizeof(cfan_rec_zone_ty);
+}
+
+/* Return 0 if h is a dump that fits in size bytes. */
+static inline int
+cfan_rec_check(const cfan_rec_hdr_ty *h, size_t size)
+{
+	if (size < sizeof(*h) || memcmp(h->magic, CFAN_REC_MAGIC, sizeof(h->magic)) || h->version != CFAN_REC_VERSION
+	    || h->slot_size != cfan_rec_slot_size(h->temps_len, h->zones_len))
+		return -1;
+	if ((uint64_t)sizeof(*h) + h->names_len + (uint64_t)h->len * h->slot_size > size)
+		return -1;
+	return (h->names_len == 0 || ((const char *)(h + 1))[h->names_len - 1] == '\0') ? 0 : -1;
+}
+
+/* Return the i-th name, temperatures first, or NULL. */
+static inline const char *
+cfan_rec_name(const cfan_rec_hdr_ty *h, uint32_t i)
+{
+	const char *p = (const char *)(h + 1);
+	const char *end = p + h->names_len;
+	for (; p < end && i; --i)
+		p += strlen(p) + 1;
+	return (p < end) ? p : NULL;
+}
+
+static inline const cfan_rec_slot_ty *
+cfan_rec_slot(const cfan_rec_hdr_ty *h, uint32_t i)
+{
+	return (const cfan_rec_slot_ty *)((const char *)(h + 1) + h->names_len + (size_t)i * h->slot_size);
+}
+
+static inline const int32_t *
+cfan_rec_temps(const cfan_rec_slot_ty *s)
+{
+	return (const int32_t *)(s + 1);
+}
+
+static inline const cfan_rec_zone_ty *
+cfan_rec_zones(const cfan_rec_hdr_ty *h, const cfan_rec_slot_ty *s)
+{
+	return (const cfan_rec_zone_ty *)(cfan_rec_temps(s) + h->temps_len);
+}
+
+static inline const char *
+cfan_rec_reason_name(unsigned int reason)
+{
+	static const char *names[] = { "direct", "unchanged", "spike", "ramp", "held", "pid", "forced", "predict", "load", "lost" };
+	return (reason < CFAN_REC_REASONS_NUM) ? names[reason] : "?";
+}
+
+#endif /* CFAN_REC_H */
@@ -0,0 +1,471 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2026 James Tirta Halim <tirtajames45 at gmail dot com> */
+
+/* Replay temperature traces through the control code of cfan, offline.
+ *
+ * Each trace is run through c_zone_speed_get() and c_interval_get(), the
+ * code cfan runs, sampled when cfan would wake up. The speed it writes is
+ * compared against the trace and against the curve at the raw temperature.
+ *
+ * A trace is a text file of "MSECS MILLIDEGREES" lines, as from reading a
+ * sysfs temp*_input, with # comments, or a flight recorder dump of cfan,
+ * of which the zone of --zone is replayed. "-" is stdin. --synth generates
+ * traces of idle, bursts and sustained load instead. */
+
+#include "config.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macros.h"
+#include "curve.h"
+#include "param.h"
+#include "zone.h"
+#include "interval.h"
+#include "conf.h"
+
+/* Trace sampling of --synth. (msecs) */
+#define SIM_SYNTH_STEP_MS 100
+
+typedef struct {
+	unsigned long long ms;
+	int temp;
+} sim_sample_ty;
+
+typedef struct {
+	sim_sample_ty *samples;
+	size_t len;
+	size_t cap;
+} sim_trace_ty;
+
+typedef struct {
+	/* msecs */
+	unsigned long long ms;
+	unsigned long long ticks;
+	/* Ticks that changed the speed, i.e. fan writes. */
+	unsigned long long changes;
+	/* Speed integrated over msecs. */
+	double speed_sum;
+	unsigned int peak;
+	/* msecs at or above --above, and at or above spike_temp_max. */
+	unsigned long long above_ms;
+	unsigned long long hot_ms;
+	/* Shortfall from the curve at the raw temperature, integrated over msecs. */
+	double lag_sum;
+	unsigned int lag_max;
+} sim_stats_ty;
+
+/* Temperatures come from the trace, so the functions are never called,
+ * but configurations naming them must load. */
+static const c_fn_name_ty sim_fn_names[] = {
+	{ "nvidia", NULL, NULL },
+	{ NULL, NULL, NULL },
+};
+
+static void
+sim_usage(void)
+{
+	fprintf(stderr, "usage: cfan-sim [--config FILE] [--set LINE]... [--zone NAME] [--curve NAME]\n"
+	                "                [--above SPEED] [--total] [--synth N [--seed N] [--length SECS]] [TRACE]...\n");
+	exit(EXIT_FAILURE);
+}
+
+static int
+sim_trace_add(sim_trace_ty *tr, unsigned long long ms, int temp)
+{
+	if (tr->len == tr->cap) {
+		const size_t cap = tr->cap ? tr->cap * 2 : 1024;
+		sim_sample_ty *p = (sim_sample_ty *)realloc(tr->samples, cap * sizeof(*p));
+		if (unlikely(p == NULL))
+			return -1;
+		tr->samples = p;
+		tr->cap = cap;
+	}
+	tr->samples[tr->len].ms = ms;
+	tr->samples[tr->len].temp = temp;
+	++tr->len;
+	return 0;
+}
+
+/* Take the temperatures of a zone from a flight recorder dump. */
+static int
+sim_rec_read(sim_trace_ty *tr, const char *path, const char *buf, size_t size, const char *zone_name)
+{
+	const cfan_rec_hdr_ty *h = (const cfan_rec_hdr_ty *)buf;
+	uint32_t z = 0;
+	if (cfan_rec_check(h, size) == -1) {
+		fprintf(stderr, "cfan-sim: %s: not a recording of this version.\n", path);
+		return -1;
+	}
+	if (zone_name) {
+		const char *name;
+		while ((name = cfan_rec_name(h, h->temps_len + z)) && strcmp(name, zone_name))
+			++z;
+		if (z >= h->zones_len) {
+			fprintf(stderr, "cfan-sim: %s: no zone named %s.\n", path, zone_name);
+			return -1;
+		}
+	}
+	for (uint32_t i = 0; i < h->len; ++i) {
+		const cfan_rec_slot_ty *s = cfan_rec_slot(h, i);
+		if (unlikely(sim_trace_add(tr, s->ms, cfan_rec_zones(h, s)[z].temp) == -1)) {
+			fprintf(stderr, "cfan-sim: out of memory.\n");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Read a trace, or the zone zone_name of a recording. Return -1 with a
+ * message on error. */
+static int
+sim_trace_read(sim_trace_ty *tr, const char *path, const char *zone_name)
+{
+	FILE *fp = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (fp == NULL) {
+		fprintf(stderr, "cfan-sim: %s: %s.\n", path, strerror(errno));
+		return -1;
+	}
+	c_conf_buf_ty text = { NULL, 0, 0 };
+	char buf[4096];
+	int ret = 0;
+	for (size_t n; ret == 0 && (n = fread(buf, 1, sizeof(buf), fp)) > 0;)
+		ret = c_conf_buf_add(&text, buf, n);
+	if (ret == 0)
+		ret = c_conf_buf_add(&text, "", 1);
+	if (fp != stdin)
+		fclose(fp);
+	if (ret == -1) {
+		fprintf(stderr, "cfan-sim: out of memory.\n");
+		free(text.p);
+		return -1;
+	}
+	tr->len = 0;
+	if (text.len > sizeof(CFAN_REC_MAGIC) && !memcmp(text.p, CFAN_REC_MAGIC, sizeof(CFAN_REC_MAGIC))) {
+		ret = sim_rec_read(tr, path, text.p, text.len - 1, zone_name);
+	} else {
+		unsigned int lineno = 0;
+		for (char *save, *line = strtok_r(text.p, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+			unsigned long long ms;
+			long temp = 0;
+			char *p = line, *end;
+			++lineno;
+			while (*p == ' ' || *p == '\t')
+				++p;
+			if (*p == '#' || *p == '\0')
+				continue;
+			ms = strtoull(p, &end, 10);
+			if (end != p)
+				temp = strtol(p = end, &end, 10);
+			if (end == p || temp < -273000 || temp > 1000000 || (tr->len && ms < tr->samples[tr->len - 1].ms)) {
+				fprintf(stderr, "cfan-sim: %s:%u: expected increasing MSECS and MILLIDEGREES.\n", path, lineno);
+				ret = -1;
+				break;
+			}
+			if (unlikely(sim_trace_add(tr, ms, (int)temp) == -1)) {
+				fprintf(stderr, "cfan-sim: out of memory.\n");
+				ret = -1;
+				break;
+			}
+		}
+	}
+	free(text.p);
+	if (ret == 0 && tr->len < 2) {
+		fprintf(stderr, "cfan-sim: %s: needs at least two samples.\n", path);
+		ret = -1;
+	}
+	return ret;
+}
+
+static unsigned long long
+sim_rand(unsigned long long *state)
+{
+	/* xorshift64 */
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/* Uniform in [lo, hi). */
+static double
+sim_uniform(unsigned long long *state, double lo, double hi)
+{
+	return lo + (hi - lo) * (double)(sim_rand(state) >> 11) / (double)(1ULL << 53);
+}
+
+/* Generate a trace of length_ms: an idle machine with bursts, as in
+ * opening a program, and sustained loads, heating and cooling at first
+ * order, with sensor noise, read in whole degrees. */
+static int
+sim_synth(sim_trace_ty *tr, unsigned long long *state, unsigned long long length_ms)
+{
+	const double ambient = sim_uniform(state, 35, 45);
+	double temp = ambient, load = 0;
+	unsigned long long phase_end = 0;
+	tr->len = 0;
+	for (unsigned long long ms = 0; ms <= length_ms; ms += SIM_SYNTH_STEP_MS) {
+		if (ms >= phase_end) {
+			const double kind = sim_uniform(state, 0, 1);
+			if (kind < 0.4) {
+				load = 0;
+				phase_end = ms + (unsigned long long)sim_uniform(state, 5000, 120000);
+			} else if (kind < 0.75) {
+				load = sim_uniform(state, 15, 45);
+				phase_end = ms + (unsigned long long)sim_uniform(state, 200, 5000);
+			} else {
+				load = sim_uniform(state, 10, 40);
+				phase_end = ms + (unsigned long long)sim_uniform(state, 30000, 600000);
+			}
+		}
+		const double target = ambient + load;
+		/* Heats faster than it cools. (secs) */
+		const double tau = (target > temp) ? 5 : 20;
+		temp += (target - temp) * SIM_SYNTH_STEP_MS / 1000 / tau;
+		const double noise = sim_uniform(state, -0.5, 0.5) + sim_uniform(state, -0.5, 0.5);
+		if (unlikely(sim_trace_add(tr, ms, (int)(temp + noise + 0.5) * 1000) == -1))
+			return -1;
+	}
+	return 0;
+}
+
+/* Account for speed held for dur msecs at temp. */
+static void
+sim_account(sim_stats_ty *s, const c_param_ty *prm, const c_curve_ty *curve, unsigned int above, unsigned int speed, int temp, unsigned long long dur)
+{
+	const unsigned int raw = c_curve_get(curve, temp);
+	s->ms += dur;
+	s->speed_sum += (double)speed * dur;
+	if (speed >= above)
+		s->above_ms += dur;
+	if (temp >= prm->spike_temp_max)
+		s->hot_ms += dur;
+	if (raw > speed) {
+		s->lag_sum += (double)(raw - speed) * dur;
+		s->lag_max = MAX(s->lag_max, raw - speed);
+	}
+}
+
+/* Run a trace through the controller of a zone, starting as if it had
+ * been at the first temperature for long. */
+static void
+sim_run(const c_param_ty *prm, const c_curve_ty *curve, unsigned int above, const sim_trace_ty *tr, sim_stats_ty *s)
+{
+	c_zone_state_ty st;
+	memset(&st, 0, sizeof(st));
+	memset(s, 0, sizeof(*s));
+	st.curve = curve;
+	st.speed_min = c_curve_min(curve);
+	st.speed_max = c_curve_max(curve);
+	st.mode = (int)prm->mode;
+	st.hyst_temp = INT_MIN;
+	c_predict_reset(&st.predict);
+	st.last_temp = tr->samples[0].temp;
+	st.last_speed = c_curve_get(curve, st.last_temp);
+	s->peak = st.last_speed;
+	const unsigned long long end = tr->samples[tr->len - 1].ms;
+	unsigned long long now = tr->samples[0].ms;
+	unsigned int interval_ms = prm->interval_ms;
+	unsigned long long tick = now + interval_ms;
+	size_t j = 0;
+	while (now < end) {
+		/* Up to the next sample or the next tick. */
+		const unsigned long long next = MIN(tick, tr->samples[j + 1].ms);
+		sim_account(s, prm, curve, above, st.last_speed, tr->samples[j].temp, next - now);
+		now = next;
+		while (j + 1 < tr->len && tr->samples[j + 1].ms <= now)
+			++j;
+		if (now < tick)
+			continue;
+		const int temp = tr->samples[j].temp;
+		int at_floor;
+		const unsigned int speed = c_zone_speed_get(prm, &st, temp, interval_ms, &at_floor);
+		s->changes += (speed != st.last_speed);
+		s->peak = MAX(s->peak, speed);
+		++s->ticks;
+		st.last_speed = speed;
+		interval_ms = c_interval_get(prm, interval_ms, temp, st.last_temp, interval_ms, at_floor && speed == st.speed_min);
+		st.last_temp = temp;
+		tick = now + interval_ms;
+	}
+}
+
+static void
+sim_merge(sim_stats_ty *dst, const sim_stats_ty *s)
+{
+	dst->ms += s->ms;
+	dst->ticks += s->ticks;
+	dst->changes += s->changes;
+	dst->speed_sum += s->speed_sum;
+	dst->peak = MAX(dst->peak, s->peak);
+	dst->above_ms += s->above_ms;
+	dst->hot_ms += s->hot_ms;
+	dst->lag_sum += s->lag_sum;
+	dst->lag_max = MAX(dst->lag_max, s->lag_max);
+}
+
+static void
+sim_print(const char *name, const sim_stats_ty *s)
+{
+	const double ms = s->ms ? (double)s->ms : 1;
+	printf("%-16s %10.1f %8llu %8llu %8.1f %6u %10.1f %10.1f %8.2f %8u\n", name, (double)s->ms / 1000, s->ticks, s->changes, s->speed_sum / ms, s->peak, (double)s->above_ms / 1000, (double)s->hot_ms / 1000, s->lag_sum / ms, s->lag_max);
+}
+
+/* Load the configuration the daemon would, with the --set lines after
+ * the file, so that they override it. */
+static void
+sim_conf_load(c_conf_ty *conf, const char *path, char **sets, unsigned int sets_len)
+{
+	char err[C_CONF_ERR_LEN];
+	char buf[4096];
+	c_conf_buf_ty text = { NULL, 0, 0 };
+	int ret = 0;
+	if (path && sets_len == 0) {
+		/* Through the cache, as cfan. */
+		if (c_conf_load(conf, path, sim_fn_names, err, sizeof(err)) == -1) {
+			fprintf(stderr, "cfan-sim: %s\n", err);
+			exit(EXIT_FAILURE);
+		}
+		return;
+	}
+	if (path) {
+		FILE *fp = fopen(path, "r");
+		if (fp == NULL) {
+			fprintf(stderr, "cfan-sim: %s: %s.\n", path, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		for (size_t n; ret == 0 && (n = fread(buf, 1, sizeof(buf), fp)) > 0;)
+			ret = c_conf_buf_add(&text, buf, n);
+		fclose(fp);
+	} else {
+		/* The builtin curves and the defaults of config.h. */
+		ret = c_conf_buf_add(&text, S_LITERAL("temp sim /dev/null\nfan sim /dev/null"));
+	}
+	for (unsigned int i = 0; ret == 0 && i < sets_len; ++i)
+		if ((ret = c_conf_buf_add(&text, S_LITERAL("\n"))) == 0)
+			ret = c_conf_buf_add(&text, sets[i], strlen(sets[i]));
+	if (ret == -1) {
+		fprintf(stderr, "cfan-sim: out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	void *img;
+	size_t img_sz;
+	if (c_conf_compile(path ? path : "--set", text.p, text.len, NULL, sim_fn_names, &img, &img_sz, err, sizeof(err)) == -1
+	    || c_conf_from_img(conf, img, img_sz, sim_fn_names, err, sizeof(err)) == -1) {
+		fprintf(stderr, "cfan-sim: %s\n", err);
+		exit(EXIT_FAILURE);
+	}
+	free(text.p);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *conf_path = NULL, *curve_name = NULL, *zone_name = NULL;
+	char **sets = (char **)calloc((size_t)argc, sizeof(char *));
+	unsigned int sets_len = 0;
+	unsigned long synth = 0, above = 128, length_s = 3600;
+	unsigned long long seed = 1;
+	int total_only = 0, i = 1;
+	if (sets == NULL)
+		return EXIT_FAILURE;
+	for (; i < argc && argv[i][0] == '-' && argv[i][1] == '-'; ++i) {
+		const char *opt = argv[i];
+		if (!strcmp(opt, "--")) {
+			++i;
+			break;
+		}
+		if (!strcmp(opt, "--total")) {
+			total_only = 1;
+			continue;
+		}
+		if (i + 1 == argc)
+			sim_usage();
+		const char *arg = argv[++i];
+		char *end;
+		if (!strcmp(opt, "--config"))
+			conf_path = arg;
+		else if (!strcmp(opt, "--set"))
+			sets[sets_len++] = argv[i];
+		else if (!strcmp(opt, "--curve"))
+			curve_name = arg;
+		else if (!strcmp(opt, "--zone"))
+			zone_name = arg;
+		else if (!strcmp(opt, "--above"))
+			above = strtoul(arg, &end, 10);
+		else if (!strcmp(opt, "--synth"))
+			synth = strtoul(arg, &end, 10);
+		else if (!strcmp(opt, "--seed"))
+			seed = strtoull(arg, &end, 10);
+		else if (!strcmp(opt, "--length"))
+			length_s = strtoul(arg, &end, 10);
+		else
+			sim_usage();
+	}
+	if (synth == 0 && i == argc)
+		sim_usage();
+	c_conf_ty conf;
+	sim_conf_load(&conf, conf_path, sets, sets_len);
+	if (conf.param.mode == CONTROL_RPM) {
+		fprintf(stderr, "cfan-sim: mode rpm needs tachometers, and is not simulated.\n");
+		return EXIT_FAILURE;
+	}
+	const c_curve_ty *curve = conf.curves + conf.curve_default;
+	/* A zone only in a recording follows the default curve. */
+	if (zone_name) {
+		unsigned int k = 0;
+		while (k < conf.zones_len && strcmp(conf.zones[k].name, zone_name))
+			++k;
+		if (k < conf.zones_len && conf.zones[k].curve)
+			curve = conf.zones[k].curve;
+	}
+	if (curve_name) {
+		unsigned int k = 0;
+		while (k < conf.curves_len && strcmp(conf.curve_names[k], curve_name))
+			++k;
+		if (k == conf.curves_len) {
+			fprintf(stderr, "cfan-sim: unknown curve: %s.\n", curve_name);
+			return EXIT_FAILURE;
+		}
+		curve = conf.curves + k;
+	}
+	if (conf.param.mode == CONTROL_CURVE && conf.param.stepdown_max > c_curve_min(curve)) {
+		fprintf(stderr, "cfan-sim: stepdown_max (%u) must not be greater than the minimum speed of the curve (%u).\n", conf.param.stepdown_max, c_curve_min(curve));
+		return EXIT_FAILURE;
+	}
+	/* Times in secs, speeds in 0-255. */
+	printf("%-16s %10s %8s %8s %8s %6s %10s %10s %8s %8s\n", "trace", "secs", "ticks", "changes", "mean", "peak", "above", "hot", "lag", "lag_max");
+	sim_trace_ty tr = { NULL, 0, 0 };
+	sim_stats_ty total, s;
+	memset(&total, 0, sizeof(total));
+	int ret = EXIT_SUCCESS;
+	seed = seed ? seed : 1;
+	for (unsigned long k = 0; k < synth; ++k) {
+		char name[32];
+		if (sim_synth(&tr, &seed, (unsigned long long)length_s * 1000) == -1) {
+			fprintf(stderr, "cfan-sim: out of memory.\n");
+			return EXIT_FAILURE;
+		}
+		sim_run(&conf.param, curve, (unsigned int)above, &tr, &s);
+		sim_merge(&total, &s);
+		snprintf(name, sizeof(name), "synth-%lu", k);
+		if (!total_only)
+			sim_print(name, &s);
+	}
+	for (; i < argc; ++i) {
+		if (sim_trace_read(&tr, argv[i], zone_name) == -1) {
+			ret = EXIT_FAILURE;
+			continue;
+		}
+		sim_run(&conf.param, curve, (unsigned int)above, &tr, &s);
+		sim_merge(&total, &s);
+		if (!total_only)
+			sim_print(argv[i], &s);
+	}
+	sim_print("total", &total);
+	free(tr.samples);
+	free(sets);
+	c_conf_free(&conf);
+	return ret;
+}
@@ -0,0 +1,233 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2026 James Tirta Halim <tirtajames45 at gmail dot com> */
+
+#ifndef CFAN_STATUS_H
+#define CFAN_STATUS_H 1
+
+/* Status segment published by cfan once per tick, and a reader for it.
+ *
+ * The segment is a file in /dev/shm with a fixed, versioned layout. cfan
+ * updates it under a seqlock, so a reader mapping it gets a consistent
+ * snapshot with cfan_status_read(), without syscalls or parsing.
+ *
+ *   cfan_status_ty st;
+ *   if (cfan_status_open(&st) == 0) {
+ *           char buf[CFAN_STATUS_SIZE_MAX];
+ *           if (cfan_status_read(&st, buf, sizeof(buf)) == 0) {
+ *                   const cfan_status_hdr_ty *h = (const cfan_status_hdr_ty *)buf;
+ *                   ... cfan_status_zones(h)[0].speed ...
+ *           }
+ *           cfan_status_close(&st);
+ *   }
+ *
+ * When cfan restarts, it replaces the segment and marks the old one as
+ * stopped. cfan_status_read() then returns -1 with errno ESTALE, and the
+ * reader should open it again. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef CFAN_STATUS_PATH
+#	define CFAN_STATUS_PATH "/dev/shm/cfan-status"
+#endif
+#define CFAN_STATUS_MAGIC    0x73666e63 /* "cnfs" */
+#define CFAN_STATUS_VERSION  3
+#define CFAN_STATUS_NAME_LEN 32
+/* Enough for 256 sensors, fans and zones. */
+#define CFAN_STATUS_SIZE_MAX (64 * 1024)
+
+/* cfan_status_zone_ty.flags */
+enum {
+	/* Ramping to a new curve. */
+	CFAN_STATUS_SWITCHING = 1 << 0,
+	/* Holding a speed set from the control socket. */
+	CFAN_STATUS_FORCED = 1 << 1,
+	/* At full speed while a device of the zone is gone. */
+	CFAN_STATUS_LOST = 1 << 2,
+};
+
+/* cfan_status_fan_ty.flags */
+enum {
+	/* rpm is read from a tachometer. */
+	CFAN_STATUS_TACH = 1 << 0,
+	/* Driven but not turning. */
+	CFAN_STATUS_STALLED = 1 << 1,
+	/* Its device is gone. */
+	CFAN_STATUS_GONE = 1 << 2,
+};
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	/* Size of the segment in bytes. */
+	uint32_t size;
+	/* Odd while an update is in progress. */
+	uint32_t seq;
+	/* 0 once cfan has exited. */
+	uint32_t running;
+	uint32_t temps_len;
+	uint32_t fans_len;
+	uint32_t zones_len;
+	/* Byte offsets of the arrays from the start of the segment. */
+	uint32_t temps_off;
+	uint32_t fans_off;
+	uint32_t zones_off;
+	/* Current update interval in msecs. */
+	uint32_t interval_ms;
+	uint64_t tick;
+	/* Time of the last update, CLOCK_MONOTONIC and CLOCK_REALTIME in msecs. */
+	uint64_t mono_ms;
+	uint64_t real_ms;
+	/* Fan writes made, skipped as unchanged, and avoided by the hysteresis. */
+	uint64_t writes;
+	uint64_t writes_skipped;
+	uint64_t writes_held;
+	int32_t pid;
+	/* Curve of zones without their own. */
+	char curve[CFAN_STATUS_NAME_LEN];
+} cfan_status_hdr_ty;
+
+typedef struct {
+	char name[CFAN_STATUS_NAME_LEN];
+	/* Millidegrees, or INT32_MIN if the last read failed. */
+	int32_t temp;
+	uint32_t reserved;
+} cfan_status_temp_ty;
+
+typedef struct {
+	char name[CFAN_STATUS_NAME_LEN];
+	/* Commanded speed (0-255). */
+	uint32_t speed;
+	/* Index into the zones. */
+	uint32_t zone;
+	uint32_t rpm;
+	uint32_t flags;
+} cfan_status_fan_ty;
+
+typedef struct {
+	char name[CFAN_STATUS_NAME_LEN];
+	char curve[CFAN_STATUS_NAME_LEN];
+	/* Millidegrees. */
+	int32_t temp;
+	/* 0-255, or RPM in mode rpm. */
+	uint32_t speed;
+	/* 0: curve, 1: pid, 2: rpm */
+	uint32_t mode;
+	uint32_t flags;
+} cfan_status_zone_ty;
+
+typedef struct {
+	const cfan_status_hdr_ty *hdr;
+	size_t size;
+} cfan_status_ty;
+
+static inline const cfan_status_temp_ty *
+cfan_status_temps(const cfan_status_hdr_ty *h)
+{
+	return (const cfan_status_temp_ty *)((const char *)h + h->temps_off);
+}
+
+static inline const cfan_status_fan_ty *
+cfan_status_fans(const cfan_status_hdr_ty *h)
+{
+	return (const cfan_status_fan_ty *)((const char *)h + h->fans_off);
+}
+
+static inline const cfan_status_zone_ty *
+cfan_status_zones(const cfan_status_hdr_ty *h)
+{
+	return (const cfan_status_zone_ty *)((const char *)h + h->zones_off);
+}
+
+/* Return the size of a segment with these many entries. */
+static inline size_t
+cfan_status_size(unsigned int temps_len, unsigned int fans_len, unsigned int zones_len)
+{
+	return sizeof(cfan_status_hdr_ty) + temps_len * sizeof(cfan_status_temp_ty) + fans_len * sizeof(cfan_status_fan_ty) + zones_len * sizeof(cfan_status_zone_ty);
+}
+
+static inline void
+cfan_status_close(cfan_status_ty *st)
+{
+	if (st->hdr != NULL)
+		munmap((void *)st->hdr, st->size);
+	st->hdr = NULL;
+	st->size = 0;
+}
+
+/* Map the segment at path read-only. Return -1 with errno set on failure. */
+static inline int
+cfan_status_open_path(cfan_status_ty *st, const char *path)
+{
+	struct stat sb;
+	st->hdr = NULL;
+	st->size = 0;
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &sb) == -1 || (size_t)sb.st_size < sizeof(cfan_status_hdr_ty)) {
+		close(fd);
+		errno = EPROTO;
+		return -1;
+	}
+	void *p = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return -1;
+	st->hdr = (const cfan_status_hdr_ty *)p;
+	st->size = (size_t)sb.st_size;
+	if (st->hdr->magic != CFAN_STATUS_MAGIC || st->hdr->version != CFAN_STATUS_VERSION || st->hdr->size != st->size
+	    || cfan_status_size(st->hdr->temps_len, st->hdr->fans_len, st->hdr->zones_len) > st->size) {
+		cfan_status_close(st);
+		errno = EPROTO;
+		return -1;
+	}
+	return 0;
+}
+
+static inline int
+cfan_status_open(cfan_status_ty *st)
+{
+	return cfan_status_open_path(st, CFAN_STATUS_PATH);
+}
+
+/* Copy a consistent snapshot of the segment into buf.
+ * Return -1 with errno ENOBUFS if buf is too small, ESTALE if cfan has
+ * exited since the segment was opened, or EAGAIN if it stays mid-update. */
+static inline int
+cfan_status_read(const cfan_status_ty *st, void *buf, size_t buf_sz)
+{
+	if (buf_sz < st->size) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	for (unsigned int tries = 0;; ++tries) {
+		/* An update takes microseconds; a writer killed in the middle
+		 * of one leaves seq odd until the next start. */
+		if (tries == 1000000) {
+			errno = EAGAIN;
+			return -1;
+		}
+		const uint32_t seq = __atomic_load_n(&st->hdr->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		memcpy(buf, st->hdr, st->size);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&st->hdr->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+	if (!((const cfan_status_hdr_ty *)buf)->running) {
+		errno = ESTALE;
+		return -1;
+	}
+	return 0;
+}
+
+#endif /* CFAN_STATUS_H */
@@ -6,76 +6,210 @@
 #include <assert.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <time.h>
+#include <poll.h>
 
 #include <sys/stat.h>
 
 #include "path.h"
+#include "event.h"
+#include "uring.h"
 #include "cfan.h"
 #include "macros.h"
 #include "util.h"
 #include "config.h"
 #include "temp.h"
 #include "step.h"
+#include "interval.h"
+#include "pid.h"
+#include "conf.h"
+#include "ctl.h"
+#include "status.h"
+#include "rec.h"
+#include "metrics.h"
+#include "alarm.h"
+#include "psi.h"
+#include "uevent.h"
+#include "discover.h"
+#ifdef USE_ACTUATOR
+#	include "actuate.h"
+#endif
 #include "table-temp.h"
 
-#include "table-fans.generated.h"
-#include "cpu.generated.h"
-
-static int c_temp_fds[LEN(c_table_temps)];
-static int c_fan_fds[LEN(c_table_fans)];
-static volatile sig_atomic_t c_sig_caught;
-static const struct timespec c_sleeptime = {INTERVAL_UPDATE, 0};
+/* Sized from c_conf in c_init(). */
+static c_conf_ty c_conf;
+/* Temperatures, followed by the tachometers of c_tach_fans. */
+static int *c_temp_fds;
+/* Millidegrees, then RPM. */
+static int *c_temps;
+/* Indices of the fans with a tachometer. */
+static unsigned int *c_tach_fans;
+static unsigned int c_tachs_len;
+#ifdef USE_IO_URING
+static c_uring_ty c_uring = { -1 };
+static char (*c_temp_bufs)[C_TEMP_BUF_LEN];
+static int *c_temp_res;
+#endif
+static int *c_fan_fds;
+static c_fan_state_ty *c_fan_states;
+static c_zone_state_ty *c_zone_states;
+/* Fan writes made, skipped as unchanged, and avoided by the hysteresis. */
+static unsigned long long c_writes;
+static unsigned long long c_writes_skipped;
+static unsigned long long c_writes_held;
+/* Paths as configured, resolved again when their device comes back: the
+ * inputs, then the pwm and enable of each fan. */
+static const char **c_specs;
+/* The inputs, then the fans, whose device is gone, see c_devices_recover(). */
+static unsigned char *c_lost;
+static unsigned int c_lost_len;
+/* When to look for them again, without a uevent. (msecs) */
+static unsigned long long c_recover_ms;
+static int c_uevent_fd = -1;
 
 #define _(x) x
 
-const unsigned char *temptospeed = FAN_CURVE_DEFAULT;
+static const char *c_conf_path = CFAN_CONF_PATH;
+/* Set on the command line, overriding the configuration. */
+static const char *c_curve_name;
+static int c_control_mode = -1;
 
 #if CFAN_PRINT_TEMP_CPU
 static int global_fd_temp_cpu = -1;
 static unsigned int global_temp_cpu_old_sz = 0;
-static unsigned int global_temp_cpu_max = 0;
 #endif
 
-unsigned int
-c_temp_sysfs_max_get(void)
+/* Return where the path of input i, a temperature or a tachometer, is
+ * kept. */
+static ATTR_INLINE const char **
+c_input_pathp(unsigned int i)
 {
-	unsigned int max = 0;
-	unsigned int valid = 0;
-	for (unsigned int i = 0, curr; i < LEN(c_table_temps); ++i) {
-		curr = c_temp_fd_get(c_temp_fds[i]);
-#if CFAN_PRINT_TEMP_CPU
-		if (i == CFAN_TEMP_CPU_IDX)
-			global_temp_cpu_max = curr;
+	return (i < c_conf.temps_len) ? &c_conf.temps[i] : &c_conf.fans_tach[c_tach_fans[i - c_conf.temps_len]];
+}
+
+static ATTR_INLINE const char *
+c_input_path(unsigned int i)
+{
+	return *c_input_pathp(i);
+}
+
+/* Return 1 if err says that the device of a file is gone, as after its
+ * driver is unloaded or the machine resumes. */
+static ATTR_INLINE int
+c_dev_gone(int err)
+{
+	return err == ENODEV || err == ENXIO;
+}
+
+/* Close input i, whose device is gone, until c_devices_recover() finds it
+ * again. */
+static void
+c_input_lose(unsigned int i)
+{
+	close(c_temp_fds[i]);
+	c_temp_fds[i] = -1;
+	if (!c_lost[i]) {
+		fprintf(stderr, "cfan: %s is gone, holding its zones at full speed until it is back.\n", c_input_path(i));
+		c_lost[i] = 1;
+		++c_lost_len;
+		++c_metrics.device_losses;
+	}
+	errno = 0;
+}
+
+static void
+c_fan_lose(unsigned int i)
+{
+	close(c_fan_fds[i]);
+	c_fan_fds[i] = -1;
+	if (!c_lost[c_conf.temps_len + c_tachs_len + i]) {
+		fprintf(stderr, "cfan: fan %s is gone, holding its zone at full speed until it is back.\n", c_conf.fan_names[i]);
+		c_lost[c_conf.temps_len + c_tachs_len + i] = 1;
+		++c_lost_len;
+		++c_metrics.device_losses;
+	}
+	errno = 0;
+}
+
+#ifdef USE_IO_URING
+static int
+c_temps_uring_read(void)
+{
+	if (unlikely(c_uring_pread_batch(&c_uring, c_temp_fds, (char *)c_temp_bufs, C_TEMP_BUF_LEN, c_temp_res, c_conf.temps_len + c_tachs_len) == -1))
+		return -1;
+	for (unsigned int i = 0; i < c_conf.temps_len + c_tachs_len; ++i) {
+		c_temps[i] = (likely(c_temp_res[i] >= 0)) ? c_temp_parse(c_temp_bufs[i], c_temp_res[i]) : C_TEMP_INVALID;
+		if (unlikely(c_temp_res[i] < 0) && c_dev_gone(-c_temp_res[i]))
+			c_input_lose(i);
+	}
+	return 0;
+}
 #endif
-		if (unlikely(curr == (unsigned int)-1)) {
-			DBG(fprintf(stderr, "%s:%d:%s: failed to get temperature from %s.\n", __FILE__, __LINE__, ASSERT_FUNC, c_table_temps[i]));
-			continue;
-		}
-		max = MAX(max, curr);
-		++valid;
-		DBG(fprintf(stderr, "%s:%d:%s: getting temperature: %d from %s.\n", __FILE__, __LINE__, ASSERT_FUNC, curr, c_table_temps[i]));
+
+/* Read all sysfs temperatures into c_temps, and the tachometers
+ * in the same batch. */
+static void
+c_temps_read(void)
+{
+#ifdef USE_IO_URING
+	if (likely(c_uring.fd != -1)) {
+		if (likely(c_temps_uring_read() == 0))
+			goto tachs;
+		DBG(fprintf(stderr, "%s:%d:%s: io_uring read failed, falling back to pread.\n", __FILE__, __LINE__, ASSERT_FUNC));
+		c_uring_exit(&c_uring);
+	}
+#endif
+	for (unsigned int i = 0; i < c_conf.temps_len + c_tachs_len; ++i) {
+		errno = 0;
+		c_temps[i] = c_temp_fd_get(c_temp_fds[i]);
+		if (unlikely(c_temps[i] == C_TEMP_INVALID) && c_dev_gone(errno))
+			c_input_lose(i);
+	}
+	errno = 0;
+#ifdef USE_IO_URING
+tachs:
+#endif
+	for (unsigned int i = 0; i < c_conf.temps_len + c_tachs_len; ++i)
+		if (unlikely(c_temps[i] == C_TEMP_INVALID))
+			++c_metrics.read_errors[i];
+	/* A tachometer that can't be read counts as stopped. */
+	for (unsigned int k = 0; k < c_tachs_len; ++k) {
+		const int rpm = c_temps[c_conf.temps_len + k];
+		c_fan_states[c_tach_fans[k]].tach.rpm = (rpm > 0) ? (unsigned int)rpm : 0;
 	}
-	return (valid == 0) ? (unsigned int)-1 : max;
 }
 
-static ATTR_INLINE unsigned int
-c_temp_max_get(void)
+/* Get the maximum temperature of a zone from c_temps and its
+ * temperature functions. c_temps must have been read already. */
+static int
+c_zone_temp_get(const c_zone_ty *z)
 {
-	unsigned int curr;
-	unsigned int max = 0;
+	int max = INT_MIN;
 	unsigned int valid = 0;
-	for (unsigned int i = 0; i < LEN(c_table_fn_temps); ++i) {
-		curr = c_table_fn_temps[i]();
-		if (unlikely(curr == (unsigned int)-1))
+	int curr;
+	const unsigned int temps_len = C_ZONE_LEN(z->temps_len, c_conf.temps_len);
+	for (unsigned int j = 0, i; j < temps_len; ++j) {
+		i = C_ZONE_AT(z->temps, z->temps_len, j);
+		curr = c_temps[i];
+		if (unlikely(curr == C_TEMP_INVALID)) {
+			DBG(fprintf(stderr, "%s:%d:%s: failed to get temperature from %s.\n", __FILE__, __LINE__, ASSERT_FUNC, c_conf.temps[i]));
 			continue;
-		if (curr > max)
-			max = curr;
+		}
+		max = MAX(max, curr);
+		++valid;
+		DBG(fprintf(stderr, "%s:%d:%s: getting temperature: %d from %s.\n", __FILE__, __LINE__, ASSERT_FUNC, curr, c_conf.temps[i]));
+	}
+	for (unsigned int j = 0; j < z->fn_temps_len; ++j) {
+		curr = z->fn_temps[j]();
+		if (unlikely(curr == C_TEMP_INVALID))
+			continue;
+		max = MAX(max, curr);
 		++valid;
 	}
 	if (unlikely(valid == 0))
-		return (unsigned int)-1;
-	DBG(fprintf(stderr, "%s:%d:%s: getting max temperature: %d.\n", __FILE__, __LINE__, ASSERT_FUNC, max));
+		return C_TEMP_INVALID;
+	DBG(fprintf(stderr, "%s:%d:%s: getting max temperature: %d for zone %s.\n", __FILE__, __LINE__, ASSERT_FUNC, max, z->name));
 	return max;
 }
 
@@ -110,16 +244,37 @@ c_fanspeed_get(const char *filename)
 	return c_atou_le3(fanspeed, (int)fanspeed_len);
 }
 
+/* Return the GPU whose fans fan i is, driven through NVML, or -1 for a
+ * pwm file. */
+static ATTR_INLINE int
+c_fan_gpu(unsigned int i)
+{
+#ifdef USE_CUDA
+	return nv_fan_gpu(c_conf.fans[i]);
+#else
+	(void)i;
+	return -1;
+#endif
+}
+
 static unsigned int
-c_fanspeed_max_get(void)
+c_fanspeed_max_get(const c_zone_ty *z)
 {
 	unsigned int max = 0;
 	unsigned int curr;
-	for (unsigned int i = 0; i < LEN(c_table_fans); ++i) {
-		curr = c_fanspeed_get(c_table_fans[i]);
+	const unsigned int fans_len = C_ZONE_LEN(z->fans_len, c_conf.fans_len);
+	for (unsigned int j = 0, i; j < fans_len; ++j) {
+		i = C_ZONE_AT(z->fans, z->fans_len, j);
+#ifdef USE_CUDA
+		if (c_fan_gpu(i) != -1)
+			curr = nv_fan_get(c_fan_gpu(i));
+		else
+#endif
+			curr = c_fanspeed_get(c_conf.fans[i]);
 		if (unlikely(curr == (unsigned int)-1))
 			DIE_GRACEFUL();
-		DBG(fprintf(stderr, "%s:%d:%s: getting fanspeed %d for fan %s.\n", __FILE__, __LINE__, ASSERT_FUNC, curr, c_table_fans[i]));
+		c_fan_states[i].pwm = curr;
+		DBG(fprintf(stderr, "%s:%d:%s: getting fanspeed %d for fan %s.\n", __FILE__, __LINE__, ASSERT_FUNC, curr, c_conf.fans[i]));
 		if (curr > max)
 			max = curr;
 	}
@@ -154,11 +309,16 @@ enum {
 	PWM_ENABLE_AUTO = '2',
 };
 
+/* Write speed (0-255) to fan i, unless it is already there. */
 static ATTR_INLINE int
-c_speeds_set(unsigned int speed)
+c_fan_write(unsigned int i, unsigned int speed)
 {
-	/* speed: 0-255 */
 	char speeds[4];
+	/* Gone, see c_fan_lose(), or not there yet. */
+	if (unlikely(c_fan_fds[i] == -1 && c_fan_gpu(i) == -1))
+		return 0;
+	if (speed == c_fan_states[i].pwm)
+		return 0;
 	/* Convert speed to a string to pass to sysfs. */
 	unsigned int speeds_len = c_utoa_le3_p(speed, speeds) - speeds;
 	speeds[speeds_len] = '\n';
@@ -167,14 +327,115 @@ c_speeds_set(unsigned int speed)
 	if (unlikely((int)speed != atoi(speeds)))
 		DIE_GRACEFUL(return -1);
 #endif
-	for (unsigned int i = 0; i < LEN(c_table_fans); ++i) {
-		DBG(fprintf(stderr, "%s:%d:%s: setting speed: %s to fan %s.\n", __FILE__, __LINE__, ASSERT_FUNC, speeds, c_table_fans[i]));
-		if (unlikely(pwrite(c_fan_fds[i], speeds, speeds_len, 0) != (ssize_t)speeds_len))
-			DIE_GRACEFUL(return -1);
+	DBG(fprintf(stderr, "%s:%d:%s: setting speed: %u to fan %s.\n", __FILE__, __LINE__, ASSERT_FUNC, speed, c_conf.fans[i]));
+#ifdef USE_CUDA
+	if (c_fan_fds[i] == -1 && c_fan_gpu(i) != -1)
+		nv_fan_set(c_fan_gpu(i), speed);
+	else
+#endif
+#ifdef USE_ACTUATOR
+	/* Counted once made, and failures come back, in c_fans_collect(). */
+	if (c_act_running) {
+		c_act_put(i, c_fan_fds[i], speed);
+		c_fan_states[i].pwm = speed;
+		return 0;
+	}
+#endif
+	if (unlikely(pwrite(c_fan_fds[i], speeds, speeds_len, 0) != (ssize_t)speeds_len)) {
+		if (c_dev_gone(errno)) {
+			c_fan_lose(i);
+			return 0;
+		}
+		DIE_GRACEFUL(return -1);
 	}
+	c_fan_states[i].pwm = speed;
+	++c_writes;
+	++c_metrics.fan_writes[i];
 	return 0;
 }
 
+#ifdef USE_ACTUATOR
+/* Count the writes the actuator thread made. */
+static void
+c_fans_collect_writes(void)
+{
+	for (unsigned int i = 0; i < c_conf.fans_len; ++i) {
+		const unsigned long long n = c_act_writes_take(i);
+		c_writes += n;
+		c_metrics.fan_writes[i] += n;
+	}
+}
+
+/* Count the writes of the actuator thread, and take the fans whose writes
+ * failed as c_fan_write() would have. */
+static void
+c_fans_collect(void)
+{
+	c_fans_collect_writes();
+	for (unsigned int i = 0; i < c_conf.fans_len; ++i) {
+		const int err = c_act_err(i);
+		if (likely(err == 0))
+			continue;
+		if (!c_dev_gone(err)) {
+			errno = err;
+			DIE_GRACEFUL();
+		}
+		/* The thread leaves it alone until forgotten. */
+		c_fan_lose(i);
+		c_act_forget(i);
+	}
+}
+#endif
+
+/* Drive the fans of a zone toward speed: PWM, or RPM in CONTROL_RPM.
+ * Stalled fans are driven at full speed to restart them, and the other
+ * fans of the zone make up for them. changed is whether speed differs
+ * from the last tick, as only then would a fan already there have been
+ * written. */
+static int
+c_zone_fans_set(const c_zone_ty *z, const c_zone_state_ty *st, unsigned int speed, unsigned int elapsed_ms, int changed)
+{
+	const unsigned int fans_len = C_ZONE_LEN(z->fans_len, c_conf.fans_len);
+	unsigned int stalled = 0;
+	for (unsigned int j = 0, i; j < fans_len; ++j) {
+		i = C_ZONE_AT(z->fans, z->fans_len, j);
+		if (c_conf.fans_tach[i] == NULL)
+			continue;
+		c_rpm_ty *tach = &c_fan_states[i].tach;
+		const int stall = c_rpm_stall_update(&c_conf.param, tach, c_fan_states[i].pwm, elapsed_ms);
+		if (unlikely(stall == 1))
+			fprintf(stderr, "cfan: fan %s stalled, %u rpm at speed %u.\n", c_conf.fan_names[i], tach->rpm, c_fan_states[i].pwm);
+		else if (unlikely(stall == -1))
+			fprintf(stderr, "cfan: fan %s is turning again, %u rpm.\n", c_conf.fan_names[i], tach->rpm);
+		stalled += (unsigned int)tach->stalled;
+	}
+	speed = c_rpm_compensate(speed, fans_len, stalled, (st->mode == CONTROL_RPM) ? st->speed_max : 255);
+	for (unsigned int j = 0, i; j < fans_len; ++j) {
+		i = C_ZONE_AT(z->fans, z->fans_len, j);
+		unsigned int pwm = speed;
+		if (unlikely(c_fan_states[i].tach.stalled))
+			pwm = 255;
+		else if (st->mode == CONTROL_RPM)
+			pwm = c_rpm_pwm_get(&c_conf.param, &c_fan_states[i].tach, speed, c_fan_states[i].pwm);
+		if (changed && pwm == c_fan_states[i].pwm)
+			++c_writes_skipped;
+		if (unlikely(c_fan_write(i, pwm) == -1))
+			return -1;
+	}
+	return 0;
+}
+
+/* Write the name of the default curve to CFAN_FILE_CURVE. */
+static int
+c_curve_file_write(int oflag)
+{
+	char curve[NAME_MAX];
+	const int curve_len = snprintf(curve, sizeof(curve), "%s\n", c_conf.curve_names[c_conf.curve_default]);
+	if (unlikely(curve_len < 0 || (size_t)curve_len >= sizeof(curve)))
+		return -1;
+	return c_puts_len(CFAN_PATH "/" CFAN_FILE_CURVE, O_CREAT | oflag, curve, (unsigned int)curve_len, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+}
+
 static void
 c_mode_setup()
 {
@@ -184,21 +445,18 @@ c_mode_setup()
 		fprintf(stderr, "cfan: another instance is already running.\n");
 		exit(EXIT_FAILURE);
 	}
-	if (temptospeed == c_table_temptospeed_med) {
-		if (unlikely(c_puts_len(CFAN_PATH "/" CFAN_FILE_CURVE, O_CREAT | O_EXCL, S_LITERAL("medium\n"), S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == -1)) {
-			fprintf(stderr, "cfan: can't write to %s.\n", CFAN_PATH "/" CFAN_FILE_CURVE);
-			c_exit(EXIT_FAILURE);
-		}
-	} else if (temptospeed == c_table_temptospeed_high) {
-		if (unlikely(c_puts_len(CFAN_PATH "/" CFAN_FILE_CURVE, O_CREAT | O_EXCL, S_LITERAL("high\n"), S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == -1)) {
-			fprintf(stderr, "cfan: can't write to %s.\n", CFAN_PATH "/" CFAN_FILE_CURVE);
-			c_exit(EXIT_FAILURE);
-		}
+	if (unlikely(c_curve_file_write(O_EXCL) == -1)) {
+		fprintf(stderr, "cfan: can't write to %s.\n", CFAN_PATH "/" CFAN_FILE_CURVE);
+		c_exit(EXIT_FAILURE);
 	}
 	if (unlikely(chmod(CFAN_PATH "/" CFAN_FILE_CURVE, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == -1)) {
 		fprintf(stderr, "cfan: can't chmod %s.\n", CFAN_PATH "/" CFAN_FILE_CURVE);
 		c_exit(EXIT_FAILURE);
 	}
+	if (unlikely(c_ctl_init(CFAN_PATH "/" CFAN_FILE_CTL) == -1)) {
+		fprintf(stderr, "cfan: can't create %s.\n", CFAN_PATH "/" CFAN_FILE_CTL);
+		c_exit(EXIT_FAILURE);
+	}
 }
 
 static void
@@ -212,25 +470,48 @@ c_mode_cleanup()
 static void
 c_cleanup(void)
 {
-	/* Set safe speed before restoring auto mode to avoid fan spike. */
-	int fans_ok = 1;
-	for (unsigned int i = 0; i < LEN(c_fan_fds); ++i)
-		if (c_fan_fds[i] == -1) { fans_ok = 0; break; }
-	if (fans_ok)
-		if (unlikely(c_speeds_set(FANSPEED_DEFAULT) == -1))
+#ifdef USE_ACTUATOR
+	/* Speeds still pending are written, and the rest here, in order. */
+	if (c_act_running) {
+		c_act_stop();
+		c_fans_collect_writes();
+	}
+	c_act_cleanup();
+#endif
+	/* Set safe speed before restoring auto mode to avoid fan spike. Only
+	 * the fans taken over, as some may not have appeared yet. */
+	const int fans_ok = (c_fan_fds != NULL && c_fan_states != NULL);
+	for (unsigned int i = 0; fans_ok && i < c_conf.fans_len; ++i)
+		if ((c_fan_fds[i] != -1 || c_fan_gpu(i) != -1) && unlikely(c_fan_write(i, c_conf.param.fanspeed_default) == -1))
 			DIE_GRACEFUL();
-	for (unsigned int i = 0; i < LEN(c_table_fans_enable); ++i) {
+	for (unsigned int i = 0; fans_ok && i < c_conf.fans_len; ++i) {
 		/* Restore mode to auto. */
-		if (unlikely(c_putchar(c_table_fans_enable[i], 0, PWM_ENABLE_AUTO) == -1))
+		if (c_conf.fans_enable[i] && c_fan_fds[i] != -1 && unlikely(c_putchar(c_conf.fans_enable[i], 0, PWM_ENABLE_AUTO) == -1))
 			DIE_GRACEFUL();
 	}
-	for (unsigned int i = 0; i < LEN(c_fan_fds); ++i)
+	for (unsigned int i = 0; c_fan_fds && i < c_conf.fans_len; ++i)
 		if (c_fan_fds[i] != -1)
 			close(c_fan_fds[i]);
-	for (unsigned int i = 0; i < LEN(c_temp_fds); ++i)
+	for (unsigned int i = 0; c_temp_fds && i < c_conf.temps_len + c_tachs_len; ++i)
 		if (c_temp_fds[i] != -1)
 			close(c_temp_fds[i]);
+#ifdef USE_IO_URING
+	if (c_uring.fd != -1)
+		c_uring_exit(&c_uring);
+#endif
+	/* Before the temperatures are closed, to put their limits back. */
+	c_alarm_cleanup();
+	c_psi_cleanup();
+	if (c_uevent_fd != -1)
+		close(c_uevent_fd);
+	c_uevent_fd = -1;
+	c_ev_cleanup();
+	c_ctl_cleanup(CFAN_PATH "/" CFAN_FILE_CTL);
+	c_status_cleanup(CFAN_STATUS_PATH);
 	c_mode_cleanup();
+#ifdef USE_CUDA
+	nv_cleanup();
+#endif
 }
 
 void
@@ -241,109 +522,475 @@ c_exit(int status)
 }
 
 static void
-c_sig_handler(int signum)
+c_sig_setup(void)
 {
-	c_sig_caught = 1;
-	(void)signum;
+	if (unlikely(c_ev_init() == -1))
+		DIE();
 }
 
+/* Sysfs paths resolved during this boot, see path.h. */
+static path_cache_ty c_path_cache;
+
 static void
-c_sig_setup(void)
+c_path_cache_load(void)
 {
-	if (unlikely(signal(SIGTERM, c_sig_handler) == SIG_ERR))
-		DIE();
-	if (unlikely(signal(SIGINT, c_sig_handler) == SIG_ERR))
-		DIE();
-	if (unlikely(signal(SIGHUP, c_sig_handler) == SIG_ERR))
-		DIE();
+	char boot[sizeof(c_path_cache.boot)];
+	/* Without a boot id, a cache could outlive the numbering it holds. */
+	if (path_line_read(PATH_BOOT_ID, boot, sizeof(boot)) == 0)
+		path_cache_load(&c_path_cache, CFAN_PATHS_CACHE, boot);
 }
 
 static void
-c_paths_sysfs_resolve(void)
-{
-	typedef struct {
-		const char **data;
-		const unsigned int len;
-	} strlist_ty;
-	/* Iterate through all the potential sysfs files. */
-	const strlist_ty tables[] = {
-		(strlist_ty) { c_table_fans,        LEN(c_table_fans)        },
-		(strlist_ty) { c_table_fans_enable, LEN(c_table_fans_enable) },
-		(strlist_ty) { c_table_temps,       LEN(c_table_temps)       },
-	};
-	/* Update hwmon/hwmon[0-9]* and thermal/thermal_zone[0-9]* to point to
-	 * the real file, given that the number may change between reboots. */
-	for (unsigned int i = 0; i < LEN(tables); ++i) {
-		for (unsigned int j = 0; j < tables[i].len; ++j) {
-			if (strstr(tables[i].data[j], "/sys/")) {
-				char *p = path_sysfs_resolve(tables[i].data[j]);
-				if (unlikely(p == NULL))
-					DIE();
-				if (p != tables[i].data[j]) {
-					/* Set new path. */
-					tables[i].data[j] = p;
-					DBG(fprintf(stderr, "%s:%d:%s: %s doesn't exist, resolved to %s (which is malloc'd).\n", __FILE__, __LINE__, ASSERT_FUNC, tables[i].data[j], p));
-				} else {
-					DBG(fprintf(stderr, "%s:%d:%s: %s exists.\n", __FILE__, __LINE__, ASSERT_FUNC, p));
-				}
+c_path_cache_save(void)
+{
+	/* Not fatal, the next start scans again. */
+	if (c_path_cache.dirty && c_path_cache.boot[0] && path_cache_save(&c_path_cache, CFAN_PATHS_CACHE) == -1) {
+		DBG(fprintf(stderr, "%s:%d:%s: can't write %s.\n", __FILE__, __LINE__, ASSERT_FUNC, CFAN_PATHS_CACHE));
+	}
+	c_path_cache.dirty = 0;
+	errno = 0;
+}
+
+/* Resolve *path in place if it is a hwmon:, thermal: or /sys path, given
+ * that the numbers of hwmon/hwmon[0-9]* and thermal/thermal_zone[0-9]* may
+ * change between reboots, through the cache if cached. Return 0 if it can
+ * be opened, 1 if its device is not there yet, or -1 if it can't be
+ * resolved. */
+static int
+c_path_resolve(path_scan_ty *scan, const char **path, int cached)
+{
+	const char *spec = *path;
+	if (!path_is_sysfs(spec))
+		return 0;
+	const char *p = cached ? path_cache_get(&c_path_cache, PATH_SYS, spec) : NULL;
+	if (p == NULL) {
+		p = path_sysfs_resolve(scan, spec);
+		if (p == NULL)
+			return (errno == ENOENT) ? 1 : -1;
+		if (p != spec && cached)
+			path_cache_put(&c_path_cache, spec, p);
+	}
+	if (p != spec) {
+		/* Set new path. */
+		*path = p;
+		DBG(fprintf(stderr, "%s:%d:%s: %s resolved to %s.\n", __FILE__, __LINE__, ASSERT_FUNC, spec, p));
+	}
+	return 0;
+}
+
+/* Return 1 if errno says that a device is not there yet. */
+static ATTR_INLINE int
+c_dev_missing(void)
+{
+	return errno == ENOENT || errno == ENODEV || errno == ENXIO;
+}
+
+/* Open input i and return as c_path_resolve(). */
+static int
+c_input_open(path_scan_ty *scan, unsigned int i, int cached)
+{
+	const char **path = c_input_pathp(i);
+	const int ret = c_path_resolve(scan, path, cached);
+	if (ret)
+		return ret;
+	c_temp_fds[i] = open(*path, O_RDONLY | O_CLOEXEC);
+	if (c_temp_fds[i] == -1)
+		return c_dev_missing() ? 1 : -1;
+	return 0;
+}
+
+/* Open fan i and take it over from the driver, holding it where the
+ * driver had it until its zone runs. Return as c_path_resolve(). */
+static int
+c_fan_open(path_scan_ty *scan, unsigned int i, int cached)
+{
+	int ret = c_path_resolve(scan, &c_conf.fans[i], cached);
+	if (ret == 0 && c_conf.fans_enable[i])
+		ret = c_path_resolve(scan, &c_conf.fans_enable[i], cached);
+	if (ret)
+		return ret;
+	c_fan_fds[i] = open(c_conf.fans[i], O_WRONLY | O_CLOEXEC);
+	if (c_fan_fds[i] == -1)
+		return c_dev_missing() ? 1 : -1;
+	unsigned int speed = c_fanspeed_get(c_conf.fans[i]);
+	if (unlikely(speed > 255))
+		speed = c_conf.param.fanspeed_default;
+	if (c_conf.fans_enable[i] && unlikely(c_putchar(c_conf.fans_enable[i], 0, PWM_ENABLE_MANUAL))) {
+		ret = c_dev_missing() ? 1 : -1;
+		close(c_fan_fds[i]);
+		c_fan_fds[i] = -1;
+		return ret;
+	}
+	/* Some drivers load another speed in manual mode. */
+	c_fan_states[i].pwm = UINT_MAX;
+#ifdef USE_ACTUATOR
+	/* It may be on another chip than when the thread started. */
+	if (c_act_running)
+		c_act_rechip(i, c_conf.fans[i]);
+#endif
+	return c_fan_write(i, speed);
+}
+
+/* Stop on a signal while waiting for devices. */
+static void
+c_devices_wait_signal(void)
+{
+	struct signalfd_siginfo si;
+	if (read(c_ev_sigfd, &si, sizeof(si)) != (ssize_t)sizeof(si))
+		return;
+	fprintf(stderr, "cfan: stopped while waiting for devices.\n");
+	c_cleanup();
+	c_metrics_cleanup();
+	exit(EXIT_SUCCESS);
+}
+
+/* Open every fan and input, waiting up to DEVICE_WAIT_MS in all for those
+ * whose drivers are still loading. Fans are taken over as soon as they
+ * appear. Uevents wake the wait, see uevent.h. */
+static void
+c_devices_wait(void)
+{
+	const unsigned int inputs_len = c_conf.temps_len + c_tachs_len;
+	const unsigned long long deadline_ms = c_now_ms() + DEVICE_WAIT_MS;
+	path_scan_ty scan = { PATH_SYS, { NULL }, { 0 }, { 0 } };
+	struct pollfd fds[3];
+	int ufd = -1, ifd = -1;
+	c_path_cache_load();
+	for (unsigned int round = 0;; ++round) {
+		unsigned int missing = 0;
+		const char *failed = NULL;
+		for (unsigned int i = 0; i < c_conf.fans_len && failed == NULL; ++i) {
+			if (c_fan_fds[i] != -1 || c_fan_gpu(i) != -1)
+				continue;
+			const int ret = c_fan_open(&scan, i, 1);
+			if (unlikely(ret == -1))
+				failed = c_conf.fans[i];
+			else if (ret == 1 && ifd != -1)
+				c_uevent_watch(ifd, c_conf.fans[i]);
+			else if (ret == 0 && round)
+				fprintf(stderr, "cfan: fan %s appeared.\n", c_conf.fan_names[i]);
+			missing += (ret == 1);
+		}
+		for (unsigned int i = 0; i < inputs_len && failed == NULL; ++i) {
+			if (c_temp_fds[i] != -1)
+				continue;
+			const int ret = c_input_open(&scan, i, 1);
+			if (unlikely(ret == -1))
+				failed = c_input_path(i);
+			else if (ret == 1 && ifd != -1)
+				c_uevent_watch(ifd, c_input_path(i));
+			missing += (ret == 1);
+		}
+		/* Rescanned each round, for the devices added since. */
+		path_scan_free(&scan);
+		if (unlikely(failed != NULL)) {
+			fprintf(stderr, "cfan: can't open %s.\n", failed);
+			DIE_GRACEFUL();
+		}
+		if (missing == 0)
+			break;
+		const unsigned long long now_ms = c_now_ms();
+		if (unlikely(now_ms >= deadline_ms)) {
+			for (unsigned int i = 0; i < c_conf.fans_len; ++i)
+				if (c_fan_fds[i] == -1 && c_fan_gpu(i) == -1)
+					fprintf(stderr, "cfan: %s did not appear within %u ms.\n", c_conf.fans[i], DEVICE_WAIT_MS);
+			for (unsigned int i = 0; i < inputs_len; ++i)
+				if (c_temp_fds[i] == -1)
+					fprintf(stderr, "cfan: %s did not appear within %u ms.\n", c_input_path(i), DEVICE_WAIT_MS);
+			errno = 0;
+			DIE_GRACEFUL();
+		}
+		if (round == 0) {
+			fprintf(stderr, "cfan: waiting up to %u ms for %u missing devices.\n", DEVICE_WAIT_MS, missing);
+			ufd = c_uevent_open();
+			ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			/* Watched from the next round on. */
+			continue;
+		}
+		fds[0] = (struct pollfd) { c_ev_sigfd, POLLIN, 0 };
+		fds[1] = (struct pollfd) { ufd, POLLIN, 0 };
+		fds[2] = (struct pollfd) { ifd, POLLIN, 0 };
+		if (poll(fds, LEN(fds), (int)MIN(deadline_ms - now_ms, (unsigned long long)C_UEVENT_RECHECK_MS)) > 0) {
+			if (fds[0].revents)
+				c_devices_wait_signal();
+			if (fds[1].revents && c_uevent_read(ufd) > 0) {
+				DBG(fprintf(stderr, "%s:%d:%s: device event.\n", __FILE__, __LINE__, ASSERT_FUNC));
 			}
+			if (fds[2].revents)
+				c_uevent_watch_ack(ifd);
+		}
+	}
+	if (ufd != -1)
+		close(ufd);
+	if (ifd != -1)
+		close(ifd);
+	c_path_cache_save();
+	/* Lost while being opened, and opened since. */
+	memset(c_lost, 0, inputs_len + c_conf.fans_len);
+	c_lost_len = 0;
+}
+
+/* Reopen input, or fan if i >= the number of inputs, i from the path it
+ * was configured as, since its device may be back under another number.
+ * Return as c_path_resolve(). */
+static int
+c_device_reopen(path_scan_ty *scan, unsigned int i)
+{
+	const unsigned int inputs_len = c_conf.temps_len + c_tachs_len;
+	const char **paths[2] = { NULL, NULL };
+	const char *specs[2] = { NULL, NULL };
+	if (i < inputs_len) {
+		paths[0] = c_input_pathp(i);
+		specs[0] = c_specs[i];
+	} else {
+		const unsigned int f = i - inputs_len;
+		paths[0] = &c_conf.fans[f];
+		specs[0] = c_specs[inputs_len + 2 * f];
+		paths[1] = &c_conf.fans_enable[f];
+		specs[1] = c_specs[inputs_len + 2 * f + 1];
+	}
+	/* The paths resolved before may be held by the cache. */
+	for (unsigned int k = 0; k < LEN(paths); ++k)
+		if (paths[k])
+			*paths[k] = specs[k];
+	int ret = (i < inputs_len) ? c_input_open(scan, i, 0) : c_fan_open(scan, i - inputs_len, 0);
+	if (ret == 0 && i >= inputs_len && c_fan_fds[i - inputs_len] == -1)
+		ret = 1;
+	/* A file that opens may still fail every read, until the driver is
+	 * bound again. */
+	if (ret == 0 && i < inputs_len) {
+		errno = 0;
+		if (c_temp_fd_get(c_temp_fds[i]) == C_TEMP_INVALID && c_dev_gone(errno)) {
+			close(c_temp_fds[i]);
+			c_temp_fds[i] = -1;
+			ret = 1;
+		}
+	}
+	for (unsigned int k = 0; k < LEN(paths); ++k) {
+		if (paths[k] == NULL || *paths[k] == specs[k])
+			continue;
+		if (ret == 0) {
+			path_cache_put(&c_path_cache, specs[k], *paths[k]);
+		} else {
+			free((char *)*paths[k]);
+			*paths[k] = specs[k];
 		}
 	}
+	return ret;
 }
 
+/* Reopen the inputs and fans whose devices are back. Their zones are held
+ * at full speed until then, see c_zone_lost(). */
 static void
-c_fans_enable(void)
+c_devices_recover(void)
 {
-	for (unsigned int i = 0; i < LEN(c_table_fans_enable); ++i)
-		if (unlikely(c_putchar(c_table_fans_enable[i], 0, PWM_ENABLE_MANUAL)))
-			DIE_GRACEFUL();
+	const unsigned int inputs_len = c_conf.temps_len + c_tachs_len;
+	path_scan_ty scan = { PATH_SYS, { NULL }, { 0 }, { 0 } };
+	for (unsigned int i = 0; i < inputs_len + c_conf.fans_len; ++i) {
+		if (!c_lost[i] || c_device_reopen(&scan, i) != 0)
+			continue;
+		c_lost[i] = 0;
+		--c_lost_len;
+		if (i < inputs_len)
+			fprintf(stderr, "cfan: %s is back.\n", c_input_path(i));
+		else
+			fprintf(stderr, "cfan: fan %s is back, at %s.\n", c_conf.fan_names[i - inputs_len], c_conf.fans[i - inputs_len]);
+	}
+	path_scan_free(&scan);
+	c_path_cache_save();
+	errno = 0;
+}
+
+/* Write the configuration of the sensors and fans found to text. */
+static void
+c_discover_text(c_conf_buf_ty *text)
+{
+	const int fans = c_discover(PATH_SYS, text);
+	if (unlikely(fans == -1))
+		DIE();
+	if (fans == 0) {
+		fprintf(stderr, "cfan: found no fans with a pwmN_enable in " PATH_SYS "/%s, write %s.\n", path_classes[PATH_HWMON].dir, c_conf_path);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Configuration of the sensors and fans found, for when there is no
+ * configuration file. */
+static void
+c_conf_builtin(c_conf_ty *conf)
+{
+	char err[C_CONF_ERR_LEN];
+	c_conf_buf_ty text = { NULL, 0, 0 };
+	void *img;
+	size_t img_sz;
+	c_discover_text(&text);
+	printf("cfan: no %s, using what was found:\n%.*s", c_conf_path, (int)text.len, text.p);
+	if (c_conf_compile("cfan --discover", text.p, text.len, NULL, c_table_fn_names, &img, &img_sz, err, sizeof(err)) == -1
+	    || c_conf_from_img(conf, img, img_sz, c_table_fn_names, err, sizeof(err)) == -1) {
+		fprintf(stderr, "cfan: %s\n", err);
+		exit(EXIT_FAILURE);
+	}
+	free(text.p);
+}
+
+/* Load c_conf_path, falling back to the sensors and fans found
+ * if it is the default path and does not exist. */
+static void
+c_conf_setup(int explicit)
+{
+	char err[C_CONF_ERR_LEN];
+	if (c_conf_load(&c_conf, c_conf_path, c_table_fn_names, err, sizeof(err)) == -1) {
+		if (explicit || errno != ENOENT) {
+			fprintf(stderr, "cfan: %s\n", err);
+			exit(EXIT_FAILURE);
+		}
+		DBG(fprintf(stderr, "%s:%d:%s: %s, discovering the sensors and fans.\n", __FILE__, __LINE__, ASSERT_FUNC, err));
+		c_conf_builtin(&c_conf);
+		errno = 0;
+	}
+	if (c_curve_name) {
+		unsigned int i = 0;
+		while (i < c_conf.curves_len && strcmp(c_conf.curve_names[i], c_curve_name))
+			++i;
+		if (unlikely(i == c_conf.curves_len)) {
+			fprintf(stderr, "cfan: no curve named %s.\n", c_curve_name);
+			exit(EXIT_FAILURE);
+		}
+		c_conf.curve_default = i;
+	}
+	if (c_control_mode != -1)
+		c_conf.param.mode = (unsigned int)c_control_mode;
+}
+
+static void
+c_zones_init(void)
+{
+	unsigned char *owners = (unsigned char *)calloc(c_conf.fans_len, 1);
+	if (unlikely(owners == NULL))
+		DIE();
+	for (unsigned int i = 0; i < c_conf.zones_len; ++i) {
+		const c_zone_ty *z = c_conf.zones + i;
+		const unsigned int temps_len = C_ZONE_LEN(z->temps_len, c_conf.temps_len);
+		const unsigned int fans_len = C_ZONE_LEN(z->fans_len, c_conf.fans_len);
+		for (unsigned int j = 0; j < temps_len; ++j) {
+			if (unlikely(C_ZONE_AT(z->temps, z->temps_len, j) >= c_conf.temps_len)) {
+				fprintf(stderr, "cfan: zone %s: temperature index %u is out of range.\n", z->name, C_ZONE_AT(z->temps, z->temps_len, j));
+				c_exit(EXIT_FAILURE);
+			}
+		}
+		for (unsigned int j = 0; j < fans_len; ++j) {
+			if (unlikely(C_ZONE_AT(z->fans, z->fans_len, j) >= c_conf.fans_len)) {
+				fprintf(stderr, "cfan: zone %s: fan index %u is out of range.\n", z->name, C_ZONE_AT(z->fans, z->fans_len, j));
+				c_exit(EXIT_FAILURE);
+			}
+			++owners[C_ZONE_AT(z->fans, z->fans_len, j)];
+		}
+		if (unlikely(temps_len + z->fn_temps_len == 0)) {
+			fprintf(stderr, "cfan: zone %s has no temperatures.\n", z->name);
+			c_exit(EXIT_FAILURE);
+		}
+		c_zone_state_ty *st = c_zone_states + i;
+		st->curve = (z->curve != NULL) ? z->curve : c_conf.curves + c_conf.curve_default;
+		if (unlikely(c_curve_check(st->curve) == -1)) {
+			fprintf(stderr, "cfan: zone %s: curve temperatures must be strictly increasing.\n", z->name);
+			c_exit(EXIT_FAILURE);
+		}
+		st->speed_min = c_curve_min(st->curve);
+		st->speed_max = c_curve_max(st->curve);
+		st->mode = (int)c_conf.param.mode;
+		if (unlikely((st->mode == CONTROL_RPM) != (st->speed_max > 255))) {
+			fprintf(stderr, "cfan: zone %s: mode rpm needs a curve in RPM, and the other modes one in 0-255.\n", z->name);
+			c_exit(EXIT_FAILURE);
+		}
+		for (unsigned int j = 0; st->mode == CONTROL_RPM && j < fans_len; ++j) {
+			if (unlikely(c_conf.fans_tach[C_ZONE_AT(z->fans, z->fans_len, j)] == NULL)) {
+				fprintf(stderr, "cfan: zone %s: fan %s has no tachometer, needed in mode rpm.\n", z->name, c_conf.fan_names[C_ZONE_AT(z->fans, z->fans_len, j)]);
+				c_exit(EXIT_FAILURE);
+			}
+		}
+	}
+	/* A fan in no zone would be left in manual mode without control. */
+	for (unsigned int i = 0; i < c_conf.fans_len; ++i) {
+		if (unlikely(owners[i] != 1)) {
+			fprintf(stderr, "cfan: %s must belong to exactly one zone.\n", c_conf.fans[i]);
+			free(owners);
+			c_exit(EXIT_FAILURE);
+		}
+	}
+	free(owners);
 }
 
 void
 c_init(void)
 {
-	c_paths_sysfs_resolve();
-	memset(c_temp_fds, -1, LEN(c_temp_fds));
-	memset(c_fan_fds, -1, LEN(c_fan_fds));
-	for (unsigned int i = 0; i < LEN(c_table_temps); ++i) {
-		unsigned int retry = 10;
-		for (;;) {
-			if (likely((c_temp_fds[i] = open(c_table_temps[i], O_RDONLY)) != -1))
-				break;
-			if (--retry == 0)
-				DIE_GRACEFUL();
-			nanosleep(&c_sleeptime, NULL);
+	c_tach_fans = (unsigned int *)malloc(c_conf.fans_len * sizeof(unsigned int));
+	if (unlikely(c_tach_fans == NULL))
+		DIE();
+	for (unsigned int i = 0; i < c_conf.fans_len; ++i)
+		if (c_conf.fans_tach[i] != NULL)
+			c_tach_fans[c_tachs_len++] = i;
+	const unsigned int inputs_len = c_conf.temps_len + c_tachs_len;
+	c_temp_fds = (int *)malloc(inputs_len * sizeof(int));
+	c_temps = (int *)malloc(inputs_len * sizeof(int));
+	c_fan_fds = (int *)malloc(c_conf.fans_len * sizeof(int));
+	c_fan_states = (c_fan_state_ty *)calloc(c_conf.fans_len, sizeof(c_fan_state_ty));
+	c_zone_states = (c_zone_state_ty *)calloc(c_conf.zones_len, sizeof(c_zone_state_ty));
+#ifdef USE_IO_URING
+	c_temp_bufs = (char (*)[C_TEMP_BUF_LEN])malloc(inputs_len * C_TEMP_BUF_LEN);
+	c_temp_res = (int *)malloc(inputs_len * sizeof(int));
+	if (unlikely((inputs_len && (c_temp_bufs == NULL || c_temp_res == NULL))))
+		DIE();
+#endif
+	if (unlikely((inputs_len && (c_temp_fds == NULL || c_temps == NULL)) || c_fan_fds == NULL || c_fan_states == NULL || c_zone_states == NULL))
+		DIE();
+	if (unlikely(c_metrics_init(&c_conf, inputs_len) == -1))
+		DIE();
+	c_specs = (const char **)malloc((inputs_len + 2 * (size_t)c_conf.fans_len) * sizeof(const char *));
+	c_lost = (unsigned char *)calloc(inputs_len + c_conf.fans_len, 1);
+	if (unlikely(c_specs == NULL || c_lost == NULL))
+		DIE();
+	for (unsigned int i = 0; i < inputs_len; ++i)
+		c_specs[i] = c_input_path(i);
+	for (unsigned int i = 0; i < c_conf.fans_len; ++i) {
+		c_specs[inputs_len + 2 * i] = c_conf.fans[i];
+		c_specs[inputs_len + 2 * i + 1] = c_conf.fans_enable[i];
+	}
+	memset(c_temp_fds, -1, inputs_len * sizeof(int));
+	memset(c_fan_fds, -1, c_conf.fans_len * sizeof(int));
+	c_zones_init();
+#ifdef USE_CUDA
+	for (unsigned int i = 0; i < c_conf.fans_len; ++i) {
+		if (c_fan_gpu(i) != -1) {
+			nv_init();
+			if (unlikely(!nv_fan_ok(c_fan_gpu(i))))
+				fprintf(stderr, "cfan: fan %s: GPU%d has no fans NVML can set, they are left to the driver.\n", c_conf.fan_names[i], c_fan_gpu(i));
 		}
 	}
-	for (unsigned int i = 0; i < LEN(c_table_fans); ++i) {
-		c_fan_fds[i] = open(c_table_fans[i], O_WRONLY);
-		if (unlikely(c_fan_fds[i] == -1))
-			DIE_GRACEFUL();
+#endif
+	c_devices_wait();
+#ifdef USE_IO_URING
+	if (inputs_len == 0 || c_uring_init(&c_uring, inputs_len) == -1) {
+		DBG(fprintf(stderr, "%s:%d:%s: io_uring not available, using pread.\n", __FILE__, __LINE__, ASSERT_FUNC));
+		errno = 0;
 	}
-	c_fans_enable();
+#endif
 }
 
 static ATTR_INLINE unsigned int
-c_speed_get(unsigned int temp)
+c_speed_get(const c_curve_ty *curve, int temp)
 {
-	const unsigned int next_speed = temptospeed[temp];
+	const unsigned int next_speed = c_curve_get(curve, temp);
 	DBG(fprintf(stderr, "%s:%d:%s: geting curr_speed: %d.\n", __FILE__, __LINE__, ASSERT_FUNC, next_speed));
 	/* Avoid updating if curr_speed has not changed. */
 	return next_speed;
 }
 
 static int
-c_temp_write(int fd, unsigned int temp, unsigned int *old_temp_len)
+c_temp_write(int fd, int temp, unsigned int *old_temp_len)
 {
-	char buf[8];
-	unsigned int size = c_utoa_le3_p(temp, buf) - buf;
+	char buf[C_TEMP_BUF_LEN];
 	/* Print milidegrees, like sysfs. */
-	buf[size] = '0';
-	++size;
-	buf[size] = '0';
-	++size;
-	buf[size] = '0';
-	++size;
+	unsigned int size = c_itoa_p(temp, buf) - buf;
 	buf[size] = '\n';
 	++size;
 	if (unlikely(size != *old_temp_len)) {
@@ -375,46 +1022,611 @@ c_temp_cpu_init(void)
 	return fd;
 }
 
+typedef struct {
+	int last_max_cpu;
+	unsigned int interval_ms;
+	/* Waiting for kernel events, see alarm.h. */
+	int sleeping;
+	unsigned long long last_ms;
+} c_loop_ty;
+
+/* Set if every zone can be woken by kernel events. */
+static int c_events;
+
+/* Return 1 if a temperature, fan or tachometer of zone z is gone. */
+static int
+c_zone_lost(const c_zone_ty *z)
+{
+	if (likely(c_lost_len == 0))
+		return 0;
+	const unsigned int inputs_len = c_conf.temps_len + c_tachs_len;
+	for (unsigned int j = 0; j < C_ZONE_LEN(z->temps_len, c_conf.temps_len); ++j)
+		if (c_lost[C_ZONE_AT(z->temps, z->temps_len, j)])
+			return 1;
+	for (unsigned int j = 0; j < C_ZONE_LEN(z->fans_len, c_conf.fans_len); ++j) {
+		const unsigned int i = C_ZONE_AT(z->fans, z->fans_len, j);
+		if (c_lost[inputs_len + i])
+			return 1;
+		for (unsigned int k = 0; k < c_tachs_len; ++k)
+			if (c_tach_fans[k] == i && c_lost[c_conf.temps_len + k])
+				return 1;
+	}
+	return 0;
+}
+
+/* Run the remaining fans of a zone that lost a device at the top of its
+ * curve, and start it over once the device is back. */
+static unsigned int
+c_zone_hold(const c_zone_ty *z, c_zone_state_ty *st, unsigned int interval_ms, unsigned int elapsed_ms, int last_reason)
+{
+	/* What is left of it, for the status. */
+	const int temp = c_zone_temp_get(z);
+	if (temp != C_TEMP_INVALID)
+		st->last_temp = temp;
+	st->target = st->speed_max;
+	st->reason = CFAN_REC_LOST;
+	c_metrics_zone((unsigned int)(st - c_zone_states), st, elapsed_ms, last_reason);
+	const int changed = (st->last_speed != st->speed_max);
+	st->last_speed = st->speed_max;
+	if (unlikely(c_zone_fans_set(z, st, st->speed_max, elapsed_ms, changed) == -1))
+		DIE_GRACEFUL();
+	return MIN(interval_ms, c_conf.param.interval_ms);
+}
+
+/* Update the fans of a zone and return the interval it asks for. */
+static unsigned int
+c_zone_tick(const c_zone_ty *z, c_zone_state_ty *st, unsigned int interval_ms, unsigned int elapsed_ms, unsigned long long now_ms)
+{
+	unsigned int curr_speed;
+	const int last_reason = st->reason;
+	if (unlikely(c_zone_lost(z)))
+		return c_zone_hold(z, st, interval_ms, elapsed_ms, last_reason);
+	if (unlikely(last_reason == CFAN_REC_LOST)) {
+		/* Back, so ramp down from the top as on the first update. */
+		st->last_temp = C_TEMP_INVALID;
+		st->hyst_temp = INT_MIN;
+		st->pid.inited = 0;
+		c_predict_reset(&st->predict);
+	}
+	const int temp = c_zone_temp_get(z);
+	if (unlikely(temp == C_TEMP_INVALID))
+		DIE_GRACEFUL();
+	/* First update. */
+	if (unlikely(st->last_temp == C_TEMP_INVALID)) {
+		st->last_temp = temp;
+		/* Ramp from where the fans are. */
+		if (st->mode == CONTROL_RPM) {
+			st->last_speed = 0;
+			for (unsigned int j = 0; j < C_ZONE_LEN(z->fans_len, c_conf.fans_len); ++j)
+				st->last_speed = MAX(st->last_speed, c_fan_states[C_ZONE_AT(z->fans, z->fans_len, j)].tach.rpm);
+		}
+	}
+	int at_floor;
+	if (st->forced_until_ms && now_ms >= st->forced_until_ms) {
+		/* Hand back to the controller without a jump. */
+		st->forced_until_ms = 0;
+		st->switching = 1;
+		st->pid.inited = 0;
+		/* The trend was not followed while forced. */
+		c_predict_reset(&st->predict);
+	}
+	if (st->forced_until_ms) {
+		curr_speed = st->forced_speed;
+		/* Never hold the fans below the curve once it is too hot. */
+		if (temp >= c_conf.param.spike_temp_max)
+			curr_speed = MAX(curr_speed, c_speed_get(st->curve, temp));
+		at_floor = 0;
+		st->target = curr_speed;
+		st->reason = CFAN_REC_FORCED;
+	} else {
+		const unsigned int raw_last = st->raw_speed;
+		st->bias = c_psi_bias(now_ms, c_conf.param.psi_bias);
+		curr_speed = c_zone_speed_get(&c_conf.param, st, temp, elapsed_ms, &at_floor);
+		/* A write saved each time the curve moves but the speed is held,
+		 * rather than each tick it stays held. */
+		if (st->reason == CFAN_REC_HELD && st->raw_speed != raw_last)
+			c_writes_held += C_ZONE_LEN(z->fans_len, c_conf.fans_len);
+	}
+	c_metrics_zone((unsigned int)(st - c_zone_states), st, elapsed_ms, last_reason);
+	const int changed = (curr_speed != st->last_speed);
+	st->last_speed = curr_speed;
+	/* Every tick, for the tachometers. Only changes are written. */
+	if (unlikely(c_zone_fans_set(z, st, curr_speed, elapsed_ms, changed) == -1))
+		DIE_GRACEFUL();
+	/* Wake up more often while the temperature is moving. */
+	interval_ms = c_interval_get(&c_conf.param, interval_ms, temp, st->last_temp, elapsed_ms, at_floor && st->last_speed == st->speed_min);
+	st->last_temp = temp;
+	return interval_ms;
+}
+
+static const char *
+c_curve_name_get(const c_curve_ty *curve)
+{
+	for (unsigned int i = 0; i < c_conf.curves_len; ++i)
+		if (c_conf.curves[i].points == curve->points)
+			return c_conf.curve_names[i];
+	return "custom";
+}
+
+/* Publish this tick to the status segment. */
 static void
-c_mainloop(void)
+c_status_publish(const c_loop_ty *l, unsigned long long now_ms)
 {
+	struct timespec ts;
+	if (c_status == NULL)
+		return;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	c_status_begin(c_status);
+	++c_status->tick;
+	c_status->mono_ms = now_ms;
+	c_status->real_ms = (unsigned long long)ts.tv_sec * 1000 + (unsigned long long)ts.tv_nsec / 1000000;
+	c_status->interval_ms = l->interval_ms;
+	c_status->writes = c_writes;
+	c_status->writes_skipped = c_writes_skipped;
+	c_status->writes_held = c_writes_held;
+	c_status_name_set(c_status->curve, c_conf.curve_names[c_conf.curve_default]);
+	for (unsigned int i = 0; i < c_conf.temps_len; ++i)
+		c_status_temps()[i].temp = (c_temps[i] != C_TEMP_INVALID) ? c_temps[i] : INT32_MIN;
+	for (unsigned int i = 0; i < c_conf.zones_len; ++i) {
+		const c_zone_state_ty *st = c_zone_states + i;
+		cfan_status_zone_ty *sz = c_status_zones() + i;
+		c_status_name_set(sz->curve, c_curve_name_get(st->curve));
+		sz->temp = st->last_temp;
+		sz->speed = st->last_speed;
+		sz->mode = (unsigned int)st->mode;
+		sz->flags = (st->switching ? CFAN_STATUS_SWITCHING : 0) | (st->forced_until_ms ? CFAN_STATUS_FORCED : 0) | ((st->reason == CFAN_REC_LOST) ? CFAN_STATUS_LOST : 0);
+	}
+	for (unsigned int i = 0; i < c_conf.fans_len; ++i) {
+		cfan_status_fan_ty *sf = c_status_fans() + i;
+		sf->speed = c_fan_states[i].pwm;
+		sf->rpm = c_fan_states[i].tach.rpm;
+		sf->flags = (c_conf.fans_tach[i] ? CFAN_STATUS_TACH : 0) | (c_fan_states[i].tach.stalled ? CFAN_STATUS_STALLED : 0) | (c_lost[c_conf.temps_len + c_tachs_len + i] ? CFAN_STATUS_GONE : 0);
+	}
+	c_status_end(c_status);
+}
+
+/* Return 1 if every zone follows its curve and rests at its bottom, so
+ * that only a rise of temperature can change a fan. */
+static int
+c_zones_idle(void)
+{
+	for (unsigned int i = 0; i < c_conf.zones_len; ++i) {
+		const c_zone_state_ty *st = c_zone_states + i;
+		if (st->mode != CONTROL_CURVE || st->forced_until_ms || st->switching || st->last_speed != st->speed_min)
+			return 0;
+	}
+	return 1;
+}
+
+static void
+c_tick(c_loop_ty *l)
+{
+	const unsigned long long start_ns = c_now_ns();
+	const unsigned long long now = start_ns / 1000000;
+	const unsigned int elapsed_ms = (unsigned int)(now - l->last_ms);
+	l->last_ms = now;
+	/* Uevents are missed in some containers. */
+	if (unlikely(c_lost_len) && now >= c_recover_ms) {
+		c_recover_ms = now + C_UEVENT_RECHECK_MS;
+		c_devices_recover();
+	}
+#ifdef USE_ACTUATOR
+	if (c_act_running)
+		c_fans_collect();
+#endif
+	c_temps_read();
 #if CFAN_PRINT_TEMP_CPU
-	global_fd_temp_cpu = c_temp_cpu_init();
+	const int max_cpu = (c_conf.temp_cpu != C_CONF_NONE) ? c_temps[c_conf.temp_cpu] : C_TEMP_INVALID;
+	/* Write to tmpfs, if temp has changed */
+	if (max_cpu != l->last_max_cpu && likely(max_cpu != C_TEMP_INVALID)) {
+		c_temp_write(global_fd_temp_cpu, max_cpu, &global_temp_cpu_old_sz);
+		l->last_max_cpu = max_cpu;
+	}
 #endif
-	/* Avoid underflow. */
-	if (unlikely(STEPDOWN_MAX > temptospeed[0])) {
-		fprintf(stderr, "%s:%d:%s: STEPDOWN_MAX (%d) must not be greater than the minimum fan curr_speed (%d).\n", __FILE__, __LINE__, ASSERT_FUNC, STEPDOWN_MAX, temptospeed[0]);
+	/* The zone that needs the shortest interval sets the pace. */
+	unsigned int interval_ms = c_conf.param.interval_max_ms;
+	for (unsigned int i = 0; i < c_conf.zones_len; ++i) {
+		/* Not inside MIN(), which would tick the zone twice. */
+		const unsigned int zone_ms = c_zone_tick(c_conf.zones + i, c_zone_states + i, l->interval_ms, elapsed_ms, now);
+		interval_ms = MIN(interval_ms, zone_ms);
+	}
+	/* Nothing is moving, so sleep until the kernel reports a rise. */
+	const int sleeping = c_events && interval_ms == c_conf.param.interval_max_ms && c_zones_idle() && c_alarm_arm_all(c_temps, c_conf.param.event_band) == 0;
+	if (!sleeping && l->sleeping)
+		c_alarm_disarm_all();
+	if (interval_ms != l->interval_ms || sleeping != l->sleeping) {
+		DBG(fprintf(stderr, "%s:%d:%s: changing interval: %u ms%s.\n", __FILE__, __LINE__, ASSERT_FUNC, interval_ms, sleeping ? ", sleeping" : ""));
+		l->interval_ms = interval_ms;
+		l->sleeping = sleeping;
+		if (unlikely(c_ev_timer_set(sleeping ? MAX(c_conf.param.event_poll_ms, interval_ms) : interval_ms) == -1))
+			DIE_GRACEFUL();
+	}
+	c_rec_tick(now, l->interval_ms, c_temps, c_zone_states);
+	c_status_publish(l, now);
+	c_metrics_tick(c_now_ns() - start_ns);
+}
+
+static c_loop_ty c_loop;
+/* Set by a command that should take effect before the next tick. */
+static int c_ctl_dirty;
+
+static const char *
+c_mode_name(int mode)
+{
+	return (mode == CONTROL_PID) ? "pid" : (mode == CONTROL_RPM) ? "rpm" : "curve";
+}
+
+/* Select the zone named name, or all zones if name is NULL. */
+static int
+c_ctl_zones(const char *name, unsigned int *first, unsigned int *last)
+{
+	*first = 0;
+	*last = c_conf.zones_len;
+	if (name == NULL)
+		return 0;
+	for (unsigned int i = 0; i < c_conf.zones_len; ++i) {
+		if (!strcmp(c_conf.zones[i].name, name)) {
+			*first = i;
+			*last = i + 1;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Append to a reply, truncating it if it does not fit. */
+static void
+c_ctl_printf(char *reply, unsigned int reply_sz, unsigned int *len, const char *fmt, ...)
+{
+	va_list ap;
+	if (*len >= reply_sz)
+		return;
+	va_start(ap, fmt);
+	const int n = vsnprintf(reply + *len, reply_sz - *len, fmt, ap);
+	va_end(ap);
+	if (n > 0)
+		*len = MIN(*len + (unsigned int)n, reply_sz - 1);
+}
+
+static unsigned int
+c_ctl_dump(char *reply, unsigned int reply_sz)
+{
+	unsigned int len = 0;
+	const unsigned long long now = c_now_ms();
+	c_ctl_printf(reply, reply_sz, &len, "interval %u %u%s\n", c_conf.param.interval_ms, c_loop.interval_ms, c_loop.sleeping ? " sleeping" : "");
+	c_ctl_printf(reply, reply_sz, &len, "writes %llu skipped %llu held %llu\n", c_writes, c_writes_skipped, c_writes_held);
+	for (unsigned int i = 0; i < c_conf.temps_len; ++i)
+		c_ctl_printf(reply, reply_sz, &len, "temp %s %d\n", c_conf.temp_names[i], c_temps[i]);
+	for (unsigned int i = 0; i < c_conf.zones_len; ++i) {
+		const c_zone_state_ty *st = c_zone_states + i;
+		c_ctl_printf(reply, reply_sz, &len, "zone %s curve %s mode %s temp %d speed %u target %u reason %s", c_conf.zones[i].name, c_curve_name_get(st->curve), c_mode_name(st->mode), st->last_temp, st->last_speed, st->target, cfan_rec_reason_name((unsigned int)st->reason));
+		if (st->switching)
+			c_ctl_printf(reply, reply_sz, &len, " switching");
+		if (st->forced_until_ms)
+			c_ctl_printf(reply, reply_sz, &len, " forced %u %llu", st->forced_speed, (st->forced_until_ms > now) ? st->forced_until_ms - now : 0);
+		c_ctl_printf(reply, reply_sz, &len, "\n");
+		const c_zone_ty *z = c_conf.zones + i;
+		for (unsigned int j = 0, f; j < C_ZONE_LEN(z->fans_len, c_conf.fans_len); ++j) {
+			f = C_ZONE_AT(z->fans, z->fans_len, j);
+			c_ctl_printf(reply, reply_sz, &len, "fan %s zone %s speed %u", c_conf.fan_names[f], z->name, c_fan_states[f].pwm);
+			if (c_conf.fans_tach[f])
+				c_ctl_printf(reply, reply_sz, &len, " rpm %u%s", c_fan_states[f].tach.rpm, c_fan_states[f].tach.stalled ? " stalled" : "");
+			c_ctl_printf(reply, reply_sz, &len, "\n");
+		}
+	}
+	return len;
+}
+
+/* Commands:
+ *   curve NAME [ZONE]         ramp to another curve
+ *   speed SPEED SECS [ZONE]   hold a speed (0-255, RPM in mode rpm) for SECS
+ *   speed auto [ZONE]         stop holding it
+ *   interval MS               set the base update interval
+ *   dump                      print the state
+ *   record [PATH]             write the flight recorder to PATH,
+ *                             or CFAN_REC_PATH
+ * Without ZONE, curve applies to the zones following the default curve,
+ * and speed to all zones. */
+static unsigned int
+c_ctl_cmd(char *line, char *reply, unsigned int reply_sz)
+{
+	char *save;
+	char *argv[5];
+	unsigned int argc = 0;
+	for (char *tok = strtok_r(line, " \t\r", &save); tok && argc < LEN(argv); tok = strtok_r(NULL, " \t\r", &save))
+		argv[argc++] = tok;
+	unsigned int len = 0;
+	unsigned int first, last;
+	unsigned long n, secs;
+	char *end;
+	if (argc == 0) {
+		c_ctl_printf(reply, reply_sz, &len, "error: empty command\n");
+	} else if (!strcmp(argv[0], "dump") && argc == 1) {
+		len = c_ctl_dump(reply, reply_sz);
+	} else if (!strcmp(argv[0], "curve") && (argc == 2 || argc == 3)) {
+		unsigned int c = 0;
+		while (c < c_conf.curves_len && strcmp(c_conf.curve_names[c], argv[1]))
+			++c;
+		if (c == c_conf.curves_len) {
+			c_ctl_printf(reply, reply_sz, &len, "error: no curve named %s\n", argv[1]);
+		} else if (c_ctl_zones((argc == 3) ? argv[2] : NULL, &first, &last) == -1) {
+			c_ctl_printf(reply, reply_sz, &len, "error: no zone named %s\n", argv[2]);
+		} else {
+			const c_curve_ty *curve = c_conf.curves + c;
+			/* Curves in RPM and in PWM don't mix, as in c_conf_finish(). */
+			if ((c_conf.param.mode == CONTROL_RPM) != (c_curve_max(curve) > 255)) {
+				c_ctl_printf(reply, reply_sz, &len, "error: %s is %sin RPM\n", argv[1], (c_conf.param.mode == CONTROL_RPM) ? "not " : "");
+				return len;
+			}
+			for (unsigned int i = first; i < last; ++i) {
+				/* Same limit as at startup, see c_mainloop(). */
+				if (c_zone_states[i].mode == CONTROL_CURVE && (argc == 3 || c_conf.zones[i].curve == NULL) && c_conf.param.stepdown_max > c_curve_min(curve)) {
+					c_ctl_printf(reply, reply_sz, &len, "error: stepdown_max is greater than the minimum speed of %s\n", argv[1]);
+					return len;
+				}
+			}
+			for (unsigned int i = first; i < last; ++i) {
+				c_zone_state_ty *st = c_zone_states + i;
+				if (argc == 2 && c_conf.zones[i].curve != NULL)
+					continue;
+				st->curve = curve;
+				st->speed_min = c_curve_min(curve);
+				st->speed_max = c_curve_max(curve);
+				st->switching = 1;
+			}
+			if (argc == 2) {
+				c_conf.curve_default = c;
+				if (unlikely(c_curve_file_write(O_TRUNC) == -1)) {
+					DBG(fprintf(stderr, "%s:%d:%s: can't write %s.\n", __FILE__, __LINE__, ASSERT_FUNC, CFAN_PATH "/" CFAN_FILE_CURVE));
+				}
+			}
+			c_ctl_dirty = 1;
+			c_ctl_printf(reply, reply_sz, &len, "ok\n");
+		}
+	} else if (!strcmp(argv[0], "speed") && argc >= 2 && !strcmp(argv[1], "auto") && argc <= 3) {
+		if (c_ctl_zones((argc == 3) ? argv[2] : NULL, &first, &last) == -1) {
+			c_ctl_printf(reply, reply_sz, &len, "error: no zone named %s\n", argv[2]);
+		} else {
+			for (unsigned int i = first; i < last; ++i) {
+				if (c_zone_states[i].forced_until_ms) {
+					c_zone_states[i].forced_until_ms = 0;
+					c_zone_states[i].switching = 1;
+					c_zone_states[i].pid.inited = 0;
+				}
+			}
+			c_ctl_dirty = 1;
+			c_ctl_printf(reply, reply_sz, &len, "ok\n");
+		}
+	} else if (!strcmp(argv[0], "speed") && (argc == 3 || argc == 4)) {
+		char *secs_end;
+		n = strtoul(argv[1], &end, 10);
+		secs = strtoul(argv[2], &secs_end, 10);
+		const unsigned long speed_max = (c_conf.param.mode == CONTROL_RPM) ? C_CONF_RPM_MAX : 255;
+		if (*end || end == argv[1] || n > speed_max) {
+			c_ctl_printf(reply, reply_sz, &len, "error: speed must be between 0 and %lu\n", speed_max);
+		} else if (*secs_end || secs_end == argv[2] || secs == 0 || secs > 86400) {
+			c_ctl_printf(reply, reply_sz, &len, "error: seconds must be between 1 and 86400\n");
+		} else if (c_ctl_zones((argc == 4) ? argv[3] : NULL, &first, &last) == -1) {
+			c_ctl_printf(reply, reply_sz, &len, "error: no zone named %s\n", argv[3]);
+		} else {
+			for (unsigned int i = first; i < last; ++i) {
+				c_zone_states[i].forced_speed = (unsigned int)n;
+				c_zone_states[i].forced_until_ms = c_now_ms() + secs * 1000;
+			}
+			c_ctl_dirty = 1;
+			c_ctl_printf(reply, reply_sz, &len, "ok\n");
+		}
+	} else if (!strcmp(argv[0], "interval") && argc == 2) {
+		n = strtoul(argv[1], &end, 10);
+		if (*end || end == argv[1] || n < c_conf.param.interval_min_ms || n > c_conf.param.interval_max_ms) {
+			c_ctl_printf(reply, reply_sz, &len, "error: interval must be between %u and %u\n", c_conf.param.interval_min_ms, c_conf.param.interval_max_ms);
+		} else {
+			/* The ramp rates are per step_ms, and do not follow. */
+			c_conf.param.interval_ms = (unsigned int)n;
+			c_loop.interval_ms = (unsigned int)n;
+			if (unlikely(c_ev_timer_set(c_loop.interval_ms) == -1))
+				DIE_GRACEFUL();
+			c_ctl_printf(reply, reply_sz, &len, "ok\n");
+		}
+	} else if (!strcmp(argv[0], "record") && argc <= 2) {
+		const char *path = (argc == 2) ? argv[1] : CFAN_REC_PATH;
+		if (c_rec_dump(path) == -1)
+			c_ctl_printf(reply, reply_sz, &len, "error: can't write %s: %s\n", path, strerror(errno));
+		else
+			c_ctl_printf(reply, reply_sz, &len, "ok %s\n", path);
+	} else {
+		c_ctl_printf(reply, reply_sz, &len, "error: usage: curve NAME [ZONE] | speed SPEED SECS [ZONE] | speed auto [ZONE] | interval MS | dump | record [PATH]\n");
+	}
+	errno = 0;
+	return len;
+}
+
+/* Write the metrics textfile, reporting only the first of a run of failures. */
+static void
+c_metrics_flush(void)
+{
+	static int failed;
+	if (c_metrics_write(c_conf.metrics, &c_conf, c_tach_fans, c_tachs_len, c_writes_skipped, c_writes_held) == 0) {
+		failed = 0;
+		return;
+	}
+	if (!failed)
+		fprintf(stderr, "cfan: can't write metrics to %s.\n", c_conf.metrics);
+	failed = 1;
+	errno = 0;
+}
+
+/* Open the alarms and the thermal events of the temperatures marked alarm.
+ * cfan only sleeps on them if they cover every zone. */
+static void
+c_events_init(void)
+{
+	if (unlikely(c_alarm_init(&c_conf, c_conf.temps, CFAN_ALARM_PATH) == -1))
 		DIE_GRACEFUL();
+	if (c_alarm_nl_init() == -1)
+		errno = 0;
+	if (unlikely(c_alarm_ev_add(C_EV_ALARM) == -1 || (c_alarm_nlfd != -1 && c_ev_add(c_alarm_nlfd, EPOLLIN, C_EV_THERMAL) == -1)))
+		DIE_GRACEFUL();
+	c_events = c_alarm_covers(&c_conf);
+	if (!c_events)
+		fprintf(stderr, "cfan: not every zone has a temp with a working alarm, cfan will keep polling.\n");
+}
+
+/* Wake on CPU pressure. Without PSI, the fans only follow the temperature. */
+static void
+c_psi_start(void)
+{
+	if (c_psi_init(C_PSI_PATH, c_conf.param.psi_stall_ms, c_conf.param.psi_window_ms) == -1) {
+		fprintf(stderr, "cfan: can't set a trigger of %u ms in %u ms on %s, load will not raise the fans.\n", c_conf.param.psi_stall_ms, c_conf.param.psi_window_ms, C_PSI_PATH);
+		errno = 0;
+		return;
 	}
-	unsigned int last_speed = c_fanspeed_max_get();
-	unsigned int curr_speed;
-	unsigned int temp;
-	unsigned int hot_secs = 0;
-	unsigned int last_max_cpu = 0;
-	unsigned int max_cpu = 0;
-	for (; !c_sig_caught; ) {
-		temp = c_temp_max_get();
-		if (unlikely(temp == (unsigned int)-1))
+	if (unlikely(c_ev_add(c_psi_fd, EPOLLPRI, C_EV_PSI) == -1))
+		DIE_GRACEFUL();
+}
+
+/* Start every zone from the speed its fans are at. */
+static void
+c_zones_start(void)
+{
+	for (unsigned int i = 0; i < c_conf.zones_len; ++i) {
+		/* Avoid underflow. */
+		if (unlikely(c_zone_states[i].mode == CONTROL_CURVE && c_conf.param.stepdown_max > c_zone_states[i].speed_min)) {
+			fprintf(stderr, "%s:%d:%s: stepdown_max (%u) must not be greater than the minimum fan curr_speed (%d) of zone %s.\n", __FILE__, __LINE__, ASSERT_FUNC, c_conf.param.stepdown_max, c_zone_states[i].speed_min, c_conf.zones[i].name);
 			DIE_GRACEFUL();
-#if CFAN_PRINT_TEMP_CPU
-		max_cpu = global_temp_cpu_max;
-		/* Write to tmpfs, if temp has changed */
-		if (max_cpu != last_max_cpu) {
-			c_temp_write(global_fd_temp_cpu, max_cpu, &global_temp_cpu_old_sz);
-			last_max_cpu = max_cpu;
 		}
+		c_zone_states[i].last_speed = c_fanspeed_max_get(c_conf.zones + i);
+		c_zone_states[i].hot_ms = 0;
+		c_zone_states[i].step_rem = 0;
+		c_zone_states[i].last_temp = C_TEMP_INVALID;
+		c_zone_states[i].hyst_temp = INT_MIN;
+		c_zone_states[i].pid.inited = 0;
+		c_predict_reset(&c_zone_states[i].predict);
+	}
+}
+
+static void
+c_mainloop(void)
+{
+#if CFAN_PRINT_TEMP_CPU
+	global_fd_temp_cpu = c_temp_cpu_init();
+#endif
+	/* Monitoring is not worth stopping fan control for. */
+	if (unlikely(c_status_init(CFAN_STATUS_PATH, &c_conf) == -1)) {
+		fprintf(stderr, "cfan: can't create %s, status will not be published.\n", CFAN_STATUS_PATH);
+		errno = 0;
+	}
+	if (unlikely(c_rec_init(&c_conf, REC_LEN) == -1 || c_rec_crash_init(CFAN_REC_PATH) == -1)) {
+		fprintf(stderr, "cfan: can't set up the flight recorder.\n");
+		errno = 0;
+	}
+	/* Limits left moved would keep the board alarming. */
+	c_rec_crash_fn = c_alarm_crash_restore;
+#ifdef USE_CUDA
+	if (nv_inited)
+		c_metrics_extra_add(nv_metrics_write);
 #endif
-		curr_speed = c_speed_get(temp);
-		/* Avoid updating when not necessary. */
-		if (curr_speed == last_speed)
-			goto sleep;
-		/* Get next step. */
-		hot_secs = c_step_get(&curr_speed, last_speed, temp, hot_secs);
-		last_speed = curr_speed;
-		if (unlikely(c_speeds_set(curr_speed) == -1))
+	if (c_conf.metrics && unlikely(c_ev_metrics_init(c_conf.metrics_s) == -1)) {
+		fprintf(stderr, "cfan: can't set up the metrics timer, metrics will not be written.\n");
+		errno = 0;
+	}
+	if (c_conf.param.event_poll_ms)
+		c_events_init();
+	if (c_conf.param.psi_stall_ms && c_conf.param.psi_bias)
+		c_psi_start();
+	/* Without uevents, lost devices are looked for each C_UEVENT_RECHECK_MS. */
+	c_uevent_fd = c_uevent_open();
+	if (c_uevent_fd != -1 && unlikely(c_ev_add(c_uevent_fd, EPOLLIN, C_EV_UEVENT) == -1))
+		DIE_GRACEFUL();
+	errno = 0;
+#ifdef USE_ACTUATOR
+	/* Slow fan chips would otherwise hold up the loop. */
+	if (unlikely(c_act_init(c_conf.fans, c_conf.fans_len) == -1 || c_act_start() == -1)) {
+		fprintf(stderr, "cfan: can't start the actuator thread, fans are written from the loop.\n");
+		errno = 0;
+	} else {
+		c_metrics_extra_add(c_act_metrics_write);
+	}
+#endif
+	c_zones_start();
+	c_loop.interval_ms = c_conf.param.interval_ms;
+	if (unlikely(c_ev_timer_set(c_loop.interval_ms) == -1))
+		DIE_GRACEFUL();
+	c_loop.last_ms = c_now_ms() - c_loop.interval_ms;
+	c_tick(&c_loop);
+	for (;;) {
+		struct epoll_event evs[C_EV_NUM + C_CTL_CLIENTS_MAX];
+		const int n = epoll_wait(c_ev_epfd, evs, LEN(evs), -1);
+		if (unlikely(n == -1)) {
+			if (errno == EINTR)
+				continue;
 			DIE_GRACEFUL();
-sleep:
-		nanosleep(&c_sleeptime, NULL);
+		}
+		for (int i = 0; i < n; ++i) {
+			switch (evs[i].data.u32) {
+			case C_EV_TIMER:
+				if (unlikely(c_ev_timer_ack() == -1))
+					DIE_GRACEFUL();
+				c_metrics_late(c_ev_timer_late_ns(c_now_ns()));
+				++c_metrics.wakeups[C_METRICS_WAKE_TIMER];
+				c_tick(&c_loop);
+				break;
+			case C_EV_ALARM:
+				c_alarm_ack();
+				++c_metrics.wakeups[C_METRICS_WAKE_ALARM];
+				c_tick(&c_loop);
+				break;
+			case C_EV_THERMAL: {
+				const int hit = c_alarm_nl_read();
+				if (unlikely(hit == -1))
+					DIE_GRACEFUL();
+				if (hit) {
+					++c_metrics.wakeups[C_METRICS_WAKE_THERMAL];
+					c_tick(&c_loop);
+				}
+				break;
+			}
+			case C_EV_PSI:
+				c_psi_fired(c_now_ms(), c_conf.param.psi_hold_ms);
+				++c_metrics.wakeups[C_METRICS_WAKE_PSI];
+				c_tick(&c_loop);
+				break;
+			case C_EV_UEVENT:
+				/* A device came back, or one was removed before its
+				 * files fail. */
+				if (c_uevent_read(c_uevent_fd) > 0 && c_lost_len) {
+					c_devices_recover();
+					++c_metrics.wakeups[C_METRICS_WAKE_UEVENT];
+					c_tick(&c_loop);
+				}
+				errno = 0;
+				break;
+			case C_EV_METRICS:
+				if (unlikely(c_ev_timer_ack_fd(c_ev_metricsfd) == -1))
+					DIE_GRACEFUL();
+				c_metrics_flush();
+				break;
+			case C_EV_SIGNAL: {
+				struct signalfd_siginfo si;
+				if (read(c_ev_sigfd, &si, sizeof(si)) != (ssize_t)sizeof(si))
+					si.ssi_signo = 0;
+				DBG(fprintf(stderr, "%s:%d:%s: caught signal %u, exiting.\n", __FILE__, __LINE__, ASSERT_FUNC, si.ssi_signo));
+				return;
+			}
+			case C_EV_CTL:
+				c_ctl_accept();
+				break;
+			default:
+				c_ctl_read(evs[i].data.u32 - C_EV_NUM, c_ctl_cmd);
+				break;
+			}
+		}
+		/* Apply commands now rather than on the next tick,
+		 * which may be up to interval_max_ms away. */
+		if (c_ctl_dirty) {
+			c_ctl_dirty = 0;
+			c_tick(&c_loop);
+		}
 	}
 }
 
@@ -423,6 +1635,14 @@ c_inits(void)
 {
 	for (unsigned int i = 0; i < LEN(c_table_fn_init); ++i)
 		c_table_fn_init[i]();
+	/* Functions used by zones of the configuration file. */
+	for (unsigned int i = 0; i < c_conf.inits_len; ++i) {
+		unsigned int j = 0;
+		while (j < LEN(c_table_fn_init) && c_table_fn_init[j] != c_conf.inits[i])
+			++j;
+		if (j == LEN(c_table_fn_init))
+			c_conf.inits[i]();
+	}
 }
 
 /* clang-format off */
@@ -431,36 +1651,60 @@ const char *usage = _("Usage: cfan [OPTIONS]...\n")
                     _("Options:\n")
                     _("  --help\n")
                     _("    Show this help.\n")
+                    _("  --config FILE\n")
+                    _("    Read the configuration from FILE instead of " CFAN_CONF_PATH ".\n")
+                    _("  --discover\n")
+                    _("    Print a configuration of the sensors and fans found, used without one.\n")
                     _("  --medium\n")
                     _("    Medium fan speed.\n")
                     _("  --high\n")
-                    _("    High fan speed.\n");
+                    _("    High fan speed.\n")
+                    _("  --pid\n")
+                    _("    Hold the temperature at pid_setpoint, within the fan curve.\n");
 
 /* clang-format on */
 
 int
 main(int argc, char **argv)
 {
-	if (argc == 2) {
-		if (!strcmp(argv[1], "--help")) {
+	int conf_explicit = 0;
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--help")) {
 			printf("%s", usage);
 			exit(EXIT_SUCCESS);
-		} else if (!strcmp(argv[1], "--medium")) {
+		} else if (!strcmp(argv[i], "--medium")) {
 			printf("cfan: using medium fan speed.\n");
-			temptospeed = c_table_temptospeed_med;
-		} else if (!strcmp(argv[1], "--high")) {
+			c_curve_name = "medium";
+		} else if (!strcmp(argv[i], "--high")) {
 			printf("cfan: using high fan speed.\n");
-			temptospeed = c_table_temptospeed_high;
+			c_curve_name = "high";
+		} else if (!strcmp(argv[i], "--pid")) {
+			c_control_mode = CONTROL_PID;
+		} else if (!strcmp(argv[i], "--discover")) {
+			c_conf_buf_ty text = { NULL, 0, 0 };
+			c_discover_text(&text);
+			fwrite(text.p, 1, text.len, stdout);
+			free(text.p);
+			exit(EXIT_SUCCESS);
+		} else if (!strcmp(argv[i], "--config") && i + 1 < argc) {
+			c_conf_path = argv[++i];
+			conf_explicit = 1;
 		} else {
 			fprintf(stderr, "%s", usage);
 			exit(EXIT_FAILURE);
 		}
 	}
+	c_conf_setup(conf_explicit);
+	if (c_conf.param.mode == CONTROL_PID)
+		printf("cfan: holding %gc.\n", (double)c_conf.param.pid_setpoint / 1000);
 	c_sig_setup();
 	c_mode_setup();
 	c_inits();
 	c_mainloop();
+	printf("cfan: %llu fan writes, %llu skipped as unchanged, %llu avoided by the hysteresis.\n", c_writes, c_writes_skipped, c_writes_held);
 	c_cleanup();
+	c_rec_cleanup();
+	c_metrics_cleanup();
 	return EXIT_SUCCESS;
 }
 
@@ -23,8 +23,6 @@
 #ifndef CFAN_H
 #define CFAN_H 1
 
-unsigned int
-c_temp_sysfs_max_get(void);
 void
 c_init(void);
 void
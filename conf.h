@@ -0,0 +1,1169 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2026 James Tirta Halim <tirtajames45 at gmail dot com> */
+
+#ifndef CONF_H
+#define CONF_H 1
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "macros.h"
+#include "config.h"
+#include "curve.h"
+#include "param.h"
+#include "zone.h"
+
+/* Runtime configuration file.
+ *
+ * The text file is validated and compiled into a position-independent
+ * image, which is cached next to it as <file>.cache. On the next start the
+ * cache is mmap'd and used in place as long as the file has not changed,
+ * so no text is parsed. See cfan.def.conf for the syntax. */
+
+#define C_CONF_MAGIC      "cfanimg"
+#define C_CONF_VERSION    5
+#define C_CONF_NONE       ((uint32_t)-1)
+#define C_CONF_FIELDS_MAX 64
+#define C_CONF_ERR_LEN    256
+#define C_CONF_RPM_MAX    100000
+
+/* Image layout. Offsets of sections are in bytes from the start of the
+ * image, lengths are in elements. Names and paths are offsets into the
+ * string pool. */
+typedef struct {
+	uint32_t off;
+	uint32_t len;
+} c_conf_sec_ty;
+
+/* c_conf_temp_ty.flags */
+enum {
+	/* Its limit may be moved to wake cfan, see alarm.h. */
+	C_CONF_TEMP_ALARM = 1 << 0,
+};
+
+typedef struct {
+	uint32_t name;
+	uint32_t path;
+	uint32_t flags;
+} c_conf_temp_ty;
+
+typedef struct {
+	uint32_t name;
+	uint32_t pwm;
+	/* Or C_CONF_NONE. */
+	uint32_t enable;
+	uint32_t tach;
+} c_conf_fan_ty;
+
+typedef struct {
+	uint32_t name;
+	/* Index into the points section. */
+	uint32_t points;
+	uint32_t len;
+} c_conf_curve_ty;
+
+typedef struct {
+	uint32_t name;
+	/* Or C_CONF_NONE for the default curve. */
+	uint32_t curve;
+	/* Index into the index section, len may be C_ZONE_ALL_LEN. */
+	uint32_t temps;
+	uint32_t temps_len;
+	uint32_t fans;
+	uint32_t fans_len;
+	/* Index into the function name section. */
+	uint32_t fns;
+	uint32_t fns_len;
+} c_conf_zone_ty;
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t size;
+	/* Hash of the compiled-in defaults, so that a rebuild with another
+	 * config.h invalidates the cache. */
+	uint64_t build;
+	/* Identity of the text file the image was compiled from. */
+	uint64_t src_dev;
+	uint64_t src_ino;
+	uint64_t src_size;
+	int64_t src_mtime_sec;
+	int64_t src_mtime_nsec;
+	c_param_ty param;
+	/* Index into temps, or C_CONF_NONE. */
+	uint32_t temp_cpu;
+	/* Index into curves. */
+	uint32_t curve_default;
+	/* Metrics textfile, or C_CONF_NONE. */
+	uint32_t metrics;
+	uint32_t metrics_s;
+	c_conf_sec_ty temps;
+	c_conf_sec_ty fans;
+	c_conf_sec_ty points;
+	c_conf_sec_ty curves;
+	c_conf_sec_ty zones;
+	c_conf_sec_ty idx;
+	c_conf_sec_ty fns;
+	c_conf_sec_ty str;
+} c_conf_hdr_ty;
+
+/* Loaded configuration. Strings and indices point into img. */
+typedef struct {
+	c_param_ty param;
+	const char **temps;
+	const char **temp_names;
+	/* C_CONF_TEMP_*. May be NULL. */
+	const unsigned char *temps_flags;
+	unsigned int temps_len;
+	/* Index into temps, or C_CONF_NONE. */
+	unsigned int temp_cpu;
+	const char **fans;
+	/* Entries may be NULL. */
+	const char **fans_enable;
+	/* Tachometers (fanN_input). Entries may be NULL. */
+	const char **fans_tach;
+	const char **fan_names;
+	unsigned int fans_len;
+	c_curve_ty *curves;
+	const char **curve_names;
+	unsigned int curves_len;
+	unsigned int curve_default;
+	/* Or NULL. */
+	const char *metrics;
+	unsigned int metrics_s;
+	const c_zone_ty *zones;
+	unsigned int zones_len;
+	/* Distinct init functions of the temperature functions in use. */
+	fn_temp_init *inits;
+	unsigned int inits_len;
+	fn_temp *fn_temps;
+	const void *img;
+	size_t img_sz;
+	int img_mapped;
+} c_conf_ty;
+
+/* Curves that exist without being defined in the file. */
+static const struct {
+	const char *name;
+	const c_curve_ty *curve;
+} c_conf_curves_builtin[] = {
+	{ "medium", &c_table_temptospeed_med },
+	{ "high", &c_table_temptospeed_high },
+};
+
+typedef struct {
+	char *p;
+	size_t len;
+	size_t cap;
+} c_conf_buf_ty;
+
+/* Zone as written, resolved once every name is known. */
+typedef struct {
+	uint32_t name;
+	uint32_t curve;
+	uint32_t temps;
+	uint32_t fans;
+	uint32_t fns;
+	unsigned int line;
+} c_conf_zone_src_ty;
+
+typedef struct {
+	const char *filename;
+	unsigned int line;
+	char *err;
+	size_t err_sz;
+	const c_fn_name_ty *fn_names;
+	c_param_ty param;
+	uint32_t temp_cpu;
+	unsigned int temp_cpu_line;
+	uint32_t curve_default;
+	unsigned int curve_default_line;
+	uint32_t metrics;
+	uint32_t metrics_s;
+	c_conf_buf_ty temps;
+	c_conf_buf_ty fans;
+	c_conf_buf_ty points;
+	c_conf_buf_ty curves;
+	c_conf_buf_ty zones;
+	c_conf_buf_ty idx;
+	c_conf_buf_ty fns;
+	c_conf_buf_ty str;
+	c_conf_buf_ty zones_src;
+} c_conf_ctx_ty;
+
+enum {
+	C_CONF_UINT,
+	/* Decimal number scaled by 1000, e.g. degrees to millidegrees. */
+	C_CONF_MILLI,
+	C_CONF_DOUBLE,
+};
+
+/* clang-format off */
+static const struct {
+	const char *key;
+	size_t off;
+	int type;
+	double min;
+	double max;
+} c_conf_params[] = {
+	{ "interval_ms",       offsetof(c_param_ty, interval_ms),       C_CONF_UINT,   1,    3600000 },
+	{ "interval_min_ms",   offsetof(c_param_ty, interval_min_ms),   C_CONF_UINT,   1,    3600000 },
+	{ "interval_max_ms",   offsetof(c_param_ty, interval_max_ms),   C_CONF_UINT,   1,    3600000 },
+	{ "slope_fast",        offsetof(c_param_ty, slope_fast),        C_CONF_UINT,   0,    1000    },
+	{ "step_ms",           offsetof(c_param_ty, step_ms),           C_CONF_UINT,   1,    3600000 },
+	{ "stepdown_max",      offsetof(c_param_ty, stepdown_max),      C_CONF_UINT,   0,    255     },
+	{ "stepup_spike",      offsetof(c_param_ty, stepup_spike),      C_CONF_UINT,   1,    255     },
+	{ "spike_max_ms",      offsetof(c_param_ty, spike_max_ms),      C_CONF_UINT,   0,    3600000 },
+	{ "spike_temp_max",    offsetof(c_param_ty, spike_temp_max),    C_CONF_MILLI,  -273, 1000    },
+	{ "hysteresis",        offsetof(c_param_ty, hysteresis),        C_CONF_MILLI,  0,    100     },
+	{ "fanspeed_default",  offsetof(c_param_ty, fanspeed_default),  C_CONF_UINT,   0,    255     },
+	{ "pid_setpoint",      offsetof(c_param_ty, pid_setpoint),      C_CONF_MILLI,  -273, 1000    },
+	{ "pid_kp",            offsetof(c_param_ty, pid_kp),            C_CONF_DOUBLE, 0,    1e6     },
+	{ "pid_ki",            offsetof(c_param_ty, pid_ki),            C_CONF_DOUBLE, 0,    1e6     },
+	{ "pid_kd",            offsetof(c_param_ty, pid_kd),            C_CONF_DOUBLE, 0,    1e6     },
+	{ "pid_d_alpha",       offsetof(c_param_ty, pid_d_alpha),       C_CONF_DOUBLE, 1e-3, 1       },
+	{ "rpm_gain",          offsetof(c_param_ty, rpm_gain),          C_CONF_DOUBLE, 1e-3, 1       },
+	{ "rpm_stall",         offsetof(c_param_ty, rpm_stall),         C_CONF_UINT,   0,    100000  },
+	{ "stall_speed_min",   offsetof(c_param_ty, stall_speed_min),   C_CONF_UINT,   0,    255     },
+	{ "stall_ms",          offsetof(c_param_ty, stall_ms),          C_CONF_UINT,   0,    3600000 },
+	{ "event_poll_ms",     offsetof(c_param_ty, event_poll_ms),     C_CONF_UINT,   0,    3600000 },
+	{ "event_band",        offsetof(c_param_ty, event_band),        C_CONF_MILLI,  0.5,  50      },
+	{ "predict_ms",        offsetof(c_param_ty, predict_ms),        C_CONF_UINT,   0,    120000  },
+	{ "predict_window_ms", offsetof(c_param_ty, predict_window_ms), C_CONF_UINT,   2000, 120000  },
+	{ "psi_stall_ms",      offsetof(c_param_ty, psi_stall_ms),      C_CONF_UINT,   0,    10000   },
+	{ "psi_window_ms",     offsetof(c_param_ty, psi_window_ms),     C_CONF_UINT,   500,  10000   },
+	{ "psi_hold_ms",       offsetof(c_param_ty, psi_hold_ms),       C_CONF_UINT,   0,    3600000 },
+	{ "psi_bias",          offsetof(c_param_ty, psi_bias),          C_CONF_UINT,   0,    255     },
+};
+/* clang-format on */
+
+static uint64_t
+c_conf_hash(uint64_t h, const void *p, size_t n)
+{
+	/* FNV-1a */
+	for (size_t i = 0; i < n; ++i) {
+		h ^= ((const unsigned char *)p)[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static uint64_t
+c_conf_build_hash(void)
+{
+	const c_param_ty p = C_PARAM_DEFAULT;
+	const uint32_t sizes[] = { sizeof(c_conf_hdr_ty), sizeof(c_param_ty), sizeof(c_point_ty), C_CONF_VERSION };
+	/* Field by field, since c_param_ty has padding. */
+	const double param[] = { p.interval_ms, p.interval_min_ms, p.interval_max_ms, p.slope_fast, p.step_ms, p.stepdown_max, p.stepup_spike, p.spike_max_ms, p.spike_temp_max, p.hysteresis, p.fanspeed_default, p.mode, p.pid_setpoint, p.rpm_stall, p.stall_speed_min, p.stall_ms, p.event_poll_ms, p.event_band, p.predict_ms, p.predict_window_ms, p.psi_stall_ms, p.psi_window_ms, p.psi_hold_ms, p.psi_bias, p.pid_kp, p.pid_ki, p.pid_kd, p.pid_d_alpha, p.rpm_gain };
+	uint64_t h = 0xcbf29ce484222325ULL;
+	h = c_conf_hash(h, sizes, sizeof(sizes));
+	h = c_conf_hash(h, param, sizeof(param));
+	for (unsigned int i = 0; i < LEN(c_conf_curves_builtin); ++i) {
+		h = c_conf_hash(h, c_conf_curves_builtin[i].name, strlen(c_conf_curves_builtin[i].name) + 1);
+		h = c_conf_hash(h, c_conf_curves_builtin[i].curve->points, c_conf_curves_builtin[i].curve->len * sizeof(c_point_ty));
+	}
+	return h;
+}
+
+static int
+c_conf_buf_add(c_conf_buf_ty *b, const void *p, size_t n)
+{
+	if (b->len + n > b->cap || b->p == NULL) {
+		size_t cap = MAX(b->cap * 2, 64);
+		while (cap < b->len + n)
+			cap *= 2;
+		char *tmp = (char *)realloc(b->p, cap);
+		if (unlikely(tmp == NULL))
+			return -1;
+		b->p = tmp;
+		b->cap = cap;
+	}
+	memcpy(b->p + b->len, p, n);
+	b->len += n;
+	return 0;
+}
+
+static int
+c_conf_error(c_conf_ctx_ty *ctx, const char *fmt, ...)
+{
+	int n;
+	if (ctx->line)
+		n = snprintf(ctx->err, ctx->err_sz, "%s:%u: ", ctx->filename, ctx->line);
+	else
+		n = snprintf(ctx->err, ctx->err_sz, "%s: ", ctx->filename);
+	if (n >= 0 && (size_t)n < ctx->err_sz) {
+		va_list ap;
+		va_start(ap, fmt);
+		vsnprintf(ctx->err + n, ctx->err_sz - (size_t)n, fmt, ap);
+		va_end(ap);
+	}
+	return -1;
+}
+
+static ATTR_INLINE const char *
+c_conf_str(const c_conf_ctx_ty *ctx, uint32_t off)
+{
+	return ctx->str.p + off;
+}
+
+static int
+c_conf_str_add(c_conf_ctx_ty *ctx, const char *s, uint32_t *off)
+{
+	if (unlikely(ctx->str.len + strlen(s) + 1 > UINT32_MAX))
+		return c_conf_error(ctx, "too large.");
+	*off = (uint32_t)ctx->str.len;
+	if (unlikely(c_conf_buf_add(&ctx->str, s, strlen(s) + 1) == -1))
+		return c_conf_error(ctx, "out of memory.");
+	return 0;
+}
+
+static int
+c_conf_add(c_conf_ctx_ty *ctx, c_conf_buf_ty *b, const void *p, size_t n)
+{
+	if (unlikely(c_conf_buf_add(b, p, n) == -1))
+		return c_conf_error(ctx, "out of memory.");
+	return 0;
+}
+
+/* Find an entry by name in a section whose entries start with a name.
+ * Return its index, or C_CONF_NONE. */
+static uint32_t
+c_conf_find(const c_conf_ctx_ty *ctx, const c_conf_buf_ty *b, size_t stride, const char *name)
+{
+	for (size_t i = 0; i < b->len / stride; ++i)
+		if (!strcmp(c_conf_str(ctx, *(const uint32_t *)(b->p + i * stride)), name))
+			return (uint32_t)i;
+	return C_CONF_NONE;
+}
+
+static int
+c_conf_name_check(c_conf_ctx_ty *ctx, const char *name)
+{
+	for (const char *p = name; *p; ++p)
+		if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '_' || *p == '-' || *p == '.'))
+			return c_conf_error(ctx, "invalid name: %s.", name);
+	return 0;
+}
+
+static int
+c_conf_uint_parse(const char *s, unsigned long *out)
+{
+	char *end;
+	if (*s < '0' || *s > '9')
+		return -1;
+	errno = 0;
+	*out = strtoul(s, &end, 10);
+	if (*end != '\0' || errno)
+		return -1;
+	return 0;
+}
+
+static int
+c_conf_double_parse(const char *s, double *out)
+{
+	char *end;
+	errno = 0;
+	*out = strtod(s, &end);
+	/* Reject nan, inf and the empty string. */
+	if (end == s || *end != '\0' || errno || !(*out == *out) || *out > 1e12 || *out < -1e12)
+		return -1;
+	return 0;
+}
+
+static ATTR_INLINE int
+c_conf_milli(double x)
+{
+	return (int)((x < 0) ? x * 1000 - 0.5 : x * 1000 + 0.5);
+}
+
+static int
+c_conf_param_set(c_conf_ctx_ty *ctx, unsigned int i, const char *val)
+{
+	double x;
+	if (c_conf_params[i].type == C_CONF_UINT) {
+		unsigned long u;
+		if (c_conf_uint_parse(val, &u) == -1 || u > UINT_MAX)
+			return c_conf_error(ctx, "%s: not a number: %s.", c_conf_params[i].key, val);
+		x = (double)u;
+	} else if (c_conf_double_parse(val, &x) == -1) {
+		return c_conf_error(ctx, "%s: not a number: %s.", c_conf_params[i].key, val);
+	}
+	if (x < c_conf_params[i].min || x > c_conf_params[i].max)
+		return c_conf_error(ctx, "%s: must be between %g and %g.", c_conf_params[i].key, c_conf_params[i].min, c_conf_params[i].max);
+	char *dst = (char *)&ctx->param + c_conf_params[i].off;
+	if (c_conf_params[i].type == C_CONF_UINT) {
+		const unsigned int u = (unsigned int)x;
+		memcpy(dst, &u, sizeof(u));
+	} else if (c_conf_params[i].type == C_CONF_MILLI) {
+		const int m = c_conf_milli(x);
+		memcpy(dst, &m, sizeof(m));
+	} else {
+		memcpy(dst, &x, sizeof(x));
+	}
+	return 0;
+}
+
+/* Return NULL if the parameters are consistent, or what is wrong. */
+static const char *
+c_conf_param_check(const c_param_ty *prm)
+{
+	if (prm->interval_min_ms == 0 || prm->interval_ms == 0)
+		return "intervals must not be 0.";
+	if (prm->interval_min_ms > prm->interval_ms || prm->interval_ms > prm->interval_max_ms)
+		return "interval_min_ms <= interval_ms <= interval_max_ms must hold.";
+	if (prm->stepdown_max > 255 || prm->stepup_spike > 255 || prm->fanspeed_default > 255)
+		return "speeds must be between 0 and 255.";
+	if (prm->mode != CONTROL_CURVE && prm->mode != CONTROL_PID && prm->mode != CONTROL_RPM)
+		return "unknown mode.";
+	if (!(prm->pid_d_alpha > 0 && prm->pid_d_alpha <= 1))
+		return "pid_d_alpha must be between 0 and 1.";
+	if (!(prm->rpm_gain > 0 && prm->rpm_gain <= 1))
+		return "rpm_gain must be between 0 and 1.";
+	if (prm->stall_speed_min > 255)
+		return "speeds must be between 0 and 255.";
+	return NULL;
+}
+
+static int
+c_conf_curve_parse(c_conf_ctx_ty *ctx, char **f, unsigned int n)
+{
+	if (n < 3)
+		return c_conf_error(ctx, "usage: curve NAME TEMP:SPEED...");
+	if (c_conf_name_check(ctx, f[1]) == -1)
+		return -1;
+	if (c_conf_find(ctx, &ctx->curves, sizeof(c_conf_curve_ty), f[1]) != C_CONF_NONE)
+		return c_conf_error(ctx, "curve %s is already defined.", f[1]);
+	c_conf_curve_ty c = { 0, (uint32_t)(ctx->points.len / sizeof(c_point_ty)), n - 2 };
+	if (c_conf_str_add(ctx, f[1], &c.name) == -1)
+		return -1;
+	for (unsigned int i = 2; i < n; ++i) {
+		char *colon = strchr(f[i], ':');
+		double temp;
+		unsigned long speed;
+		if (colon == NULL)
+			return c_conf_error(ctx, "curve %s: expected TEMP:SPEED, got %s.", f[1], f[i]);
+		*colon = '\0';
+		if (c_conf_double_parse(f[i], &temp) == -1 || temp < -273 || temp > 1000)
+			return c_conf_error(ctx, "curve %s: bad temperature: %s.", f[1], f[i]);
+		/* Up to 255, or RPM in mode rpm, checked once the mode is known. */
+		if (c_conf_uint_parse(colon + 1, &speed) == -1 || speed > C_CONF_RPM_MAX)
+			return c_conf_error(ctx, "curve %s: bad speed: %s.", f[1], colon + 1);
+		const c_point_ty p = { c_conf_milli(temp), (unsigned int)speed };
+		if (i > 2 && p.temp <= ((const c_point_ty *)(ctx->points.p + ctx->points.len))[-1].temp)
+			return c_conf_error(ctx, "curve %s: temperatures must be strictly increasing.", f[1]);
+		if (c_conf_add(ctx, &ctx->points, &p, sizeof(p)) == -1)
+			return -1;
+	}
+	return c_conf_add(ctx, &ctx->curves, &c, sizeof(c));
+}
+
+static int
+c_conf_zone_parse(c_conf_ctx_ty *ctx, char **f, unsigned int n)
+{
+	if (n < 2)
+		return c_conf_error(ctx, "usage: zone NAME [curve=NAME] [temps=NAME,...|*] [fans=NAME,...|*] [fn=NAME,...]");
+	if (c_conf_name_check(ctx, f[1]) == -1)
+		return -1;
+	if (c_conf_find(ctx, &ctx->zones_src, sizeof(c_conf_zone_src_ty), f[1]) != C_CONF_NONE)
+		return c_conf_error(ctx, "zone %s is already defined.", f[1]);
+	c_conf_zone_src_ty z = { 0, C_CONF_NONE, C_CONF_NONE, C_CONF_NONE, C_CONF_NONE, ctx->line };
+	if (c_conf_str_add(ctx, f[1], &z.name) == -1)
+		return -1;
+	for (unsigned int i = 2; i < n; ++i) {
+		char *eq = strchr(f[i], '=');
+		uint32_t *dst;
+		if (eq == NULL || eq[1] == '\0')
+			return c_conf_error(ctx, "zone %s: expected KEY=VALUE, got %s.", f[1], f[i]);
+		*eq = '\0';
+		if (!strcmp(f[i], "curve"))
+			dst = &z.curve;
+		else if (!strcmp(f[i], "temps"))
+			dst = &z.temps;
+		else if (!strcmp(f[i], "fans"))
+			dst = &z.fans;
+		else if (!strcmp(f[i], "fn"))
+			dst = &z.fns;
+		else
+			return c_conf_error(ctx, "zone %s: unknown key: %s.", f[1], f[i]);
+		if (c_conf_str_add(ctx, eq + 1, dst) == -1)
+			return -1;
+	}
+	return c_conf_add(ctx, &ctx->zones_src, &z, sizeof(z));
+}
+
+static int
+c_conf_line_parse(c_conf_ctx_ty *ctx, char *line)
+{
+	char *f[C_CONF_FIELDS_MAX];
+	unsigned int n = 0;
+	char *comment = strchr(line, '#');
+	if (comment)
+		*comment = '\0';
+	for (char *p = line;;) {
+		while (*p == ' ' || *p == '\t' || *p == '\r')
+			++p;
+		if (*p == '\0')
+			break;
+		if (n == LEN(f))
+			return c_conf_error(ctx, "too many fields.");
+		f[n++] = p;
+		while (*p && *p != ' ' && *p != '\t' && *p != '\r')
+			++p;
+		if (*p)
+			*p++ = '\0';
+	}
+	if (n == 0)
+		return 0;
+	for (unsigned int i = 0; i < LEN(c_conf_params); ++i) {
+		if (!strcmp(f[0], c_conf_params[i].key)) {
+			if (n != 2)
+				return c_conf_error(ctx, "usage: %s VALUE", f[0]);
+			return c_conf_param_set(ctx, i, f[1]);
+		}
+	}
+	if (!strcmp(f[0], "mode")) {
+		if (n == 2 && !strcmp(f[1], "curve"))
+			ctx->param.mode = CONTROL_CURVE;
+		else if (n == 2 && !strcmp(f[1], "pid"))
+			ctx->param.mode = CONTROL_PID;
+		else if (n == 2 && !strcmp(f[1], "rpm"))
+			ctx->param.mode = CONTROL_RPM;
+		else
+			return c_conf_error(ctx, "usage: mode curve|pid|rpm");
+		return 0;
+	}
+	if (!strcmp(f[0], "temp")) {
+		if ((n != 3 && n != 4) || (n == 4 && strcmp(f[3], "alarm")))
+			return c_conf_error(ctx, "usage: temp NAME PATH [alarm]");
+		if (c_conf_name_check(ctx, f[1]) == -1)
+			return -1;
+		if (c_conf_find(ctx, &ctx->temps, sizeof(c_conf_temp_ty), f[1]) != C_CONF_NONE)
+			return c_conf_error(ctx, "temp %s is already defined.", f[1]);
+		c_conf_temp_ty t;
+		t.flags = (n == 4) ? C_CONF_TEMP_ALARM : 0;
+		if (c_conf_str_add(ctx, f[1], &t.name) == -1 || c_conf_str_add(ctx, f[2], &t.path) == -1)
+			return -1;
+		return c_conf_add(ctx, &ctx->temps, &t, sizeof(t));
+	}
+	if (!strcmp(f[0], "fan")) {
+		if (n < 3 || n > 5)
+			return c_conf_error(ctx, "usage: fan NAME PWM [PWM_ENABLE] [tach=FAN_INPUT]");
+		if (c_conf_name_check(ctx, f[1]) == -1)
+			return -1;
+		if (c_conf_find(ctx, &ctx->fans, sizeof(c_conf_fan_ty), f[1]) != C_CONF_NONE)
+			return c_conf_error(ctx, "fan %s is already defined.", f[1]);
+		c_conf_fan_ty fan = { 0, 0, C_CONF_NONE, C_CONF_NONE };
+		if (c_conf_str_add(ctx, f[1], &fan.name) == -1 || c_conf_str_add(ctx, f[2], &fan.pwm) == -1)
+			return -1;
+		for (unsigned int i = 3; i < n; ++i) {
+			uint32_t *dst = &fan.enable;
+			const char *path = f[i];
+			if (!strncmp(f[i], "tach=", S_LEN("tach="))) {
+				dst = &fan.tach;
+				path += S_LEN("tach=");
+			}
+			if (*dst != C_CONF_NONE || *path == '\0')
+				return c_conf_error(ctx, "usage: fan NAME PWM [PWM_ENABLE] [tach=FAN_INPUT]");
+			if (c_conf_str_add(ctx, path, dst) == -1)
+				return -1;
+		}
+		return c_conf_add(ctx, &ctx->fans, &fan, sizeof(fan));
+	}
+	if (!strcmp(f[0], "temp_cpu") || !strcmp(f[0], "default_curve")) {
+		if (n != 2)
+			return c_conf_error(ctx, "usage: %s NAME", f[0]);
+		const int cpu = !strcmp(f[0], "temp_cpu");
+		if (c_conf_str_add(ctx, f[1], cpu ? &ctx->temp_cpu : &ctx->curve_default) == -1)
+			return -1;
+		*(cpu ? &ctx->temp_cpu_line : &ctx->curve_default_line) = ctx->line;
+		return 0;
+	}
+	if (!strcmp(f[0], "metrics")) {
+		unsigned long secs = METRICS_S;
+		if ((n != 2 && n != 3) || (n == 3 && (c_conf_uint_parse(f[2], &secs) == -1 || secs == 0 || secs > 86400)))
+			return c_conf_error(ctx, "usage: metrics PATH [SECS]");
+		ctx->metrics_s = (uint32_t)secs;
+		return c_conf_str_add(ctx, f[1], &ctx->metrics);
+	}
+	if (!strcmp(f[0], "curve"))
+		return c_conf_curve_parse(ctx, f, n);
+	if (!strcmp(f[0], "zone"))
+		return c_conf_zone_parse(ctx, f, n);
+	return c_conf_error(ctx, "unknown key: %s.", f[0]);
+}
+
+/* Resolve a comma-separated list of names, or "*", into the index section.
+ * find returns the index of a name, or C_CONF_NONE. */
+static int
+c_conf_list_resolve(c_conf_ctx_ty *ctx, const char *zone, const char *what, uint32_t list, const c_conf_buf_ty *table, size_t stride, uint32_t *start, uint32_t *len)
+{
+	*start = (uint32_t)(ctx->idx.len / sizeof(uint32_t));
+	*len = 0;
+	if (list == C_CONF_NONE)
+		return 0;
+	if (!strcmp(c_conf_str(ctx, list), "*")) {
+		*start = 0;
+		*len = C_ZONE_ALL_LEN;
+		return 0;
+	}
+	char *names = strdup(c_conf_str(ctx, list));
+	if (unlikely(names == NULL))
+		return c_conf_error(ctx, "out of memory.");
+	int ret = 0;
+	for (char *save, *name = strtok_r(names, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+		const uint32_t i = c_conf_find(ctx, table, stride, name);
+		if (i == C_CONF_NONE) {
+			ret = c_conf_error(ctx, "zone %s: unknown %s: %s.", zone, what, name);
+			break;
+		}
+		if ((ret = c_conf_add(ctx, &ctx->idx, &i, sizeof(i))) == -1)
+			break;
+		++*len;
+	}
+	free(names);
+	return ret;
+}
+
+static int
+c_conf_zone_resolve(c_conf_ctx_ty *ctx, const c_conf_zone_src_ty *src)
+{
+	const char *name = c_conf_str(ctx, src->name);
+	c_conf_zone_ty z = { src->name, C_CONF_NONE, 0, 0, 0, 0, 0, 0 };
+	ctx->line = src->line;
+	if (src->curve != C_CONF_NONE) {
+		z.curve = c_conf_find(ctx, &ctx->curves, sizeof(c_conf_curve_ty), c_conf_str(ctx, src->curve));
+		if (z.curve == C_CONF_NONE)
+			return c_conf_error(ctx, "zone %s: unknown curve: %s.", name, c_conf_str(ctx, src->curve));
+	}
+	if (c_conf_list_resolve(ctx, name, "temp", src->temps, &ctx->temps, sizeof(c_conf_temp_ty), &z.temps, &z.temps_len) == -1)
+		return -1;
+	if (c_conf_list_resolve(ctx, name, "fan", src->fans, &ctx->fans, sizeof(c_conf_fan_ty), &z.fans, &z.fans_len) == -1)
+		return -1;
+	z.fns = (uint32_t)(ctx->fns.len / sizeof(uint32_t));
+	if (src->fns != C_CONF_NONE) {
+		/* Store each name on its own in the string pool. */
+		char *names = strdup(c_conf_str(ctx, src->fns));
+		if (unlikely(names == NULL))
+			return c_conf_error(ctx, "out of memory.");
+		int ret = 0;
+		for (char *save, *fn = strtok_r(names, ",", &save); fn; fn = strtok_r(NULL, ",", &save)) {
+			const c_fn_name_ty *f = ctx->fn_names;
+			while (f && f->name && strcmp(f->name, fn))
+				++f;
+			uint32_t off;
+			if (f == NULL || f->name == NULL) {
+				ret = c_conf_error(ctx, "zone %s: unknown temperature function: %s.", name, fn);
+				break;
+			}
+			if ((ret = c_conf_str_add(ctx, fn, &off)) == -1 || (ret = c_conf_add(ctx, &ctx->fns, &off, sizeof(off))) == -1)
+				break;
+			++z.fns_len;
+		}
+		free(names);
+		if (ret == -1)
+			return -1;
+	}
+	const unsigned int temps_len = (z.temps_len == C_ZONE_ALL_LEN) ? (unsigned int)(ctx->temps.len / sizeof(c_conf_temp_ty)) : z.temps_len;
+	if (temps_len + z.fns_len == 0)
+		return c_conf_error(ctx, "zone %s has no temperatures.", name);
+	if (z.fans_len == 0)
+		return c_conf_error(ctx, "zone %s has no fans.", name);
+	return c_conf_add(ctx, &ctx->zones, &z, sizeof(z));
+}
+
+/* Add the builtin curves that the file did not redefine, and resolve
+ * names that may refer to entries defined further down. */
+static int
+c_conf_finish(c_conf_ctx_ty *ctx)
+{
+	const char *msg;
+	/* The builtin curves are in PWM, so mode rpm must not fall back on them. */
+	const uint32_t curves_file = (uint32_t)(ctx->curves.len / sizeof(c_conf_curve_ty));
+	for (unsigned int i = 0; i < LEN(c_conf_curves_builtin); ++i) {
+		if (c_conf_find(ctx, &ctx->curves, sizeof(c_conf_curve_ty), c_conf_curves_builtin[i].name) != C_CONF_NONE)
+			continue;
+		const c_curve_ty *curve = c_conf_curves_builtin[i].curve;
+		c_conf_curve_ty c = { 0, (uint32_t)(ctx->points.len / sizeof(c_point_ty)), curve->len };
+		if (c_conf_str_add(ctx, c_conf_curves_builtin[i].name, &c.name) == -1
+		    || c_conf_add(ctx, &ctx->points, curve->points, curve->len * sizeof(c_point_ty)) == -1
+		    || c_conf_add(ctx, &ctx->curves, &c, sizeof(c)) == -1)
+			return -1;
+	}
+	if (ctx->curve_default != C_CONF_NONE) {
+		ctx->line = ctx->curve_default_line;
+		const uint32_t name = ctx->curve_default;
+		ctx->curve_default = c_conf_find(ctx, &ctx->curves, sizeof(c_conf_curve_ty), c_conf_str(ctx, name));
+		if (ctx->curve_default == C_CONF_NONE)
+			return c_conf_error(ctx, "unknown curve: %s.", c_conf_str(ctx, name));
+	} else {
+		for (unsigned int i = 0; i < LEN(c_conf_curves_builtin); ++i)
+			if (c_conf_curves_builtin[i].curve == FAN_CURVE_DEFAULT)
+				ctx->curve_default = c_conf_find(ctx, &ctx->curves, sizeof(c_conf_curve_ty), c_conf_curves_builtin[i].name);
+		if (ctx->curve_default == C_CONF_NONE)
+			ctx->curve_default = 0;
+	}
+	if (ctx->temp_cpu != C_CONF_NONE) {
+		ctx->line = ctx->temp_cpu_line;
+		const uint32_t name = ctx->temp_cpu;
+		ctx->temp_cpu = c_conf_find(ctx, &ctx->temps, sizeof(c_conf_temp_ty), c_conf_str(ctx, name));
+		if (ctx->temp_cpu == C_CONF_NONE)
+			return c_conf_error(ctx, "unknown temp: %s.", c_conf_str(ctx, name));
+	}
+	ctx->line = 0;
+	if (ctx->fans.len == 0)
+		return c_conf_error(ctx, "no fan is configured.");
+	/* Without zones, every fan follows every temperature. */
+	if (ctx->zones_src.len == 0) {
+		c_conf_zone_src_ty z = { 0, C_CONF_NONE, C_CONF_NONE, C_CONF_NONE, C_CONF_NONE, 0 };
+		if (c_conf_str_add(ctx, "all", &z.name) == -1 || c_conf_str_add(ctx, "*", &z.temps) == -1 || c_conf_str_add(ctx, "*", &z.fans) == -1)
+			return -1;
+		if (c_conf_add(ctx, &ctx->zones_src, &z, sizeof(z)) == -1)
+			return -1;
+	}
+	for (size_t i = 0; i < ctx->zones_src.len / sizeof(c_conf_zone_src_ty); ++i)
+		if (c_conf_zone_resolve(ctx, (const c_conf_zone_src_ty *)ctx->zones_src.p + i) == -1)
+			return -1;
+	ctx->line = 0;
+	/* A fan in no zone would be left in manual mode without control. */
+	const unsigned int fans_len = (unsigned int)(ctx->fans.len / sizeof(c_conf_fan_ty));
+	for (unsigned int f = 0; f < fans_len; ++f) {
+		unsigned int owners = 0;
+		for (size_t i = 0; i < ctx->zones.len / sizeof(c_conf_zone_ty); ++i) {
+			const c_conf_zone_ty *z = (const c_conf_zone_ty *)ctx->zones.p + i;
+			for (unsigned int j = 0; j < C_ZONE_LEN(z->fans_len, fans_len); ++j)
+				owners += (C_ZONE_AT((const uint32_t *)ctx->idx.p + z->fans, z->fans_len, j) == f);
+		}
+		if (owners != 1)
+			return c_conf_error(ctx, "fan %s must belong to exactly one zone.", c_conf_str(ctx, ((const c_conf_fan_ty *)ctx->fans.p)[f].name));
+	}
+	if ((msg = c_conf_param_check(&ctx->param)))
+		return c_conf_error(ctx, "%s", msg);
+	if (ctx->param.mode == CONTROL_RPM) {
+		if (ctx->curve_default >= curves_file)
+			return c_conf_error(ctx, "mode rpm needs default_curve naming a curve in RPM.");
+		for (size_t i = 0; i < ctx->zones.len / sizeof(c_conf_zone_ty); ++i) {
+			const c_conf_zone_ty *z = (const c_conf_zone_ty *)ctx->zones.p + i;
+			if (z->curve != C_CONF_NONE && z->curve >= curves_file)
+				return c_conf_error(ctx, "zone %s: mode rpm needs a curve in RPM.", c_conf_str(ctx, z->name));
+		}
+		for (unsigned int f = 0; f < fans_len; ++f)
+			if (((const c_conf_fan_ty *)ctx->fans.p)[f].tach == C_CONF_NONE)
+				return c_conf_error(ctx, "fan %s needs tach= in mode rpm.", c_conf_str(ctx, ((const c_conf_fan_ty *)ctx->fans.p)[f].name));
+	} else {
+		for (size_t i = 0; i < ctx->points.len / sizeof(c_point_ty); ++i)
+			if (((const c_point_ty *)ctx->points.p)[i].speed > 255)
+				return c_conf_error(ctx, "curve speeds above 255 are RPM, for mode rpm only.");
+	}
+	return 0;
+}
+
+static void
+c_conf_ctx_free(c_conf_ctx_ty *ctx)
+{
+	c_conf_buf_ty *bufs[] = { &ctx->temps, &ctx->fans, &ctx->points, &ctx->curves, &ctx->zones, &ctx->idx, &ctx->fns, &ctx->str, &ctx->zones_src };
+	for (unsigned int i = 0; i < LEN(bufs); ++i)
+		free(bufs[i]->p);
+}
+
+/* Compile the text of a configuration file into a malloc'd image.
+ * st identifies the file, for checking the cache later, and may be NULL.
+ * fn_names lists the temperature functions zones may use, terminated
+ * by a NULL name. On error, return -1 and write "file:line: reason"
+ * to err. */
+static int
+c_conf_compile(const char *filename, const char *text, size_t text_len, const struct stat *st, const c_fn_name_ty *fn_names, void **img, size_t *img_sz, char *err, size_t err_sz)
+{
+	c_conf_ctx_ty ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	const c_param_ty param = C_PARAM_DEFAULT;
+	ctx.param = param;
+	ctx.filename = filename;
+	ctx.err = err;
+	ctx.err_sz = err_sz;
+	ctx.fn_names = fn_names;
+	ctx.temp_cpu = C_CONF_NONE;
+	ctx.curve_default = C_CONF_NONE;
+	ctx.metrics = C_CONF_NONE;
+	char *copy = (char *)malloc(text_len + 1);
+	if (unlikely(copy == NULL))
+		return c_conf_error(&ctx, "out of memory.");
+	memcpy(copy, text, text_len);
+	copy[text_len] = '\0';
+	int ret = 0;
+	char *line = copy;
+	for (char *next; line; line = next) {
+		++ctx.line;
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		if ((ret = c_conf_line_parse(&ctx, line)) == -1)
+			break;
+	}
+	free(copy);
+	if (ret == -1 || (ret = c_conf_finish(&ctx)) == -1) {
+		c_conf_ctx_free(&ctx);
+		return -1;
+	}
+	/* Lay out the sections after the header, 8-byte aligned. */
+	c_conf_hdr_ty hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	struct {
+		c_conf_sec_ty *sec;
+		const c_conf_buf_ty *buf;
+		size_t elem;
+	} secs[] = {
+		{ &hdr.temps, &ctx.temps, sizeof(c_conf_temp_ty) },
+		{ &hdr.fans, &ctx.fans, sizeof(c_conf_fan_ty) },
+		{ &hdr.points, &ctx.points, sizeof(c_point_ty) },
+		{ &hdr.curves, &ctx.curves, sizeof(c_conf_curve_ty) },
+		{ &hdr.zones, &ctx.zones, sizeof(c_conf_zone_ty) },
+		{ &hdr.idx, &ctx.idx, sizeof(uint32_t) },
+		{ &hdr.fns, &ctx.fns, sizeof(uint32_t) },
+		{ &hdr.str, &ctx.str, 1 },
+	};
+	size_t size = sizeof(hdr);
+	for (unsigned int i = 0; i < LEN(secs); ++i) {
+		size = (size + 7) & ~(size_t)7;
+		secs[i].sec->off = (uint32_t)size;
+		secs[i].sec->len = (uint32_t)(secs[i].buf->len / secs[i].elem);
+		size += secs[i].buf->len;
+	}
+	if (unlikely(size > UINT32_MAX)) {
+		c_conf_ctx_free(&ctx);
+		return c_conf_error(&ctx, "too large.");
+	}
+	memcpy(hdr.magic, C_CONF_MAGIC, sizeof(hdr.magic));
+	hdr.version = C_CONF_VERSION;
+	hdr.size = (uint32_t)size;
+	hdr.build = c_conf_build_hash();
+	if (st) {
+		hdr.src_dev = (uint64_t)st->st_dev;
+		hdr.src_ino = (uint64_t)st->st_ino;
+		hdr.src_size = (uint64_t)st->st_size;
+		hdr.src_mtime_sec = (int64_t)st->st_mtim.tv_sec;
+		hdr.src_mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+	}
+	hdr.param = ctx.param;
+	hdr.temp_cpu = ctx.temp_cpu;
+	hdr.curve_default = ctx.curve_default;
+	hdr.metrics = ctx.metrics;
+	hdr.metrics_s = ctx.metrics_s;
+	char *p = (char *)calloc(1, size);
+	if (unlikely(p == NULL)) {
+		c_conf_ctx_free(&ctx);
+		return c_conf_error(&ctx, "out of memory.");
+	}
+	memcpy(p, &hdr, sizeof(hdr));
+	for (unsigned int i = 0; i < LEN(secs); ++i)
+		if (secs[i].buf->len)
+			memcpy(p + secs[i].sec->off, secs[i].buf->p, secs[i].buf->len);
+	c_conf_ctx_free(&ctx);
+	*img = p;
+	*img_sz = size;
+	return 0;
+}
+
+static ATTR_INLINE int
+c_conf_sec_check(const c_conf_sec_ty *sec, size_t elem, size_t size)
+{
+	return (sec->off % 8 == 0 && sec->off <= size && sec->len <= (size - sec->off) / elem) ? 0 : -1;
+}
+
+static void
+c_conf_free(c_conf_ty *conf);
+
+/* Check an image and fill in conf from it. The image must outlive conf.
+ * fn_names is as for c_conf_compile(). */
+static int
+c_conf_from_img(c_conf_ty *conf, const void *img, size_t img_sz, const c_fn_name_ty *fn_names, char *err, size_t err_sz)
+{
+#define C_CONF_BAD(what)                                           \
+	do {                                                       \
+		snprintf(err, err_sz, "corrupt image: %s.", (what)); \
+		goto fail;                                         \
+	} while (0)
+	const char *base = (const char *)img;
+	const c_conf_hdr_ty *hdr = (const c_conf_hdr_ty *)img;
+	memset(conf, 0, sizeof(*conf));
+	if (img_sz < sizeof(*hdr) || memcmp(hdr->magic, C_CONF_MAGIC, sizeof(hdr->magic)))
+		C_CONF_BAD("magic");
+	if (hdr->version != C_CONF_VERSION || hdr->build != c_conf_build_hash())
+		C_CONF_BAD("built by another version");
+	if (hdr->size != img_sz)
+		C_CONF_BAD("size");
+	if (c_conf_sec_check(&hdr->temps, sizeof(c_conf_temp_ty), img_sz) || c_conf_sec_check(&hdr->fans, sizeof(c_conf_fan_ty), img_sz)
+	    || c_conf_sec_check(&hdr->points, sizeof(c_point_ty), img_sz) || c_conf_sec_check(&hdr->curves, sizeof(c_conf_curve_ty), img_sz)
+	    || c_conf_sec_check(&hdr->zones, sizeof(c_conf_zone_ty), img_sz) || c_conf_sec_check(&hdr->idx, sizeof(uint32_t), img_sz)
+	    || c_conf_sec_check(&hdr->fns, sizeof(uint32_t), img_sz) || c_conf_sec_check(&hdr->str, 1, img_sz))
+		C_CONF_BAD("section out of bounds");
+	const char *str = base + hdr->str.off;
+	if (hdr->str.len == 0 || str[hdr->str.len - 1] != '\0')
+		C_CONF_BAD("string pool");
+#define C_CONF_STR(off) (((off) < hdr->str.len) ? str + (off) : NULL)
+	const c_conf_temp_ty *temps = (const c_conf_temp_ty *)(base + hdr->temps.off);
+	const c_conf_fan_ty *fans = (const c_conf_fan_ty *)(base + hdr->fans.off);
+	const c_point_ty *points = (const c_point_ty *)(base + hdr->points.off);
+	const c_conf_curve_ty *curves = (const c_conf_curve_ty *)(base + hdr->curves.off);
+	const c_conf_zone_ty *zones = (const c_conf_zone_ty *)(base + hdr->zones.off);
+	const uint32_t *idx = (const uint32_t *)(base + hdr->idx.off);
+	const uint32_t *fns = (const uint32_t *)(base + hdr->fns.off);
+	const char *msg;
+	if ((msg = c_conf_param_check(&hdr->param)))
+		C_CONF_BAD(msg);
+	if (hdr->fans.len == 0 || hdr->curves.len == 0 || hdr->zones.len == 0)
+		C_CONF_BAD("empty table");
+	if (hdr->curve_default >= hdr->curves.len || (hdr->temp_cpu != C_CONF_NONE && hdr->temp_cpu >= hdr->temps.len))
+		C_CONF_BAD("index");
+	conf->param = hdr->param;
+	conf->temps_len = hdr->temps.len;
+	conf->temp_cpu = hdr->temp_cpu;
+	conf->fans_len = hdr->fans.len;
+	conf->curves_len = hdr->curves.len;
+	conf->curve_default = hdr->curve_default;
+	conf->metrics = (hdr->metrics == C_CONF_NONE) ? NULL : C_CONF_STR(hdr->metrics);
+	conf->metrics_s = hdr->metrics_s;
+	if (hdr->metrics != C_CONF_NONE && (conf->metrics == NULL || conf->metrics_s == 0))
+		C_CONF_BAD("metrics");
+	conf->zones_len = hdr->zones.len;
+	conf->temps = (const char **)calloc(conf->temps_len + 1, sizeof(char *));
+	conf->temp_names = (const char **)calloc(conf->temps_len + 1, sizeof(char *));
+	unsigned char *temps_flags = (unsigned char *)calloc(conf->temps_len + 1, 1);
+	conf->temps_flags = temps_flags;
+	conf->fans = (const char **)calloc(conf->fans_len, sizeof(char *));
+	conf->fans_enable = (const char **)calloc(conf->fans_len, sizeof(char *));
+	conf->fans_tach = (const char **)calloc(conf->fans_len, sizeof(char *));
+	conf->fan_names = (const char **)calloc(conf->fans_len, sizeof(char *));
+	conf->curves = (c_curve_ty *)calloc(conf->curves_len, sizeof(c_curve_ty));
+	conf->curve_names = (const char **)calloc(conf->curves_len, sizeof(char *));
+	c_zone_ty *zs = (c_zone_ty *)calloc(conf->zones_len, sizeof(c_zone_ty));
+	conf->zones = zs;
+	conf->fn_temps = (fn_temp *)calloc(hdr->fns.len + 1, sizeof(fn_temp));
+	conf->inits = (fn_temp_init *)calloc(hdr->fns.len + 1, sizeof(fn_temp_init));
+	if (unlikely(!conf->temps || !conf->temp_names || !temps_flags || !conf->fans || !conf->fans_enable || !conf->fans_tach || !conf->fan_names || !conf->curves || !conf->curve_names || !zs || !conf->fn_temps || !conf->inits)) {
+		snprintf(err, err_sz, "out of memory.");
+		goto fail;
+	}
+	for (unsigned int i = 0; i < conf->temps_len; ++i) {
+		conf->temp_names[i] = C_CONF_STR(temps[i].name);
+		temps_flags[i] = (unsigned char)temps[i].flags;
+		conf->temps[i] = C_CONF_STR(temps[i].path);
+		if (!conf->temp_names[i] || !conf->temps[i])
+			C_CONF_BAD("temp");
+	}
+	for (unsigned int i = 0; i < conf->fans_len; ++i) {
+		conf->fan_names[i] = C_CONF_STR(fans[i].name);
+		conf->fans[i] = C_CONF_STR(fans[i].pwm);
+		conf->fans_enable[i] = (fans[i].enable == C_CONF_NONE) ? NULL : C_CONF_STR(fans[i].enable);
+		conf->fans_tach[i] = (fans[i].tach == C_CONF_NONE) ? NULL : C_CONF_STR(fans[i].tach);
+		if (!conf->fan_names[i] || !conf->fans[i] || (fans[i].enable != C_CONF_NONE && !conf->fans_enable[i]) || (fans[i].tach != C_CONF_NONE && !conf->fans_tach[i]))
+			C_CONF_BAD("fan");
+	}
+	for (unsigned int i = 0; i < conf->curves_len; ++i) {
+		conf->curve_names[i] = C_CONF_STR(curves[i].name);
+		if (!conf->curve_names[i] || curves[i].points > hdr->points.len || curves[i].len > hdr->points.len - curves[i].points)
+			C_CONF_BAD("curve");
+		conf->curves[i].points = points + curves[i].points;
+		conf->curves[i].len = curves[i].len;
+		if (c_curve_check(conf->curves + i) == -1)
+			C_CONF_BAD("curve");
+	}
+	for (unsigned int i = 0, fn_i = 0; i < conf->zones_len; ++i) {
+		const c_conf_zone_ty *src = zones + i;
+		c_zone_ty *z = zs + i;
+		z->name = C_CONF_STR(src->name);
+		if (!z->name || (src->curve != C_CONF_NONE && src->curve >= conf->curves_len))
+			C_CONF_BAD("zone");
+		z->curve = (src->curve == C_CONF_NONE) ? NULL : conf->curves + src->curve;
+		if ((src->temps_len != C_ZONE_ALL_LEN && (src->temps > hdr->idx.len || src->temps_len > hdr->idx.len - src->temps))
+		    || (src->fans_len != C_ZONE_ALL_LEN && (src->fans > hdr->idx.len || src->fans_len > hdr->idx.len - src->fans))
+		    || src->fns > hdr->fns.len || src->fns_len > hdr->fns.len - src->fns)
+			C_CONF_BAD("zone");
+		z->temps = (src->temps_len == C_ZONE_ALL_LEN) ? NULL : idx + src->temps;
+		z->temps_len = src->temps_len;
+		z->fans = (src->fans_len == C_ZONE_ALL_LEN) ? NULL : idx + src->fans;
+		z->fans_len = src->fans_len;
+		for (unsigned int j = 0; j < C_ZONE_LEN(z->temps_len, conf->temps_len); ++j)
+			if (C_ZONE_AT(z->temps, z->temps_len, j) >= conf->temps_len)
+				C_CONF_BAD("zone temp");
+		for (unsigned int j = 0; j < C_ZONE_LEN(z->fans_len, conf->fans_len); ++j)
+			if (C_ZONE_AT(z->fans, z->fans_len, j) >= conf->fans_len)
+				C_CONF_BAD("zone fan");
+		z->fn_temps = conf->fn_temps + fn_i;
+		z->fn_temps_len = src->fns_len;
+		for (unsigned int j = 0; j < src->fns_len; ++j, ++fn_i) {
+			const char *name = C_CONF_STR(fns[src->fns + j]);
+			const c_fn_name_ty *f = fn_names;
+			while (name && f && f->name && strcmp(f->name, name))
+				++f;
+			/* Built with a different set of functions. */
+			if (!name || !f || !f->name)
+				C_CONF_BAD("unknown temperature function");
+			conf->fn_temps[fn_i] = f->fn;
+			if (f->init) {
+				unsigned int k = 0;
+				while (k < conf->inits_len && conf->inits[k] != f->init)
+					++k;
+				if (k == conf->inits_len)
+					conf->inits[conf->inits_len++] = f->init;
+			}
+		}
+	}
+	conf->img = img;
+	conf->img_sz = img_sz;
+	return 0;
+fail:
+	c_conf_free(conf);
+	return -1;
+#undef C_CONF_STR
+#undef C_CONF_BAD
+}
+
+/* Free what c_conf_from_img() allocated, and the image it owns, if any. */
+static void
+c_conf_free(c_conf_ty *conf)
+{
+	free(conf->temps);
+	free(conf->temp_names);
+	free((void *)conf->temps_flags);
+	free(conf->fans);
+	free(conf->fans_enable);
+	free(conf->fans_tach);
+	free(conf->fan_names);
+	free(conf->curves);
+	free(conf->curve_names);
+	free((void *)conf->zones);
+	free(conf->fn_temps);
+	free(conf->inits);
+	if (conf->img_mapped)
+		munmap((void *)conf->img, conf->img_sz);
+	else
+		free((void *)conf->img);
+	memset(conf, 0, sizeof(*conf));
+}
+
+/* Map the cache of the file identified by st, if it was compiled from it. */
+static int
+c_conf_cache_map(c_conf_ty *conf, const char *cache, const struct stat *st, const c_fn_name_ty *fn_names)
+{
+	char err[C_CONF_ERR_LEN];
+	int fd = open(cache, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	struct stat cst;
+	if (fstat(fd, &cst) == -1 || (size_t)cst.st_size < sizeof(c_conf_hdr_ty)) {
+		close(fd);
+		return -1;
+	}
+	void *img = mmap(NULL, (size_t)cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (img == MAP_FAILED)
+		return -1;
+	const c_conf_hdr_ty *hdr = (const c_conf_hdr_ty *)img;
+	if (hdr->src_dev != (uint64_t)st->st_dev || hdr->src_ino != (uint64_t)st->st_ino || hdr->src_size != (uint64_t)st->st_size
+	    || hdr->src_mtime_sec != (int64_t)st->st_mtim.tv_sec || hdr->src_mtime_nsec != (int64_t)st->st_mtim.tv_nsec) {
+		DBG(fprintf(stderr, "%s:%d:%s: %s is stale.\n", __FILE__, __LINE__, ASSERT_FUNC, cache));
+		munmap(img, (size_t)cst.st_size);
+		return -1;
+	}
+	if (c_conf_from_img(conf, img, (size_t)cst.st_size, fn_names, err, sizeof(err)) == -1) {
+		DBG(fprintf(stderr, "%s:%d:%s: %s: %s\n", __FILE__, __LINE__, ASSERT_FUNC, cache, err));
+		munmap(img, (size_t)cst.st_size);
+		return -1;
+	}
+	conf->img_mapped = 1;
+	return 0;
+}
+
+/* Replace the cache atomically, so a concurrent start never maps half of it. */
+static int
+c_conf_cache_write(const char *cache, const void *img, size_t img_sz)
+{
+	char tmp[PATH_MAX];
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", cache) >= (int)sizeof(tmp))
+		return -1;
+	int fd = mkstemp(tmp);
+	if (fd == -1)
+		return -1;
+	const int ok = (fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == 0 && write(fd, img, img_sz) == (ssize_t)img_sz);
+	/* Once only: the fd is gone even if close() fails. */
+	if ((close(fd) == -1) | !ok) {
+		unlink(tmp);
+		return -1;
+	}
+	if (rename(tmp, cache) == -1) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+/* Load a configuration file, through its cache when it is up to date.
+ * On error, return -1 with errno set if the file could not be read, and
+ * the reason in err. */
+static int
+c_conf_load(c_conf_ty *conf, const char *filename, const c_fn_name_ty *fn_names, char *err, size_t err_sz)
+{
+	char cache[PATH_MAX];
+	struct stat st;
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		const int e = errno;
+		snprintf(err, err_sz, "%s: %s.", filename, strerror(e));
+		if (fd != -1)
+			close(fd);
+		errno = e;
+		return -1;
+	}
+	if (snprintf(cache, sizeof(cache), "%s.cache", filename) >= (int)sizeof(cache))
+		cache[0] = '\0';
+	if (cache[0] && c_conf_cache_map(conf, cache, &st, fn_names) == 0) {
+		close(fd);
+		DBG(fprintf(stderr, "%s:%d:%s: using %s.\n", __FILE__, __LINE__, ASSERT_FUNC, cache));
+		return 0;
+	}
+	char *text = (char *)malloc((size_t)st.st_size + 1);
+	if (unlikely(text == NULL)) {
+		close(fd);
+		snprintf(err, err_sz, "%s: out of memory.", filename);
+		return -1;
+	}
+	ssize_t len = 0;
+	for (ssize_t n; len < st.st_size; len += n) {
+		n = read(fd, text + len, (size_t)(st.st_size - len));
+		if (n == -1 && errno == EINTR) {
+			n = 0;
+			continue;
+		}
+		if (n <= 0)
+			break;
+	}
+	close(fd);
+	void *img = NULL;
+	size_t img_sz = 0;
+	const int ret = c_conf_compile(filename, text, (size_t)len, &st, fn_names, &img, &img_sz, err, err_sz);
+	free(text);
+	if (ret == -1)
+		return -1;
+	if (c_conf_from_img(conf, img, img_sz, fn_names, err, err_sz) == -1) {
+		free(img);
+		return -1;
+	}
+	/* A read-only directory only costs the next start a parse. */
+	if (cache[0] && c_conf_cache_write(cache, img, img_sz) == -1) {
+		DBG(fprintf(stderr, "%s:%d:%s: can't write %s.\n", __FILE__, __LINE__, ASSERT_FUNC, cache));
+	}
+	errno = 0;
+	return 0;
+}
+
+#endif /* CONF_H */
@@ -1,13 +1,35 @@
 #ifndef CONFIG_H
 #	define CONFIG_H 1
 
+#	include "curve.h"
+
 /* Monitor Nvidia GPU with NVML. (Uncomment to enable)
  * For open-Source drivers, where you can use monitor temperature through
- * sysfs, place the path to the temperature file in table-temp.h. */
+ * sysfs, name the temperature file in the configuration file. */
 #	define USE_CUDA 1
+/* GPUs are sampled every NV_SAMPLE_MS by a thread of their own, and one not
+ * sampled for NV_STALE_MS, e.g. because the driver hangs, is taken to be at
+ * NV_STALE_TEMP. (msecs, degrees) */
+#	define NV_SAMPLE_MS 500
+#	define NV_STALE_MS 5000
+#	define NV_STALE_TEMP 100
+/* Read all sysfs temperature files in one batch through io_uring, instead of
+ * one pread at a time. Falls back to pread if io_uring is not available.
+ * (Comment out to disable) */
+#	define USE_IO_URING 1
+/* Write the fans from a thread of their own, so that a slow Super I/O or
+ * SMBus chip does not hold up the loop. (Comment out to disable) */
+#	define USE_ACTUATOR 1
 /* How often to update. (secs) */
 #	define INTERVAL_UPDATE 1
-/* Maximum fan speed change per update when ramping down (0-255). */
+/* Bounds of the adaptive update interval. The interval stretches up to
+ * INTERVAL_MAX_MS while the temperature is flat at the bottom of the curve,
+ * and shrinks down to INTERVAL_MIN_MS while it is changing fast. (msecs) */
+#	define INTERVAL_MIN_MS 100
+#	define INTERVAL_MAX_MS 10000
+/* Temperature change that is considered fast. (degrees per sec) */
+#	define SLOPE_FAST 2
+/* Maximum fan speed change per INTERVAL_UPDATE when ramping down (0-255). */
 #	define STEPDOWN_MAX 8
 /* Amount of seconds to wait before significantly ramping up in fan speed. */
 #	define SPIKE_MAX 3
@@ -15,277 +37,116 @@
 #	define FANSPEED_DEFAULT 60
 /* Set temperature to allow fans to instantly ramp up signifcantly. */
 #	define SPIKE_TEMP_MAX 70
-#	define FAN_CURVE_DEFAULT c_table_temptospeed_med
+/* Degrees a falling temperature must drop before the fan speed follows.
+ * Avoids rewriting the fans while the temperature dithers. (0 to disable) */
+#	define HYSTERESIS 2
+#	define FAN_CURVE_DEFAULT (&c_table_temptospeed_med)
+
+/* How fan speed is derived from temperature:
+ * CONTROL_CURVE: look up the fan curve and ramp with STEPDOWN_MAX and SPIKE_MAX.
+ * CONTROL_PID: hold PID_SETPOINT with a PID controller, between the minimum
+ *              and maximum speed of the fan curve. (Also selected by --pid) */
+#	define CONTROL_CURVE 0
+#	define CONTROL_PID 1
+#	define CONTROL_MODE CONTROL_CURVE
+/* CONTROL_RPM: curves are in RPM, and each fan's PWM is corrected from its
+ *              tachometer until it turns at that speed. (mode rpm in the
+ *              configuration file, where every fan needs tach=) */
+#	define CONTROL_RPM 2
+/* Share of the RPM error corrected per update (0-1). */
+#	define RPM_GAIN 0.5
+/* A fan driven at STALL_SPEED_MIN (0-255) or faster that turns slower than
+ * RPM_STALL for STALL_MS (msecs) is stalled. It is driven at full speed to
+ * restart it, and the other fans of its zone make up for it. */
+#	define RPM_STALL 200
+#	define STALL_SPEED_MIN 100
+#	define STALL_MS 5000
+/* While every zone idles at the bottom of its curve, sleep until an alarm
+ * sensor rises EVENT_BAND degrees or a thermal zone crosses a trip point,
+ * waking at least every EVENT_POLL_MS (msecs). Alarm sensors are marked
+ * with alarm in the configuration file. (0 to disable) */
+#	define EVENT_POLL_MS 0
+#	define EVENT_BAND 2
+/* Ramp early for a steady rise: follow the curve at the temperature
+ * projected PREDICT_MS ahead from the trend of the last PREDICT_WINDOW_MS.
+ * A spike that levels off is not projected. (msecs, 0 to disable) */
+#	define PREDICT_MS 0
+#	define PREDICT_WINDOW_MS 16000
+/* Ramp early for load: once tasks stall on the CPU for PSI_STALL_MS within
+ * PSI_WINDOW_MS, as reported by /proc/pressure/cpu, run the fans of the
+ * zones following a curve PSI_BIAS (0-255) above it, until PSI_HOLD_MS after
+ * the pressure last did so. (msecs, 0 to disable) */
+#	define PSI_STALL_MS 0
+#	define PSI_WINDOW_MS 1000
+#	define PSI_HOLD_MS 10000
+#	define PSI_BIAS 40
+/* Temperature to hold in CONTROL_PID. (degrees) */
+#	define PID_SETPOINT 75
+/* Fan speed (0-255) per degree of error. */
+#	define PID_KP 6.0
+/* Fan speed (0-255) per degree of error per sec. */
+#	define PID_KI 0.5
+/* Fan speed (0-255) per degree per sec of temperature change. */
+#	define PID_KD 10.0
+/* Smoothing of the derivative (0-1). Lower filters more. */
+#	define PID_D_ALPHA 0.3
+
+/* Runtime configuration. Without it, the values in this file are used, with
+ * the sensors and fans found at startup. (Overridden by --config) */
+#	define CFAN_CONF_PATH "/etc/cfan.conf"
 
 #	define CFAN_PATH "/tmp/cfan"
 #	define CFAN_FILE_CURVE "curve"
 #	define CFAN_FILE_LOCK "cfan.lock"
+/* Control socket, see cfan-ctl. */
+#	define CFAN_FILE_CTL "ctl"
+/* Flight recorder: the last REC_LEN ticks are kept in memory, and written
+ * to CFAN_REC_PATH by `cfan-ctl record` or when cfan crashes. */
+#	define REC_LEN 4096
+#	define CFAN_REC_PATH "/var/tmp/cfan.rec"
+/* Time given in all to the devices still missing at startup, as their
+ * drivers load, before cfan gives up. (msecs) */
+#	define DEVICE_WAIT_MS 10000
+/* Sysfs paths resolved during this boot, so that a restart does not scan
+ * /sys/class/hwmon and /sys/class/thermal again. */
+#	define CFAN_PATHS_CACHE "/var/tmp/cfan.paths"
+/* The limits of the sensors marked alarm, as they were before cfan moved
+ * them, so that a start after cfan was killed puts them back. */
+#	define CFAN_ALARM_PATH "/var/tmp/cfan.alarm"
+/* Seconds between rewrites of the metrics textfile, when the configuration
+ * file asks for one with metrics PATH. */
+#	define METRICS_S 15
 
 #	define CFAN_PRINT_TEMP_CPU 1
 #	define CFAN_FILE_TEMP_CPU "temp_cpu"
 
-/* Fan speed: 0-255
- * c_table_temptospeed[temperature] = speed */
-static const unsigned char c_table_temptospeed_med[] = {
+/* Fan speed: 0-255, temperature: millidegrees.
+ * Speed is interpolated between breakpoints, and held
+ * at the first and last speed outside of them. */
+static const c_point_ty c_table_temptospeed_med_points[] = {
 	/* 0-45c: min speed */
-	/* [0] = */ 51,
-	/* [1] = */ 51,
-	/* [2] = */ 51,
-	/* [3] = */ 51,
-	/* [4] = */ 51,
-	/* [5] = */ 51,
-	/* [6] = */ 51,
-	/* [7] = */ 51,
-	/* [8] = */ 51,
-	/* [9] = */ 51,
-	/* [10] = */ 51,
-	/* [11] = */ 51,
-	/* [12] = */ 51,
-	/* [13] = */ 51,
-	/* [14] = */ 51,
-	/* [15] = */ 51,
-	/* [16] = */ 51,
-	/* [17] = */ 51,
-	/* [18] = */ 51,
-	/* [19] = */ 51,
-	/* [20] = */ 51,
-	/* [21] = */ 51,
-	/* [22] = */ 51,
-	/* [23] = */ 51,
-	/* [24] = */ 51,
-	/* [25] = */ 51,
-	/* [26] = */ 51,
-	/* [27] = */ 51,
-	/* [28] = */ 51,
-	/* [29] = */ 51,
-	/* [30] = */ 51,
-	/* [31] = */ 51,
-	/* [32] = */ 51,
-	/* [33] = */ 51,
-	/* [34] = */ 51,
-	/* [35] = */ 51,
-	/* [36] = */ 51,
-	/* [37] = */ 51,
-	/* [38] = */ 51,
-	/* [39] = */ 51,
-	/* [40] = */ 51,
-	/* [41] = */ 51,
-	/* [42] = */ 51,
-	/* [43] = */ 51,
-	/* [44] = */ 51,
-	/* [45] = */ 51,
-
+	{ 45000, 51 },
 	/* 46-59c: low speed */
-	/* [46] = */ 55,
-	/* [47] = */ 60,
-	/* [48] = */ 68,
-	/* [49] = */ 73,
-	/* [50] = */ 79,
-	/* [51] = */ 84,
-	/* [52] = */ 90,
-	/* [53] = */ 95,
-	/* [54] = */ 101,
-	/* [55] = */ 106,
-	/* [56] = */ 112,
-	/* [57] = */ 117,
-	/* [58] = */ 123,
-	/* [59] = */ 128,
-
-	/* 60-69c: medium speed */
-	/* [60] = */ 134,
-	/* [61] = */ 139,
-	/* [62] = */ 145,
-	/* [63] = */ 150,
-	/* [64] = */ 156,
-	/* [65] = */ 161,
-	/* [66] = */ 167,
-	/* [67] = */ 172,
-	/* [68] = */ 178,
-	/* [69] = */ 183,
-
-	/* 70-80c: high speed */
-	/* [70] = */ 189,
-	/* [71] = */ 194,
-	/* [72] = */ 200,
-	/* [73] = */ 205,
-	/* [74] = */ 211,
-	/* [75] = */ 216,
-	/* [76] = */ 222,
-	/* [77] = */ 227,
-	/* [78] = */ 233,
-	/* [79] = */ 238,
-	/* [80] = */ 244,
-	/* [81] = */ 249,
-
-	/* 82-100c: max speed */
-	/* [82] = */ 255,
-	/* [83] = */ 255,
-	/* [84] = */ 255,
-	/* [85] = */ 255,
-	/* [86] = */ 255,
-	/* [87] = */ 255,
-	/* [88] = */ 255,
-	/* [89] = */ 255,
-	/* [90] = */ 255,
-	/* [91] = */ 255,
-	/* [92] = */ 255,
-	/* [93] = */ 255,
-	/* [94] = */ 255,
-	/* [95] = */ 255,
-	/* [96] = */ 255,
-	/* [97] = */ 255,
-	/* [98] = */ 255,
-	/* [99] = */ 255,
-	/* [100] = */ 255,
-	/* [101] = */ 255,
-	/* [102] = */ 255,
-	/* [103] = */ 255,
-	/* [104] = */ 255,
-	/* [105] = */ 255,
-	/* [106] = */ 255,
-	/* [107] = */ 255,
-	/* [108] = */ 255,
-	/* [109] = */ 255,
-	/* [110] = */ 255,
-	/* [111] = */ 255,
-	/* [112] = */ 255,
-	/* [113] = */ 255,
-	/* [114] = */ 255,
-	/* [115] = */ 255,
-	/* [116] = */ 255,
-	/* [117] = */ 255,
-	/* [118] = */ 255,
-	/* [119] = */ 255
+	{ 46000, 55 },
+	{ 47000, 60 },
+	{ 59000, 128 },
+	/* 60-81c: medium to high speed */
+	{ 81000, 249 },
+	/* 82+c: max speed */
+	{ 82000, 255 },
 };
 
-/* Fan speed: 0-255
- * c_table_temptospeed[temperature] = speed */
-static const unsigned char c_table_temptospeed_high[] = {
+/* Fan speed: 0-255, temperature: millidegrees. */
+static const c_point_ty c_table_temptospeed_high_points[] = {
 	/* 0-40c: min speed */
-	/* [0] = */ 51,
-	/* [1] = */ 51,
-	/* [2] = */ 51,
-	/* [3] = */ 51,
-	/* [4] = */ 51,
-	/* [5] = */ 51,
-	/* [6] = */ 51,
-	/* [7] = */ 51,
-	/* [8] = */ 51,
-	/* [9] = */ 51,
-	/* [10] = */ 51,
-	/* [11] = */ 51,
-	/* [12] = */ 51,
-	/* [13] = */ 51,
-	/* [14] = */ 51,
-	/* [15] = */ 51,
-	/* [16] = */ 51,
-	/* [17] = */ 51,
-	/* [18] = */ 51,
-	/* [19] = */ 51,
-	/* [20] = */ 51,
-	/* [21] = */ 51,
-	/* [22] = */ 51,
-	/* [23] = */ 51,
-	/* [24] = */ 51,
-	/* [25] = */ 51,
-	/* [26] = */ 51,
-	/* [27] = */ 51,
-	/* [28] = */ 51,
-	/* [29] = */ 51,
-	/* [30] = */ 51,
-	/* [31] = */ 51,
-	/* [32] = */ 51,
-	/* [33] = */ 51,
-	/* [34] = */ 51,
-	/* [35] = */ 51,
-	/* [36] = */ 51,
-	/* [37] = */ 51,
-	/* [38] = */ 51,
-	/* [39] = */ 51,
-	/* [40] = */ 51,
-
+	{ 40000, 51 },
 	/* 41-69c: linear ramp (approx +7 per degree) */
-	/* [41] = */ 58,
-	/* [42] = */ 65,
-	/* [43] = */ 72,
-	/* [44] = */ 79,
-	/* [45] = */ 86,
-	/* [46] = */ 93,
-	/* [47] = */ 100,
-	/* [48] = */ 107,
-	/* [49] = */ 114,
-	/* [50] = */ 121,
-	/* [51] = */ 128,
-	/* [52] = */ 135,
-	/* [53] = */ 142,
-	/* [54] = */ 149,
-	/* [55] = */ 156,
-	/* [56] = */ 163,
-	/* [57] = */ 170,
-	/* [58] = */ 177,
-	/* [59] = */ 184,
-	/* [60] = */ 191,
-	/* [61] = */ 198,
-	/* [62] = */ 205,
-	/* [63] = */ 212,
-	/* [64] = */ 219,
-	/* [65] = */ 226,
-	/* [66] = */ 233,
-	/* [67] = */ 240,
-	/* [68] = */ 247,
-	/* [69] = */ 254,
-
+	{ 69000, 254 },
 	/* 70+c: max speed */
-	/* [70] = */ 255,
-	/* [71] = */ 255,
-	/* [72] = */ 255,
-	/* [73] = */ 255,
-	/* [74] = */ 255,
-	/* [75] = */ 255,
-	/* [76] = */ 255,
-	/* [77] = */ 255,
-	/* [78] = */ 255,
-	/* [79] = */ 255,
-	/* [80] = */ 255,
-	/* [81] = */ 255,
-	/* [82] = */ 255,
-	/* [83] = */ 255,
-	/* [84] = */ 255,
-	/* [85] = */ 255,
-	/* [86] = */ 255,
-	/* [87] = */ 255,
-	/* [88] = */ 255,
-	/* [89] = */ 255,
-	/* [90] = */ 255,
-	/* [91] = */ 255,
-	/* [92] = */ 255,
-	/* [93] = */ 255,
-	/* [94] = */ 255,
-	/* [95] = */ 255,
-	/* [96] = */ 255,
-	/* [97] = */ 255,
-	/* [98] = */ 255,
-	/* [99] = */ 255,
-	/* [100] = */ 255,
-	/* [101] = */ 255,
-	/* [102] = */ 255,
-	/* [103] = */ 255,
-	/* [104] = */ 255,
-	/* [105] = */ 255,
-	/* [106] = */ 255,
-	/* [107] = */ 255,
-	/* [108] = */ 255,
-	/* [109] = */ 255,
-	/* [110] = */ 255,
-	/* [111] = */ 255,
-	/* [112] = */ 255,
-	/* [113] = */ 255,
-	/* [114] = */ 255,
-	/* [115] = */ 255,
-	/* [116] = */ 255,
-	/* [117] = */ 255,
-	/* [118] = */ 255,
-	/* [119] = */ 255
+	{ 70000, 255 },
 };
 
+static const c_curve_ty c_table_temptospeed_med = C_CURVE(c_table_temptospeed_med_points);
+static const c_curve_ty c_table_temptospeed_high = C_CURVE(c_table_temptospeed_high_points);
+
 #endif /* CONFIG_H */
@@ -1,4 +1,6 @@
 # NVML (uncomment to disable)
 LIB_CUDA = /opt/cuda/lib64
-# LDFLAGS_CUDA = -L$(LIB_CUDA) -lnvidia-ml
+# LDFLAGS_CUDA = -L$(LIB_CUDA) -lnvidia-ml -pthread
 # REQ_CUDA = gpu-nvidia.h
+# For USE_ACTUATOR in config.h.
+LDFLAGS_ACTUATOR = -pthread
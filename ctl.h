@@ -0,0 +1,198 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2026 James Tirta Halim <tirtajames45 at gmail dot com> */
+
+#ifndef CTL_H
+#define CTL_H 1
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "macros.h"
+#include "event.h"
+
+/* Control socket. Clients send newline-terminated commands over a
+ * SOCK_STREAM unix socket and get one reply per command. Everything is
+ * non-blocking and served from the main loop's epoll set: the listening
+ * socket as C_EV_CTL, and client slot i as C_EV_NUM + i. */
+
+#define C_CTL_CLIENTS_MAX 8
+#define C_CTL_LINE_MAX    256
+#define C_CTL_REPLY_MAX   16384
+
+typedef struct {
+	int fd;
+	unsigned int len;
+	char buf[C_CTL_LINE_MAX];
+} c_ctl_client_ty;
+
+/* Handle one command, without the newline, and write the reply to reply.
+ * Return the length of the reply. */
+typedef unsigned int (*c_ctl_fn)(char *line, char *reply, unsigned int reply_sz);
+
+static int c_ctl_fd = -1;
+static c_ctl_client_ty c_ctl_clients[C_CTL_CLIENTS_MAX];
+
+static int
+c_ctl_init(const char *path)
+{
+	struct sockaddr_un addr;
+	for (unsigned int i = 0; i < C_CTL_CLIENTS_MAX; ++i)
+		c_ctl_clients[i].fd = -1;
+	if (unlikely(strlen(path) >= sizeof(addr.sun_path))) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	c_ctl_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (unlikely(c_ctl_fd == -1))
+		return -1;
+	/* Left behind by a crash, since the lock file is checked first. */
+	(void)unlink(path);
+	/* Controlling the fans is for root only, from the moment the socket
+	 * exists, not from the chmod() after. */
+	const mode_t mask = umask(S_IRWXG | S_IRWXO);
+	const int ret = bind(c_ctl_fd, (const struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+	if (unlikely(ret == -1))
+		return -1;
+	if (unlikely(chmod(path, S_IRUSR | S_IWUSR) == -1))
+		return -1;
+	if (unlikely(listen(c_ctl_fd, C_CTL_CLIENTS_MAX) == -1))
+		return -1;
+	return c_ev_add(c_ctl_fd, EPOLLIN, C_EV_CTL);
+}
+
+/* Return 1 if the peer of fd runs as the user of cfan, or as root. */
+static int
+c_ctl_peer_ok(int fd)
+{
+	/* struct ucred, which glibc hides without _GNU_SOURCE. */
+	struct {
+		int32_t pid;
+		uint32_t uid;
+		uint32_t gid;
+	} cred;
+	socklen_t len = sizeof(cred);
+	if (unlikely(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1 || len != sizeof(cred)))
+		return 0;
+	return cred.uid == 0 || cred.uid == (uint32_t)geteuid();
+}
+
+static void
+c_ctl_close(unsigned int slot)
+{
+	c_ctl_client_ty *c = c_ctl_clients + slot;
+	if (c->fd == -1)
+		return;
+	/* Closing also removes it from the epoll set. */
+	close(c->fd);
+	c->fd = -1;
+	c->len = 0;
+}
+
+static void
+c_ctl_accept(void)
+{
+	for (;;) {
+		const int fd = accept(c_ctl_fd, NULL, NULL);
+		if (fd == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+				DBG(fprintf(stderr, "%s:%d:%s: accept failed.\n", __FILE__, __LINE__, ASSERT_FUNC));
+			}
+			errno = 0;
+			return;
+		}
+		if (unlikely(fcntl(fd, F_SETFL, O_NONBLOCK) == -1 || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)) {
+			close(fd);
+			errno = 0;
+			continue;
+		}
+		if (unlikely(!c_ctl_peer_ok(fd))) {
+			(void)send(fd, S_LITERAL("error: permission denied\n"), MSG_NOSIGNAL | MSG_DONTWAIT);
+			close(fd);
+			errno = 0;
+			continue;
+		}
+		unsigned int slot = 0;
+		while (slot < C_CTL_CLIENTS_MAX && c_ctl_clients[slot].fd != -1)
+			++slot;
+		if (unlikely(slot == C_CTL_CLIENTS_MAX)) {
+			(void)send(fd, S_LITERAL("error: too many clients\n"), MSG_NOSIGNAL | MSG_DONTWAIT);
+			close(fd);
+			continue;
+		}
+		if (unlikely(c_ev_add(fd, EPOLLIN | EPOLLRDHUP, C_EV_NUM + slot) == -1)) {
+			close(fd);
+			errno = 0;
+			continue;
+		}
+		c_ctl_clients[slot].fd = fd;
+		c_ctl_clients[slot].len = 0;
+	}
+}
+
+/* Read what a client sent and answer every complete line. */
+static void
+c_ctl_read(unsigned int slot, c_ctl_fn fn)
+{
+	static char reply[C_CTL_REPLY_MAX];
+	c_ctl_client_ty *c = c_ctl_clients + slot;
+	if (unlikely(slot >= C_CTL_CLIENTS_MAX || c->fd == -1))
+		return;
+	for (;;) {
+		const ssize_t n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, MSG_DONTWAIT);
+		if (n == 0 || (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+			c_ctl_close(slot);
+			break;
+		}
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		c->len += (unsigned int)n;
+		char *line = c->buf;
+		char *nl;
+		while ((nl = (char *)memchr(line, '\n', c->len - (unsigned int)(line - c->buf)))) {
+			*nl = '\0';
+			const unsigned int len = fn(line, reply, sizeof(reply));
+			/* A client that does not read its replies loses them. */
+			if (send(c->fd, reply, len, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)len) {
+				c_ctl_close(slot);
+				errno = 0;
+				return;
+			}
+			line = nl + 1;
+		}
+		c->len -= (unsigned int)(line - c->buf);
+		memmove(c->buf, line, c->len);
+		if (unlikely(c->len == sizeof(c->buf))) {
+			(void)send(c->fd, S_LITERAL("error: line too long\n"), MSG_NOSIGNAL | MSG_DONTWAIT);
+			c_ctl_close(slot);
+			break;
+		}
+	}
+	errno = 0;
+}
+
+static void
+c_ctl_cleanup(const char *path)
+{
+	if (c_ctl_fd == -1)
+		return;
+	for (unsigned int i = 0; i < C_CTL_CLIENTS_MAX; ++i)
+		c_ctl_close(i);
+	close(c_ctl_fd);
+	c_ctl_fd = -1;
+	(void)unlink(path);
+}
+
+#endif /* CTL_H */
@@ -0,0 +1,89 @@
+#ifndef CURVE_H
+#define CURVE_H 1
+
+#include "macros.h"
+
+/* A fan curve is a list of breakpoints sorted by temperature.
+ * Between breakpoints the speed is interpolated linearly, and
+ * outside of them it saturates at the first and last speed. */
+typedef struct {
+	/* Millidegrees. */
+	int temp;
+	/* 0-255 */
+	unsigned int speed;
+} c_point_ty;
+
+typedef struct {
+	const c_point_ty *points;
+	unsigned int len;
+} c_curve_ty;
+
+#define C_CURVE(points) { (points), LEN(points) }
+
+/* Get the speed for temp, in millidegrees. */
+static ATTR_INLINE unsigned int
+c_curve_get(const c_curve_ty *c, int temp)
+{
+	const c_point_ty *p = c->points;
+	if (temp <= p[0].temp)
+		return p[0].speed;
+	if (temp >= p[c->len - 1].temp)
+		return p[c->len - 1].speed;
+	unsigned int i = 1;
+	while (temp > p[i].temp)
+		++i;
+	/* p[i - 1].temp < temp <= p[i].temp */
+	const long long dt = (long long)p[i].temp - p[i - 1].temp;
+	const long long num = ((long long)p[i].speed - (long long)p[i - 1].speed) * ((long long)temp - p[i - 1].temp);
+	/* Round to nearest. */
+	const long long ds = ((num >= 0) ? num + dt / 2 : num - dt / 2) / dt;
+	return (unsigned int)((long long)p[i - 1].speed + ds);
+}
+
+/* Get the temperature to look a curve up at, with a hysteresis band of
+ * band millidegrees. Rises are followed at once, and falls only once the
+ * temperature is band below where it was followed to, so that dithering
+ * across a breakpoint does not change the speed. *held is the state,
+ * starting at INT_MIN. */
+static ATTR_INLINE int
+c_curve_hyst(int *held, int temp, int band)
+{
+	if (temp > *held)
+		*held = temp;
+	else if (temp + band < *held)
+		*held = temp + band;
+	return *held;
+}
+
+/* Return 0 if the breakpoints are usable, i.e. there is at least one
+ * and their temperatures are strictly increasing. */
+static ATTR_INLINE int
+c_curve_check(const c_curve_ty *c)
+{
+	if (c->points == NULL || c->len == 0)
+		return -1;
+	for (unsigned int i = 1; i < c->len; ++i)
+		if (c->points[i].temp <= c->points[i - 1].temp)
+			return -1;
+	return 0;
+}
+
+static ATTR_INLINE unsigned int
+c_curve_min(const c_curve_ty *c)
+{
+	unsigned int min = c->points[0].speed;
+	for (unsigned int i = 1; i < c->len; ++i)
+		min = MIN(min, c->points[i].speed);
+	return min;
+}
+
+static ATTR_INLINE unsigned int
+c_curve_max(const c_curve_ty *c)
+{
+	unsigned int max = c->points[0].speed;
+	for (unsigned int i = 1; i < c->len; ++i)
+		max = MAX(max, c->points[i].speed);
+	return max;
+}
+
+#endif /* CURVE_H */
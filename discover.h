@@ -0,0 +1,285 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2026 James Tirta Halim <tirtajames45 at gmail dot com> */
+
+#ifndef DISCOVER_H
+#define DISCOVER_H 1
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "conf.h"
+#include "macros.h"
+#include "path.h"
+
+/* Discovery of the sensors and fans of the machine, for when there is no
+ * configuration file, so that one binary runs on any board.
+ *
+ * Each hwmon is classified by its name. A CPU, GPU or drive contributes its
+ * first tempN_input, which for coretemp, k10temp, amdgpu, nvme and
+ * drivetemp is the package, Tctl, edge or composite temperature. Every chip
+ * contributes the pwmN that have a pwmN_enable, with fanN_input as their
+ * tachometer. The result is written as a configuration file, which
+ * `cfan --discover` prints:
+ *
+ *   board  the fans of the other chips, following the CPUs, or every
+ *          sensor if no CPU was found
+ *   gpuN   the fans of a GPU, following the GPU
+ *
+ * Drives are in no zone: they run hotter than a CPU at idle, and would keep
+ * the board fans up. Chips are named as hwmon:NAME[@DEVICE], see path.h. */
+
+enum {
+	C_DISCOVER_CPU = 0,
+	C_DISCOVER_GPU,
+	C_DISCOVER_DRIVE,
+	/* Anything else, e.g. a Super I/O chip. */
+	C_DISCOVER_BOARD,
+	C_DISCOVER_KINDS
+};
+
+static const char *const c_discover_kinds[C_DISCOVER_KINDS] = { "cpu", "gpu", "drive", "board" };
+
+static const struct {
+	const char *name;
+	unsigned int kind;
+} c_discover_chips[] = {
+	{ "coretemp", C_DISCOVER_CPU },
+	{ "k10temp", C_DISCOVER_CPU },
+	{ "k8temp", C_DISCOVER_CPU },
+	{ "zenpower", C_DISCOVER_CPU },
+	{ "via_cputemp", C_DISCOVER_CPU },
+	{ "cpu_thermal", C_DISCOVER_CPU },
+	{ "amdgpu", C_DISCOVER_GPU },
+	{ "radeon", C_DISCOVER_GPU },
+	{ "nouveau", C_DISCOVER_GPU },
+	{ "nvme", C_DISCOVER_DRIVE },
+	{ "drivetemp", C_DISCOVER_DRIVE },
+};
+
+typedef struct {
+	const path_node_ty *node;
+	unsigned int kind;
+	/* Index among the chips of its kind with a sensor. */
+	unsigned int nth;
+	/* N of its first tempN_input, or 0. */
+	unsigned int temp;
+	/* Bit N of the pwmN with a pwmN_enable, and of the fanN_input. */
+	uint32_t pwms;
+	uint32_t tachs;
+	unsigned int pwms_len;
+	/* Prefix of its files. */
+	char id[PATH_MAX];
+} c_discover_chip_ty;
+
+/* Return N if name is prefix, N and suffix, with 0 < N < 32, or 0. */
+static unsigned int
+c_discover_num(const char *name, const char *prefix, const char *suffix)
+{
+	const size_t len = strlen(prefix);
+	unsigned int n = 0;
+	if (strncmp(name, prefix, len))
+		return 0;
+	const char *p = name + len;
+	for (; *p >= '0' && *p <= '9' && n < 32; ++p)
+		n = n * 10 + (unsigned int)(*p - '0');
+	if (p == name + len || n >= 32 || strcmp(p, suffix))
+		return 0;
+	return n;
+}
+
+/* Read the files of the hwmon of chip. */
+static void
+c_discover_files(c_discover_chip_ty *chip)
+{
+	uint32_t enables = 0;
+	unsigned int n;
+	DIR *d = opendir(chip->node->real);
+	if (d == NULL)
+		return;
+	for (const struct dirent *e; (e = readdir(d)) != NULL;) {
+		if ((n = c_discover_num(e->d_name, "temp", "_input")) && (chip->temp == 0 || n < chip->temp))
+			chip->temp = n;
+		else if ((n = c_discover_num(e->d_name, "pwm", "")))
+			chip->pwms |= (uint32_t)1 << n;
+		else if ((n = c_discover_num(e->d_name, "pwm", "_enable")))
+			enables |= (uint32_t)1 << n;
+		else if ((n = c_discover_num(e->d_name, "fan", "_input")))
+			chip->tachs |= (uint32_t)1 << n;
+	}
+	closedir(d);
+	/* One without pwmN_enable is not ours to set. */
+	chip->pwms &= enables;
+	for (n = 1; n < 32; ++n)
+		chip->pwms_len += (chip->pwms >> n) & 1;
+	if (chip->kind == C_DISCOVER_BOARD)
+		chip->temp = 0;
+}
+
+/* Name chip by its name, and its device if another has the same name, as
+ * path_identity_resolve() expects, or else by its directory. */
+static void
+c_discover_id(const path_scan_ty *s, c_discover_chip_ty *chip)
+{
+	const path_node_ty *n = chip->node;
+	unsigned int names = 0, devs = 0;
+	for (unsigned int i = 0; i < s->lens[PATH_HWMON]; ++i) {
+		const path_node_ty *m = s->nodes[PATH_HWMON] + i;
+		if (!strcmp(m->name, n->name)) {
+			++names;
+			devs += !strcmp(m->dev, n->dev);
+		}
+	}
+	if (n->name[0] != '\0' && strcspn(n->name, "/@# \t") == strlen(n->name)) {
+		if (names == 1) {
+			snprintf(chip->id, sizeof(chip->id), "%s%s", path_classes[PATH_HWMON].spec, n->name);
+			return;
+		}
+		if (devs == 1 && n->dev[0] != '\0' && strcspn(n->dev, "/# \t") == strlen(n->dev)) {
+			snprintf(chip->id, sizeof(chip->id), "%s%s@%s", path_classes[PATH_HWMON].spec, n->name, n->dev);
+			return;
+		}
+	}
+	snprintf(chip->id, sizeof(chip->id), "%s", n->real);
+}
+
+static int
+c_discover_cmp(const void *a, const void *b)
+{
+	const c_discover_chip_ty *x = (const c_discover_chip_ty *)a, *y = (const c_discover_chip_ty *)b;
+	int ret;
+	if (x->kind != y->kind)
+		return (x->kind < y->kind) ? -1 : 1;
+	if ((ret = strcmp(x->node->name, y->node->name)))
+		return ret;
+	return strcmp(x->node->dev, y->node->dev);
+}
+
+static int
+c_discover_printf(c_conf_buf_ty *b, const char *fmt, ...)
+{
+	char line[PATH_MAX * 3 + 128];
+	va_list ap;
+	va_start(ap, fmt);
+	const int n = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	if (unlikely(n < 0 || (size_t)n >= sizeof(line))) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return c_conf_buf_add(b, line, (size_t)n);
+}
+
+/* Write the fans of chip, named prefix and a number from first on. */
+static int
+c_discover_fans(c_conf_buf_ty *b, const c_discover_chip_ty *chip, const char *prefix, unsigned int first)
+{
+	for (unsigned int n = 1; n < 32; ++n) {
+		if (!(chip->pwms & ((uint32_t)1 << n)))
+			continue;
+		if (c_discover_printf(b, "fan %s%u %s/pwm%u %s/pwm%u_enable", prefix, first++, chip->id, n, chip->id, n) == -1
+		    || ((chip->tachs & ((uint32_t)1 << n)) && c_discover_printf(b, " tach=%s/fan%u_input", chip->id, n) == -1)
+		    || c_discover_printf(b, " # %s\n", chip->node->name) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+/* Write the names of len fans, prefix and a number from 0 on, separated by
+ * commas. */
+static int
+c_discover_fan_list(c_conf_buf_ty *b, const char *prefix, unsigned int len)
+{
+	for (unsigned int k = 0; k < len; ++k)
+		if (c_discover_printf(b, "%s%s%u", k ? "," : "", prefix, k) == -1)
+			return -1;
+	return 0;
+}
+
+/* A GPU with a sensor drives its own fans, see c_discover(). */
+#define C_DISCOVER_OWN_FANS(c) ((c)->kind == C_DISCOVER_GPU && (c)->temp)
+
+/* Append the configuration of the hwmons under sys to text. Return the
+ * number of fans found, or -1. */
+static int
+c_discover(const char *sys, c_conf_buf_ty *text)
+{
+	char name[32];
+	path_scan_ty s = { sys, { NULL }, { 0 }, { 0 } };
+	c_discover_chip_ty *chips = NULL;
+	unsigned int kinds[C_DISCOVER_KINDS] = { 0 }, fans = 0, board = 0;
+	int ret = -1;
+	if (path_scan_class(&s, PATH_HWMON) == -1)
+		goto out;
+	const unsigned int len = s.lens[PATH_HWMON];
+	chips = (c_discover_chip_ty *)calloc(len ? len : 1, sizeof(c_discover_chip_ty));
+	if (unlikely(chips == NULL))
+		goto out;
+	for (unsigned int i = 0; i < len; ++i) {
+		chips[i].node = s.nodes[PATH_HWMON] + i;
+		chips[i].kind = C_DISCOVER_BOARD;
+		for (unsigned int j = 0; j < LEN(c_discover_chips); ++j)
+			if (!strcmp(chips[i].node->name, c_discover_chips[j].name))
+				chips[i].kind = c_discover_chips[j].kind;
+		c_discover_files(chips + i);
+		c_discover_id(&s, chips + i);
+	}
+	/* So that the names do not follow the hwmon numbers of the boot. */
+	qsort(chips, len, sizeof(c_discover_chip_ty), c_discover_cmp);
+	for (unsigned int i = 0; i < len; ++i)
+		if (chips[i].temp)
+			chips[i].nth = kinds[chips[i].kind]++;
+	if (c_discover_printf(text, "# Found in %s/%s by cfan --discover.\n", sys, path_classes[PATH_HWMON].dir) == -1)
+		goto out;
+	for (unsigned int i = 0; i < len; ++i) {
+		const c_discover_chip_ty *c = chips + i;
+		if (c->temp && c_discover_printf(text, "temp %s%u %s/temp%u_input # %s%s\n", c_discover_kinds[c->kind], c->nth, c->id, c->temp, c->node->name, (c->kind == C_DISCOVER_DRIVE) ? ", in no zone" : "") == -1)
+			goto out;
+	}
+	if (kinds[C_DISCOVER_CPU] && c_discover_printf(text, "temp_cpu cpu0\n") == -1)
+		goto out;
+	for (unsigned int i = 0; i < len; ++i) {
+		const c_discover_chip_ty *c = chips + i;
+		if (C_DISCOVER_OWN_FANS(c)) {
+			snprintf(name, sizeof(name), "gpu%u-fan", c->nth);
+			if (c_discover_fans(text, c, name, 0) == -1)
+				goto out;
+			fans += c->pwms_len;
+		} else {
+			if (c_discover_fans(text, c, "fan", board) == -1)
+				goto out;
+			board += c->pwms_len;
+		}
+	}
+	if (board) {
+		if (c_discover_printf(text, "zone board temps=") == -1)
+			goto out;
+		for (unsigned int k = 0; k < kinds[C_DISCOVER_CPU]; ++k)
+			if (c_discover_printf(text, "%scpu%u", k ? "," : "", k) == -1)
+				goto out;
+		if ((kinds[C_DISCOVER_CPU] == 0 && c_discover_printf(text, "*") == -1)
+		    || c_discover_printf(text, " fans=") == -1
+		    || c_discover_fan_list(text, "fan", board) == -1
+		    || c_discover_printf(text, "\n") == -1)
+			goto out;
+	}
+	for (unsigned int i = 0; i < len; ++i) {
+		const c_discover_chip_ty *c = chips + i;
+		if (!C_DISCOVER_OWN_FANS(c) || !c->pwms)
+			continue;
+		snprintf(name, sizeof(name), "gpu%u-fan", c->nth);
+		if (c_discover_printf(text, "zone gpu%u temps=gpu%u fans=", c->nth, c->nth) == -1
+		    || c_discover_fan_list(text, name, c->pwms_len) == -1
+		    || c_discover_printf(text, "\n") == -1)
+			goto out;
+	}
+	ret = (int)(fans + board);
+out:
+	free(chips);
+	path_scan_free(&s);
+	return ret;
+}
+
+#endif /* DISCOVER_H */
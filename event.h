@@ -0,0 +1,179 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2026 James Tirta Halim <tirtajames45 at gmail dot com> */
+
+#ifndef EVENT_H
+#define EVENT_H 1
+
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "macros.h"
+
+/* Event sources waited on by the main loop.
+ * The id is passed through epoll_event.data.u32.
+ * Ids from C_EV_NUM on are control socket clients. */
+enum {
+	C_EV_TIMER = 0,
+	C_EV_SIGNAL,
+	C_EV_CTL,
+	C_EV_METRICS,
+	/* Kernel events, see alarm.h. */
+	C_EV_ALARM,
+	C_EV_THERMAL,
+	/* CPU pressure, see psi.h. */
+	C_EV_PSI,
+	/* Devices added and removed, see uevent.h. */
+	C_EV_UEVENT,
+	C_EV_NUM
+};
+
+static int c_ev_epfd = -1;
+static int c_ev_timerfd = -1;
+static int c_ev_sigfd = -1;
+static int c_ev_metricsfd = -1;
+/* Next expiry and period of c_ev_timerfd, in nsecs. */
+static unsigned long long c_ev_timer_next_ns;
+static unsigned long long c_ev_timer_period_ns;
+
+static int
+c_ev_add(int fd, unsigned int events, unsigned int id)
+{
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.u64 = 0;
+	ev.data.u32 = id;
+	return epoll_ctl(c_ev_epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/* Fire every interval_ms, starting one period from now.
+ * Deadlines are absolute on CLOCK_MONOTONIC, so time spent
+ * in a tick does not push back the next one. */
+static int
+c_ev_timer_set(unsigned int interval_ms)
+{
+	struct itimerspec its;
+	if (unlikely(clock_gettime(CLOCK_MONOTONIC, &its.it_value) == -1))
+		return -1;
+	its.it_interval.tv_sec = (time_t)(interval_ms / 1000);
+	its.it_interval.tv_nsec = (long)(interval_ms % 1000) * 1000000L;
+	its.it_value.tv_sec += its.it_interval.tv_sec;
+	its.it_value.tv_nsec += its.it_interval.tv_nsec;
+	if (its.it_value.tv_nsec >= 1000000000L) {
+		++its.it_value.tv_sec;
+		its.it_value.tv_nsec -= 1000000000L;
+	}
+	c_ev_timer_next_ns = (unsigned long long)its.it_value.tv_sec * 1000000000 + (unsigned long long)its.it_value.tv_nsec;
+	c_ev_timer_period_ns = (unsigned long long)interval_ms * 1000000;
+	return timerfd_settime(c_ev_timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static ATTR_INLINE unsigned long long
+c_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000 + (unsigned long long)ts.tv_nsec;
+}
+
+static ATTR_INLINE unsigned long long
+c_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + (unsigned long long)ts.tv_nsec / 1000000;
+}
+
+/* Return how late the timer fired after its last expiry, seen at now_ns,
+ * and move on to its next expiry. Missed periods are skipped, as by the
+ * timer. */
+static ATTR_INLINE unsigned long long
+c_ev_timer_late_ns(unsigned long long now_ns)
+{
+	if (unlikely(c_ev_timer_period_ns == 0 || now_ns < c_ev_timer_next_ns))
+		return 0;
+	const unsigned long long since = now_ns - c_ev_timer_next_ns;
+	c_ev_timer_next_ns += (since / c_ev_timer_period_ns + 1) * c_ev_timer_period_ns;
+	return since % c_ev_timer_period_ns;
+}
+
+/* Wake the main loop with C_EV_METRICS every interval_s. */
+static int
+c_ev_metrics_init(unsigned int interval_s)
+{
+	struct itimerspec its;
+	c_ev_metricsfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (unlikely(c_ev_metricsfd == -1))
+		return -1;
+	its.it_interval.tv_sec = (time_t)interval_s;
+	its.it_interval.tv_nsec = 0;
+	its.it_value = its.it_interval;
+	if (unlikely(timerfd_settime(c_ev_metricsfd, 0, &its, NULL) == -1))
+		return -1;
+	return c_ev_add(c_ev_metricsfd, EPOLLIN, C_EV_METRICS);
+}
+
+/* Consume the expiration count of fd. Missed periods are not replayed. */
+static int
+c_ev_timer_ack_fd(int fd)
+{
+	uint64_t expired;
+	if (unlikely(read(fd, &expired, sizeof(expired)) == -1))
+		return (errno == EAGAIN) ? 0 : -1;
+	return 0;
+}
+
+static ATTR_INLINE int
+c_ev_timer_ack(void)
+{
+	return c_ev_timer_ack_fd(c_ev_timerfd);
+}
+
+/* Block SIGTERM, SIGINT and SIGHUP, and receive them through
+ * a signalfd instead, so that they wake up the main loop. */
+static int
+c_ev_init(void)
+{
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGHUP);
+	if (unlikely(sigprocmask(SIG_BLOCK, &mask, NULL) == -1))
+		return -1;
+	c_ev_sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (unlikely(c_ev_sigfd == -1))
+		return -1;
+	c_ev_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (unlikely(c_ev_timerfd == -1))
+		return -1;
+	c_ev_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (unlikely(c_ev_epfd == -1))
+		return -1;
+	if (unlikely(c_ev_add(c_ev_sigfd, EPOLLIN, C_EV_SIGNAL) == -1))
+		return -1;
+	if (unlikely(c_ev_add(c_ev_timerfd, EPOLLIN, C_EV_TIMER) == -1))
+		return -1;
+	return 0;
+}
+
+static void
+c_ev_cleanup(void)
+{
+	if (c_ev_epfd != -1)
+		close(c_ev_epfd);
+	if (c_ev_timerfd != -1)
+		close(c_ev_timerfd);
+	if (c_ev_sigfd != -1)
+		close(c_ev_sigfd);
+	if (c_ev_metricsfd != -1)
+		close(c_ev_metricsfd);
+	c_ev_epfd = c_ev_timerfd = c_ev_sigfd = c_ev_metricsfd = -1;
+}
+
+#endif /* EVENT_H */
@@ -13,13 +13,26 @@
 
 #		include <stdio.h>
 #		include <stdlib.h>
+#		include <stdint.h>
+#		include <string.h>
 #		include <unistd.h>
 #		include <assert.h>
 #		include <time.h>
 #		include <errno.h>
+#		include <pthread.h>
+#		include <signal.h>
 
 #		include "cfan.h"
+#		include "event.h"
 #		include "macros.h"
+#		include "temp.h"
+
+/* GPUs are sampled by a thread of their own every NV_SAMPLE_MS, since an
+ * NVML call can block for tens of msecs. The main loop only reads the
+ * latest sample of each GPU, and takes one older than NV_STALE_MS as
+ * NV_STALE_TEMP rather than wait for the driver. The fans of a GPU are
+ * set by the same thread, woken by the main loop when their speed
+ * changes. */
 
 #		define NV_DIE_GRACEFUL(nv_ret)                                                                                      \
 			do {                                                                                                         \
@@ -47,54 +60,472 @@ nv_nvmlDeviceGetTemperature(nvmlDevice_t device, nvmlTemperatureSensors_t sensor
 #		endif
 }
 
+/* Latest sample of a GPU. Written by the sampling thread under a seqlock,
+ * as the status segment is, so that the reader never waits. */
+typedef struct {
+	uint32_t seq;
+	/* Millidegrees of the GPU and of its memory, or C_TEMP_INVALID. */
+	int temp;
+	int mem_temp;
+	/* Milliwatts, or 0 if not reported. */
+	unsigned int power_mw;
+	/* When it was read, on CLOCK_MONOTONIC, or 0 if never. (msecs) */
+	unsigned long long ms;
+} nv_slot_ty;
+
+/* Fans of a GPU, set by the sampling thread as well. */
+typedef struct {
+	/* Speed asked for by the main loop, and last set (0-255), or -1. */
+	int want;
+	int applied;
+	unsigned int fans_len;
+	/* Range the driver accepts. (percent) */
+	unsigned int min_pct;
+	unsigned int max_pct;
+	int failed;
+} nv_fan_ty;
+
+/* Tries of a reader racing a write before it gives up on the slot. */
+#		define NV_SLOT_TRIES 64
+/* Fans in the configuration file named nvidia:N are the fans of GPU N. */
+#		define NV_FAN_PREFIX "nvidia:"
+
 /* Global variables */
 static nvmlDevice_t *nv_device;
 static unsigned int nv_device_count;
 static int nv_inited;
+/* NVML could not be set up. GPUs are then taken as NV_STALE_TEMP. */
+static int nv_failed;
 static nvmlReturn_t nv_ret;
+static nv_slot_ty *nv_slots;
+static nv_fan_ty *nv_fans;
+/* Set once a GPU has been reported stale, until it is sampled again. */
+static unsigned char *nv_stale;
+static pthread_t nv_thread;
+static int nv_thread_started;
+/* Wakes the sampling thread to set the fans or to stop, and nv_cleanup()
+ * once it has. */
+static pthread_mutex_t nv_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t nv_cond;
+static int nv_kick;
+static int nv_stop;
+static int nv_done;
+
+static void
+nv_slot_put(nv_slot_ty *s, const nv_slot_ty *v)
+{
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+	/* Order the odd seq before the data. */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&s->temp, v->temp, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->mem_temp, v->mem_temp, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->power_mw, v->power_mw, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->ms, v->ms, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Return -1 if the slot kept changing under the reader. */
+static int
+nv_slot_get(const nv_slot_ty *s, nv_slot_ty *v)
+{
+	for (unsigned int i = 0; i < NV_SLOT_TRIES; ++i) {
+		const uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		v->temp = __atomic_load_n(&s->temp, __ATOMIC_RELAXED);
+		v->mem_temp = __atomic_load_n(&s->mem_temp, __ATOMIC_RELAXED);
+		v->power_mw = __atomic_load_n(&s->power_mw, __ATOMIC_RELAXED);
+		v->ms = __atomic_load_n(&s->ms, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq)
+			return 0;
+	}
+	return -1;
+}
+
+static double
+nv_field_value(const nvmlFieldValue_t *f)
+{
+	switch (f->valueType) {
+	case NVML_VALUE_TYPE_DOUBLE:
+		return f->value.dVal;
+	case NVML_VALUE_TYPE_UNSIGNED_LONG:
+		return (double)f->value.ulVal;
+	case NVML_VALUE_TYPE_UNSIGNED_LONG_LONG:
+		return (double)f->value.ullVal;
+	case NVML_VALUE_TYPE_SIGNED_LONG_LONG:
+		return (double)f->value.sllVal;
+	default:
+		return (double)f->value.uiVal;
+	}
+}
+
+/* Read a GPU: its temperature, then its memory temperature and power in
+ * one batch. Fields the GPU does not report are left out. */
+static nvmlReturn_t
+nv_read(unsigned int i, nv_slot_ty *v)
+{
+	unsigned int temp;
+	nvmlFieldValue_t f[2];
+	nvmlReturn_t ret = nv_nvmlDeviceGetTemperature(nv_device[i], NVML_TEMPERATURE_GPU, &temp);
+	if (unlikely(ret != NVML_SUCCESS))
+		return ret;
+	v->temp = (int)temp * 1000;
+	v->mem_temp = C_TEMP_INVALID;
+	v->power_mw = 0;
+	memset(f, 0, sizeof(f));
+	f[0].fieldId = NVML_FI_DEV_MEMORY_TEMP;
+	f[1].fieldId = NVML_FI_DEV_POWER_INSTANT;
+	ret = nvmlDeviceGetFieldValues(nv_device[i], (int)LEN(f), f);
+	if (ret == NVML_SUCCESS) {
+		if (f[0].nvmlReturn == NVML_SUCCESS)
+			v->mem_temp = (int)nv_field_value(f) * 1000;
+		if (f[1].nvmlReturn == NVML_SUCCESS)
+			v->power_mw = (unsigned int)nv_field_value(f + 1);
+	}
+	DBG(fprintf(stderr, "%s:%d:%s: getting temperature: %d, memory %d, power %u mW from GPU%u.\n", __FILE__, __LINE__, ASSERT_FUNC, v->temp, v->mem_temp, v->power_mw, i));
+	return NVML_SUCCESS;
+}
 
+/* Read every GPU. A GPU that fails keeps its last sample, which goes
+ * stale. */
+static void
+nv_sample(void)
+{
+	nv_slot_ty v;
+	for (unsigned int i = 0; i < nv_device_count; ++i) {
+		const nvmlReturn_t ret = nv_read(i, &v);
+		if (unlikely(ret != NVML_SUCCESS)) {
+			DBG(fprintf(stderr, "%s:%d:%s: GPU%u: %s\n", __FILE__, __LINE__, ASSERT_FUNC, i, nvmlErrorString(ret)));
+			continue;
+		}
+		v.ms = c_now_ms();
+		nv_slot_put(nv_slots + i, &v);
+	}
+}
+
+/* Set the fans whose speed was changed by nv_fan_set(). A GPU that fails
+ * is retried on the next change or sample. */
+static void
+nv_fans_apply(void)
+{
+	for (unsigned int i = 0; i < nv_device_count; ++i) {
+		nv_fan_ty *f = nv_fans + i;
+		const int want = __atomic_load_n(&f->want, __ATOMIC_RELAXED);
+		if (want < 0 || want == f->applied)
+			continue;
+		/* The curve is in 0-255, the driver in percent. */
+		const unsigned int pct = MIN(MAX(((unsigned int)want * 100 + 127) / 255, f->min_pct), f->max_pct);
+		nvmlReturn_t ret = NVML_SUCCESS;
+		for (unsigned int j = 0; j < f->fans_len && ret == NVML_SUCCESS; ++j)
+			ret = nvmlDeviceSetFanSpeed_v2(nv_device[i], j, pct);
+		if (unlikely(ret != NVML_SUCCESS)) {
+			if (!f->failed)
+				fprintf(stderr, "cfan: GPU%u: can't set the fan speed: %s.\n", i, nvmlErrorString(ret));
+			f->failed = 1;
+			continue;
+		}
+		DBG(fprintf(stderr, "%s:%d:%s: setting speed: %u%% to the fans of GPU%u.\n", __FILE__, __LINE__, ASSERT_FUNC, pct, i));
+		f->failed = 0;
+		f->applied = want;
+	}
+}
+
+static void
+nv_ts_add(struct timespec *ts, unsigned int ms)
+{
+	ts->tv_sec += (time_t)(ms / 1000);
+	ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		++ts->tv_sec;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+/* Sample every NV_SAMPLE_MS, and set the fans as soon as they change. */
+static void *
+nv_sample_thread(void *arg)
+{
+	struct timespec next;
+	(void)arg;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	nv_ts_add(&next, NV_SAMPLE_MS);
+	for (;;) {
+		int due = 0;
+		pthread_mutex_lock(&nv_lock);
+		while (!nv_stop && !nv_kick && !due)
+			due = (pthread_cond_timedwait(&nv_cond, &nv_lock, &next) == ETIMEDOUT);
+		const int stop = nv_stop;
+		nv_kick = 0;
+		pthread_mutex_unlock(&nv_lock);
+		if (stop)
+			break;
+		nv_fans_apply();
+		if (due) {
+			nv_sample();
+			/* From now, so that a slow driver is not sampled back to back. */
+			clock_gettime(CLOCK_MONOTONIC, &next);
+			nv_ts_add(&next, NV_SAMPLE_MS);
+		}
+	}
+	pthread_mutex_lock(&nv_lock);
+	nv_done = 1;
+	pthread_cond_broadcast(&nv_cond);
+	pthread_mutex_unlock(&nv_lock);
+	return NULL;
+}
+
+/* Signals are left to the main loop. */
+static int
+nv_thread_start(void)
+{
+	pthread_condattr_t attr;
+	sigset_t all, old;
+	if (pthread_condattr_init(&attr) || pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) || pthread_cond_init(&nv_cond, &attr))
+		return -1;
+	pthread_condattr_destroy(&attr);
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	const int ret = pthread_create(&nv_thread, NULL, nv_sample_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (ret)
+		return -1;
+	nv_thread_started = 1;
+	return 0;
+}
+
+/* Hand the fans cfan has set back to the driver. */
+static void
+nv_fans_restore(void)
+{
+	for (unsigned int i = 0; nv_fans && i < nv_device_count; ++i) {
+		if (nv_fans[i].applied < 0)
+			continue;
+		for (unsigned int j = 0; j < nv_fans[i].fans_len; ++j) {
+			const nvmlReturn_t ret = nvmlDeviceSetDefaultFanSpeed_v2(nv_device[i], j);
+			if (unlikely(ret != NVML_SUCCESS))
+				fprintf(stderr, "cfan: GPU%u: can't hand fan %u back to the driver: %s.\n", i, j, nvmlErrorString(ret));
+		}
+		nv_fans[i].applied = -1;
+	}
+}
+
+/* Safe to call more than once. A thread stuck in the driver for
+ * NV_STALE_MS is left behind, with NVML and its memory, rather than hang
+ * the exit. */
 static void
 nv_cleanup()
 {
+	if (nv_thread_started) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		nv_ts_add(&deadline, NV_STALE_MS);
+		pthread_mutex_lock(&nv_lock);
+		nv_stop = 1;
+		pthread_cond_broadcast(&nv_cond);
+		while (!nv_done && pthread_cond_timedwait(&nv_cond, &nv_lock, &deadline) == 0)
+			;
+		const int done = nv_done;
+		pthread_mutex_unlock(&nv_lock);
+		nv_thread_started = 0;
+		if (!done) {
+			fprintf(stderr, "cfan: the GPU sampling thread is stuck in the driver, leaving it.\n");
+			pthread_detach(nv_thread);
+			return;
+		}
+		pthread_join(nv_thread, NULL);
+	}
+	nv_fans_restore();
 	if (nv_inited)
 		nvmlShutdown();
+	nv_inited = 0;
 	free(nv_device);
+	free(nv_slots);
+	free(nv_fans);
+	free(nv_stale);
+	nv_device = NULL;
+	nv_slots = NULL;
+	nv_fans = NULL;
+	nv_stale = NULL;
+	nv_device_count = 0;
+}
+
+/* Without NVML, cfan carries on: the GPUs are taken as hot, and their fans
+ * are left to the driver. */
+static void
+nv_fail(const char *what, nvmlReturn_t ret)
+{
+	fprintf(stderr, "cfan: NVML: %s: %s, GPUs are taken as %u degrees and their fans are left to the driver.\n", what, nvmlErrorString(ret), NV_STALE_TEMP);
+	nv_cleanup();
+	nv_failed = 1;
 }
 
+/* Runs once, however many zones or fans use the GPUs. */
 static void
 nv_init()
 {
+	if (nv_inited || nv_failed)
+		return;
 	nv_ret = nvmlInit();
-	if (unlikely(nv_ret != NVML_SUCCESS))
-		NV_DIE_GRACEFUL(nv_ret);
+	if (unlikely(nv_ret != NVML_SUCCESS)) {
+		nv_fail("init", nv_ret);
+		return;
+	}
 	nv_inited = 1;
 	nv_ret = nvmlDeviceGetCount(&nv_device_count);
-	if (unlikely(nv_ret != NVML_SUCCESS))
-		NV_DIE_GRACEFUL(nv_ret);
+	if (unlikely(nv_ret != NVML_SUCCESS)) {
+		nv_fail("count", nv_ret);
+		return;
+	}
 	nv_device = (nvmlDevice_t *)calloc(nv_device_count, sizeof(nvmlDevice_t));
-	if (unlikely(nv_device == NULL))
+	nv_slots = (nv_slot_ty *)calloc(nv_device_count, sizeof(nv_slot_ty));
+	nv_fans = (nv_fan_ty *)calloc(nv_device_count, sizeof(nv_fan_ty));
+	nv_stale = (unsigned char *)calloc(nv_device_count, 1);
+	if (unlikely(nv_device_count && (nv_device == NULL || nv_slots == NULL || nv_fans == NULL || nv_stale == NULL)))
 		NV_DIE_GRACEFUL(nv_ret);
 	for (unsigned int i = 0; i < nv_device_count; ++i) {
 		nv_ret = nvmlDeviceGetHandleByIndex(i, nv_device + i);
-		if (unlikely(nv_ret != NVML_SUCCESS))
-			NV_DIE_GRACEFUL(nv_ret);
+		if (unlikely(nv_ret != NVML_SUCCESS)) {
+			nv_fail("handle", nv_ret);
+			return;
+		}
+		nv_fans[i].want = nv_fans[i].applied = -1;
+		/* GPUs without fans, or that can't report them, are not driven. */
+		if (nvmlDeviceGetNumFans(nv_device[i], &nv_fans[i].fans_len) != NVML_SUCCESS
+		    || nvmlDeviceGetMinMaxFanSpeed(nv_device[i], &nv_fans[i].min_pct, &nv_fans[i].max_pct) != NVML_SUCCESS)
+			nv_fans[i].fans_len = 0;
 	}
+	/* So that the first tick has a sample. */
+	nv_sample();
+	if (unlikely(nv_thread_start() == -1))
+		NV_DIE_GRACEFUL(nv_ret);
 }
 
+/* Return the GPU of a fan named NV_FAN_PREFIX N, or -1. */
+static int
+nv_fan_gpu(const char *path)
+{
+	if (strncmp(path, NV_FAN_PREFIX, S_LEN(NV_FAN_PREFIX)))
+		return -1;
+	path += S_LEN(NV_FAN_PREFIX);
+	if (*path < '0' || *path > '9')
+		return -1;
+	int gpu = 0;
+	for (; *path >= '0' && *path <= '9' && gpu < 1000; ++path)
+		gpu = gpu * 10 + (*path - '0');
+	return (*path == '\0') ? gpu : -1;
+}
+
+/* Return 1 if cfan can drive the fans of gpu. */
+static int
+nv_fan_ok(int gpu)
+{
+	return gpu >= 0 && (unsigned int)gpu < nv_device_count && nv_fans[gpu].fans_len != 0;
+}
+
+/* Return the speed the fans of gpu are at (0-255), or 255 if unknown. */
 static unsigned int
+nv_fan_get(int gpu)
+{
+	unsigned int pct;
+	if (!nv_fan_ok(gpu) || nvmlDeviceGetFanSpeed_v2(nv_device[gpu], 0, &pct) != NVML_SUCCESS)
+		return 255;
+	return MIN(pct, 100) * 255 / 100;
+}
+
+/* Ask for the fans of gpu to be set to speed (0-255). They are set by the
+ * sampling thread, so that the tick does not wait on the driver. */
+static void
+nv_fan_set(int gpu, unsigned int speed)
+{
+	if (!nv_fan_ok(gpu) || __atomic_exchange_n(&nv_fans[gpu].want, (int)speed, __ATOMIC_RELAXED) == (int)speed)
+		return;
+	pthread_mutex_lock(&nv_lock);
+	nv_kick = 1;
+	pthread_cond_signal(&nv_cond);
+	pthread_mutex_unlock(&nv_lock);
+}
+
+/* Return the millidegrees of GPU i, the hotter of the GPU and its memory,
+ * from its latest sample, or NV_STALE_TEMP if it is stale. */
+static int
+nv_temp_gpu_get(unsigned int i, unsigned long long now)
+{
+	nv_slot_ty v;
+	if (unlikely(nv_slot_get(nv_slots + i, &v) == -1 || v.ms == 0 || now - v.ms > NV_STALE_MS)) {
+		if (!nv_stale[i])
+			fprintf(stderr, "cfan: GPU%u has not been sampled for %u ms, taking it as %u degrees.\n", i, NV_STALE_MS, NV_STALE_TEMP);
+		nv_stale[i] = 1;
+		return NV_STALE_TEMP * 1000;
+	}
+	nv_stale[i] = 0;
+	return MAX(v.temp, v.mem_temp);
+}
+
+/* Return millidegrees, from the latest samples. */
+static int
 nv_temp_gpu_get_max()
 {
-	unsigned int max = 0;
-	unsigned int temp;
+	int max = 0;
+	const unsigned long long now = c_now_ms();
+	if (unlikely(nv_failed))
+		return NV_STALE_TEMP * 1000;
+	for (unsigned int i = 0; i < nv_device_count; ++i)
+		max = MAX(max, nv_temp_gpu_get(i, now));
+	return max;
+}
+
+/* Temperature functions of a single GPU, for a zone per GPU:
+ * fn=nvidia0 to fn=nvidia7. */
+#		define NV_TEMP_GPU(n)                                                                     \
+			static int nv_temp_gpu##n(void)                                                    \
+			{                                                                                  \
+				if (unlikely(nv_failed))                                                   \
+					return NV_STALE_TEMP * 1000;                                       \
+				return (n < nv_device_count) ? nv_temp_gpu_get(n, c_now_ms()) : C_TEMP_INVALID; \
+			}
+NV_TEMP_GPU(0)
+NV_TEMP_GPU(1)
+NV_TEMP_GPU(2)
+NV_TEMP_GPU(3)
+NV_TEMP_GPU(4)
+NV_TEMP_GPU(5)
+NV_TEMP_GPU(6)
+NV_TEMP_GPU(7)
+
+/* Entries of c_table_fn_names. */
+#		define NV_FN_NAMES                                  \
+			{ "nvidia0", nv_temp_gpu0, nv_init },        \
+			{ "nvidia1", nv_temp_gpu1, nv_init },        \
+			{ "nvidia2", nv_temp_gpu2, nv_init },        \
+			{ "nvidia3", nv_temp_gpu3, nv_init },        \
+			{ "nvidia4", nv_temp_gpu4, nv_init },        \
+			{ "nvidia5", nv_temp_gpu5, nv_init },        \
+			{ "nvidia6", nv_temp_gpu6, nv_init },        \
+			{ "nvidia7", nv_temp_gpu7, nv_init }
+
+/* Write the latest samples to the metrics textfile. */
+static void
+nv_metrics_write(FILE *fp)
+{
+	nv_slot_ty v;
+	const unsigned long long now = c_now_ms();
+	fprintf(fp, "# HELP cfan_gpu_temp_celsius Latest temperature of a GPU, and of its memory.\n# TYPE cfan_gpu_temp_celsius gauge\n");
 	for (unsigned int i = 0; i < nv_device_count; ++i) {
-		nv_ret = nv_nvmlDeviceGetTemperature(nv_device[i], NVML_TEMPERATURE_GPU, &temp);
-		if (unlikely(nv_ret != NVML_SUCCESS))
-			NV_DIE_GRACEFUL(nv_ret);
-		DBG(fprintf(stderr, "%s:%d:%s: getting temperature: %d from GPU%d.\n", __FILE__, __LINE__, ASSERT_FUNC, temp, i));
-		if (temp > max)
-			max = temp;
+		if (nv_slot_get(nv_slots + i, &v) == -1 || v.ms == 0)
+			continue;
+		fprintf(fp, "cfan_gpu_temp_celsius{gpu=\"%u\",sensor=\"gpu\"} %.3f\n", i, (double)v.temp / 1000);
+		if (v.mem_temp != C_TEMP_INVALID)
+			fprintf(fp, "cfan_gpu_temp_celsius{gpu=\"%u\",sensor=\"memory\"} %.3f\n", i, (double)v.mem_temp / 1000);
 	}
-	return max;
+	fprintf(fp, "# HELP cfan_gpu_power_watts Latest power draw of a GPU.\n# TYPE cfan_gpu_power_watts gauge\n");
+	for (unsigned int i = 0; i < nv_device_count; ++i)
+		if (nv_slot_get(nv_slots + i, &v) == 0 && v.ms != 0 && v.power_mw)
+			fprintf(fp, "cfan_gpu_power_watts{gpu=\"%u\"} %.3f\n", i, (double)v.power_mw / 1000);
+	fprintf(fp, "# HELP cfan_gpu_sample_age_seconds Age of the latest sample of a GPU.\n# TYPE cfan_gpu_sample_age_seconds gauge\n");
+	for (unsigned int i = 0; i < nv_device_count; ++i)
+		if (nv_slot_get(nv_slots + i, &v) == 0 && v.ms != 0)
+			fprintf(fp, "cfan_gpu_sample_age_seconds{gpu=\"%u\"} %.3f\n", i, (double)(now - v.ms) / 1000);
 }
 
 #	endif
@@ -0,0 +1,30 @@
+#ifndef INTERVAL_H
+#define INTERVAL_H 1
+
+#include "macros.h"
+#include "param.h"
+
+/* Get the next update interval in msecs.
+ *
+ * Shrink to interval_min_ms when the temperature moves faster than slope_fast.
+ * Stretch exponentially up to interval_max_ms while the fans sit at the bottom
+ * of the curve and the temperature is flat. Otherwise, return exponentially
+ * to interval_ms. */
+static ATTR_INLINE unsigned int
+c_interval_get(const c_param_ty *prm, unsigned int interval_ms, int temp, int last_temp, unsigned int elapsed_ms, int at_floor)
+{
+	/* Millidegrees. */
+	const unsigned long long delta = (temp > last_temp) ? (unsigned long long)((long long)temp - last_temp) : (unsigned long long)((long long)last_temp - temp);
+	const unsigned int base_ms = prm->interval_ms;
+	/* delta / 1000 / (elapsed_ms / 1000) >= slope_fast */
+	if (delta != 0 && delta >= (unsigned long long)prm->slope_fast * elapsed_ms)
+		return prm->interval_min_ms;
+	/* Tolerate sensor jitter of one degree. */
+	if (at_floor && delta <= 1000)
+		return MIN(MAX(interval_ms, base_ms) * 2, prm->interval_max_ms);
+	if (interval_ms < base_ms)
+		return MIN(interval_ms * 2, base_ms);
+	return base_ms;
+}
+
+#endif /* INTERVAL_H */
@@ -0,0 +1,205 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2026 James Tirta Halim <tirtajames45 at gmail dot com> */
+
+#ifndef METRICS_H
+#define METRICS_H 1
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "cfan-rec.h"
+#include "macros.h"
+#include "conf.h"
+#include "zone.h"
+
+/* Counters of cfan itself, written as a Prometheus textfile for the
+ * node_exporter textfile collector. A tick only increments them;
+ * c_metrics_write() formats them from its own timer. */
+
+/* Bands of speed, as quarters of the zone's maximum. */
+#define C_METRICS_BANDS 4
+
+/* What woke the loop. */
+enum {
+	C_METRICS_WAKE_TIMER = 0,
+	C_METRICS_WAKE_ALARM,
+	C_METRICS_WAKE_THERMAL,
+	C_METRICS_WAKE_PSI,
+	C_METRICS_WAKE_UEVENT,
+	C_METRICS_WAKE_NUM
+};
+
+static const char *const c_metrics_wake_names[] = { "timer", "alarm", "thermal", "psi", "uevent" };
+
+typedef struct {
+	unsigned long long ticks;
+	unsigned long long tick_ns;
+	unsigned long long tick_ns_max;
+	/* How late the timer woke the loop. */
+	unsigned long long timer_ticks;
+	unsigned long long late_ns;
+	unsigned long long late_ns_max;
+	unsigned long long wakeups[C_METRICS_WAKE_NUM];
+	/* Per temperature, then per tachometer. */
+	unsigned long long *read_errors;
+	/* Per fan. */
+	unsigned long long *fan_writes;
+	/* Per zone, C_METRICS_BANDS each. */
+	unsigned long long *band_ms;
+	/* Per zone. */
+	unsigned long long *spikes;
+	/* Sensors and fans whose device went away. */
+	unsigned long long device_losses;
+} c_metrics_ty;
+
+static c_metrics_ty c_metrics;
+/* Write the metrics of optional sources, e.g. the GPUs. */
+static void (*c_metrics_extras[2])(FILE *fp);
+
+/* Allocate the counters for conf, with inputs_len temperatures and
+ * tachometers. */
+static int
+c_metrics_init(const c_conf_ty *conf, unsigned int inputs_len)
+{
+	const size_t len = inputs_len + conf->fans_len + (size_t)conf->zones_len * (C_METRICS_BANDS + 1);
+	unsigned long long *p = (unsigned long long *)calloc(len + 1, sizeof(unsigned long long));
+	if (unlikely(p == NULL))
+		return -1;
+	memset(&c_metrics, 0, sizeof(c_metrics));
+	c_metrics.read_errors = p;
+	c_metrics.fan_writes = c_metrics.read_errors + inputs_len;
+	c_metrics.band_ms = c_metrics.fan_writes + conf->fans_len;
+	c_metrics.spikes = c_metrics.band_ms + (size_t)conf->zones_len * C_METRICS_BANDS;
+	return 0;
+}
+
+static ATTR_INLINE void
+c_metrics_tick(unsigned long long ns)
+{
+	++c_metrics.ticks;
+	c_metrics.tick_ns += ns;
+	c_metrics.tick_ns_max = MAX(c_metrics.tick_ns_max, ns);
+}
+
+static ATTR_INLINE void
+c_metrics_late(unsigned long long ns)
+{
+	++c_metrics.timer_ticks;
+	c_metrics.late_ns += ns;
+	c_metrics.late_ns_max = MAX(c_metrics.late_ns_max, ns);
+}
+
+/* Count elapsed_ms at the speed zone i had, and a spike held back, if the
+ * zone just started holding one back. */
+static ATTR_INLINE void
+c_metrics_zone(unsigned int i, const c_zone_state_ty *st, unsigned int elapsed_ms, int last_reason)
+{
+	const unsigned int band = (unsigned int)((unsigned long long)st->last_speed * C_METRICS_BANDS / ((unsigned long long)st->speed_max + 1));
+	c_metrics.band_ms[(size_t)i * C_METRICS_BANDS + MIN(band, C_METRICS_BANDS - 1)] += elapsed_ms;
+	if (st->reason == CFAN_REC_SPIKE && last_reason != CFAN_REC_SPIKE)
+		++c_metrics.spikes[i];
+}
+
+static void
+c_metrics_head(FILE *fp, const char *name, const char *type, const char *help)
+{
+	fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* Write the counters of conf to path, through a temporary file renamed
+ * into place, so that the collector never reads half of them. tach_fans
+ * are the fans of the tachometers; skipped and held count the writes not
+ * made. */
+static int
+c_metrics_write(const char *path, const c_conf_ty *conf, const unsigned int *tach_fans, unsigned int tachs_len, unsigned long long skipped, unsigned long long held)
+{
+	char tmp[PATH_MAX];
+	if (unlikely((size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp))) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	/* Never through a link left in its place. */
+	unlink(tmp);
+	const int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd == -1)
+		return -1;
+	FILE *fp = fdopen(fd, "w");
+	if (unlikely(fp == NULL)) {
+		close(fd);
+		unlink(tmp);
+		return -1;
+	}
+	c_metrics_head(fp, "cfan_ticks_total", "counter", "Control loop ticks.");
+	fprintf(fp, "cfan_ticks_total %llu\n", c_metrics.ticks);
+	c_metrics_head(fp, "cfan_tick_duration_seconds", "summary", "Time spent in a tick.");
+	fprintf(fp, "cfan_tick_duration_seconds_sum %.9f\ncfan_tick_duration_seconds_count %llu\n", (double)c_metrics.tick_ns / 1e9, c_metrics.ticks);
+	c_metrics_head(fp, "cfan_tick_duration_max_seconds", "gauge", "Longest tick since start.");
+	fprintf(fp, "cfan_tick_duration_max_seconds %.9f\n", (double)c_metrics.tick_ns_max / 1e9);
+	c_metrics_head(fp, "cfan_timer_late_seconds", "summary", "How late the interval timer woke the loop.");
+	fprintf(fp, "cfan_timer_late_seconds_sum %.9f\ncfan_timer_late_seconds_count %llu\n", (double)c_metrics.late_ns / 1e9, c_metrics.timer_ticks);
+	c_metrics_head(fp, "cfan_timer_late_max_seconds", "gauge", "Latest wakeup since start.");
+	fprintf(fp, "cfan_timer_late_max_seconds %.9f\n", (double)c_metrics.late_ns_max / 1e9);
+	c_metrics_head(fp, "cfan_wakeups_total", "counter", "Wakeups of the loop, by what woke it.");
+	for (unsigned int i = 0; i < C_METRICS_WAKE_NUM; ++i)
+		fprintf(fp, "cfan_wakeups_total{source=\"%s\"} %llu\n", c_metrics_wake_names[i], c_metrics.wakeups[i]);
+	c_metrics_head(fp, "cfan_sensor_read_errors_total", "counter", "Failed reads of a temperature.");
+	for (unsigned int i = 0; i < conf->temps_len; ++i)
+		fprintf(fp, "cfan_sensor_read_errors_total{sensor=\"%s\"} %llu\n", conf->temp_names[i], c_metrics.read_errors[i]);
+	c_metrics_head(fp, "cfan_tach_read_errors_total", "counter", "Failed reads of a tachometer.");
+	for (unsigned int k = 0; k < tachs_len; ++k)
+		fprintf(fp, "cfan_tach_read_errors_total{fan=\"%s\"} %llu\n", conf->fan_names[tach_fans[k]], c_metrics.read_errors[conf->temps_len + k]);
+	c_metrics_head(fp, "cfan_device_losses_total", "counter", "Sensors and fans whose device went away, as on a driver reload.");
+	fprintf(fp, "cfan_device_losses_total %llu\n", c_metrics.device_losses);
+	c_metrics_head(fp, "cfan_fan_writes_total", "counter", "Speeds written to a fan.");
+	for (unsigned int i = 0; i < conf->fans_len; ++i)
+		fprintf(fp, "cfan_fan_writes_total{fan=\"%s\"} %llu\n", conf->fan_names[i], c_metrics.fan_writes[i]);
+	c_metrics_head(fp, "cfan_writes_skipped_total", "counter", "Fan writes skipped as unchanged.");
+	fprintf(fp, "cfan_writes_skipped_total %llu\n", skipped);
+	c_metrics_head(fp, "cfan_writes_held_total", "counter", "Fan writes avoided by the hysteresis.");
+	fprintf(fp, "cfan_writes_held_total %llu\n", held);
+	c_metrics_head(fp, "cfan_zone_speed_band_seconds_total", "counter", "Time a zone spent in a band of its speed, in percent of its maximum.");
+	for (unsigned int i = 0; i < conf->zones_len; ++i)
+		for (unsigned int b = 0; b < C_METRICS_BANDS; ++b)
+			fprintf(fp, "cfan_zone_speed_band_seconds_total{zone=\"%s\",band=\"%u-%u\"} %.3f\n", conf->zones[i].name, b * 100 / C_METRICS_BANDS, (b + 1) * 100 / C_METRICS_BANDS, (double)c_metrics.band_ms[(size_t)i * C_METRICS_BANDS + b] / 1000);
+	c_metrics_head(fp, "cfan_zone_spike_suppressions_total", "counter", "Rises of the fan speed held back as a spike.");
+	for (unsigned int i = 0; i < conf->zones_len; ++i)
+		fprintf(fp, "cfan_zone_spike_suppressions_total{zone=\"%s\"} %llu\n", conf->zones[i].name, c_metrics.spikes[i]);
+	for (unsigned int i = 0; i < LEN(c_metrics_extras) && c_metrics_extras[i]; ++i)
+		c_metrics_extras[i](fp);
+	if (unlikely((ferror(fp) | fclose(fp)) != 0)) {
+		unlink(tmp);
+		return -1;
+	}
+	if (unlikely(rename(tmp, path) == -1)) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+/* Add fn to the sources written after the counters. */
+static void
+c_metrics_extra_add(void (*fn)(FILE *fp))
+{
+	for (unsigned int i = 0; i < LEN(c_metrics_extras); ++i)
+		if (c_metrics_extras[i] == NULL) {
+			c_metrics_extras[i] = fn;
+			return;
+		}
+}
+
+static void
+c_metrics_cleanup(void)
+{
+	free(c_metrics.read_errors);
+	memset(&c_metrics, 0, sizeof(c_metrics));
+	memset(c_metrics_extras, 0, sizeof(c_metrics_extras));
+}
+
+#endif /* METRICS_H */
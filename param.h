@@ -0,0 +1,99 @@
+#ifndef PARAM_H
+#define PARAM_H 1
+
+#include "config.h"
+
+/* Spike step speed change per INTERVAL_UPDATE (0-255). */
+#define STEPUP_SPIKE 4
+
+/* Tunables that the configuration file can override.
+ * The defaults come from config.h. */
+typedef struct {
+	/* msecs */
+	unsigned int interval_ms;
+	unsigned int interval_min_ms;
+	unsigned int interval_max_ms;
+	/* Degrees per sec. */
+	unsigned int slope_fast;
+	/* Time stepdown_max and stepup_spike are given per, apart from how
+	 * often the loop runs. (msecs) */
+	unsigned int step_ms;
+	/* 0-255 per step_ms. */
+	unsigned int stepdown_max;
+	unsigned int stepup_spike;
+	/* msecs */
+	unsigned int spike_max_ms;
+	/* Millidegrees. */
+	int spike_temp_max;
+	/* Millidegrees. */
+	int hysteresis;
+	/* 0-255 */
+	unsigned int fanspeed_default;
+	/* CONTROL_CURVE, CONTROL_PID or CONTROL_RPM. */
+	unsigned int mode;
+	/* Millidegrees. */
+	int pid_setpoint;
+	/* RPM */
+	unsigned int rpm_stall;
+	/* 0-255 */
+	unsigned int stall_speed_min;
+	/* msecs */
+	unsigned int stall_ms;
+	/* Safety-net interval while sleeping on kernel events, 0 to never
+	 * sleep on them. (msecs) */
+	unsigned int event_poll_ms;
+	/* Millidegrees. */
+	int event_band;
+	/* How far ahead to project a rising temperature, 0 to not, and over
+	 * how long to fit it. (msecs) */
+	unsigned int predict_ms;
+	unsigned int predict_window_ms;
+	/* CPU pressure trigger, 0 to not set one, its window, and how long
+	 * the bias lasts after it fires. (msecs) */
+	unsigned int psi_stall_ms;
+	unsigned int psi_window_ms;
+	unsigned int psi_hold_ms;
+	/* 0-255 above the curve. */
+	unsigned int psi_bias;
+	double pid_kp;
+	double pid_ki;
+	double pid_kd;
+	double pid_d_alpha;
+	double rpm_gain;
+} c_param_ty;
+
+/* clang-format off */
+#define C_PARAM_DEFAULT {                 \
+	INTERVAL_UPDATE * 1000,           \
+	INTERVAL_MIN_MS,                  \
+	INTERVAL_MAX_MS,                  \
+	SLOPE_FAST,                       \
+	INTERVAL_UPDATE * 1000,           \
+	STEPDOWN_MAX,                     \
+	STEPUP_SPIKE,                     \
+	SPIKE_MAX * 1000,                 \
+	SPIKE_TEMP_MAX * 1000,            \
+	HYSTERESIS * 1000,                \
+	FANSPEED_DEFAULT,                 \
+	CONTROL_MODE,                     \
+	PID_SETPOINT * 1000,              \
+	RPM_STALL,                        \
+	STALL_SPEED_MIN,                  \
+	STALL_MS,                         \
+	EVENT_POLL_MS,                    \
+	EVENT_BAND * 1000,                \
+	PREDICT_MS,                       \
+	PREDICT_WINDOW_MS,                \
+	PSI_STALL_MS,                     \
+	PSI_WINDOW_MS,                    \
+	PSI_HOLD_MS,                      \
+	PSI_BIAS,                         \
+	PID_KP,                           \
+	PID_KI,                           \
+	PID_KD,                           \
+	PID_D_ALPHA,                      \
+	RPM_GAIN,                         \
+}
+/* clang-format on */
+
+#endif /* PARAM_H */
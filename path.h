@@ -23,92 +23,393 @@
 #ifndef PATH_H
 #	define PATH_H 1
 
-#	include <glob.h>
+#	include <dirent.h>
+#	include <errno.h>
+#	include <fcntl.h>
 #	include <string.h>
 #	include <unistd.h>
-#	include <assert.h>
 #	include <stdio.h>
 #	include <stdlib.h>
 #	include <limits.h>
-#	include <regex.h>
+
+#	include <sys/stat.h>
 
 #	include "macros.h"
 
-static ATTR_INLINE char *
-u_stpcpy_len(char *dst, const char *src, size_t n)
+/* Resolution of sysfs paths whose hwmon or thermal zone number may change
+ * between boots, with a single scan of /sys/class/hwmon or
+ * /sys/class/thermal:
+ *
+ *   hwmon:NAME[@DEVICE]/FILE  the hwmon named NAME, of the device DEVICE
+ *                             if several have that name, e.g.
+ *                             hwmon:nct6775@nct6775.656/pwm1
+ *   thermal:TYPE/FILE         the thermal zone of type TYPE, e.g.
+ *                             thermal:x86_pkg_temp/temp
+ *   /sys/devices/.../hwmon/hwmonN/FILE
+ *                             the hwmon of the same device, if the file is
+ *                             gone, e.g. after a reboot
+ *
+ * A path that matches more than one directory is an error, rather than the
+ * first match. Resolved paths are kept in a cache keyed by the boot id, so
+ * that a restart does not scan at all. */
+
+/* Where sysfs is. Tests use a tree of their own. */
+#	define PATH_SYS "/sys"
+#	define PATH_BOOT_ID "/proc/sys/kernel/random/boot_id"
+/* Cache entries and file, at most. */
+#	define PATH_CACHE_MAX 4096
+#	define PATH_CACHE_SZ  (1 << 20)
+
+enum {
+	PATH_HWMON = 0,
+	PATH_THERMAL,
+	PATH_CLASSES
+};
+
+static const struct {
+	/* Prefix of an identity, directory under sysfs, prefix of its
+	 * entries, and the file that names them. */
+	const char *spec;
+	const char *dir;
+	const char *entry;
+	const char *name;
+} path_classes[PATH_CLASSES] = {
+	{ "hwmon:",   "class/hwmon",   "hwmon",        "name" },
+	{ "thermal:", "class/thermal", "thermal_zone", "type" },
+};
+
+typedef struct {
+	/* Real path of the directory. */
+	char *real;
+	/* Its name, or the type of a thermal zone. */
+	char name[64];
+	/* Name of its device, or "" if it has none. */
+	char dev[NAME_MAX + 1];
+} path_node_ty;
+
+typedef struct {
+	const char *sys;
+	/* Each class is scanned on first use. */
+	path_node_ty *nodes[PATH_CLASSES];
+	unsigned int lens[PATH_CLASSES];
+	int scanned[PATH_CLASSES];
+} path_scan_ty;
+
+typedef struct {
+	char boot[64];
+	/* The file, which the entries loaded from it point into. */
+	char *text;
+	const char *specs[PATH_CACHE_MAX];
+	const char *paths[PATH_CACHE_MAX];
+	unsigned int len;
+	/* Changed since it was loaded. */
+	int dirty;
+} path_cache_ty;
+
+/* Read the first line of path into buf, without the newline. */
+static int
+path_line_read(const char *path, char *buf, size_t sz)
 {
-	dst = (char *)memcpy(dst, src, n) + n;
-	*dst = '\0';
-	return dst;
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	const ssize_t n = read(fd, buf, sz - 1);
+	close(fd);
+	if (n <= 0)
+		return -1;
+	buf[n] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+static int
+path_scan_class(path_scan_ty *s, unsigned int c)
+{
+	char dir[PATH_MAX], p[PATH_MAX + NAME_MAX + 2], dev[PATH_MAX];
+	const size_t entry_len = strlen(path_classes[c].entry);
+	s->scanned[c] = 1;
+	snprintf(dir, sizeof(dir), "%s/%s", s->sys, path_classes[c].dir);
+	DIR *d = opendir(dir);
+	/* No such class, so nothing matches. */
+	if (d == NULL)
+		return 0;
+	unsigned int cap = 0;
+	for (const struct dirent *e; (e = readdir(d)) != NULL;) {
+		if (strncmp(e->d_name, path_classes[c].entry, entry_len) || e->d_name[entry_len] < '0' || e->d_name[entry_len] > '9')
+			continue;
+		if (s->lens[c] == cap) {
+			cap = cap ? cap * 2 : 16;
+			path_node_ty *nodes = (path_node_ty *)realloc(s->nodes[c], cap * sizeof(path_node_ty));
+			if (unlikely(nodes == NULL)) {
+				closedir(d);
+				return -1;
+			}
+			s->nodes[c] = nodes;
+		}
+		path_node_ty *n = s->nodes[c] + s->lens[c];
+		snprintf(p, sizeof(p), "%s/%s", dir, e->d_name);
+		n->real = realpath(p, NULL);
+		if (n->real == NULL)
+			continue;
+		snprintf(p, sizeof(p), "%s/%s", n->real, path_classes[c].name);
+		if (path_line_read(p, n->name, sizeof(n->name)) == -1)
+			n->name[0] = '\0';
+		n->dev[0] = '\0';
+		snprintf(p, sizeof(p), "%s/device", n->real);
+		if (realpath(p, dev) != NULL)
+			snprintf(n->dev, sizeof(n->dev), "%s", strrchr(dev, '/') + 1);
+		DBG(fprintf(stderr, "%s:%d:%s: %s is %s of %s.\n", __FILE__, __LINE__, ASSERT_FUNC, n->real, n->name, n->dev));
+		++s->lens[c];
+	}
+	closedir(d);
+	return 0;
+}
+
+static void
+path_scan_free(path_scan_ty *s)
+{
+	for (unsigned int c = 0; c < PATH_CLASSES; ++c) {
+		for (unsigned int i = 0; i < s->lens[c]; ++i)
+			free(s->nodes[c][i].real);
+		free(s->nodes[c]);
+		s->nodes[c] = NULL;
+		s->lens[c] = 0;
+		s->scanned[c] = 0;
+	}
 }
 
-/* Update hwmon/hwmon[0-9]* and thermal/thermal_zone[0-9]* to point to
- * the real file, given that the number may change between reboots.
- *
- * Return pointer to malloc'd resolved filename.
- * If file already exists, then return original filename
- *
- * Filename should start with /sys/devices/platform.
- *
- * Example filename: /sys/devices/platform/coretemp.0/hwmon/hwmon2/temp1_input */
 static char *
-path_sysfs_resolve(const char *filename)
+path_join(const char *dir, const char *file)
 {
-#	if !defined NAME_MAX || !defined PATH_MAX
-	enum {
-#		ifndef NAME_MAX
-		NAME_MAX = 256,
-#		endif
-#		ifndef PATH_MAX
-		PATH_MAX = 4096,
-#		endif
-	};
-#	endif
-	/* No need to continue if file exists. */
-	if (access(filename, F_OK) == 0)
-		return (char *)filename;
-	regex_t r;
-	regmatch_t rm[4];
-	/* Convert the filename into a glob. */
-	const char *pattern = "\\(\\/sys\\/devices.*\\)\\/\\([^/0-9]*\\)[0-9]*\\/\\([^/]*\\)$";
-	DBG(fprintf(stderr, "%s:%d:%s: pattern: %s.\n", __FILE__, __LINE__, ASSERT_FUNC, pattern));
-	int ret = regcomp(&r, pattern, 0);
-	if (unlikely(ret))
+	const size_t dir_len = strlen(dir), file_len = strlen(file);
+	char *p = (char *)malloc(dir_len + 1 + file_len + 1);
+	if (unlikely(p == NULL))
 		return NULL;
-	ret = regexec(&r, filename, 4, rm, 0);
-	regfree(&r);
-	if (unlikely(ret != REG_NOERROR))
+	memcpy(p, dir, dir_len);
+	p[dir_len] = '/';
+	memcpy(p + dir_len + 1, file, file_len + 1);
+	return p;
+}
+
+/* Resolve spec, after the identity prefix of class c. */
+static char *
+path_identity_resolve(path_scan_ty *s, unsigned int c, const char *spec)
+{
+	const char *id = spec + strlen(path_classes[c].spec);
+	const char *slash = strchr(id, '/');
+	if (slash == NULL || slash == id || slash[1] == '\0') {
+		fprintf(stderr, "cfan: %s: expected %sNAME[@DEVICE]/FILE.\n", spec, path_classes[c].spec);
+		errno = EINVAL;
 		return NULL;
-	char glob_pattern[PATH_MAX + NAME_MAX];
-	char *glob_end = glob_pattern;
-	/* Construct the glob pattern. */
-	/* /sys/devices/.* */
-	glob_end = (char *)u_stpcpy_len(glob_end, filename + rm[1].rm_so, (size_t)(rm[1].rm_eo - rm[1].rm_so));
-	glob_end = (char *)u_stpcpy_len(glob_end, S_LITERAL("/"));
-	/* hwmon[0-9]* */
-	glob_end = (char *)u_stpcpy_len(glob_end, filename + rm[2].rm_so, (size_t)(rm[2].rm_eo - rm[2].rm_so));
-	glob_end = (char *)u_stpcpy_len(glob_end, S_LITERAL("[0-9]*/"));
-	/* tail */
-	glob_end = (char *)u_stpcpy_len(glob_end, filename + rm[3].rm_so, (size_t)(rm[3].rm_eo - rm[3].rm_so));
-	DBG(fprintf(stderr, "%s:%d:%s: glob_pattern: %s.\n", __FILE__, __LINE__, ASSERT_FUNC, glob_pattern));
-	glob_t g;
-	/* Expand the glob into the real file. */
-	ret = glob(glob_pattern, 0, NULL, &g);
-	if (ret == 0) {
-		const size_t len = strlen(g.gl_pathv[0]);
-		char *heap = (char *)malloc(len + 1);
-		if (heap == NULL)
+	}
+	const char *at = (const char *)memchr(id, '@', (size_t)(slash - id));
+	const size_t name_len = (size_t)((at ? at : slash) - id);
+	const size_t dev_len = at ? (size_t)(slash - at - 1) : 0;
+	if (!s->scanned[c] && unlikely(path_scan_class(s, c) == -1))
+		return NULL;
+	const path_node_ty *found = NULL;
+	for (unsigned int i = 0; i < s->lens[c]; ++i) {
+		const path_node_ty *n = s->nodes[c] + i;
+		if (strlen(n->name) != name_len || memcmp(n->name, id, name_len))
+			continue;
+		if (at && (strlen(n->dev) != dev_len || memcmp(n->dev, at + 1, dev_len)))
+			continue;
+		if (found) {
+			fprintf(stderr, "cfan: %s matches both %s (%s) and %s (%s), add @DEVICE.\n", spec, found->real, found->dev, n->real, n->dev);
+			errno = EINVAL;
 			return NULL;
-		u_stpcpy_len(heap, g.gl_pathv[0], len);
-		globfree(&g);
-		DBG(fprintf(stderr, "%s:%d:%s: heap (malloc'd): %s.\n", __FILE__, __LINE__, ASSERT_FUNC, heap));
-		return heap;
-	} else if (unlikely(ret == GLOB_NOMATCH)) {
-		globfree(&g);
-	} else { /* glob error */
+		}
+		found = n;
+	}
+	if (found == NULL) {
+		errno = ENOENT;
 		return NULL;
 	}
+	return path_join(found->real, slash + 1);
+}
+
+/* Return the length of the device part of a hwmon or thermal zone
+ * directory: .../DEVICE/hwmon/hwmonN or .../DEVICE/thermal_zoneN. */
+static size_t
+path_parent_len(const char *dir, size_t len, unsigned int c)
+{
+	while (len && dir[len - 1] != '/')
+		--len;
+	if (len)
+		--len;
+	if (c == PATH_HWMON && len >= S_LEN("/hwmon") && !memcmp(dir + len - S_LEN("/hwmon"), "/hwmon", S_LEN("/hwmon")))
+		len -= S_LEN("/hwmon");
+	return len;
+}
+
+/* Resolve a path to a file that is gone, by the device of its hwmon or
+ * thermal zone. */
+static char *
+path_device_resolve(path_scan_ty *s, const char *spec)
+{
+	const char *file = strrchr(spec, '/');
+	errno = ENOENT;
+	if (file == NULL || file == spec)
+		return NULL;
+	const size_t dir_len = (size_t)(file - spec);
+	const char *base = file;
+	while (base > spec && base[-1] != '/')
+		--base;
+	for (unsigned int c = 0; c < PATH_CLASSES; ++c) {
+		const size_t entry_len = strlen(path_classes[c].entry);
+		if (strncmp(base, path_classes[c].entry, entry_len) || base[entry_len] < '0' || base[entry_len] > '9')
+			continue;
+		const size_t parent_len = path_parent_len(spec, dir_len, c);
+		if (!s->scanned[c] && unlikely(path_scan_class(s, c) == -1))
+			return NULL;
+		char *found = NULL;
+		for (unsigned int i = 0; i < s->lens[c]; ++i) {
+			const path_node_ty *n = s->nodes[c] + i;
+			if (path_parent_len(n->real, strlen(n->real), c) != parent_len || memcmp(n->real, spec, parent_len))
+				continue;
+			char *p = path_join(n->real, file + 1);
+			if (unlikely(p == NULL) || access(p, F_OK) == -1) {
+				free(p);
+				continue;
+			}
+			if (found) {
+				fprintf(stderr, "cfan: %s could be %s or %s, name it by %sNAME[@DEVICE]/FILE instead.\n", spec, found, p, path_classes[c].spec);
+				free(found);
+				free(p);
+				errno = EINVAL;
+				return NULL;
+			}
+			found = p;
+		}
+		errno = (found == NULL) ? ENOENT : 0;
+		return found;
+	}
 	return NULL;
 }
 
+/* Return 1 if spec is resolved by path_sysfs_resolve(). */
+static int
+path_is_sysfs(const char *spec)
+{
+	for (unsigned int c = 0; c < PATH_CLASSES; ++c)
+		if (!strncmp(spec, path_classes[c].spec, strlen(path_classes[c].spec)))
+			return 1;
+	return strstr(spec, "/sys/") != NULL;
+}
+
+/* Return the file spec refers to: spec itself if it exists, or a malloc'd
+ * path. Return NULL with ENOENT if it matches nothing yet, or, saying why,
+ * with EINVAL if it matches several or is malformed. */
+static char *
+path_sysfs_resolve(path_scan_ty *s, const char *spec)
+{
+	for (unsigned int c = 0; c < PATH_CLASSES; ++c)
+		if (!strncmp(spec, path_classes[c].spec, strlen(path_classes[c].spec)))
+			return path_identity_resolve(s, c, spec);
+	/* No need to continue if file exists. */
+	if (access(spec, F_OK) == 0)
+		return (char *)spec;
+	return path_device_resolve(s, spec);
+}
+
+/* Load the entries of the cache at path if they were written during boot,
+ * in place of those of an earlier load. Only a file of the current user
+ * that no one else can write is trusted, since cfan writes to the paths
+ * it holds. */
+static void
+path_cache_load(path_cache_ty *cache, const char *path, const char *boot)
+{
+	struct stat st;
+	free(cache->text);
+	cache->text = NULL;
+	cache->len = 0;
+	cache->dirty = 0;
+	snprintf(cache->boot, sizeof(cache->boot), "%s", boot);
+	const int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1)
+		return;
+	char *text = NULL;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) || st.st_size <= 0 || st.st_size > PATH_CACHE_SZ
+	    || (text = (char *)malloc((size_t)st.st_size + 1)) == NULL || read(fd, text, (size_t)st.st_size) != (ssize_t)st.st_size) {
+		free(text);
+		close(fd);
+		return;
+	}
+	close(fd);
+	text[st.st_size] = '\0';
+	char *line = text, *next = strchr(line, '\n');
+	if (next == NULL || (size_t)(next - line) != strlen(boot) || memcmp(line, boot, strlen(boot))) {
+		free(text);
+		return;
+	}
+	cache->text = text;
+	for (line = next + 1; (next = strchr(line, '\n')) != NULL && cache->len < PATH_CACHE_MAX; line = next + 1) {
+		*next = '\0';
+		char *tab = strchr(line, '\t');
+		if (tab == NULL)
+			continue;
+		*tab = '\0';
+		cache->specs[cache->len] = line;
+		cache->paths[cache->len] = tab + 1;
+		++cache->len;
+	}
+}
+
+/* Return the cached path of spec, if it is under sys and still exists. */
+static const char *
+path_cache_get(const path_cache_ty *cache, const char *sys, const char *spec)
+{
+	const size_t sys_len = strlen(sys);
+	for (unsigned int i = 0; i < cache->len; ++i) {
+		if (strcmp(cache->specs[i], spec))
+			continue;
+		const char *p = cache->paths[i];
+		if (strncmp(p, sys, sys_len) || p[sys_len] != '/' || strstr(p, "/../") || access(p, F_OK) == -1)
+			return NULL;
+		return p;
+	}
+	return NULL;
+}
+
+static void
+path_cache_put(path_cache_ty *cache, const char *spec, const char *path)
+{
+	unsigned int i = 0;
+	while (i < cache->len && strcmp(cache->specs[i], spec))
+		++i;
+	if (i == PATH_CACHE_MAX)
+		return;
+	cache->specs[i] = spec;
+	cache->paths[i] = path;
+	cache->len += (i == cache->len);
+	cache->dirty = 1;
+}
+
+/* Write the cache to path, through a temporary file renamed into place. */
+static int
+path_cache_save(const path_cache_ty *cache, const char *path)
+{
+	char tmp[PATH_MAX];
+	if (unlikely((size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp)))
+		return -1;
+	unlink(tmp);
+	const int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd == -1)
+		return -1;
+	FILE *fp = fdopen(fd, "w");
+	if (unlikely(fp == NULL)) {
+		close(fd);
+		unlink(tmp);
+		return -1;
+	}
+	fprintf(fp, "%s\n", cache->boot);
+	for (unsigned int i = 0; i < cache->len; ++i)
+		fprintf(fp, "%s\t%s\n", cache->specs[i], cache->paths[i]);
+	if ((ferror(fp) | fclose(fp)) != 0 || rename(tmp, path) == -1) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
 #endif /* PATH_H */
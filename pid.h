@@ -0,0 +1,53 @@
+#ifndef PID_H
+#define PID_H 1
+
+#include "macros.h"
+#include "param.h"
+
+/* PID controller holding a zone at pid_setpoint.
+ *
+ * The integral is kept in output units (fan speed), so it can be seeded with
+ * the current fan speed for a bumpless start. The derivative is taken on the
+ * temperature rather than on the error, and low-pass filtered against sensor
+ * noise. */
+typedef struct {
+	double integral;
+	double deriv;
+	int last_temp;
+	int inited;
+} c_pid_ty;
+
+static ATTR_INLINE double
+c_pid_clamp(double x, double lo, double hi)
+{
+	return (x < lo) ? lo : (x > hi) ? hi : x;
+}
+
+/* Get the next fan speed, between speed_min and speed_max.
+ * temp is in millidegrees. */
+static ATTR_INLINE unsigned int
+c_pid_get(const c_param_ty *prm, c_pid_ty *pid, int temp, unsigned int last_speed, unsigned int elapsed_ms, unsigned int speed_min, unsigned int speed_max)
+{
+	const double dt = (double)elapsed_ms / 1000;
+	const double err = ((double)temp - prm->pid_setpoint) / 1000;
+	const double p = prm->pid_kp * err;
+	if (unlikely(!pid->inited)) {
+		pid->integral = c_pid_clamp((double)last_speed - p, 0, speed_max);
+		pid->deriv = 0;
+		pid->last_temp = temp;
+		pid->inited = 1;
+	}
+	if (likely(dt > 0))
+		pid->deriv += prm->pid_d_alpha * (((double)temp - (double)pid->last_temp) / 1000 / dt - pid->deriv);
+	pid->last_temp = temp;
+	const double d = prm->pid_kd * pid->deriv;
+	/* Anti-windup: integrate only up to where the output saturates, so that
+	 * it leaves saturation as soon as the error reverses. */
+	const double integral = c_pid_clamp(pid->integral + prm->pid_ki * err * dt, speed_min - p - d, speed_max - p - d);
+	pid->integral = c_pid_clamp(integral, 0, speed_max);
+	const double speed = c_pid_clamp(p + pid->integral + d, speed_min, speed_max);
+	DBG(fprintf(stderr, "%s:%d:%s: pid: p: %f, i: %f, d: %f, speed: %f.\n", __FILE__, __LINE__, ASSERT_FUNC, p, pid->integral, d, speed));
+	return (unsigned int)(speed + 0.5);
+}
+
+#endif /* PID_H */
@@ -0,0 +1,141 @@
+#ifndef PREDICT_H
+#define PREDICT_H 1
+
+#include <limits.h>
+
+#include "macros.h"
+#include "param.h"
+
+/* Trend of the temperature of a zone, to ramp ahead of a sustained rise.
+ *
+ * A line is fit to the samples of the last predict_window_ms, and to each
+ * half of the window. The rise is taken as sustained if both halves rise
+ * and the newer half at least half as fast as the older. A spike fails
+ * this once it has levelled off or fallen back for half a window. A rise
+ * taken as sustained is projected predict_ms ahead, slowing down as it
+ * did over the window, and the zone moves there at once, without the
+ * spike suppression of c_step_get(), so a spike that looks sustained for
+ * that long raises the fans too; they ramp back down as usual once the
+ * trend is flat. */
+
+/* Samples kept, over up to two windows. */
+#define C_PREDICT_LEN 16
+/* Rise over the window below which the trend is taken as flat.
+ * (millidegrees) */
+#define C_PREDICT_RISE_MIN 2000
+
+typedef struct {
+	/* Msecs, summed from elapsed_ms, and millidegrees. */
+	unsigned long long ms[C_PREDICT_LEN];
+	int temp[C_PREDICT_LEN];
+	/* Samples, the newest at last. */
+	unsigned int len;
+	unsigned int last;
+	unsigned long long now_ms;
+	/* Projection being followed, or INT_MIN. */
+	int ahead;
+} c_predict_ty;
+
+/* Add temp, elapsed_ms after the previous sample. The newest sample is
+ * replaced until it is a fourteenth of the window past the one before it,
+ * so that the ring always spans the window, however short the interval. */
+static ATTR_INLINE void
+c_predict_add(const c_param_ty *prm, c_predict_ty *p, int temp, unsigned int elapsed_ms)
+{
+	p->now_ms += elapsed_ms;
+	if (p->len >= 2) {
+		const unsigned int prev = (p->last + C_PREDICT_LEN - 1) % C_PREDICT_LEN;
+		if (p->ms[p->last] - p->ms[prev] < prm->predict_window_ms / (C_PREDICT_LEN - 2)) {
+			p->ms[p->last] = p->now_ms;
+			p->temp[p->last] = temp;
+			return;
+		}
+	}
+	p->last = (p->last + 1) % C_PREDICT_LEN;
+	p->ms[p->last] = p->now_ms;
+	p->temp[p->last] = temp;
+	if (p->len < C_PREDICT_LEN)
+		++p->len;
+}
+
+/* Fit a line to the samples from from_ms to to_ms. Return the number of
+ * samples, and the slope in millidegrees per sec in *slope. */
+static ATTR_INLINE unsigned int
+c_predict_fit(const c_predict_ty *p, unsigned long long from_ms, unsigned long long to_ms, double *slope)
+{
+	unsigned int n = 0;
+	double sum_t = 0, sum_y = 0;
+	for (unsigned int k = 0; k < p->len; ++k) {
+		const unsigned int i = (p->last + C_PREDICT_LEN - k) % C_PREDICT_LEN;
+		if (p->ms[i] < from_ms)
+			break;
+		if (p->ms[i] <= to_ms) {
+			++n;
+			sum_t += (double)(p->ms[i] - from_ms);
+			sum_y += p->temp[i];
+		}
+	}
+	*slope = 0;
+	if (n < 2)
+		return n;
+	/* Least squares, around the means. */
+	const double mean_t = sum_t / n, mean_y = sum_y / n;
+	double stt = 0, sty = 0;
+	for (unsigned int k = 0; k < p->len; ++k) {
+		const unsigned int i = (p->last + C_PREDICT_LEN - k) % C_PREDICT_LEN;
+		if (p->ms[i] < from_ms)
+			break;
+		if (p->ms[i] <= to_ms) {
+			const double dt = (double)(p->ms[i] - from_ms) - mean_t;
+			stt += dt * dt;
+			sty += dt * (p->temp[i] - mean_y);
+		}
+	}
+	if (stt > 0)
+		*slope = sty / stt * 1000;
+	return n;
+}
+
+/* Add temp and return the temperature to follow: the projection of a
+ * steady rise predict_ms ahead, held while the rise lasts, or else temp. */
+static ATTR_INLINE int
+c_predict_get(const c_param_ty *prm, c_predict_ty *p, int temp, unsigned int elapsed_ms)
+{
+	if (prm->predict_ms == 0)
+		return temp;
+	c_predict_add(prm, p, temp, elapsed_ms);
+	const unsigned long long window = prm->predict_window_ms;
+	double slope = 0, older, newer;
+	const unsigned long long from = (p->now_ms > window) ? p->now_ms - window : 0, mid = p->now_ms - window / 2;
+	const unsigned int n = (p->now_ms >= window) ? c_predict_fit(p, from, p->now_ms, &slope) : 0;
+	/* A rise of less than C_PREDICT_RISE_MIN over the window is sensor
+	 * noise, and one that slows down by half is a spike. */
+	if (n < 4 || slope * (double)window / 1000 < C_PREDICT_RISE_MIN
+	    || c_predict_fit(p, from, mid, &older) < 2 || older <= 0
+	    || c_predict_fit(p, mid, p->now_ms, &newer) < 2 || newer * 2 < older) {
+		p->ahead = INT_MIN;
+		return temp;
+	}
+	/* The slope keeps slowing down by newer / older each half window, so
+	 * that a rise that levels off is projected to about where it does,
+	 * rather than past it. At most the range of a curve. */
+	const double r = MIN(newer / older, 1.0), half = (double)(window / 2);
+	double rise = 0, k = newer * r / 1000;
+	for (double t = 0; t < prm->predict_ms && rise < 100000; t += half, k *= r)
+		rise += k * MIN(half, prm->predict_ms - t);
+	rise = MIN(rise, 100000.0);
+	DBG(fprintf(stderr, "%s:%d:%s: rising %f millidegrees per sec, slowing by %f, predicting %d.\n", __FILE__, __LINE__, ASSERT_FUNC, newer, r, temp + (int)rise));
+	/* Not lowered while the rise lasts. */
+	p->ahead = MAX(p->ahead, temp + (int)rise);
+	return p->ahead;
+}
+
+/* Forget the samples and the projection. */
+static ATTR_INLINE void
+c_predict_reset(c_predict_ty *p)
+{
+	p->len = 0;
+	p->ahead = INT_MIN;
+}
+
+#endif /* PREDICT_H */
@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2026 James Tirta Halim <tirtajames45 at gmail dot com> */
+
+#ifndef PSI_H
+#define PSI_H 1
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "macros.h"
+
+/* Feed-forward from CPU pressure, see Documentation/accounting/psi.rst.
+ *
+ * A trigger written to /proc/pressure/cpu makes the file report EPOLLPRI
+ * once tasks have stalled on the CPU for psi_stall_ms within a window of
+ * psi_window_ms, seconds before the package heats up. Each zone following
+ * a curve then jumps to psi_bias above it until psi_hold_ms after the
+ * last trigger, and ramps back down through c_step_get(). The kernel reports a
+ * trigger at most once per window. */
+
+#define C_PSI_PATH "/proc/pressure/cpu"
+
+static int c_psi_fd = -1;
+/* End of the bias, on CLOCK_MONOTONIC. (msecs) */
+static unsigned long long c_psi_until_ms;
+
+/* Open path and write a trigger of stall_ms within window_ms to it.
+ * Return the file descriptor, or -1 if the kernel has no PSI or rejects
+ * the trigger. */
+static int
+c_psi_init(const char *path, unsigned int stall_ms, unsigned int window_ms)
+{
+	char buf[64];
+	const int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	/* In usecs, written with its NUL. */
+	const int len = snprintf(buf, sizeof(buf), "some %u %u", stall_ms * 1000, window_ms * 1000);
+	if (write(fd, buf, (size_t)len + 1) != (ssize_t)len + 1) {
+		close(fd);
+		return -1;
+	}
+	c_psi_fd = fd;
+	return fd;
+}
+
+/* A trigger fired at now_ms. */
+static ATTR_INLINE void
+c_psi_fired(unsigned long long now_ms, unsigned int hold_ms)
+{
+	c_psi_until_ms = now_ms + hold_ms;
+	DBG(fprintf(stderr, "%s:%d:%s: CPU pressure, biasing until %llu.\n", __FILE__, __LINE__, ASSERT_FUNC, c_psi_until_ms));
+}
+
+/* Return the bias of the zones at now_ms. */
+static ATTR_INLINE unsigned int
+c_psi_bias(unsigned long long now_ms, unsigned int bias)
+{
+	return (now_ms < c_psi_until_ms) ? bias : 0;
+}
+
+static void
+c_psi_cleanup(void)
+{
+	if (c_psi_fd != -1)
+		close(c_psi_fd);
+	c_psi_fd = -1;
+	c_psi_until_ms = 0;
+}
+
+#endif /* PSI_H */
@@ -0,0 +1,219 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2026 James Tirta Halim <tirtajames45 at gmail dot com> */
+
+#ifndef REC_H
+#define REC_H 1
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cfan-rec.h"
+#include "macros.h"
+#include "conf.h"
+#include "temp.h"
+
+/* Writer side of cfan-rec.h: a ring of the last REC_LEN ticks, in memory.
+ * c_rec_tick() copies a few dozen bytes per tick. c_rec_dump() only uses
+ * async-signal-safe calls, so that it can run from a crash handler. */
+
+typedef struct {
+	/* The names, then the ring. */
+	char *buf;
+	size_t names_len;
+	uint32_t slot_size;
+	uint32_t temps_len;
+	uint32_t zones_len;
+	uint32_t len;
+	/* Next slot to write. */
+	uint32_t head;
+	uint64_t ticks;
+} c_rec_ty;
+
+static c_rec_ty c_rec;
+/* Where the crash handler dumps to. */
+static const char *c_rec_crash_path;
+/* Called by the crash handler before it dumps, to undo what cfan changed
+ * outside of itself. Must be async-signal-safe. */
+static void (*c_rec_crash_fn)(void);
+
+static ATTR_INLINE char *
+c_rec_slot(uint32_t i)
+{
+	return c_rec.buf + c_rec.names_len + (size_t)i * c_rec.slot_size;
+}
+
+/* Allocate the ring for len ticks of conf. */
+static int
+c_rec_init(const c_conf_ty *conf, uint32_t len)
+{
+	size_t names_len = 0;
+	for (unsigned int i = 0; i < conf->temps_len; ++i)
+		names_len += strlen(conf->temp_names[i]) + 1;
+	for (unsigned int i = 0; i < conf->zones_len; ++i)
+		names_len += strlen(conf->zones[i].name) + 1;
+	c_rec.slot_size = (uint32_t)cfan_rec_slot_size(conf->temps_len, conf->zones_len);
+	c_rec.buf = (char *)calloc(1, names_len + (size_t)len * c_rec.slot_size);
+	if (unlikely(c_rec.buf == NULL))
+		return -1;
+	c_rec.names_len = names_len;
+	c_rec.temps_len = conf->temps_len;
+	c_rec.zones_len = conf->zones_len;
+	c_rec.len = len;
+	c_rec.head = 0;
+	c_rec.ticks = 0;
+	char *p = c_rec.buf;
+	for (unsigned int i = 0; i < conf->temps_len; ++i)
+		p = stpcpy(p, conf->temp_names[i]) + 1;
+	for (unsigned int i = 0; i < conf->zones_len; ++i)
+		p = stpcpy(p, conf->zones[i].name) + 1;
+	return 0;
+}
+
+/* Record a tick: temps are c_temps, states the zones after the tick. */
+static ATTR_INLINE void
+c_rec_tick(unsigned long long now_ms, unsigned int interval_ms, const int *temps, const c_zone_state_ty *states)
+{
+	if (unlikely(c_rec.buf == NULL))
+		return;
+	char *p = c_rec_slot(c_rec.head);
+	cfan_rec_slot_ty *s = (cfan_rec_slot_ty *)p;
+	s->ms = now_ms;
+	s->interval_ms = interval_ms;
+	int32_t *t = (int32_t *)(s + 1);
+	for (uint32_t i = 0; i < c_rec.temps_len; ++i)
+		t[i] = (temps[i] != C_TEMP_INVALID) ? temps[i] : INT32_MIN;
+	cfan_rec_zone_ty *z = (cfan_rec_zone_ty *)(t + c_rec.temps_len);
+	for (uint32_t i = 0; i < c_rec.zones_len; ++i) {
+		z[i].temp = states[i].last_temp;
+		z[i].target = states[i].target;
+		z[i].speed = states[i].last_speed;
+		z[i].reason = (uint8_t)states[i].reason;
+	}
+	c_rec.head = (c_rec.head + 1 == c_rec.len) ? 0 : c_rec.head + 1;
+	++c_rec.ticks;
+}
+
+static int
+c_rec_write(int fd, const void *p, size_t n)
+{
+	for (const char *s = (const char *)p; n;) {
+		const ssize_t w = write(fd, s, n);
+		if (w == -1 && errno == EINTR)
+			continue;
+		if (w <= 0)
+			return -1;
+		s += w;
+		n -= (size_t)w;
+	}
+	return 0;
+}
+
+/* Write the ring to path, oldest tick first. */
+static int
+c_rec_dump(const char *path)
+{
+	struct timespec mono, real;
+	cfan_rec_hdr_ty h;
+	if (c_rec.buf == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	const uint32_t len = (c_rec.ticks < c_rec.len) ? (uint32_t)c_rec.ticks : c_rec.len;
+	/* Where the oldest kept tick is. */
+	const uint32_t first = (c_rec.ticks < c_rec.len) ? 0 : c_rec.head;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CFAN_REC_MAGIC, sizeof(h.magic));
+	h.version = CFAN_REC_VERSION;
+	h.slot_size = c_rec.slot_size;
+	h.temps_len = c_rec.temps_len;
+	h.zones_len = c_rec.zones_len;
+	h.len = len;
+	h.names_len = (uint32_t)c_rec.names_len;
+	h.ticks = c_rec.ticks;
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	h.real_ms = ((int64_t)real.tv_sec - mono.tv_sec) * 1000 + (real.tv_nsec - mono.tv_nsec) / 1000000;
+	/* The directory may be world-writable, so never follow a link there:
+	 * write a new file and rename it into place, without snprintf(), as
+	 * this runs in the crash handler too. */
+	char tmp[PATH_MAX];
+	const size_t path_len = strlen(path);
+	if (unlikely(path_len + sizeof(".tmp") > sizeof(tmp))) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memcpy(tmp, path, path_len);
+	memcpy(tmp + path_len, ".tmp", sizeof(".tmp"));
+	unlink(tmp);
+	const int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd == -1)
+		return -1;
+	const uint32_t tail = MIN(len, c_rec.len - first);
+	if (c_rec_write(fd, &h, sizeof(h)) == -1 || c_rec_write(fd, c_rec.buf, c_rec.names_len) == -1
+	    || c_rec_write(fd, c_rec_slot(first), (size_t)tail * c_rec.slot_size) == -1
+	    || c_rec_write(fd, c_rec_slot(0), (size_t)(len - tail) * c_rec.slot_size) == -1) {
+		const int e = errno;
+		close(fd);
+		unlink(tmp);
+		errno = e;
+		return -1;
+	}
+	if (close(fd) == -1 || rename(tmp, path) == -1) {
+		const int e = errno;
+		unlink(tmp);
+		errno = e;
+		return -1;
+	}
+	return 0;
+}
+
+static void
+c_rec_crash(int sig)
+{
+	const int e = errno;
+	if (c_rec_crash_fn != NULL)
+		c_rec_crash_fn();
+	(void)c_rec_dump(c_rec_crash_path);
+	errno = e;
+	/* The handler was reset, so this ends the process as sig would have. */
+	raise(sig);
+}
+
+/* Dump to path on SIGSEGV, SIGBUS, SIGFPE, SIGILL and SIGABRT, which
+ * includes DIE(). */
+static int
+c_rec_crash_init(const char *path)
+{
+	static char altstack[16384];
+	const int sigs[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+	struct sigaction sa;
+	stack_t ss;
+	c_rec_crash_path = path;
+	/* A stack overflow leaves no stack to handle it on. */
+	ss.ss_sp = altstack;
+	ss.ss_size = sizeof(altstack);
+	ss.ss_flags = 0;
+	if (unlikely(sigaltstack(&ss, NULL) == -1))
+		return -1;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = c_rec_crash;
+	sa.sa_flags = SA_RESETHAND | SA_ONSTACK;
+	sigemptyset(&sa.sa_mask);
+	for (unsigned int i = 0; i < LEN(sigs); ++i)
+		if (unlikely(sigaction(sigs[i], &sa, NULL) == -1))
+			return -1;
+	return 0;
+}
+
+static void
+c_rec_cleanup(void)
+{
+	free(c_rec.buf);
+	c_rec.buf = NULL;
+}
+
+#endif /* REC_H */
@@ -0,0 +1,81 @@
+#ifndef RPM_H
+#define RPM_H 1
+
+#include "macros.h"
+#include "param.h"
+
+/* Tachometer side of a fan: closed-loop RPM control and stall detection.
+ *
+ * In CONTROL_RPM the curve gives a target RPM, and each fan's PWM is moved
+ * by rpm_gain of the error, converted to PWM through the RPM per PWM unit
+ * that the fan was last seen doing. This is an integral controller whose
+ * gain follows the fan, so that fans of different models and ages reach
+ * the same RPM. */
+typedef struct {
+	/* Last read, 0 if it could not be read. */
+	unsigned int rpm;
+	/* Estimated RPM per PWM unit, 0 until seen turning. */
+	double slope;
+	/* msecs spent driven but not turning. */
+	unsigned int stall_ms;
+	int stalled;
+} c_rpm_ty;
+
+/* RPM per PWM unit assumed before a fan has been seen turning,
+ * about 2000 RPM at full speed. */
+#define C_RPM_SLOPE_DEFAULT 8.0
+
+/* Get the PWM (0-255) that moves the fan from pwm toward target RPM. */
+static ATTR_INLINE unsigned int
+c_rpm_pwm_get(const c_param_ty *prm, c_rpm_ty *r, unsigned int target, unsigned int pwm)
+{
+	if (r->rpm > 0 && pwm > 0) {
+		const double slope = (double)r->rpm / pwm;
+		r->slope = (r->slope > 0) ? r->slope + 0.2 * (slope - r->slope) : slope;
+	}
+	const double k = (r->slope > 0) ? r->slope : C_RPM_SLOPE_DEFAULT;
+	double next = (double)pwm + prm->rpm_gain * ((double)target - (double)r->rpm) / k;
+	next = (next < 0) ? 0 : (next > 255) ? 255 : next;
+	DBG(fprintf(stderr, "%s:%d:%s: rpm: target: %u, rpm: %u, pwm: %u -> %f.\n", __FILE__, __LINE__, ASSERT_FUNC, target, r->rpm, pwm, next));
+	return (unsigned int)(next + 0.5);
+}
+
+/* Track whether a fan driven at pwm is turning.
+ * Return 1 when it has just stalled, -1 when it has just recovered,
+ * and 0 otherwise. */
+static ATTR_INLINE int
+c_rpm_stall_update(const c_param_ty *prm, c_rpm_ty *r, unsigned int pwm, unsigned int elapsed_ms)
+{
+	if (r->stalled) {
+		if (r->rpm < prm->rpm_stall)
+			return 0;
+		r->stalled = 0;
+		r->stall_ms = 0;
+		return -1;
+	}
+	/* Fans may stop at low speeds on purpose. */
+	if (pwm < prm->stall_speed_min || r->rpm >= prm->rpm_stall) {
+		r->stall_ms = 0;
+		return 0;
+	}
+	r->stall_ms += elapsed_ms;
+	if (r->stall_ms < prm->stall_ms)
+		return 0;
+	r->stalled = 1;
+	return 1;
+}
+
+/* Get the speed for the fans of a group that still turn, so that together
+ * they move as much air as all fans_len would at speed. */
+static ATTR_INLINE unsigned int
+c_rpm_compensate(unsigned int speed, unsigned int fans_len, unsigned int stalled, unsigned int speed_max)
+{
+	if (stalled == 0)
+		return speed;
+	if (stalled >= fans_len)
+		return speed_max;
+	const unsigned long long s = (unsigned long long)speed * fans_len / (fans_len - stalled);
+	return (s > speed_max) ? speed_max : (unsigned int)s;
+}
+
+#endif /* RPM_H */
@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2026 James Tirta Halim <tirtajames45 at gmail dot com> */
+
+#ifndef STATUS_H
+#define STATUS_H 1
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cfan-status.h"
+#include "macros.h"
+#include "conf.h"
+
+/* Writer side of cfan-status.h. Names and sizes are filled in once by
+ * c_status_init(); c_status_begin() and c_status_end() bracket the updates
+ * of each tick. */
+
+static cfan_status_hdr_ty *c_status;
+
+static ATTR_INLINE cfan_status_temp_ty *
+c_status_temps(void)
+{
+	return (cfan_status_temp_ty *)((char *)c_status + c_status->temps_off);
+}
+
+static ATTR_INLINE cfan_status_fan_ty *
+c_status_fans(void)
+{
+	return (cfan_status_fan_ty *)((char *)c_status + c_status->fans_off);
+}
+
+static ATTR_INLINE cfan_status_zone_ty *
+c_status_zones(void)
+{
+	return (cfan_status_zone_ty *)((char *)c_status + c_status->zones_off);
+}
+
+static ATTR_INLINE void
+c_status_begin(cfan_status_hdr_ty *h)
+{
+	__atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELAXED);
+	/* Order the odd seq before the data. */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static ATTR_INLINE void
+c_status_end(cfan_status_hdr_ty *h)
+{
+	__atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void
+c_status_name_set(char *dst, const char *src)
+{
+	/* Truncated, always terminated. */
+	strncpy(dst, src, CFAN_STATUS_NAME_LEN - 1);
+	dst[CFAN_STATUS_NAME_LEN - 1] = '\0';
+}
+
+/* Mark a segment left behind by an earlier run as stopped, so that
+ * readers still mapping it know to open the new one. */
+static void
+c_status_stale(const char *path)
+{
+	struct stat st;
+	const int fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd == -1)
+		return;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(cfan_status_hdr_ty)) {
+		cfan_status_hdr_ty *h = (cfan_status_hdr_ty *)mmap(NULL, sizeof(cfan_status_hdr_ty), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (h != MAP_FAILED) {
+			if (h->magic == CFAN_STATUS_MAGIC) {
+				/* Its writer is gone, so seq may be left odd. */
+				h->seq |= 1;
+				h->running = 0;
+				c_status_end(h);
+			}
+			munmap(h, sizeof(cfan_status_hdr_ty));
+		}
+	}
+	close(fd);
+}
+
+/* Create the segment at path, sized and named for conf.
+ * It is filled in under a temporary name and renamed into place, so
+ * readers never see it half made. */
+static int
+c_status_init(const char *path, const c_conf_ty *conf)
+{
+	char tmp[PATH_MAX];
+	const size_t size = cfan_status_size(conf->temps_len, conf->fans_len, conf->zones_len);
+	if (unlikely(size > CFAN_STATUS_SIZE_MAX || (size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= sizeof(tmp))) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	const int fd = mkstemp(tmp);
+	if (unlikely(fd == -1))
+		return -1;
+	if (unlikely(fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == -1 || ftruncate(fd, (off_t)size) == -1))
+		goto err;
+	c_status = (cfan_status_hdr_ty *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (unlikely(c_status == MAP_FAILED)) {
+		c_status = NULL;
+		goto err;
+	}
+	close(fd);
+	c_status->magic = CFAN_STATUS_MAGIC;
+	c_status->version = CFAN_STATUS_VERSION;
+	c_status->size = (uint32_t)size;
+	c_status->running = 1;
+	c_status->pid = (int32_t)getpid();
+	c_status->temps_len = conf->temps_len;
+	c_status->fans_len = conf->fans_len;
+	c_status->zones_len = conf->zones_len;
+	c_status->temps_off = sizeof(cfan_status_hdr_ty);
+	c_status->fans_off = c_status->temps_off + conf->temps_len * (uint32_t)sizeof(cfan_status_temp_ty);
+	c_status->zones_off = c_status->fans_off + conf->fans_len * (uint32_t)sizeof(cfan_status_fan_ty);
+	for (unsigned int i = 0; i < conf->temps_len; ++i) {
+		c_status_name_set(c_status_temps()[i].name, conf->temp_names[i]);
+		c_status_temps()[i].temp = INT32_MIN;
+	}
+	for (unsigned int i = 0; i < conf->fans_len; ++i)
+		c_status_name_set(c_status_fans()[i].name, conf->fan_names[i]);
+	for (unsigned int i = 0; i < conf->zones_len; ++i) {
+		const c_zone_ty *z = conf->zones + i;
+		c_status_name_set(c_status_zones()[i].name, z->name);
+		for (unsigned int j = 0; j < C_ZONE_LEN(z->fans_len, conf->fans_len); ++j)
+			c_status_fans()[C_ZONE_AT(z->fans, z->fans_len, j)].zone = i;
+	}
+	c_status_stale(path);
+	if (unlikely(rename(tmp, path) == -1)) {
+		munmap(c_status, size);
+		c_status = NULL;
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+err:
+	close(fd);
+	unlink(tmp);
+	return -1;
+}
+
+static void
+c_status_cleanup(const char *path)
+{
+	if (c_status == NULL)
+		return;
+	c_status_begin(c_status);
+	c_status->running = 0;
+	c_status_end(c_status);
+	munmap(c_status, c_status->size);
+	c_status = NULL;
+	(void)unlink(path);
+}
+
+#endif /* STATUS_H */
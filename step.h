@@ -1,30 +1,54 @@
 #ifndef STEP_H
 #define STEP_H 1
 
-#include "config.h"
 #include "macros.h"
+#include "param.h"
 
-/* Spike step speed change per update (0-255). */
-#define STEPUP_SPIKE 4
+/* Scale a step given per step_ms to the time that actually passed, so
+ * that ramping speed does not depend on the interval. What
+ * is left of a whole step is carried in *rem to the next call, so that
+ * ten ticks of 100 ms ramp as far as one of 1000 ms. */
+static ATTR_INLINE unsigned int
+c_step_scale(const c_param_ty *prm, unsigned int step, unsigned int elapsed_ms, unsigned int *rem)
+{
+	const unsigned long long scaled = (unsigned long long)step * elapsed_ms + *rem;
+	const unsigned long long n = scaled / prm->step_ms;
+	if (n > 255) {
+		*rem = 0;
+		return 255;
+	}
+	*rem = (unsigned int)(scaled % prm->step_ms);
+	return (unsigned int)n;
+}
 
+/* temp is in millidegrees.
+ * Return the msecs spent holding back a spike so far, which is
+ * passed back as hot_ms on the next update. *rem carries the part of a
+ * step not taken yet, see c_step_scale(), and is cleared once the speed
+ * is not held back. */
 static ATTR_INLINE unsigned int
-c_step_get(unsigned int *curr_speed, unsigned int last_speed, unsigned int temp, unsigned int hot_secs)
+c_step_get(const c_param_ty *prm, unsigned int *curr_speed, unsigned int last_speed, int temp, unsigned int hot_ms, unsigned int elapsed_ms, unsigned int *rem)
 {
+	const unsigned int want = *curr_speed;
 	unsigned int hot = 0;
 	if (*curr_speed > last_speed) {
 		/* Ramp up slower for short spikes.
 		 * This avoids fans ramping up
 		 * when opening a browser. */
-		if (*curr_speed > last_speed + STEPDOWN_MAX
-		    && hot_secs <= SPIKE_MAX
-		    && likely(temp < SPIKE_TEMP_MAX)) {
-			*curr_speed = last_speed + STEPUP_SPIKE;
-			hot = hot_secs + 1;
+		if (*curr_speed > last_speed + prm->stepdown_max
+		    && hot_ms <= prm->spike_max_ms
+		    && likely(temp < prm->spike_temp_max)) {
+			*curr_speed = MIN(*curr_speed, last_speed + c_step_scale(prm, prm->stepup_spike, elapsed_ms, rem));
+			hot = hot_ms + elapsed_ms;
 		}
 	} else { /* *curr_speed < last_speed */
 		/* Always ramp down slower. */
-		*curr_speed = MAX(*curr_speed, last_speed - STEPDOWN_MAX);
+		const unsigned int step = c_step_scale(prm, prm->stepdown_max, elapsed_ms, rem);
+		if (last_speed > step)
+			*curr_speed = MAX(*curr_speed, last_speed - step);
 	}
+	if (*curr_speed == want)
+		*rem = 0;
 	DBG(fprintf(stderr, "%s:%d:%s: getting step: %d.\n", __FILE__, __LINE__, ASSERT_FUNC, *curr_speed));
 	return hot;
 }
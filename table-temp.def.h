@@ -1,35 +1,22 @@
-#include "cpu.generated.h"
-
 #include "gpu-nvidia.h"
 #include "cfan.h"
+#include "zone.h"
 
-/* Add sysfs temperature files, or any file, provided that
- * it uses the same format, and is continuously updated. */
-static const char *c_table_temps[] = {
-	/*
-	 * Temperature files from sysfs MUST start with /sys/devices/platform/,
-	 * not /sys/class/, to allow the program to find the correct file
-	 * across reboots. These files will then be passed to path_sysfs_resolve
-	 * which finds the actual file. To get the real file from a sysfs file
-	 * starting with /sys/class, use the realpath command.
-	 *
-	 * For example:
-	 * "/sys/devices/platform/coretemp.0/hwmon/hwmon2/temp1_input",
-	 * "/sys/devices/platform/coretemp.0/hwmon/hwmon2/temp2_input",
-	 * */
-	TEMP_FILE_CPU,
-};
-
-typedef unsigned int (*fn_temp)(void);
-
-static const fn_temp c_table_fn_temps[] = {
-	c_temp_sysfs_max_get,
-	/* nv_temp_gpu_get_max, */
-};
-
-typedef void (*fn_temp_init)(void);
+/* Without a configuration file, the sensors and fans are those that
+ * discover.h finds, and `cfan --discover` prints them as a configuration
+ * file to start from. */
 
 static const fn_temp_init c_table_fn_init[] = {
 	c_init,
 	/* nv_init, */
 };
+
+/* Temperature functions that zones in the configuration file
+ * can use with fn=NAME, and how to initialize them. */
+static const c_fn_name_ty c_table_fn_names[] = {
+#ifdef USE_CUDA
+	{ "nvidia", nv_temp_gpu_get_max, nv_init },
+	NV_FN_NAMES,
+#endif
+	{ NULL, NULL, NULL },
+};
@@ -1,26 +1,52 @@
 #ifndef TEMP_H
 #define TEMP_H 1
 
-#include "macros.h"
-#include "util.h"
+#include <limits.h>
 #include <unistd.h>
 
-static unsigned int
+#include "macros.h"
+
+/* Returned for a temperature that could not be read. */
+#define C_TEMP_INVALID INT_MIN
+
+/* Big enough for any int in millidegrees, like sysfs prints them. */
+#define C_TEMP_BUF_LEN 16
+
+/* Parse len bytes of a sysfs temperature in millidegrees,
+ * e.g. "47000\n" or "-5500\n", of any number of digits.
+ * Return C_TEMP_INVALID if there are no digits. */
+static ATTR_INLINE int
+c_temp_parse(const char *buf, int len)
+{
+	const char *p = buf;
+	const char *end = buf + len;
+	int neg = 0;
+	if (p < end && *p == '-') {
+		neg = 1;
+		++p;
+	}
+	const char *digits = p;
+	unsigned int temp = 0;
+	for (; p < end && (unsigned int)(*p - '0') < 10; ++p)
+		temp = temp * 10 + (unsigned int)(*p - '0');
+	/* No digits, or too many to be a temperature. */
+	if (unlikely(p == digits || p - digits > 9))
+		return C_TEMP_INVALID;
+	return neg ? -(int)temp : (int)temp;
+}
+
+/* Return millidegrees, or C_TEMP_INVALID. */
+static int
 c_temp_fd_get(int fd)
 {
-	char buf[S_LEN("100") + S_LEN("000") + S_LEN("\n")];
+	char buf[C_TEMP_BUF_LEN];
 	int read_sz;
 	do {
 		read_sz = pread(fd, buf, sizeof(buf), 0);
 	} while (unlikely(read_sz == -1) && errno == EINTR);
 	if (unlikely(read_sz == -1))
-		return (unsigned int)-1;
-	if (*(buf + read_sz - 1) == '\n')
-		--read_sz;
-	read_sz -= (int)S_LEN("000");
-	*(buf + read_sz) = '\0';
-	return c_atou_le3(buf, read_sz);
+		return C_TEMP_INVALID;
+	return c_temp_parse(buf, read_sz);
 }
 
 #endif /* TEMP_H */
-
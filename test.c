@@ -1,11 +1,35 @@
 #include "util.h"
 #include "config.h"
 #include "step.h"
+#include "interval.h"
+#include "uring.h"
+#include "pid.h"
+#include "rpm.h"
+#include "curve.h"
 #include "temp.h"
+#include "conf.h"
+#include "ctl.h"
+#include "status.h"
+#include "rec.h"
+#include "metrics.h"
+#include "alarm.h"
+#include "psi.h"
+#include "path.h"
+#include "uevent.h"
+#include "discover.h"
+#include "actuate.h"
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define TICK_MS (INTERVAL_UPDATE * 1000)
+
+static const c_param_ty prm = C_PARAM_DEFAULT;
 
 static unsigned int tests_run;
 static unsigned int tests_failed;
@@ -99,6 +123,28 @@ test_utoa_le3_3digit(void)
 		fail("255");
 }
 
+static void
+test_itoa(void)
+{
+	char buf[16];
+	char *end = c_itoa_p(55000, buf);
+	*end = '\0';
+	if (end != buf + 5 || strcmp(buf, "55000") != 0)
+		fail("55000");
+	end = c_itoa_p(-5500, buf);
+	*end = '\0';
+	if (end != buf + 5 || strcmp(buf, "-5500") != 0)
+		fail("-5500");
+	end = c_itoa_p(0, buf);
+	*end = '\0';
+	if (end != buf + 1 || strcmp(buf, "0") != 0)
+		fail("0");
+	end = c_itoa_p(INT_MIN, buf);
+	*end = '\0';
+	if (strcmp(buf, "-2147483648") != 0)
+		fail("INT_MIN");
+}
+
 static void
 test_temp_fd_get_basic(void)
 {
@@ -106,10 +152,10 @@ test_temp_fd_get_basic(void)
 	if (!f) { fail("tmpfile"); return; }
 	fwrite("55000\n", 1, 6, f);
 	fflush(f);
-	unsigned int result = c_temp_fd_get(fileno(f));
+	int result = c_temp_fd_get(fileno(f));
 	fclose(f);
-	if (result != 55)
-		fail("55000 -> 55");
+	if (result != 55000)
+		fail("55000");
 }
 
 static void
@@ -119,10 +165,10 @@ test_temp_fd_get_nonl(void)
 	if (!f) { fail("tmpfile"); return; }
 	fwrite("55000", 1, 5, f);
 	fflush(f);
-	unsigned int result = c_temp_fd_get(fileno(f));
+	int result = c_temp_fd_get(fileno(f));
 	fclose(f);
-	if (result != 55)
-		fail("55000 no newline -> 55");
+	if (result != 55000)
+		fail("55000 no newline");
 }
 
 static void
@@ -132,10 +178,10 @@ test_temp_fd_get_hundred(void)
 	if (!f) { fail("tmpfile"); return; }
 	fwrite("100000\n", 1, 7, f);
 	fflush(f);
-	unsigned int result = c_temp_fd_get(fileno(f));
+	int result = c_temp_fd_get(fileno(f));
 	fclose(f);
-	if (result != 100)
-		fail("100000 -> 100");
+	if (result != 100000)
+		fail("100000");
 }
 
 static void
@@ -145,10 +191,232 @@ test_temp_fd_get_zero(void)
 	if (!f) { fail("tmpfile"); return; }
 	fwrite("00000\n", 1, 6, f);
 	fflush(f);
-	unsigned int result = c_temp_fd_get(fileno(f));
+	int result = c_temp_fd_get(fileno(f));
 	fclose(f);
 	if (result != 0)
-		fail("00000 -> 0");
+		fail("00000");
+}
+
+static void
+test_temp_parse(void)
+{
+	if (c_temp_parse("47000\n", 6) != 47000)
+		fail("47000");
+	if (c_temp_parse("47125", 5) != 47125)
+		fail("47125");
+	if (c_temp_parse("", 0) != C_TEMP_INVALID)
+		fail("empty read");
+	if (c_temp_parse("\n", 1) != C_TEMP_INVALID)
+		fail("newline only");
+}
+
+static void
+test_temp_parse_negative(void)
+{
+	if (c_temp_parse("-5500\n", 6) != -5500)
+		fail("-5500");
+	if (c_temp_parse("-\n", 2) != C_TEMP_INVALID)
+		fail("sign only");
+}
+
+static void
+test_temp_parse_lengths(void)
+{
+	if (c_temp_parse("0\n", 2) != 0)
+		fail("0");
+	if (c_temp_parse("500\n", 4) != 500)
+		fail("500");
+	if (c_temp_parse("125000\n", 7) != 125000)
+		fail("125000");
+	if (c_temp_parse("1234567890\n", 11) != C_TEMP_INVALID)
+		fail("too long");
+}
+
+static void
+test_uring_pread_batch(void)
+{
+	c_uring_ty r;
+	/* io_uring may be disabled, in which case cfan uses pread. */
+	if (c_uring_init(&r, 2) == -1)
+		return;
+	if (!c_uring_op_supported(&r, IORING_OP_READ) || c_uring_op_supported(&r, 255))
+		fail("uring probe");
+	FILE *f1 = tmpfile();
+	FILE *f2 = tmpfile();
+	if (!f1 || !f2) { fail("tmpfile"); c_uring_exit(&r); return; }
+	fwrite("61000\n", 1, 6, f1);
+	fwrite("102000\n", 1, 7, f2);
+	fflush(f1);
+	fflush(f2);
+	const int fds[] = { fileno(f1), fileno(f2) };
+	char bufs[2][C_TEMP_BUF_LEN] = { { 0 } };
+	int res[2];
+	for (unsigned int round = 0; round < 3; ++round) {
+		if (c_uring_pread_batch(&r, fds, (char *)bufs, C_TEMP_BUF_LEN, res, 2) != 0) {
+			fail("uring submit");
+			break;
+		}
+		if (c_temp_parse(bufs[0], res[0]) != 61000)  fail("uring 61000");
+		if (c_temp_parse(bufs[1], res[1]) != 102000) fail("uring 102000");
+	}
+	fclose(f1);
+	fclose(f2);
+	c_uring_exit(&r);
+}
+
+static const c_point_ty test_points[] = {
+	{ 40000, 50 },
+	{ 50000, 100 },
+	{ 60000, 250 },
+};
+static const c_curve_ty test_curve = C_CURVE(test_points);
+
+static void
+test_curve_breakpoints(void)
+{
+	if (c_curve_get(&test_curve, 40000) != 50)  fail("curve 40000");
+	if (c_curve_get(&test_curve, 50000) != 100) fail("curve 50000");
+	if (c_curve_get(&test_curve, 60000) != 250) fail("curve 60000");
+}
+
+static void
+test_curve_interpolate(void)
+{
+	if (c_curve_get(&test_curve, 45000) != 75)  fail("curve 45000");
+	if (c_curve_get(&test_curve, 40100) != 51)  fail("curve 40100");
+	if (c_curve_get(&test_curve, 55500) != 183) fail("curve 55500");
+	/* Every millidegree step changes the speed by at most one step of the curve. */
+	unsigned int last = c_curve_get(&test_curve, 40000);
+	for (int t = 40001; t <= 60000; ++t) {
+		const unsigned int curr = c_curve_get(&test_curve, t);
+		if (curr < last || curr > last + 1) {
+			fail("curve monotonic");
+			break;
+		}
+		last = curr;
+	}
+}
+
+static void
+test_curve_saturate(void)
+{
+	if (c_curve_get(&test_curve, -20000) != 50)   fail("curve below");
+	if (c_curve_get(&test_curve, 0) != 50)        fail("curve 0");
+	if (c_curve_get(&test_curve, 125000) != 250)  fail("curve 125000");
+	if (c_curve_get(&test_curve, INT_MAX) != 250) fail("curve INT_MAX");
+}
+
+static void
+test_curve_hyst(void)
+{
+	int held = INT_MIN;
+	if (c_curve_hyst(&held, 50000, 2000) != 50000) fail("hyst first");
+	/* Dithering within the band holds the speed. */
+	if (c_curve_hyst(&held, 49000, 2000) != 50000) fail("hyst hold fall");
+	if (c_curve_hyst(&held, 48000, 2000) != 50000) fail("hyst hold edge");
+	if (c_curve_get(&test_curve, c_curve_hyst(&held, 49500, 2000)) != 100) fail("hyst hold speed");
+	/* Rises are followed at once. */
+	if (c_curve_hyst(&held, 51000, 2000) != 51000) fail("hyst rise");
+	/* A fall past the band follows, band above the temperature. */
+	if (c_curve_hyst(&held, 45000, 2000) != 47000) fail("hyst fall");
+	if (c_curve_hyst(&held, 46000, 2000) != 47000) fail("hyst hold after fall");
+	held = INT_MIN;
+	if (c_curve_hyst(&held, 45000, 0) != 45000 || c_curve_hyst(&held, 44000, 0) != 44000) fail("hyst none");
+}
+
+static void
+test_zone_speed_get(void)
+{
+	c_zone_state_ty st;
+	int at_floor;
+	memset(&st, 0, sizeof(st));
+	st.curve = &test_curve;
+	st.speed_min = 50;
+	st.speed_max = 250;
+	st.mode = CONTROL_CURVE;
+	st.hyst_temp = INT_MIN;
+	st.last_speed = 50;
+	if (c_zone_speed_get(&prm, &st, 50000, TICK_MS, &at_floor) != 54 || at_floor) fail("zone spike");
+	if (st.hot_ms != TICK_MS || st.reason != CFAN_REC_SPIKE)                  fail("zone hot");
+	st.last_speed = 100;
+	if (c_zone_speed_get(&prm, &st, 49000, TICK_MS, &at_floor) != 100 || st.reason != CFAN_REC_HELD) fail("zone hyst");
+	if (st.raw_speed != c_curve_get(&test_curve, 49000)) fail("zone raw");
+	/* Looked up at 47000, ramped down by STEPDOWN_MAX. */
+	if (c_zone_speed_get(&prm, &st, 45000, TICK_MS, &at_floor) != 100 - STEPDOWN_MAX || st.reason != CFAN_REC_RAMP) fail("zone down");
+}
+
+static void
+test_predict(void)
+{
+	c_param_ty p = prm;
+	c_predict_ty pr;
+	int temp = 0, ahead = 0;
+	p.predict_ms = 5000;
+	p.predict_window_ms = 8000;
+	/* A rise of a degree per sec is projected 5 degrees ahead. */
+	memset(&pr, 0, sizeof(pr));
+	c_predict_reset(&pr);
+	for (unsigned int i = 0; i <= 20; ++i) {
+		temp = 40000 + (int)i * 1000;
+		ahead = c_predict_get(&p, &pr, temp, 1000);
+	}
+	if (ahead < temp + 4500 || ahead > temp + 5500) fail("predict steady");
+	/* Short intervals do not push the window out of the ring. */
+	for (unsigned int i = 0; i < 200; ++i)
+		ahead = c_predict_get(&p, &pr, temp, 100);
+	if (pr.now_ms - pr.ms[(pr.last + 1) % C_PREDICT_LEN] < p.predict_window_ms) fail("predict ring");
+	/* A spike is no longer projected once it has been level for half a
+	 * window. */
+	c_predict_reset(&pr);
+	for (unsigned int i = 0; i <= 24; ++i) {
+		temp = 40000 + 3000 * (int)MIN(MAX(i, 10) - 10, 2);
+		ahead = c_predict_get(&p, &pr, temp, 1000);
+		if (i >= 12 + 4 && ahead != temp) fail("predict spike");
+	}
+	/* Nor is a sensor dithering by a degree. */
+	c_predict_reset(&pr);
+	for (unsigned int i = 0; i <= 20; ++i)
+		if (c_predict_get(&p, &pr, 40000 + (int)(i & 1) * 1000, 1000) != 40000 + (int)(i & 1) * 1000) fail("predict noise");
+	p.predict_ms = 0;
+	if (c_predict_get(&p, &pr, 40000, 1000) != 40000) fail("predict off");
+}
+
+static void
+test_zone_predict(void)
+{
+	c_param_ty p = prm;
+	c_zone_state_ty st;
+	int at_floor, ahead = 0;
+	p.predict_ms = 5000;
+	p.predict_window_ms = 8000;
+	memset(&st, 0, sizeof(st));
+	st.curve = &test_curve;
+	st.speed_min = 50;
+	st.speed_max = 250;
+	st.mode = CONTROL_CURVE;
+	st.hyst_temp = INT_MIN;
+	st.last_speed = c_curve_get(&test_curve, 46000);
+	c_predict_reset(&st.predict);
+	/* Half a degree per sec: the target is the curve 2.5 degrees ahead. */
+	for (unsigned int i = 0; i <= 16; ++i) {
+		st.last_speed = c_zone_speed_get(&p, &st, 46000 + (int)i * 500, 1000, &at_floor);
+		ahead |= (st.target > c_curve_get(&test_curve, 46000 + (int)i * 500));
+		/* Not held back again as a spike. */
+		if (st.reason == CFAN_REC_SPIKE && st.target > c_curve_get(&test_curve, 46000 + (int)i * 500)) fail("zone predict spike");
+	}
+	if (st.last_speed != st.target) fail("zone predict applied");
+	if (!ahead || st.target < c_curve_get(&test_curve, 56000) || st.target > c_curve_get(&test_curve, 57000)) fail("zone predict");
+}
+
+static void
+test_curve_check(void)
+{
+	static const c_point_ty bad[] = { { 50000, 50 }, { 50000, 60 } };
+	static const c_curve_ty bad_curve = C_CURVE(bad);
+	if (c_curve_check(&test_curve) != 0) fail("check ok");
+	if (c_curve_check(&bad_curve) != -1) fail("check bad");
+	if (c_curve_min(&test_curve) != 50)  fail("curve min");
+	if (c_curve_max(&test_curve) != 250) fail("curve max");
 }
 
 static void
@@ -156,9 +424,10 @@ test_step_get_spike(void)
 {
 	unsigned int curr = 100;
 	unsigned int last = 50;
-	unsigned int hot = c_step_get(&curr, last, 60, 0);
-	if (curr != 54) fail("spike curr");
-	if (hot != 1)   fail("spike hot");
+	unsigned int rem = 0;
+	unsigned int hot = c_step_get(&prm, &curr, last, 60000, 0, TICK_MS, &rem);
+	if (curr != 54)      fail("spike curr");
+	if (hot != TICK_MS) fail("spike hot");
 }
 
 static void
@@ -166,7 +435,8 @@ test_step_get_hot_exceeded(void)
 {
 	unsigned int curr = 100;
 	unsigned int last = 50;
-	unsigned int hot = c_step_get(&curr, last, 60, SPIKE_MAX + 1);
+	unsigned int rem = 0;
+	unsigned int hot = c_step_get(&prm, &curr, last, 60000, (SPIKE_MAX + 1) * 1000, TICK_MS, &rem);
 	if (curr != 100) fail("hotx curr");
 	if (hot != 0)    fail("hotx hot");
 }
@@ -176,7 +446,8 @@ test_step_get_hightemp(void)
 {
 	unsigned int curr = 100;
 	unsigned int last = 50;
-	unsigned int hot = c_step_get(&curr, last, SPIKE_TEMP_MAX, 0);
+	unsigned int rem = 0;
+	unsigned int hot = c_step_get(&prm, &curr, last, SPIKE_TEMP_MAX * 1000, 0, TICK_MS, &rem);
 	if (curr != 100) fail("hightemp curr");
 	if (hot != 0)    fail("hightemp hot");
 }
@@ -186,7 +457,8 @@ test_step_get_small_rise(void)
 {
 	unsigned int curr = 55;
 	unsigned int last = 50;
-	unsigned int hot = c_step_get(&curr, last, 60, 0);
+	unsigned int rem = 0;
+	unsigned int hot = c_step_get(&prm, &curr, last, 60000, 0, TICK_MS, &rem);
 	if (curr != 55) fail("smallrise curr");
 	if (hot != 0)   fail("smallrise hot");
 }
@@ -196,7 +468,8 @@ test_step_get_rampdown_sharp(void)
 {
 	unsigned int curr = 30;
 	unsigned int last = 50;
-	unsigned int hot = c_step_get(&curr, last, 60, 0);
+	unsigned int rem = 0;
+	unsigned int hot = c_step_get(&prm, &curr, last, 60000, 0, TICK_MS, &rem);
 	if (curr != 42) fail("sharpdown curr");
 	if (hot != 0)   fail("sharpdown hot");
 }
@@ -206,7 +479,8 @@ test_step_get_rampdown_gentle(void)
 {
 	unsigned int curr = 44;
 	unsigned int last = 50;
-	unsigned int hot = c_step_get(&curr, last, 60, 0);
+	unsigned int rem = 0;
+	unsigned int hot = c_step_get(&prm, &curr, last, 60000, 0, TICK_MS, &rem);
 	if (curr != 44) fail("gentledown curr");
 	if (hot != 0)   fail("gentledown hot");
 }
@@ -216,11 +490,815 @@ test_step_get_rampdown_boundary(void)
 {
 	unsigned int curr = 42;
 	unsigned int last = 50;
-	unsigned int hot = c_step_get(&curr, last, 60, 0);
+	unsigned int rem = 0;
+	unsigned int hot = c_step_get(&prm, &curr, last, 60000, 0, TICK_MS, &rem);
 	if (curr != 42) fail("boundary curr");
 	if (hot != 0)   fail("boundary hot");
 }
 
+static void
+test_step_get_spike_last(void)
+{
+	unsigned int curr = 100;
+	unsigned int last = 50;
+	unsigned int rem = 0;
+	unsigned int hot = c_step_get(&prm, &curr, last, 60000, SPIKE_MAX * 1000, TICK_MS, &rem);
+	if (curr != 54)                          fail("spikelast curr");
+	if (hot != SPIKE_MAX * 1000 + TICK_MS) fail("spikelast hot");
+}
+
+static void
+test_step_get_rampdown_short_tick(void)
+{
+	unsigned int curr = 30;
+	unsigned int last = 50;
+	unsigned int rem = 0;
+	unsigned int hot = c_step_get(&prm, &curr, last, 60000, 0, TICK_MS / 2, &rem);
+	if (curr != 50 - STEPDOWN_MAX / 2) fail("shortdown curr");
+	if (hot != 0)                      fail("shortdown hot");
+}
+
+static void
+test_step_scale_carry(void)
+{
+	unsigned int rem = 0, sum = 0;
+	/* Ten ticks of 100 ms ramp as far as one of 1000 ms. */
+	for (unsigned int i = 0; i < 10; ++i)
+		sum += c_step_scale(&prm, STEPUP_SPIKE, TICK_MS / 10, &rem);
+	if (sum != STEPUP_SPIKE || rem != 0)
+		fail("scale carry up");
+	sum = 0;
+	for (unsigned int i = 0; i < 10; ++i)
+		sum += c_step_scale(&prm, STEPDOWN_MAX, TICK_MS / 10, &rem);
+	if (sum != STEPDOWN_MAX || rem != 0)
+		fail("scale carry down");
+	if (c_step_scale(&prm, STEPDOWN_MAX, TICK_MS, &rem) != STEPDOWN_MAX)
+		fail("scale tick");
+	/* Polling faster, as with cfan-ctl interval, ramps no faster. */
+	c_param_ty fast = prm;
+	fast.interval_ms = TICK_MS / 10;
+	if (c_step_scale(&fast, STEPDOWN_MAX, TICK_MS / 10, &rem) != STEPDOWN_MAX / 10 || rem == 0)
+		fail("scale interval");
+	rem = 0;
+	/* A spike held over ten short ticks ends where one long tick does. */
+	unsigned int last = 50, one = 100;
+	for (unsigned int i = 0; i < 10; ++i) {
+		unsigned int curr = 100;
+		c_step_get(&prm, &curr, last, 60000, 0, TICK_MS / 10, &rem);
+		last = curr;
+	}
+	c_step_get(&prm, &one, 50, 60000, 0, TICK_MS, &rem);
+	if (last != one)
+		fail("scale carry spike");
+}
+
+static void
+test_interval_fast(void)
+{
+	if (c_interval_get(&prm, TICK_MS, 60000, 60000 - SLOPE_FAST * 1000, TICK_MS, 0) != INTERVAL_MIN_MS)
+		fail("fast rise");
+	if (c_interval_get(&prm, TICK_MS, 60000 - SLOPE_FAST * 1000, 60000, TICK_MS, 1) != INTERVAL_MIN_MS)
+		fail("fast fall");
+}
+
+static void
+test_interval_stretch(void)
+{
+	unsigned int interval = TICK_MS;
+	for (unsigned int i = 0; i < 32; ++i)
+		interval = c_interval_get(&prm, interval, 40000, 40000, interval, 1);
+	if (interval != INTERVAL_MAX_MS)
+		fail("stretch to max");
+}
+
+static void
+test_interval_relax(void)
+{
+	unsigned int interval = INTERVAL_MIN_MS;
+	for (unsigned int i = 0; i < 32; ++i)
+		interval = c_interval_get(&prm, interval, 60000, 60000, interval, 0);
+	if (interval != TICK_MS)
+		fail("relax to base");
+	if (c_interval_get(&prm, INTERVAL_MAX_MS, 60000, 59000, INTERVAL_MAX_MS, 0) != TICK_MS)
+		fail("leave floor");
+}
+
+static void
+test_pid_bumpless(void)
+{
+	c_pid_ty pid = { 0 };
+	if (c_pid_get(&prm, &pid, (PID_SETPOINT) * 1000, 120, TICK_MS, 51, 255) != 120)
+		fail("pid bumpless start");
+}
+
+static void
+test_pid_clamp(void)
+{
+	c_pid_ty pid = { 0 };
+	unsigned int speed = 100;
+	for (unsigned int i = 0; i < 60; ++i)
+		speed = c_pid_get(&prm, &pid, (PID_SETPOINT - 30) * 1000, speed, TICK_MS, 51, 255);
+	if (speed != 51)
+		fail("pid clamp min");
+	c_pid_ty pid2 = { 0 };
+	speed = 100;
+	for (unsigned int i = 0; i < 60; ++i)
+		speed = c_pid_get(&prm, &pid2, (PID_SETPOINT + 30) * 1000, speed, TICK_MS, 51, 255);
+	if (speed != 255)
+		fail("pid clamp max");
+}
+
+static void
+test_pid_antiwindup(void)
+{
+	c_pid_ty pid = { 0 };
+	unsigned int speed = 100;
+	/* Saturate at the maximum for a long time... */
+	for (unsigned int i = 0; i < 600; ++i)
+		speed = c_pid_get(&prm, &pid, (PID_SETPOINT + 10) * 1000, speed, TICK_MS, 51, 255);
+	/* ...then the output must leave it as soon as the error reverses. */
+	for (unsigned int i = 0; i < 10; ++i)
+		speed = c_pid_get(&prm, &pid, (PID_SETPOINT - 5) * 1000, speed, TICK_MS, 51, 255);
+	if (speed >= 255)
+		fail("pid windup");
+}
+
+static void
+test_pid_settles(void)
+{
+	c_pid_ty pid = { 0 };
+	unsigned int speed = 51;
+	/* Plant: temperature falls with fan speed. */
+	double temp = PID_SETPOINT + 10;
+	for (unsigned int i = 0; i < 2000; ++i) {
+		speed = c_pid_get(&prm, &pid, (int)(temp * 1000), speed, TICK_MS, 51, 255);
+		temp += ((95.0 - speed * 0.15) - temp) * 0.05;
+	}
+	if ((unsigned int)(temp + 0.5) != PID_SETPOINT)
+		fail("pid settle");
+}
+
+static void
+test_rpm_converges(void)
+{
+	/* Two models: one spins up late, the other faster and sooner. */
+	static const double gain[] = { 10, 16 };
+	static const double offset[] = { -300, 100 };
+	for (unsigned int m = 0; m < LEN(gain); ++m) {
+		c_rpm_ty r = { 0 };
+		unsigned int pwm = 128;
+		for (unsigned int i = 0; i < 50; ++i) {
+			const double rpm = gain[m] * pwm + offset[m];
+			r.rpm = (rpm > 0) ? (unsigned int)rpm : 0;
+			pwm = c_rpm_pwm_get(&prm, &r, 1500, pwm);
+		}
+		const double rpm = gain[m] * pwm + offset[m];
+		if (rpm < 1500 - gain[m] || rpm > 1500 + gain[m])
+			fail("rpm converge");
+	}
+}
+
+static void
+test_rpm_stall(void)
+{
+	c_rpm_ty r = { 0 };
+	/* Stopped at a low speed on purpose. */
+	for (unsigned int i = 0; i < 20; ++i)
+		if (c_rpm_stall_update(&prm, &r, STALL_SPEED_MIN - 1, TICK_MS) != 0 || r.stalled)
+			fail("rpm stall low speed");
+	unsigned int ms = 0;
+	while (c_rpm_stall_update(&prm, &r, 255, TICK_MS) == 0 && ms <= STALL_MS)
+		ms += TICK_MS;
+	if (!r.stalled || ms + TICK_MS != STALL_MS)
+		fail("rpm stall");
+	r.rpm = RPM_STALL;
+	if (c_rpm_stall_update(&prm, &r, 255, TICK_MS) != -1 || r.stalled)
+		fail("rpm recover");
+}
+
+static void
+test_rpm_compensate(void)
+{
+	if (c_rpm_compensate(100, 4, 0, 255) != 100) fail("rpm compensate none");
+	if (c_rpm_compensate(100, 4, 1, 255) != 133) fail("rpm compensate one");
+	if (c_rpm_compensate(200, 2, 1, 255) != 255) fail("rpm compensate clamp");
+	if (c_rpm_compensate(800, 2, 2, 2000) != 2000) fail("rpm compensate all");
+}
+
+static int
+test_conf_fn(void)
+{
+	return 42000;
+}
+
+static const c_fn_name_ty test_conf_fns[] = {
+	{ "test", test_conf_fn, NULL },
+	{ NULL, NULL, NULL },
+};
+
+static const char test_conf_text[] = "# comment\n"
+                                     "temp cpu /tmp/cpu\n"
+                                     "temp gpu /tmp/gpu\n"
+                                     "temp_cpu cpu\n"
+                                     "fan a /tmp/pwm1 /tmp/pwm1_enable\n"
+                                     "fan b /tmp/pwm2 tach=/tmp/fan2_input\n"
+                                     "curve quiet 40:51 50.5:60 80:255 # trailing\n"
+                                     "default_curve high\n"
+                                     "zone z0 temps=cpu fans=a\n"
+                                     "zone z1 curve=quiet temps=* fn=test fans=b\n"
+                                     "stepdown_max 4\n"
+                                     "spike_temp_max 65.5\n"
+                                     "pid_kp 2.5\n"
+                                     "mode pid\n";
+
+static void
+test_conf_compile(void)
+{
+	char err[C_CONF_ERR_LEN] = "";
+	void *img;
+	size_t img_sz;
+	c_conf_ty conf;
+	if (c_conf_compile("t", test_conf_text, S_LEN(test_conf_text), NULL, test_conf_fns, &img, &img_sz, err, sizeof(err)) == -1) {
+		fail(err);
+		return;
+	}
+	if (c_conf_from_img(&conf, img, img_sz, test_conf_fns, err, sizeof(err)) == -1) {
+		free(img);
+		fail(err);
+		return;
+	}
+	if (conf.temps_len != 2 || strcmp(conf.temps[1], "/tmp/gpu") || conf.temp_cpu != 0) fail("conf temps");
+	if (conf.fans_len != 2 || strcmp(conf.fans_enable[0], "/tmp/pwm1_enable") || conf.fans_enable[1] != NULL) fail("conf fans");
+	if (conf.fans_tach[0] != NULL || strcmp(conf.fans_tach[1], "/tmp/fan2_input")) fail("conf tach");
+	/* quiet, then the builtin medium and high. */
+	if (conf.curves_len != 3 || strcmp(conf.curve_names[conf.curve_default], "high")) fail("conf curves");
+	if (conf.curves[0].len != 3 || conf.curves[0].points[1].temp != 50500) fail("conf points");
+	if (conf.zones_len != 2 || conf.zones[0].curve != NULL || conf.zones[1].curve != conf.curves) fail("conf zone curve");
+	if (conf.zones[0].temps_len != 1 || conf.zones[0].temps[0] != 0 || conf.zones[0].fans[0] != 0) fail("conf zone0");
+	if (conf.zones[1].temps_len != C_ZONE_ALL_LEN || conf.zones[1].fans[0] != 1) fail("conf zone1");
+	if (conf.zones[1].fn_temps_len != 1 || conf.zones[1].fn_temps[0]() != 42000) fail("conf fn");
+	if (conf.param.stepdown_max != 4 || conf.param.spike_temp_max != 65500 || conf.param.pid_kp != 2.5 || conf.param.mode != CONTROL_PID) fail("conf param");
+	if (conf.param.interval_ms != prm.interval_ms) fail("conf param default");
+	c_conf_free(&conf);
+}
+
+static void
+test_conf_errors(void)
+{
+	static const struct {
+		const char *text;
+		const char *err;
+	} tests[] = {
+		{ "fan a /p\nbogus 1\n", "t:2: unknown key: bogus." },
+		{ "stepdown_max 256\nfan a /p\n", "t:1: stepdown_max: must be between 0 and 255." },
+		{ "curve c 50:60 40:70\n", "t:1: curve c: temperatures must be strictly increasing." },
+		{ "curve c 50:100001\n", "t:1: curve c: bad speed: 100001." },
+		{ "temp t /t\nfan a /p\ncurve c 50:256\n", "t: curve speeds above 255 are RPM, for mode rpm only." },
+		{ "mode rpm\ntemp t /t\nfan a /p tach=/a\n", "t: mode rpm needs default_curve naming a curve in RPM." },
+		{ "mode rpm\ntemp t /t\nfan a /p\ncurve c 40:800 80:2000\ndefault_curve c\n", "t: fan a needs tach= in mode rpm." },
+		{ "fan a /p tach=\n", "t:1: usage: fan NAME PWM [PWM_ENABLE] [tach=FAN_INPUT]" },
+		{ "fan a /p\nfan a /q\n", "t:2: fan a is already defined." },
+		{ "fan a /p\n\nzone z temps=nope fans=a\n", "t:3: zone z: unknown temp: nope." },
+		{ "temp t /t\nfan a /p\nfan b /q\nzone z temps=t fans=a\n", "t: fan b must belong to exactly one zone." },
+		{ "temp t /t\nfan a /p\nzone z temps=t fn=nope fans=a\n", "t:3: zone z: unknown temperature function: nope." },
+		{ "temp t /t\n", "t: no fan is configured." },
+		{ "metrics /m 0\n", "t:1: usage: metrics PATH [SECS]" },
+		{ "temp t /t bogus\n", "t:1: usage: temp NAME PATH [alarm]" },
+	};
+	for (unsigned int i = 0; i < LEN(tests); ++i) {
+		char err[C_CONF_ERR_LEN] = "";
+		void *img = NULL;
+		size_t img_sz;
+		if (c_conf_compile("t", tests[i].text, strlen(tests[i].text), NULL, test_conf_fns, &img, &img_sz, err, sizeof(err)) != -1) {
+			free(img);
+			fail(tests[i].text);
+		} else if (strcmp(err, tests[i].err)) {
+			fail(err);
+		}
+	}
+}
+
+static void
+test_conf_corrupt(void)
+{
+	char err[C_CONF_ERR_LEN];
+	void *img;
+	size_t img_sz;
+	c_conf_ty conf;
+	if (c_conf_compile("t", test_conf_text, S_LEN(test_conf_text), NULL, test_conf_fns, &img, &img_sz, err, sizeof(err)) == -1) {
+		fail(err);
+		return;
+	}
+	if (c_conf_from_img(&conf, img, img_sz - 1, test_conf_fns, err, sizeof(err)) != -1)
+		fail("conf truncated");
+	c_conf_hdr_ty *hdr = (c_conf_hdr_ty *)img;
+	hdr->zones.len += 1000;
+	if (c_conf_from_img(&conf, img, img_sz, test_conf_fns, err, sizeof(err)) != -1)
+		fail("conf bad section");
+	hdr->zones.len -= 1000;
+	/* Built without the function a zone uses. */
+	if (c_conf_from_img(&conf, img, img_sz, test_conf_fns + 1, err, sizeof(err)) != -1)
+		fail("conf missing fn");
+	free(img);
+}
+
+static void
+test_conf_cache(void)
+{
+	char path[] = "/tmp/cfan-test-conf-XXXXXX";
+	char cache[sizeof(path) + S_LEN(".cache")];
+	char err[C_CONF_ERR_LEN];
+	c_conf_ty conf;
+	int fd = mkstemp(path);
+	if (fd == -1) {
+		fail("mkstemp");
+		return;
+	}
+	snprintf(cache, sizeof(cache), "%s.cache", path);
+	if (write(fd, test_conf_text, S_LEN(test_conf_text)) != (ssize_t)S_LEN(test_conf_text))
+		fail("write conf");
+	/* Compiled from text, and the cache written. */
+	if (c_conf_load(&conf, path, test_conf_fns, err, sizeof(err)) == -1 || conf.img_mapped)
+		fail("conf first load");
+	else
+		c_conf_free(&conf);
+	/* Mapped from the cache. */
+	if (c_conf_load(&conf, path, test_conf_fns, err, sizeof(err)) == -1 || !conf.img_mapped || conf.param.stepdown_max != 4)
+		fail("conf cached load");
+	else
+		c_conf_free(&conf);
+	/* Changed file: the stale cache is ignored. */
+	if (write(fd, S_LITERAL("stepdown_max 6\n")) != (ssize_t)S_LEN("stepdown_max 6\n"))
+		fail("append conf");
+	if (c_conf_load(&conf, path, test_conf_fns, err, sizeof(err)) == -1 || conf.img_mapped || conf.param.stepdown_max != 6)
+		fail("conf stale cache");
+	else
+		c_conf_free(&conf);
+	close(fd);
+	unlink(cache);
+	unlink(path);
+}
+
+static unsigned int
+test_ctl_echo(char *line, char *reply, unsigned int reply_sz)
+{
+	return (unsigned int)snprintf(reply, reply_sz, "<%s>\n", line);
+}
+
+/* Like the main loop, retry when interrupted, as when the process is
+ * stopped and continued. */
+static int
+test_epoll_wait(struct epoll_event *ev, int timeout_ms)
+{
+	int n;
+	do
+		n = epoll_wait(c_ev_epfd, ev, 1, timeout_ms);
+	while (n == -1 && errno == EINTR);
+	return n;
+}
+
+static void
+test_ev_timer(void)
+{
+	struct epoll_event ev;
+	if (c_ev_init() == -1) {
+		fail("ev init");
+		return;
+	}
+	if (c_ev_timer_set(10) == -1)
+		fail("ev timer set");
+	if (test_epoll_wait(&ev, 1000) != 1 || ev.data.u32 != C_EV_TIMER)
+		fail("ev timer fired");
+	if (c_ev_timer_ack() == -1)
+		fail("ev timer ack");
+	if (c_ev_metrics_init(1) == -1 || c_ev_metricsfd == -1)
+		fail("ev metrics init");
+	c_ev_cleanup();
+	if (c_ev_metricsfd != -1)
+		fail("ev metrics cleanup");
+}
+
+static void
+test_ctl_socket(void)
+{
+	char path[64];
+	char buf[64];
+	struct sockaddr_un addr;
+	struct epoll_event ev;
+	snprintf(path, sizeof(path), "/tmp/cfan-test-ctl-%d", (int)getpid());
+	if (c_ev_init() == -1 || c_ctl_init(path) == -1) {
+		fail("ctl init");
+		c_ev_cleanup();
+		return;
+	}
+	struct stat st;
+	if (stat(path, &st) == -1 || (st.st_mode & (S_IRWXG | S_IRWXO)))
+		fail("ctl mode");
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (connect(fd, (const struct sockaddr *)&addr, sizeof(addr)) == -1)
+		fail("ctl connect");
+	c_ctl_accept();
+	if (c_ctl_clients[0].fd == -1)
+		fail("ctl accept");
+	/* A complete line is answered, the rest is kept for later. */
+	if (write(fd, S_LITERAL("dump\ncur")) != (ssize_t)S_LEN("dump\ncur"))
+		fail("ctl write");
+	if (test_epoll_wait(&ev, 1000) != 1 || ev.data.u32 != C_EV_NUM)
+		fail("ctl event");
+	c_ctl_read(0, test_ctl_echo);
+	ssize_t n = read(fd, buf, sizeof(buf));
+	if (n != (ssize_t)S_LEN("<dump>\n") || memcmp(buf, "<dump>\n", (size_t)n)) fail("ctl reply");
+	if (write(fd, S_LITERAL("ve high\n")) != (ssize_t)S_LEN("ve high\n"))
+		fail("ctl write");
+	c_ctl_read(0, test_ctl_echo);
+	n = read(fd, buf, sizeof(buf));
+	if (n != (ssize_t)S_LEN("<curve high>\n") || memcmp(buf, "<curve high>\n", (size_t)n)) fail("ctl partial line");
+	/* The client going away frees the slot. */
+	close(fd);
+	c_ctl_read(0, test_ctl_echo);
+	if (c_ctl_clients[0].fd != -1) fail("ctl close");
+	c_ctl_cleanup(path);
+	if (access(path, F_OK) == 0) fail("ctl unlink");
+	c_ev_cleanup();
+}
+
+static void
+test_status_segment(void)
+{
+	char path[64];
+	char err[C_CONF_ERR_LEN] = "";
+	static char buf[CFAN_STATUS_SIZE_MAX];
+	void *img;
+	size_t img_sz;
+	c_conf_ty conf;
+	cfan_status_ty st, old;
+	snprintf(path, sizeof(path), "/tmp/cfan-test-status-%d", (int)getpid());
+	if (c_conf_compile("t", test_conf_text, S_LEN(test_conf_text), NULL, test_conf_fns, &img, &img_sz, err, sizeof(err)) == -1
+	    || c_conf_from_img(&conf, img, img_sz, test_conf_fns, err, sizeof(err)) == -1) {
+		fail(err);
+		return;
+	}
+	if (c_status_init(path, &conf) == -1 || cfan_status_open_path(&st, path) == -1) {
+		fail("status init");
+		c_conf_free(&conf);
+		return;
+	}
+	c_status_begin(c_status);
+	++c_status->tick;
+	c_status_temps()[1].temp = 51500;
+	c_status_fans()[1].speed = 128;
+	if (cfan_status_read(&st, buf, sizeof(buf)) != -1 || errno != EAGAIN) fail("status mid-update");
+	c_status_end(c_status);
+	if (cfan_status_read(&st, buf, sizeof(buf)) == -1) fail("status read");
+	const cfan_status_hdr_ty *h = (const cfan_status_hdr_ty *)buf;
+	if (h->tick != 1 || h->temps_len != 2 || h->fans_len != 2 || h->zones_len != 2) fail("status header");
+	if (strcmp(cfan_status_temps(h)[1].name, "gpu") || cfan_status_temps(h)[1].temp != 51500 || cfan_status_temps(h)[0].temp != INT32_MIN) fail("status temps");
+	if (strcmp(cfan_status_fans(h)[1].name, "b") || cfan_status_fans(h)[1].speed != 128 || cfan_status_fans(h)[1].zone != 1) fail("status fans");
+	if (strcmp(cfan_status_zones(h)[1].name, "z1")) fail("status zones");
+	if (cfan_status_read(&st, buf, 16) != -1 || errno != ENOBUFS) fail("status small buffer");
+	/* A new run replaces the segment and marks the old one stopped. */
+	old = st;
+	if (c_status_init(path, &conf) == -1 || cfan_status_open_path(&st, path) == -1) fail("status reinit");
+	if (cfan_status_read(&old, buf, sizeof(buf)) != -1 || errno != ESTALE) fail("status stale");
+	if (cfan_status_read(&st, buf, sizeof(buf)) == -1 || h->tick != 0) fail("status new");
+	cfan_status_close(&old);
+	c_status_cleanup(path);
+	if (cfan_status_read(&st, buf, sizeof(buf)) != -1 || errno != ESTALE) fail("status stopped");
+	if (access(path, F_OK) == 0) fail("status unlink");
+	cfan_status_close(&st);
+	c_conf_free(&conf);
+	errno = 0;
+}
+
+static void
+test_rec_ring(void)
+{
+	char path[64];
+	char err[C_CONF_ERR_LEN] = "";
+	static char buf[4096];
+	void *img;
+	size_t img_sz;
+	c_conf_ty conf;
+	c_zone_state_ty states[2];
+	int temps[2] = { 40000, C_TEMP_INVALID };
+	snprintf(path, sizeof(path), "/tmp/cfan-test-rec-%d", (int)getpid());
+	if (c_conf_compile("t", test_conf_text, S_LEN(test_conf_text), NULL, test_conf_fns, &img, &img_sz, err, sizeof(err)) == -1
+	    || c_conf_from_img(&conf, img, img_sz, test_conf_fns, err, sizeof(err)) == -1) {
+		fail(err);
+		return;
+	}
+	memset(states, 0, sizeof(states));
+	if (c_rec_init(&conf, 4) == -1) {
+		fail("rec init");
+		c_conf_free(&conf);
+		return;
+	}
+	/* Six ticks into four slots keeps the last four. */
+	for (unsigned int i = 0; i < 6; ++i) {
+		states[1].last_speed = 100 + i;
+		states[1].target = 200;
+		states[1].reason = CFAN_REC_SPIKE;
+		c_rec_tick(1000 * i, 1000, temps, states);
+	}
+	if (c_rec_dump(path) == -1) fail("rec dump");
+	const int fd = open(path, O_RDONLY);
+	const ssize_t n = (fd == -1) ? -1 : read(fd, buf, sizeof(buf));
+	if (fd != -1)
+		close(fd);
+	const cfan_rec_hdr_ty *h = (const cfan_rec_hdr_ty *)buf;
+	if (n <= 0 || cfan_rec_check(h, (size_t)n) == -1) {
+		fail("rec check");
+	} else {
+		if (h->len != 4 || h->ticks != 6 || h->temps_len != 2 || h->zones_len != 2) fail("rec header");
+		if (strcmp(cfan_rec_name(h, 1), "gpu") || strcmp(cfan_rec_name(h, 3), "z1") || cfan_rec_name(h, 4) != NULL) fail("rec names");
+		if (cfan_rec_slot(h, 0)->ms != 2000 || cfan_rec_slot(h, 3)->ms != 5000) fail("rec order");
+		if (cfan_rec_temps(cfan_rec_slot(h, 0))[1] != INT32_MIN) fail("rec temps");
+		const cfan_rec_zone_ty *z = cfan_rec_zones(h, cfan_rec_slot(h, 3)) + 1;
+		if (z->speed != 105 || z->target != 200 || z->reason != CFAN_REC_SPIKE) fail("rec zone");
+		if (cfan_rec_check(h, (size_t)n - 1) != -1) fail("rec truncated");
+	}
+	/* A link left in its place is replaced, not written through. */
+	char victim[80];
+	char v[8] = "";
+	struct stat st;
+	snprintf(victim, sizeof(victim), "%s.victim", path);
+	int vfd = open(victim, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (vfd == -1 || write(vfd, "keep\n", 5) != 5 || unlink(path) == -1 || symlink(victim, path) == -1) fail("rec link");
+	if (vfd != -1)
+		close(vfd);
+	if (c_rec_dump(path) == -1 || lstat(path, &st) == -1 || !S_ISREG(st.st_mode)) fail("rec link replaced");
+	vfd = open(victim, O_RDONLY);
+	if (vfd == -1 || read(vfd, v, sizeof(v)) != 5 || memcmp(v, "keep\n", 5)) fail("rec link followed");
+	if (vfd != -1)
+		close(vfd);
+	unlink(victim);
+	unlink(path);
+	/* A crash dumps the ring and still ends the process. */
+	int status;
+	const pid_t pid = fork();
+	if (pid == 0) {
+		if (c_rec_crash_init(path) == 0)
+			raise(SIGSEGV);
+		_exit(0);
+	}
+	if (pid == -1 || waitpid(pid, &status, 0) != pid || !WIFSIGNALED(status) || WTERMSIG(status) != SIGSEGV) fail("rec crash signal");
+	if (access(path, R_OK) != 0) fail("rec crash dump");
+	unlink(path);
+	c_rec_cleanup();
+	c_conf_free(&conf);
+	errno = 0;
+}
+
+static void
+test_metrics_extra(FILE *fp)
+{
+	fprintf(fp, "test_extra 1\n");
+}
+
+static void
+test_metrics_textfile(void)
+{
+	static const char text[] = "temp cpu /tmp/cpu\nfan a /tmp/pwm1 tach=/tmp/fan1_input\nzone z temps=* fans=*\nmetrics /tmp/m 5\n";
+	char path[64];
+	char err[C_CONF_ERR_LEN] = "";
+	static char buf[8192];
+	void *img;
+	size_t img_sz;
+	c_conf_ty conf;
+	c_zone_state_ty st;
+	const unsigned int tach_fans[] = { 0 };
+	snprintf(path, sizeof(path), "/tmp/cfan-test-metrics-%d.prom", (int)getpid());
+	if (c_conf_compile("t", text, S_LEN(text), NULL, test_conf_fns, &img, &img_sz, err, sizeof(err)) == -1
+	    || c_conf_from_img(&conf, img, img_sz, test_conf_fns, err, sizeof(err)) == -1) {
+		fail(err);
+		return;
+	}
+	if (conf.metrics == NULL || strcmp(conf.metrics, "/tmp/m") || conf.metrics_s != 5) fail("metrics conf");
+	if (c_metrics_init(&conf, 2) == -1) {
+		fail("metrics init");
+		c_conf_free(&conf);
+		return;
+	}
+	memset(&st, 0, sizeof(st));
+	st.speed_max = 255;
+	/* 1.5 s in the lowest quarter, then 2 s in the highest, where a spike
+	 * is held back over two ticks. */
+	st.last_speed = 51;
+	c_metrics_zone(0, &st, 1500, CFAN_REC_DIRECT);
+	st.last_speed = 255;
+	st.reason = CFAN_REC_SPIKE;
+	c_metrics_zone(0, &st, 1000, CFAN_REC_DIRECT);
+	c_metrics_zone(0, &st, 1000, CFAN_REC_SPIKE);
+	c_metrics_tick(2000000);
+	c_metrics_tick(1000000);
+	++c_metrics.read_errors[1];
+	++c_metrics.fan_writes[0];
+	++c_metrics.wakeups[C_METRICS_WAKE_ALARM];
+	/* The timer is late by 3 ms, then on time after skipping a period. */
+	c_ev_timer_next_ns = 1000000000;
+	c_ev_timer_period_ns = 100000000;
+	if (c_ev_timer_late_ns(1003000000) != 3000000 || c_ev_timer_next_ns != 1100000000) fail("timer late");
+	if (c_ev_timer_late_ns(1200000000) != 0 || c_ev_timer_next_ns != 1300000000) fail("timer skip");
+	c_metrics_extra_add(test_metrics_extra);
+	/* A link left as the temporary file is not written through. */
+	snprintf(buf, sizeof(buf), "%s.tmp", path);
+	if (symlink("/tmp/cfan-test-metrics-victim", buf) == -1) fail("metrics link");
+	if (c_metrics_write(path, &conf, tach_fans, 1, 7, 9) == -1) {
+		fail("metrics write");
+	} else {
+		const int fd = open(path, O_RDONLY);
+		const ssize_t n = (fd == -1) ? -1 : read(fd, buf, sizeof(buf) - 1);
+		if (fd != -1)
+			close(fd);
+		buf[(n > 0) ? n : 0] = '\0';
+		if (!strstr(buf, "\ncfan_ticks_total 2\n")) fail("metrics ticks");
+		if (!strstr(buf, "\ncfan_tick_duration_seconds_sum 0.003000000\n")) fail("metrics duration");
+		if (!strstr(buf, "\ncfan_tick_duration_max_seconds 0.002000000\n")) fail("metrics duration max");
+		if (!strstr(buf, "\ncfan_sensor_read_errors_total{sensor=\"cpu\"} 0\n")) fail("metrics sensor");
+		if (!strstr(buf, "\ncfan_tach_read_errors_total{fan=\"a\"} 1\n")) fail("metrics tach");
+		if (!strstr(buf, "\ncfan_fan_writes_total{fan=\"a\"} 1\n")) fail("metrics writes");
+		if (!strstr(buf, "\ncfan_writes_held_total 9\n")) fail("metrics held");
+		if (!strstr(buf, "\ncfan_wakeups_total{source=\"alarm\"} 1\n") || !strstr(buf, "\ncfan_wakeups_total{source=\"timer\"} 0\n")) fail("metrics wakeups");
+		if (!strstr(buf, "{zone=\"z\",band=\"0-25\"} 1.500\n") || !strstr(buf, "{zone=\"z\",band=\"75-100\"} 2.000\n")) fail("metrics bands");
+		if (!strstr(buf, "\ncfan_zone_spike_suppressions_total{zone=\"z\"} 1\n")) fail("metrics spikes");
+		if (!strstr(buf, "\ntest_extra 1\n")) fail("metrics extra");
+	}
+	snprintf(buf, sizeof(buf), "%s.tmp", path);
+	if (access(buf, F_OK) == 0) fail("metrics tmp left");
+	if (access("/tmp/cfan-test-metrics-victim", F_OK) == 0) fail("metrics link followed");
+	unlink("/tmp/cfan-test-metrics-victim");
+	unlink(path);
+	c_metrics_cleanup();
+	c_conf_free(&conf);
+	errno = 0;
+}
+
+static int
+test_file_put(const char *dir, const char *name, const char *s)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd == -1)
+		return -1;
+	const ssize_t n = write(fd, s, strlen(s));
+	close(fd);
+	return (n == (ssize_t)strlen(s)) ? 0 : -1;
+}
+
+static void
+test_alarm_limits(void)
+{
+	char dir[] = "/tmp/cfan-test-alarm-XXXXXX";
+	char path[PATH_MAX];
+	char text[PATH_MAX + 256];
+	char err[C_CONF_ERR_LEN] = "";
+	char buf[32];
+	char saved[PATH_MAX];
+	char boot[64];
+	void *img;
+	size_t img_sz;
+	c_conf_ty conf;
+	c_alarm_ty a;
+	if (mkdtemp(dir) == NULL) {
+		fail("alarm dir");
+		return;
+	}
+	if (test_file_put(dir, "temp1_input", "45000\n") == -1 || test_file_put(dir, "temp1_max", "80000\n") == -1 || test_file_put(dir, "temp1_max_alarm", "0\n") == -1 || test_file_put(dir, "temp2_input", "45000\n") == -1)
+		fail("alarm files");
+	/* Arming moves the limit band above the temperature, and disarming
+	 * writes back the one it had. */
+	snprintf(path, sizeof(path), "%s/temp1_input", dir);
+	if (c_alarm_open(&a, path) == -1) {
+		fail("alarm open");
+	} else {
+		if (c_alarm_arm(&a, 47000) == -1 || a.armed != 47000) fail("alarm arm");
+		ssize_t n = pread(a.max_fd, buf, sizeof(buf) - 1, 0);
+		buf[(n > 0) ? n : 0] = '\0';
+		if (strncmp(buf, "47000", 5)) fail("alarm limit");
+		/* A crash puts it back, and leaves it armed for the exit. */
+		c_alarms = &a;
+		c_alarms_len = 1;
+		c_alarm_crash_restore();
+		c_alarms = NULL;
+		c_alarms_len = 0;
+		n = pread(a.max_fd, buf, sizeof(buf) - 1, 0);
+		buf[(n > 0) ? n : 0] = '\0';
+		if (strcmp(buf, "80000\n") || a.armed != 47000) fail("alarm crash restore");
+		if (c_alarm_disarm(&a) == -1 || a.armed != INT_MIN) fail("alarm disarm");
+		n = pread(a.max_fd, buf, sizeof(buf) - 1, 0);
+		buf[(n > 0) ? n : 0] = '\0';
+		if (strcmp(buf, "80000\n")) fail("alarm restore");
+		c_alarm_close(&a);
+	}
+	/* No tempN_max. */
+	snprintf(path, sizeof(path), "%s/temp2_input", dir);
+	if (c_alarm_open(&a, path) != -1) fail("alarm without max");
+	if (c_alarm_open(&a, "/sys/class/thermal/thermal_zone3/temp") == -1 || a.tz != 3 || a.max_fd != -1) fail("alarm thermal zone");
+	if (c_alarm_open(&a, "/tmp/cpu") != -1) fail("alarm unknown");
+	/* A regular file can't be tested, so only the thermal zone is kept,
+	 * and its trip points do not cover its zone, even with the thermal
+	 * events. */
+	snprintf(text, sizeof(text), "temp cpu %s/temp1_input alarm\ntemp tz /sys/class/thermal/thermal_zone3/temp alarm\ntemp gpu /tmp/gpu\nfan a /tmp/pwm1\nzone z temps=tz fans=a\n", dir);
+	if (c_conf_compile("t", text, strlen(text), NULL, test_conf_fns, &img, &img_sz, err, sizeof(err)) == -1
+	    || c_conf_from_img(&conf, img, img_sz, test_conf_fns, err, sizeof(err)) == -1) {
+		fail(err);
+	} else {
+		if (conf.temps_flags[0] != C_CONF_TEMP_ALARM || conf.temps_flags[1] != C_CONF_TEMP_ALARM || conf.temps_flags[2] != 0) fail("alarm conf");
+		/* Left moved by a cfan that was killed, whose original was saved
+		 * during this boot. */
+		snprintf(saved, sizeof(saved), "%s/saved", dir);
+		snprintf(text, sizeof(text), "%s\n%s/temp1_input\t80000\n", (path_line_read(PATH_BOOT_ID, boot, sizeof(boot)) == 0) ? boot : "", dir);
+		if (test_file_put(dir, "temp1_max", "47000\n") == -1 || test_file_put(dir, "saved", text) == -1)
+			fail("alarm saved files");
+		if (c_alarm_init(&conf, conf.temps, saved) == -1) fail("alarm init");
+		snprintf(path, sizeof(path), "%s/temp1_max", dir);
+		if (path_line_read(path, buf, sizeof(buf)) == -1 || strcmp(buf, "80000")) fail("alarm saved restore");
+		if (c_alarm_nl_init() != -1 && c_alarm_nl_read() == -1) fail("alarm thermal events");
+		if (c_alarm_nlfd != -1)
+			close(c_alarm_nlfd);
+		c_alarm_nlfd = -1;
+		if (c_alarms[0].max_fd != -1 || c_alarms[1].tz != 3 || c_alarms[2].tz != -1) fail("alarm init kept");
+		/* Nothing to wait on. */
+		c_alarm_ack();
+		if (c_alarm_ev_add(C_EV_ALARM) == -1) fail("alarm ev add");
+		if (c_alarm_covers(&conf)) fail("alarm covers without events");
+		c_alarm_nlfd = open("/dev/null", O_RDONLY);
+		if (c_alarm_covers(&conf)) fail("alarm covers with trip points");
+		c_alarms[1].max_fd = c_alarm_nlfd;
+		if (!c_alarm_covers(&conf)) fail("alarm covers");
+		c_alarms[1].max_fd = -1;
+		const int temps[] = { 45000, 45000, 45000 };
+		if (c_alarm_arm_all(temps, 2000) == -1) fail("alarm arm all");
+		c_alarm_cleanup();
+		if (c_alarms != NULL || c_alarm_nlfd != -1) fail("alarm cleanup");
+		if (access(saved, F_OK) == 0) fail("alarm saved unlink");
+		c_conf_free(&conf);
+	}
+	static const char *const names[] = { "temp1_input", "temp1_max", "temp1_max_alarm", "temp2_input", "saved" };
+	for (unsigned int i = 0; i < LEN(names); ++i) {
+		snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+		unlink(path);
+	}
+	rmdir(dir);
+	errno = 0;
+}
+
+static void
+test_psi_bias(void)
+{
+	char path[] = "/tmp/cfan-test-psi-XXXXXX";
+	char buf[64];
+	c_zone_state_ty st;
+	int at_floor;
+	/* The trigger is written in usecs, with its NUL. */
+	const int tmp = mkstemp(path);
+	if (tmp == -1) {
+		fail("psi mkstemp");
+		return;
+	}
+	close(tmp);
+	if (c_psi_init(path, 150, 1000) == -1) {
+		fail("psi init");
+	} else {
+		const ssize_t n = pread(c_psi_fd, buf, sizeof(buf), 0);
+		if (n != (ssize_t)sizeof("some 150000 1000000") || memcmp(buf, "some 150000 1000000", (size_t)n)) fail("psi trigger");
+	}
+	unlink(path);
+	c_psi_cleanup();
+	if (c_psi_fd != -1 || c_psi_init(path, 150, 1000) != -1) fail("psi missing");
+	/* Held for hold_ms after the last trigger. */
+	if (c_psi_bias(1000, 40) != 0) fail("psi idle");
+	c_psi_fired(1000, 5000);
+	if (c_psi_bias(5999, 40) != 40 || c_psi_bias(6000, 40) != 0) fail("psi hold");
+	c_psi_cleanup();
+	/* The bias is added to the curve, up to its top, and applied on the
+	 * first tick rather than ramped to as a spike. */
+	memset(&st, 0, sizeof(st));
+	st.curve = &test_curve;
+	st.speed_min = 50;
+	st.speed_max = 250;
+	st.mode = CONTROL_CURVE;
+	st.hyst_temp = INT_MIN;
+	c_predict_reset(&st.predict);
+	st.last_speed = c_curve_get(&test_curve, 40000);
+	st.bias = 40;
+	if (c_zone_speed_get(&prm, &st, 40000, TICK_MS, &at_floor) != c_curve_get(&test_curve, 40000) + 40 || st.target != c_curve_get(&test_curve, 40000) + 40 || at_floor) fail("psi zone bias");
+	if (st.reason != CFAN_REC_LOAD) fail("psi zone reason");
+	st.bias = 255;
+	c_zone_speed_get(&prm, &st, 40000, TICK_MS, &at_floor);
+	if (st.target != st.speed_max) fail("psi zone max");
+	/* Not in CONTROL_PID. */
+	st.mode = CONTROL_PID;
+	st.pid.inited = 0;
+	c_zone_speed_get(&prm, &st, 40000, TICK_MS, &at_floor);
+	if (st.reason != CFAN_REC_PID) fail("psi zone pid");
+	errno = 0;
+}
+
 /*
  * Verify the fd guard pattern used in c_cleanup().
  * The bug: c_fan_fds was zero-initialized (static storage),
@@ -271,6 +1349,283 @@ test_fd_guard_all_valid(void)
 		fail("all valid fds should be ok");
 }
 
+/* Create dir/rel, with its parents, holding s, or a symlink to s if rel
+ * ends with '@'. */
+static int
+test_tree_put(const char *dir, const char *rel, const char *s)
+{
+	char path[PATH_MAX];
+	const int len = snprintf(path, sizeof(path), "%s/%s", dir, rel);
+	const int link = (path[len - 1] == '@');
+	if (link)
+		path[len - 1] = '\0';
+	for (char *p = path + strlen(dir) + 1; (p = strchr(p, '/')) != NULL; ++p) {
+		*p = '\0';
+		const int ret = mkdir(path, S_IRWXU);
+		*p = '/';
+		if (ret == -1 && errno != EEXIST)
+			return -1;
+	}
+	if (link)
+		return symlink(s, path);
+	return test_file_put(dir, rel, s);
+}
+
+static void
+test_tree_rm(const char *path)
+{
+	char sub[PATH_MAX];
+	DIR *d = opendir(path);
+	if (d == NULL) {
+		unlink(path);
+		return;
+	}
+	for (const struct dirent *e; (e = readdir(d)) != NULL;) {
+		if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+			continue;
+		snprintf(sub, sizeof(sub), "%s/%s", path, e->d_name);
+		/* Not into symlinks. */
+		if (e->d_type == DT_DIR)
+			test_tree_rm(sub);
+		else
+			unlink(sub);
+	}
+	closedir(d);
+	rmdir(path);
+}
+
+static void
+test_path_resolve(void)
+{
+	char dir[] = "/tmp/cfan-test-path-XXXXXX";
+	char sys[PATH_MAX], spec[PATH_MAX], want[PATH_MAX], cache_path[PATH_MAX];
+	static const char *const tree[][2] = {
+		{ "sys/devices/platform/coretemp.0/hwmon/hwmon2/name", "coretemp\n" },
+		{ "sys/devices/platform/coretemp.0/hwmon/hwmon2/temp1_input", "45000\n" },
+		{ "sys/devices/platform/coretemp.0/hwmon/hwmon2/device@", "../../../coretemp.0" },
+		{ "sys/devices/platform/nct6775.656/hwmon/hwmon3/name", "nct6775\n" },
+		{ "sys/devices/platform/nct6775.656/hwmon/hwmon3/pwm1", "128\n" },
+		{ "sys/devices/platform/nct6775.656/hwmon/hwmon3/device@", "../../../nct6775.656" },
+		{ "sys/devices/platform/nct6775.2592/hwmon/hwmon4/name", "nct6775\n" },
+		{ "sys/devices/platform/nct6775.2592/hwmon/hwmon4/pwm1", "128\n" },
+		{ "sys/devices/platform/nct6775.2592/hwmon/hwmon4/device@", "../../../nct6775.2592" },
+		{ "sys/devices/virtual/thermal/thermal_zone0/type", "acpitz\n" },
+		{ "sys/devices/virtual/thermal/thermal_zone0/temp", "40000\n" },
+		{ "sys/devices/virtual/thermal/thermal_zone1/type", "x86_pkg_temp\n" },
+		{ "sys/devices/virtual/thermal/thermal_zone1/temp", "50000\n" },
+		{ "sys/class/hwmon/hwmon2@", "../../devices/platform/coretemp.0/hwmon/hwmon2" },
+		{ "sys/class/hwmon/hwmon3@", "../../devices/platform/nct6775.656/hwmon/hwmon3" },
+		{ "sys/class/hwmon/hwmon4@", "../../devices/platform/nct6775.2592/hwmon/hwmon4" },
+		{ "sys/class/thermal/thermal_zone0@", "../../devices/virtual/thermal/thermal_zone0" },
+		{ "sys/class/thermal/thermal_zone1@", "../../devices/virtual/thermal/thermal_zone1" },
+	};
+	if (mkdtemp(dir) == NULL) {
+		fail("path dir");
+		return;
+	}
+	for (unsigned int i = 0; i < LEN(tree); ++i)
+		if (test_tree_put(dir, tree[i][0], tree[i][1]) == -1)
+			fail("path tree");
+	snprintf(sys, sizeof(sys), "%s/sys", dir);
+	path_scan_ty s = { sys, { NULL }, { 0 }, { 0 } };
+	/* Failures are reported, as cfan would. */
+	const int err = dup(STDERR_FILENO), null = open("/dev/null", O_WRONLY);
+	dup2(null, STDERR_FILENO);
+	close(null);
+	if (!path_is_sysfs("hwmon:coretemp/temp1_input") || !path_is_sysfs("/sys/class/hwmon/hwmon2/pwm1") || path_is_sysfs("/tmp/cpu")) fail("path is sysfs");
+	char *p = path_sysfs_resolve(&s, "hwmon:coretemp/temp1_input");
+	snprintf(want, sizeof(want), "%s/devices/platform/coretemp.0/hwmon/hwmon2/temp1_input", sys);
+	if (p == NULL || strcmp(p, want)) fail("path name");
+	free(p);
+	if (s.lens[PATH_HWMON] != 3 || s.scanned[PATH_THERMAL]) fail("path scan");
+	/* Two chips of the same name need the device. */
+	if (path_sysfs_resolve(&s, "hwmon:nct6775/pwm1") != NULL) fail("path ambiguous");
+	p = path_sysfs_resolve(&s, "hwmon:nct6775@nct6775.2592/pwm1");
+	snprintf(want, sizeof(want), "%s/devices/platform/nct6775.2592/hwmon/hwmon4/pwm1", sys);
+	if (p == NULL || strcmp(p, want)) fail("path device");
+	free(p);
+	if (path_sysfs_resolve(&s, "hwmon:it87/pwm1") != NULL || path_sysfs_resolve(&s, "hwmon:coretemp") != NULL) fail("path missing");
+	/* A path of the last boot follows its device, not the first hwmon. */
+	snprintf(spec, sizeof(spec), "%s/devices/platform/nct6775.656/hwmon/hwmon9/pwm1", sys);
+	p = path_sysfs_resolve(&s, spec);
+	snprintf(want, sizeof(want), "%s/devices/platform/nct6775.656/hwmon/hwmon3/pwm1", sys);
+	if (p == NULL || strcmp(p, want)) fail("path legacy");
+	free(p);
+	if (path_sysfs_resolve(&s, want) != want) fail("path exists");
+	/* Every thermal zone is under the same device. */
+	snprintf(spec, sizeof(spec), "%s/devices/virtual/thermal/thermal_zone7/temp", sys);
+	if (path_sysfs_resolve(&s, spec) != NULL) fail("path legacy ambiguous");
+	p = path_sysfs_resolve(&s, "thermal:x86_pkg_temp/temp");
+	snprintf(want, sizeof(want), "%s/devices/virtual/thermal/thermal_zone1/temp", sys);
+	if (p == NULL || strcmp(p, want)) fail("path thermal");
+	dup2(err, STDERR_FILENO);
+	close(err);
+	/* The cache holds for its boot only. */
+	path_cache_ty c;
+	memset(&c, 0, sizeof(c));
+	snprintf(cache_path, sizeof(cache_path), "%s/paths", dir);
+	path_cache_load(&c, cache_path, "boot-a");
+	if (c.len != 0) fail("path cache empty");
+	path_cache_put(&c, "thermal:x86_pkg_temp/temp", p);
+	if (!c.dirty || path_cache_save(&c, cache_path) == -1) fail("path cache save");
+	path_cache_load(&c, cache_path, "boot-a");
+	const char *q = path_cache_get(&c, sys, "thermal:x86_pkg_temp/temp");
+	if (c.len != 1 || c.dirty || q == NULL || strcmp(q, want)) fail("path cache load");
+	if (path_cache_get(&c, "/sys", "thermal:x86_pkg_temp/temp") != NULL) fail("path cache outside");
+	path_cache_load(&c, cache_path, "boot-b");
+	if (c.len != 0) fail("path cache boot");
+	chmod(cache_path, S_IRUSR | S_IWUSR | S_IWOTH);
+	path_cache_load(&c, cache_path, "boot-a");
+	if (c.len != 0 || c.text != NULL) fail("path cache writable");
+	free(p);
+	path_scan_free(&s);
+	test_tree_rm(dir);
+	errno = 0;
+}
+
+static void
+test_discover(void)
+{
+	char dir[] = "/tmp/cfan-test-discover-XXXXXX";
+	char sys[PATH_MAX], want[2048], err[C_CONF_ERR_LEN] = "";
+	static const char *const tree[][2] = {
+		{ "sys/devices/platform/coretemp.1/hwmon/hwmon1/name", "coretemp\n" },
+		{ "sys/devices/platform/coretemp.1/hwmon/hwmon1/temp1_input", "45000\n" },
+		{ "sys/devices/platform/coretemp.1/hwmon/hwmon1/temp2_input", "44000\n" },
+		{ "sys/devices/platform/coretemp.1/hwmon/hwmon1/device@", "../../../coretemp.1" },
+		{ "sys/devices/platform/coretemp.0/hwmon/hwmon2/name", "coretemp\n" },
+		{ "sys/devices/platform/coretemp.0/hwmon/hwmon2/temp10_input", "46000\n" },
+		{ "sys/devices/platform/coretemp.0/hwmon/hwmon2/temp1_input", "47000\n" },
+		{ "sys/devices/platform/coretemp.0/hwmon/hwmon2/device@", "../../../coretemp.0" },
+		{ "sys/devices/platform/nct6775.656/hwmon/hwmon3/name", "nct6775\n" },
+		{ "sys/devices/platform/nct6775.656/hwmon/hwmon3/temp1_input", "30000\n" },
+		{ "sys/devices/platform/nct6775.656/hwmon/hwmon3/pwm1", "128\n" },
+		{ "sys/devices/platform/nct6775.656/hwmon/hwmon3/pwm1_enable", "2\n" },
+		{ "sys/devices/platform/nct6775.656/hwmon/hwmon3/fan1_input", "900\n" },
+		{ "sys/devices/platform/nct6775.656/hwmon/hwmon3/pwm2", "128\n" },
+		{ "sys/devices/platform/nct6775.656/hwmon/hwmon3/pwm2_enable", "2\n" },
+		{ "sys/devices/platform/nct6775.656/hwmon/hwmon3/pwm3", "128\n" },
+		{ "sys/devices/platform/nct6775.656/hwmon/hwmon3/pwm3_mode", "1\n" },
+		{ "sys/devices/platform/nct6775.656/hwmon/hwmon3/device@", "../../../nct6775.656" },
+		{ "sys/devices/pci0000:00/0000:03:00.0/hwmon/hwmon4/name", "amdgpu\n" },
+		{ "sys/devices/pci0000:00/0000:03:00.0/hwmon/hwmon4/temp2_input", "60000\n" },
+		{ "sys/devices/pci0000:00/0000:03:00.0/hwmon/hwmon4/temp1_input", "55000\n" },
+		{ "sys/devices/pci0000:00/0000:03:00.0/hwmon/hwmon4/pwm1", "80\n" },
+		{ "sys/devices/pci0000:00/0000:03:00.0/hwmon/hwmon4/pwm1_enable", "2\n" },
+		{ "sys/devices/pci0000:00/0000:03:00.0/hwmon/hwmon4/fan1_input", "1200\n" },
+		{ "sys/devices/pci0000:00/0000:03:00.0/hwmon/hwmon4/device@", "../.." },
+		{ "sys/devices/pci0000:00/0000:01:00.0/nvme/nvme0/hwmon0/name", "nvme\n" },
+		{ "sys/devices/pci0000:00/0000:01:00.0/nvme/nvme0/hwmon0/temp1_input", "50000\n" },
+		{ "sys/devices/pci0000:00/0000:01:00.0/nvme/nvme0/hwmon0/device@", ".." },
+		{ "sys/class/hwmon/hwmon0@", "../../devices/pci0000:00/0000:01:00.0/nvme/nvme0/hwmon0" },
+		{ "sys/class/hwmon/hwmon1@", "../../devices/platform/coretemp.1/hwmon/hwmon1" },
+		{ "sys/class/hwmon/hwmon2@", "../../devices/platform/coretemp.0/hwmon/hwmon2" },
+		{ "sys/class/hwmon/hwmon3@", "../../devices/platform/nct6775.656/hwmon/hwmon3" },
+		{ "sys/class/hwmon/hwmon4@", "../../devices/pci0000:00/0000:03:00.0/hwmon/hwmon4" },
+	};
+	if (mkdtemp(dir) == NULL) {
+		fail("discover dir");
+		return;
+	}
+	for (unsigned int i = 0; i < LEN(tree); ++i)
+		if (test_tree_put(dir, tree[i][0], tree[i][1]) == -1)
+			fail("discover tree");
+	snprintf(sys, sizeof(sys), "%s/sys", dir);
+	c_conf_buf_ty text = { NULL, 0, 0 };
+	/* Sorted by kind and device, not by hwmon number. The board's own
+	 * sensor, and pwm3 without pwm3_enable, are left out. */
+	snprintf(want, sizeof(want),
+	         "# Found in %s/class/hwmon by cfan --discover.\n"
+	         "temp cpu0 hwmon:coretemp@coretemp.0/temp1_input # coretemp\n"
+	         "temp cpu1 hwmon:coretemp@coretemp.1/temp1_input # coretemp\n"
+	         "temp gpu0 hwmon:amdgpu/temp1_input # amdgpu\n"
+	         "temp drive0 hwmon:nvme/temp1_input # nvme, in no zone\n"
+	         "temp_cpu cpu0\n"
+	         "fan gpu0-fan0 hwmon:amdgpu/pwm1 hwmon:amdgpu/pwm1_enable tach=hwmon:amdgpu/fan1_input # amdgpu\n"
+	         "fan fan0 hwmon:nct6775/pwm1 hwmon:nct6775/pwm1_enable tach=hwmon:nct6775/fan1_input # nct6775\n"
+	         "fan fan1 hwmon:nct6775/pwm2 hwmon:nct6775/pwm2_enable # nct6775\n"
+	         "zone board temps=cpu0,cpu1 fans=fan0,fan1\n"
+	         "zone gpu0 temps=gpu0 fans=gpu0-fan0\n",
+	         sys);
+	if (c_discover(sys, &text) != 3 || text.len != strlen(want) || memcmp(text.p, want, text.len)) fail("discover text");
+	/* The text is a configuration file, naming files that resolve. */
+	void *img;
+	size_t img_sz;
+	c_conf_ty conf;
+	if (c_conf_compile("t", text.p, text.len, NULL, test_conf_fns, &img, &img_sz, err, sizeof(err)) == -1
+	    || c_conf_from_img(&conf, img, img_sz, test_conf_fns, err, sizeof(err)) == -1) {
+		fail(err);
+	} else {
+		if (conf.temps_len != 4 || conf.temp_cpu != 0 || conf.fans_len != 3 || conf.zones_len != 2) fail("discover conf");
+		if (conf.zones[0].temps_len != 2 || conf.zones[0].fans_len != 2 || conf.zones[1].fans[0] != 0) fail("discover zones");
+		path_scan_ty s = { sys, { NULL }, { 0 }, { 0 } };
+		char *p = path_sysfs_resolve(&s, conf.temps[1]);
+		snprintf(want, sizeof(want), "%s/devices/platform/coretemp.1/hwmon/hwmon1/temp1_input", sys);
+		if (p == NULL || strcmp(p, want)) fail("discover resolve");
+		free(p);
+		path_scan_free(&s);
+		c_conf_free(&conf);
+	}
+	free(text.p);
+	/* A machine with no fans to set. */
+	text.p = NULL;
+	text.len = text.cap = 0;
+	test_tree_rm(dir);
+	if (c_discover(dir, &text) != 0 || text.len == 0) fail("discover empty");
+	free(text.p);
+	errno = 0;
+}
+
+static void
+test_uevent(void)
+{
+	static const char add[] = "add@/devices/platform/nct6775.656/hwmon/hwmon3\0ACTION=add\0DEVPATH=/devices/platform/nct6775.656/hwmon/hwmon3\0SUBSYSTEM=hwmon\0SEQNUM=4121";
+	static const char bind[] = "bind@/devices/platform/nct6775.656\0ACTION=bind\0DEVPATH=/devices/platform/nct6775.656\0SUBSYSTEM=platform\0DRIVER=nct6775";
+	static const char rm[] = "remove@/devices/virtual/thermal/thermal_zone1\0ACTION=remove\0SUBSYSTEM=thermal";
+	static const char usb[] = "add@/devices/pci0000:00/usb1/1-1\0ACTION=add\0SUBSYSTEM=usb";
+	static const char change[] = "change@/devices/platform/coretemp.0/hwmon/hwmon2\0ACTION=change\0SUBSYSTEM=hwmon";
+	if (c_uevent_parse(add, sizeof(add)) != C_UEVENT_ADD) fail("uevent add");
+	if (c_uevent_parse(bind, sizeof(bind)) != C_UEVENT_ADD) fail("uevent bind");
+	if (c_uevent_parse(rm, sizeof(rm)) != C_UEVENT_REMOVE) fail("uevent remove");
+	if (c_uevent_parse(usb, sizeof(usb)) != 0) fail("uevent other subsystem");
+	if (c_uevent_parse(change, sizeof(change)) != 0) fail("uevent change");
+	/* Drained as the socket would be. */
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, sv) == -1) {
+		fail("uevent socketpair");
+	} else {
+		if (send(sv[1], usb, sizeof(usb), 0) == -1 || send(sv[1], rm, sizeof(rm), 0) == -1 || send(sv[1], add, sizeof(add), 0) == -1) fail("uevent send");
+		if (c_uevent_read(sv[0]) != (C_UEVENT_ADD | C_UEVENT_REMOVE)) fail("uevent read");
+		if (c_uevent_read(sv[0]) != 0) fail("uevent drained");
+		close(sv[0]);
+		close(sv[1]);
+	}
+	const int fd = c_uevent_open();
+	if (fd != -1)
+		close(fd);
+	/* The nearest existing directory is watched. */
+	char dir[] = "/tmp/cfan-test-uevent-XXXXXX", path[PATH_MAX];
+	const int ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (mkdtemp(dir) == NULL || ifd == -1) {
+		fail("uevent watch setup");
+	} else {
+		snprintf(path, sizeof(path), "%s/hwmon/temp1_input", dir);
+		if (c_uevent_watch(ifd, path) == -1) fail("uevent watch");
+		struct pollfd pfd = { ifd, POLLIN, 0 };
+		if (poll(&pfd, 1, 0) != 0) fail("uevent watch quiet");
+		snprintf(path, sizeof(path), "%s/hwmon", dir);
+		mkdir(path, S_IRWXU);
+		if (poll(&pfd, 1, 1000) != 1) fail("uevent watch event");
+		c_uevent_watch_ack(ifd);
+		if (poll(&pfd, 1, 0) != 0) fail("uevent watch ack");
+		rmdir(path);
+		rmdir(dir);
+	}
+	if (ifd != -1)
+		close(ifd);
+	errno = 0;
+}
+
 /*
  * Verify that the retry pattern actually retries on transient failures.
  * The old code placed DIE_GRACEFUL inside the if (open fails) block,
@@ -300,6 +1655,83 @@ test_retry_loop_multiple_attempts(void)
 		fail("expected 5 attempts");
 }
 
+static void
+test_act(void)
+{
+	char dir[] = "/tmp/cfan-test-act-XXXXXX";
+	char p0[PATH_MAX], p1[PATH_MAX], buf[2048];
+	const char *paths[3] = { p0, p1, "nvidia:0" };
+	if (mkdtemp(dir) == NULL) {
+		fail("act dir");
+		return;
+	}
+	if (test_file_put(dir, "name", "nct6775\n") == -1 || test_file_put(dir, "pwm1", "0\n") == -1 || test_file_put(dir, "pwm2", "0\n") == -1)
+		fail("act files");
+	snprintf(p0, sizeof(p0), "%s/pwm1", dir);
+	snprintf(p1, sizeof(p1), "%s/pwm2", dir);
+	/* Both files are of one chip, and NVML of none. */
+	if (c_act_init(paths, 3) == -1) {
+		fail("act init");
+		test_tree_rm(dir);
+		return;
+	}
+	if (c_act_chips_len != 1 || strcmp(c_act_chips[0].name, "nct6775") || c_act_slots[1].chip != 0 || c_act_slots[2].chip != C_ACT_NO_CHIP) fail("act chips");
+	const int fd0 = open(p0, O_WRONLY | O_CLOEXEC);
+	/* Writes to it fail. */
+	const int fd1 = open(p1, O_RDONLY | O_CLOEXEC);
+	if (fd0 == -1 || fd1 == -1 || c_act_start() == -1) {
+		fail("act start");
+	} else {
+		/* Only the latest speed is sure to be written. */
+		c_act_put(0, fd0, 10);
+		c_act_put(0, fd0, 128);
+		c_act_put(0, fd0, 200);
+		c_act_put(1, fd1, 50);
+		c_act_stop();
+		if (c_act_running) fail("act stop");
+		const ssize_t n = pread(fd1, buf, sizeof(buf) - 1, 0);
+		buf[(n > 0) ? n : 0] = '\0';
+		if (strcmp(buf, "0\n")) fail("act failed write");
+		const int fd = open(p0, O_RDONLY);
+		const ssize_t m = (fd == -1) ? -1 : read(fd, buf, sizeof(buf) - 1);
+		if (fd != -1)
+			close(fd);
+		buf[(m > 0) ? m : 0] = '\0';
+		if (strcmp(buf, "200\n")) fail("act latest");
+		if (c_act_err(0) != 0 || c_act_err(1) != EBADF) fail("act err");
+		if (c_act_chips[0].writes < 1 || c_act_chips[0].writes > 3 || c_act_chips[0].ns_max > c_act_chips[0].ns) fail("act stats");
+		/* Only the writes made count, not those replaced or failed. */
+		const unsigned long long made = c_act_writes_take(0);
+		if (made != c_act_chips[0].writes || c_act_writes_take(0) != 0 || c_act_writes_take(1) != 0) fail("act writes");
+		/* A fan found again elsewhere is labelled with its new chip. */
+		c_act_rechip(2, p1);
+		if (c_act_slots[2].chip != 0) fail("act rechip");
+		c_act_rechip(2, "/nonexistent/hwmon9/pwm1");
+		if (c_act_slots[2].chip != 1 || c_act_chips_len != 2 || strcmp(c_act_chips[1].name, "hwmon9")) fail("act rechip new");
+		c_act_forget(1);
+		if (c_act_err(1) != 0 || c_act_slots[1].want != C_ACT_NONE) fail("act forget");
+		FILE *fp = tmpfile();
+		if (fp == NULL) {
+			fail("act metrics");
+		} else {
+			c_act_metrics_write(fp);
+			rewind(fp);
+			const size_t k = fread(buf, 1, sizeof(buf) - 1, fp);
+			buf[k] = '\0';
+			fclose(fp);
+			if (!strstr(buf, "\ncfan_fan_write_seconds_count{chip=\"nct6775\",device=\"\"} ")) fail("act metrics count");
+			if (!strstr(buf, "\ncfan_fan_write_max_seconds{chip=\"nct6775\",device=\"\"} ")) fail("act metrics max");
+		}
+	}
+	if (fd0 != -1)
+		close(fd0);
+	if (fd1 != -1)
+		close(fd1);
+	c_act_cleanup();
+	test_tree_rm(dir);
+	errno = 0;
+}
+
 int
 main(void)
 {
@@ -312,10 +1744,23 @@ main(void)
 	TEST(test_utoa_le3_1digit);
 	TEST(test_utoa_le3_2digit);
 	TEST(test_utoa_le3_3digit);
+	TEST(test_itoa);
 	TEST(test_temp_fd_get_basic);
 	TEST(test_temp_fd_get_nonl);
 	TEST(test_temp_fd_get_hundred);
 	TEST(test_temp_fd_get_zero);
+	TEST(test_temp_parse);
+	TEST(test_temp_parse_negative);
+	TEST(test_temp_parse_lengths);
+	TEST(test_curve_breakpoints);
+	TEST(test_curve_interpolate);
+	TEST(test_curve_saturate);
+	TEST(test_curve_check);
+	TEST(test_curve_hyst);
+	TEST(test_zone_speed_get);
+	TEST(test_predict);
+	TEST(test_zone_predict);
+	TEST(test_uring_pread_batch);
 	TEST(test_step_get_spike);
 	TEST(test_step_get_hot_exceeded);
 	TEST(test_step_get_hightemp);
@@ -323,6 +1768,34 @@ main(void)
 	TEST(test_step_get_rampdown_sharp);
 	TEST(test_step_get_rampdown_gentle);
 	TEST(test_step_get_rampdown_boundary);
+	TEST(test_step_get_spike_last);
+	TEST(test_step_get_rampdown_short_tick);
+	TEST(test_step_scale_carry);
+	TEST(test_interval_fast);
+	TEST(test_interval_stretch);
+	TEST(test_interval_relax);
+	TEST(test_pid_bumpless);
+	TEST(test_pid_clamp);
+	TEST(test_pid_antiwindup);
+	TEST(test_pid_settles);
+	TEST(test_rpm_converges);
+	TEST(test_rpm_stall);
+	TEST(test_rpm_compensate);
+	TEST(test_conf_compile);
+	TEST(test_conf_errors);
+	TEST(test_conf_corrupt);
+	TEST(test_conf_cache);
+	TEST(test_ev_timer);
+	TEST(test_ctl_socket);
+	TEST(test_status_segment);
+	TEST(test_rec_ring);
+	TEST(test_metrics_textfile);
+	TEST(test_alarm_limits);
+	TEST(test_psi_bias);
+	TEST(test_path_resolve);
+	TEST(test_discover);
+	TEST(test_act);
+	TEST(test_uevent);
 	TEST(test_fd_guard_zero_init);
 	TEST(test_fd_guard_minus_one_init);
 	TEST(test_fd_guard_mixed);
@@ -0,0 +1,145 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2026 James Tirta Halim <tirtajames45 at gmail dot com> */
+
+#ifndef UEVENT_H
+#define UEVENT_H 1
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "macros.h"
+
+/* Kernel device events, to learn when a hwmon or thermal zone appears
+ * instead of polling for its files.
+ *
+ * The uevent netlink socket reports each device the kernel adds, binds or
+ * removes, as "ACTION@DEVPATH" followed by NUL-separated KEY=VALUE pairs.
+ * Containers often have no such socket, so files on other filesystems, and
+ * sysfs without it, are watched through inotify on their nearest existing
+ * directory. Neither is complete, as sysfs raises no inotify events, so
+ * waiters still look again every so often. */
+
+/* Look again after this long without an event. (msecs) */
+#define C_UEVENT_RECHECK_MS 1000
+
+enum {
+	/* A device was added or bound to its driver. */
+	C_UEVENT_ADD = 1 << 0,
+	C_UEVENT_REMOVE = 1 << 1,
+};
+
+/* Open a socket receiving the uevents of the kernel. Return it, or -1. */
+static int
+c_uevent_open(void)
+{
+	struct sockaddr_nl sa;
+	const int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if (fd == -1)
+		return -1;
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	/* The kernel's group, rather than udev's. */
+	sa.nl_groups = 1;
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Return the C_UEVENT_* of a message of len bytes, if it is about a hwmon
+ * or thermal zone, or a driver bound to its device. */
+static unsigned int
+c_uevent_parse(const char *msg, size_t len)
+{
+	unsigned int action = 0;
+	int ours = 0;
+	for (const char *p = msg, *end = msg + len; p < end; p += strlen(p) + 1) {
+		if (!strncmp(p, "ACTION=", S_LEN("ACTION="))) {
+			p += S_LEN("ACTION=");
+			if (!strcmp(p, "add") || !strcmp(p, "move"))
+				action = C_UEVENT_ADD;
+			else if (!strcmp(p, "bind"))
+				action = C_UEVENT_ADD, ours = 1;
+			else if (!strcmp(p, "remove") || !strcmp(p, "unbind"))
+				action = C_UEVENT_REMOVE;
+		} else if (!strcmp(p, "SUBSYSTEM=hwmon") || !strcmp(p, "SUBSYSTEM=thermal")) {
+			ours = 1;
+		}
+	}
+	return ours ? action : 0;
+}
+
+/* Drain fd and return the C_UEVENT_* it reported, or -1. */
+static int
+c_uevent_read(int fd)
+{
+	/* Uevents are at most a page, UEVENT_BUFFER_SIZE. */
+	char buf[4096 + 1];
+	unsigned int events = 0;
+	for (;;) {
+		const ssize_t n = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				errno = 0;
+				return (int)events;
+			}
+			/* Missed some, so take them as both. */
+			if (errno == ENOBUFS)
+				events |= C_UEVENT_ADD | C_UEVENT_REMOVE;
+			else if (errno != EINTR)
+				return -1;
+			continue;
+		}
+		buf[n] = '\0';
+		events |= c_uevent_parse(buf, (size_t)n);
+	}
+}
+
+/* Watch the nearest existing directory of path, for it or one of its
+ * parents to appear. */
+static int
+c_uevent_watch(int ifd, const char *path)
+{
+	char dir[PATH_MAX];
+	size_t len = strlen(path);
+	if (unlikely(len >= sizeof(dir)))
+		return -1;
+	memcpy(dir, path, len + 1);
+	for (;;) {
+		while (len && dir[len - 1] != '/')
+			--len;
+		/* Keep the root. */
+		dir[(len > 1) ? len - 1 : len] = '\0';
+		if (len == 0)
+			return -1;
+		if (inotify_add_watch(ifd, dir, IN_CREATE | IN_MOVED_TO | IN_ATTRIB | IN_ONLYDIR) != -1)
+			return 0;
+		if (errno != ENOENT && errno != ENOTDIR)
+			return -1;
+		if (len <= 1)
+			return -1;
+		--len;
+	}
+}
+
+/* Drain the events of an inotify fd. */
+static void
+c_uevent_watch_ack(int ifd)
+{
+	union {
+		struct inotify_event ev;
+		char buf[4096];
+	} u;
+	while (read(ifd, u.buf, sizeof(u.buf)) > 0)
+		;
+	errno = 0;
+}
+
+#endif /* UEVENT_H */
@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2026 James Tirta Halim <tirtajames45 at gmail dot com> */
+
+#ifndef URING_H
+#define URING_H 1
+
+/* Minimal io_uring, enough to submit a batch of preads and wait for all of
+ * them with a single io_uring_enter(). Uses the raw syscalls so that cfan
+ * does not depend on liburing. */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "macros.h"
+
+typedef struct {
+	int fd;
+	unsigned int entries;
+	void *sq_ring;
+	size_t sq_ring_sz;
+	void *cq_ring;
+	size_t cq_ring_sz;
+	struct io_uring_sqe *sqes;
+	size_t sqes_sz;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+} c_uring_ty;
+
+static void
+c_uring_exit(c_uring_ty *r)
+{
+	if (r->sqes != NULL && r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->sqes_sz);
+	if (r->cq_ring != NULL && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_sz);
+	if (r->sq_ring != NULL && r->sq_ring != MAP_FAILED)
+		munmap(r->sq_ring, r->sq_ring_sz);
+	if (r->fd != -1)
+		close(r->fd);
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+}
+
+/* Return 1 if the kernel behind r supports op. The probe is as new as
+ * IORING_OP_READ (5.6), so a kernel without it has neither. */
+static int
+c_uring_op_supported(const c_uring_ty *r, unsigned int op)
+{
+	union {
+		struct io_uring_probe probe;
+		char buf[sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op)];
+	} u;
+	memset(&u, 0, sizeof(u));
+	if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE, &u.probe, 256) == -1)
+		return 0;
+	return op < u.probe.ops_len && (u.probe.ops[op].flags & IO_URING_OP_SUPPORTED);
+}
+
+/* Return 0 on success, or -1 if io_uring or its IORING_OP_READ is not
+ * available, in which case the caller should fall back to pread. */
+static int
+c_uring_init(c_uring_ty *r, unsigned int entries)
+{
+	struct io_uring_params p;
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+	r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd == -1)
+		return -1;
+	if (!c_uring_op_supported(r, IORING_OP_READ))
+		goto err;
+	r->entries = p.sq_entries;
+	r->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->sq_ring_sz = r->cq_ring_sz = MAX(r->sq_ring_sz, r->cq_ring_sz);
+	r->sq_ring = mmap(NULL, r->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ring == MAP_FAILED)
+		goto err;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ring = r->sq_ring;
+	} else {
+		r->cq_ring = mmap(NULL, r->cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ring == MAP_FAILED)
+			goto err;
+	}
+	r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		goto err;
+	r->sq_tail = (unsigned int *)((char *)r->sq_ring + p.sq_off.tail);
+	r->sq_mask = (unsigned int *)((char *)r->sq_ring + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *)((char *)r->sq_ring + p.sq_off.array);
+	r->cq_head = (unsigned int *)((char *)r->cq_ring + p.cq_off.head);
+	r->cq_tail = (unsigned int *)((char *)r->cq_ring + p.cq_off.tail);
+	r->cq_mask = (unsigned int *)((char *)r->cq_ring + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cq_ring + p.cq_off.cqes);
+	return 0;
+err:
+	c_uring_exit(r);
+	return -1;
+}
+
+/* Read up to buf_sz bytes at offset 0 from each of fds[0..n) into
+ * bufs + i * buf_sz, with one submission for the whole batch.
+ * res[i] receives the number of bytes read, or -errno.
+ *
+ * Return 0 on success, or -1 if the batch could not be submitted. */
+static int
+c_uring_pread_batch(c_uring_ty *r, const int *fds, char *bufs, unsigned int buf_sz, int *res, unsigned int n)
+{
+	if (unlikely(n > r->entries))
+		return -1;
+	unsigned int tail = *r->sq_tail;
+	const unsigned int mask = *r->sq_mask;
+	for (unsigned int i = 0; i < n; ++i, ++tail) {
+		struct io_uring_sqe *sqe = r->sqes + (tail & mask);
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = fds[i];
+		sqe->addr = (unsigned long)(bufs + (size_t)i * buf_sz);
+		sqe->len = buf_sz;
+		sqe->off = 0;
+		sqe->user_data = i;
+		r->sq_array[tail & mask] = tail & mask;
+		res[i] = -EINPROGRESS;
+	}
+	__atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+	unsigned int to_submit = n;
+	unsigned int done = 0;
+	while (done < n) {
+		const int ret = (int)syscall(__NR_io_uring_enter, r->fd, to_submit, n - done, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (unlikely(ret == -1)) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		to_submit -= MIN((unsigned int)ret, to_submit);
+		unsigned int head = *r->cq_head;
+		const unsigned int cq_tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != cq_tail; ++head) {
+			const struct io_uring_cqe *cqe = r->cqes + (head & *r->cq_mask);
+			if (likely(cqe->user_data < n)) {
+				res[cqe->user_data] = cqe->res;
+				++done;
+			}
+		}
+		__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+#endif /* URING_H */
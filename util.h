@@ -1,6 +1,8 @@
 #ifndef UTIL_H
 #define UTIL_H 1
 
+#include <string.h>
+
 #include "macros.h"
 
 static unsigned int
@@ -35,4 +37,22 @@ c_utoa_le3_p(unsigned int num, char *buf)
 	return buf + 1;
 }
 
+/* Not nul-terminated */
+static char *
+c_itoa_p(int num, char *buf)
+{
+	char tmp[S_LEN("2147483648")];
+	char *p = tmp + sizeof(tmp);
+	unsigned int u = (num < 0) ? -(unsigned int)num : (unsigned int)num;
+	do {
+		*--p = (char)(u % 10 + '0');
+		u /= 10;
+	} while (u);
+	if (num < 0)
+		*buf++ = '-';
+	const unsigned int len = (unsigned int)(tmp + sizeof(tmp) - p);
+	memcpy(buf, p, len);
+	return buf + len;
+}
+
 #endif /* UTIL_H */
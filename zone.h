@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2026 James Tirta Halim <tirtajames45 at gmail dot com> */
+
+#ifndef ZONE_H
+#define ZONE_H 1
+
+#include "cfan-rec.h"
+#include "macros.h"
+#include "pid.h"
+#include "predict.h"
+#include "step.h"
+#include "rpm.h"
+#include "curve.h"
+
+/* Return millidegrees, or C_TEMP_INVALID. */
+typedef int (*fn_temp)(void);
+typedef void (*fn_temp_init)(void);
+
+/* Temperature function that the configuration file refers to by name,
+ * with the function that must run once before it is called. */
+typedef struct {
+	const char *name;
+	fn_temp fn;
+	fn_temp_init init;
+} c_fn_name_ty;
+
+/* A zone drives its own fans from the maximum of its own temperatures,
+ * through its own curve, and ramps independently of the other zones. */
+typedef struct {
+	const char *name;
+	/* Indices into the temperature table. */
+	const unsigned int *temps;
+	unsigned int temps_len;
+	/* Temperature functions, e.g. nv_temp_gpu_get_max. */
+	const fn_temp *fn_temps;
+	unsigned int fn_temps_len;
+	/* Indices into the fan table. */
+	const unsigned int *fans;
+	unsigned int fans_len;
+	/* Fan curve, or NULL to use the default curve. */
+	const c_curve_ty *curve;
+} c_zone_ty;
+
+/* Runtime state of a zone. */
+typedef struct {
+	const c_curve_ty *curve;
+	unsigned int speed_min;
+	unsigned int speed_max;
+	int mode;
+	c_pid_ty pid;
+	/* PWM (0-255), or RPM in CONTROL_RPM. */
+	unsigned int last_speed;
+	/* Speed of the curve or the controller before ramping, and why
+	 * last_speed differs from it: CFAN_REC_*. */
+	unsigned int target;
+	int reason;
+	/* Speed of the curve at the temperature itself, without the
+	 * hysteresis, to count the writes it saves. */
+	unsigned int raw_speed;
+	unsigned int hot_ms;
+	/* Part of a step carried over, see c_step_scale(). */
+	unsigned int step_rem;
+	int last_temp;
+	/* Temperature the curve is looked up at, see c_curve_hyst(). */
+	int hyst_temp;
+	c_predict_ty predict;
+	/* Added to the curve (0-255), see psi.h. */
+	unsigned int bias;
+	/* Ramping to a new curve through c_step_get(). */
+	int switching;
+	/* Speed set from the control socket, held until forced_until_ms. */
+	unsigned int forced_speed;
+	unsigned long long forced_until_ms;
+} c_zone_state_ty;
+
+/* Runtime state of a fan. */
+typedef struct {
+	/* Last written (0-255). */
+	unsigned int pwm;
+	/* Used if the fan has a tachometer. */
+	c_rpm_ty tach;
+} c_fan_state_ty;
+
+/* Get the speed the controller of a zone moves to at temp: the curve,
+ * looked up through the hysteresis and ahead of a steady rise, plus bias,
+ * or the PID
+ * controller, ramped through c_step_get(). Does not update last_speed, but
+ * sets target and reason. *at_floor is set if the target is the bottom of
+ * the curve. cfan-sim replays traces through this. */
+static ATTR_INLINE unsigned int
+c_zone_speed_get(const c_param_ty *prm, c_zone_state_ty *st, int temp, unsigned int elapsed_ms, int *at_floor)
+{
+	unsigned int curr_speed;
+	if (st->mode == CONTROL_PID) {
+		curr_speed = c_pid_get(prm, &st->pid, temp, st->last_speed, elapsed_ms, st->speed_min, st->speed_max);
+		st->reason = CFAN_REC_PID;
+	} else {
+		const int ahead = c_predict_get(prm, &st->predict, temp, elapsed_ms);
+		curr_speed = c_curve_get(st->curve, c_curve_hyst(&st->hyst_temp, temp, prm->hysteresis));
+		st->raw_speed = c_curve_get(st->curve, temp);
+		st->reason = CFAN_REC_DIRECT;
+		/* Only ever ahead of the curve, never below it. */
+		if (ahead != temp && c_curve_get(st->curve, ahead) > curr_speed) {
+			curr_speed = c_curve_get(st->curve, ahead);
+			st->reason = CFAN_REC_PREDICT;
+		} else if (curr_speed == st->last_speed)
+			st->reason = (temp != st->hyst_temp && st->raw_speed != curr_speed) ? CFAN_REC_HELD : CFAN_REC_UNCHANGED;
+	}
+	/* In CONTROL_RPM, step in 1/255 of the top of the curve,
+	 * so that the steps mean the same as in PWM. */
+	const unsigned int unit = (st->mode == CONTROL_RPM) ? MAX(st->speed_max / 255, 1) : 1;
+	if (st->bias && st->mode != CONTROL_PID && curr_speed < st->speed_max) {
+		curr_speed = MIN(curr_speed + st->bias * unit, st->speed_max);
+		st->reason = CFAN_REC_LOAD;
+	}
+	st->target = curr_speed;
+	*at_floor = (curr_speed == st->speed_min);
+	/* The controller does its own smoothing, without c_step_get(),
+	 * except while moving to a new curve. */
+	if (st->mode != CONTROL_PID || st->switching) {
+		const unsigned int target = curr_speed;
+		unsigned int step = curr_speed / unit;
+		/* Get next step. While switching, hot_ms is held at 0 so that
+		 * rises are ramped as spikes too, unless it is already hot.
+		 * A predicted rise has already outlasted any spike, and the load
+		 * bias is there to get ahead of the heat, so both are taken at
+		 * once. */
+		if (step > st->last_speed / unit && (st->reason == CFAN_REC_PREDICT || st->reason == CFAN_REC_LOAD) && !st->switching) {
+			st->hot_ms = 0;
+			st->step_rem = 0;
+		} else if (step != st->last_speed / unit) {
+			st->hot_ms = c_step_get(prm, &step, st->last_speed / unit, temp, st->switching ? 0 : st->hot_ms, elapsed_ms, &st->step_rem);
+		}
+		curr_speed = (step == target / unit) ? target : step * unit;
+		if (curr_speed != target)
+			st->reason = (curr_speed < target) ? CFAN_REC_SPIKE : CFAN_REC_RAMP;
+		if (st->switching && curr_speed == target) {
+			st->switching = 0;
+			st->hot_ms = 0;
+		}
+	}
+	return curr_speed;
+}
+
+/* Helpers to fill in c_zone_ty pointer/length pairs:
+ *   C_ZONE_IDX(0, 2)  the listed indices
+ *   C_ZONE_ALL        every entry of the table
+ *   C_ZONE_NONE       no entries
+ *   C_ZONE_FN(f, g)   the listed temperature functions */
+#define C_ZONE_ALL_LEN  ((unsigned int)-1)
+#define C_ZONE_IDX(...) ((const unsigned int[]){ __VA_ARGS__ }), LEN(((const unsigned int[]){ __VA_ARGS__ }))
+#define C_ZONE_FN(...)  ((const fn_temp[]){ __VA_ARGS__ }), LEN(((const fn_temp[]){ __VA_ARGS__ }))
+#define C_ZONE_ALL      NULL, C_ZONE_ALL_LEN
+#define C_ZONE_NONE     NULL, 0
+
+/* Resolve the length and the j-th index of a pointer/length pair,
+ * where table_len is the length of the table it indexes into. */
+#define C_ZONE_LEN(len, table_len) (((len) == C_ZONE_ALL_LEN) ? (table_len) : (len))
+#define C_ZONE_AT(idx, len, j)     (((len) == C_ZONE_ALL_LEN) ? (j) : (idx)[j])
+
+#endif /* ZONE_H */